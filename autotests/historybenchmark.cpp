@@ -0,0 +1,327 @@
+/*
+    This file is part of the KDE project.
+
+    SPDX-FileCopyrightText: 2026 Konqueror Developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include <QTest>
+#include <konq_historyloader_p.h>
+#include <konqcompletionindex.h>
+#include <konqhistorymanager.h>
+#include <konqhistorymodel.h>
+
+#include <KConfigGroup>
+#include <KSharedConfig>
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QObject>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+/**
+ * Benchmarks of the history, with synthetic histories of various sizes.
+ *
+ * Everything happens in a temporary home directory. Changes go through the
+ * session bus like in Konqueror, so a benchmark waits until they came back.
+ * The benchmark runs itself again with dbus-run-session, so that this bus is
+ * a private one: the synthetic entries and settings mustn't reach the running
+ * Konqueror instances, and a headless box needn't have a session bus.
+ *
+ * Not run by ctest, as the 100k histories take minutes; run it by hand.
+ */
+class HistoryBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+    void benchmarkLoad_data();
+    void benchmarkLoad();
+    void benchmarkSave_data();
+    void benchmarkSave();
+    void benchmarkAddEntries_data();
+    void benchmarkAddEntries();
+    void benchmarkRemoveEntries_data();
+    void benchmarkRemoveEntries();
+    void benchmarkExpireEntries_data();
+    void benchmarkExpireEntries();
+    void benchmarkCompletion_data();
+    void benchmarkCompletion();
+    void benchmarkHistoryModel_data();
+    void benchmarkHistoryModel();
+
+private:
+    QTemporaryDir m_homeDir;
+};
+
+// The synthetic entries were visited during that many days, one after the other
+static const int s_historyDays = 180;
+
+// Loading 100k entries in the background takes longer than QTRY_VERIFY waits by default
+static const int s_timeout = 60000;
+
+static QUrl entryUrl(int i)
+{
+    return QUrl(QStringLiteral("http://host%1.example.org/page/%2").arg(i % 1000).arg(i));
+}
+
+static KonqHistoryList createHistory(int count)
+{
+    KonqHistoryList list;
+    const QDateTime start = QDateTime::currentDateTime().addDays(-s_historyDays);
+    const qint64 step = qint64(s_historyDays) * 24 * 3600 / count;
+    for (int i = 0; i < count; ++i) {
+        KonqHistoryEntry entry;
+        entry.url = entryUrl(i);
+        entry.title = QStringLiteral("Page %1").arg(i);
+        entry.numberOfTimesVisited = 1 + i % 5;
+        entry.firstVisited = start.addSecs(i * step);
+        entry.lastVisited = entry.firstVisited;
+        list.append(entry);
+    }
+    return list;
+}
+
+// Writes the history file like KonqHistoryProvider does when saving
+static void saveHistory(const KonqHistoryList &history)
+{
+    const QString fileName = KonqHistoryLoader::historyFileName();
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+
+    QSaveFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    QDataStream stream(&file);
+    KonqHistoryLoader::writeHistory(stream, history);
+    QVERIFY(file.commit());
+}
+
+static void writeHistory(int count)
+{
+    QFile::remove(KonqHistoryLoader::journalFileName());
+    saveHistory(createHistory(count));
+}
+
+static void addSizes()
+{
+    QTest::addColumn<int>("count");
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("100k") << 100000;
+}
+
+void HistoryBenchmark::initTestCase()
+{
+    QVERIFY(m_homeDir.isValid());
+    // The test mode of QStandardPaths uses directories below the home directory
+    qputenv("HOME", QFile::encodeName(m_homeDir.path()));
+    QStandardPaths::setTestModeEnabled(true);
+}
+
+void HistoryBenchmark::init()
+{
+    // Keep all the synthetic entries, until a benchmark says otherwise
+    KConfigGroup cs(KSharedConfig::openConfig(QStringLiteral("konquerorrc")), "HistorySettings");
+    cs.writeEntry("Maximum of History entries", 1000000);
+    cs.writeEntry("Maximum age of History entries", 0);
+    cs.sync();
+}
+
+void HistoryBenchmark::benchmarkLoad_data()
+{
+    addSizes();
+}
+
+void HistoryBenchmark::benchmarkLoad()
+{
+    QFETCH(int, count);
+    writeHistory(count);
+
+    QBENCHMARK_ONCE {
+        KonqHistoryManager mgr(nullptr);
+        QTRY_VERIFY_WITH_TIMEOUT(mgr.isFullyLoaded(), s_timeout);
+        QCOMPARE(mgr.entries().count(), count);
+    }
+}
+
+void HistoryBenchmark::benchmarkSave_data()
+{
+    addSizes();
+}
+
+void HistoryBenchmark::benchmarkSave()
+{
+    QFETCH(int, count);
+    const KonqHistoryList history = createHistory(count);
+
+    QBENCHMARK {
+        saveHistory(history);
+    }
+
+    KonqHistoryLoader loader;
+    QVERIFY(loader.loadHistory());
+    QCOMPARE(loader.entries().count(), count);
+}
+
+void HistoryBenchmark::benchmarkAddEntries_data()
+{
+    addSizes();
+}
+
+void HistoryBenchmark::benchmarkAddEntries()
+{
+    QFETCH(int, count);
+    writeHistory(count);
+
+    KonqHistoryManager mgr(nullptr);
+    QTRY_VERIFY_WITH_TIMEOUT(mgr.isFullyLoaded(), s_timeout);
+    // new urls, and visits of ones already in the history
+    const int added = count / 10;
+    QBENCHMARK_ONCE {
+        for (int i = 0; i < added; ++i) {
+            mgr.confirmPending(entryUrl(count + i), QString(), QStringLiteral("New page"));
+            mgr.confirmPending(entryUrl(i * 10), QString(), QString());
+        }
+        QTRY_COMPARE_WITH_TIMEOUT(mgr.entries().count(), count + added, s_timeout);
+    }
+    QCOMPARE(mgr.entries().last().url, entryUrl(count + added - 1));
+}
+
+void HistoryBenchmark::benchmarkRemoveEntries_data()
+{
+    addSizes();
+}
+
+void HistoryBenchmark::benchmarkRemoveEntries()
+{
+    QFETCH(int, count);
+    writeHistory(count);
+
+    KonqHistoryManager mgr(nullptr);
+    QTRY_VERIFY_WITH_TIMEOUT(mgr.isFullyLoaded(), s_timeout);
+    const int removed = count / 10;
+    QBENCHMARK_ONCE {
+        for (int i = 0; i < removed; ++i) {
+            mgr.emitRemoveFromHistory(entryUrl(i * 10));
+        }
+        QTRY_COMPARE_WITH_TIMEOUT(mgr.entries().count(), count - removed, s_timeout);
+    }
+}
+
+void HistoryBenchmark::benchmarkExpireEntries_data()
+{
+    addSizes();
+}
+
+void HistoryBenchmark::benchmarkExpireEntries()
+{
+    QFETCH(int, count);
+    writeHistory(count);
+
+    KonqHistoryManager mgr(nullptr);
+    QTRY_VERIFY_WITH_TIMEOUT(mgr.isFullyLoaded(), s_timeout);
+    QBENCHMARK_ONCE {
+        mgr.emitSetMaxAge(s_historyDays / 2);
+        QTRY_VERIFY_WITH_TIMEOUT(mgr.entries().count() < count * 2 / 3, s_timeout);
+    }
+    QVERIFY(mgr.entries().count() > count / 3);
+    mgr.emitSetMaxAge(0);
+}
+
+void HistoryBenchmark::benchmarkCompletion_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::addColumn<bool>("substring");
+    QTest::addColumn<QString>("text");
+    const QList<int> counts{1000, 10000, 100000};
+    for (int count : counts) {
+        const QByteArray size = QByteArray::number(count / 1000) + "k";
+        QTest::newRow((size + " prefix").constData()) << count << false << QStringLiteral("http://host1");
+        QTest::newRow((size + " substring").constData()) << count << true << QStringLiteral("page/12");
+    }
+}
+
+void HistoryBenchmark::benchmarkCompletion()
+{
+    QFETCH(int, count);
+    QFETCH(bool, substring);
+    QFETCH(QString, text);
+
+    KonqCompletionIndex index;
+    const KonqHistoryList history = createHistory(count);
+    for (const KonqHistoryEntry &entry : history) {
+        index.addItem(entry.url.toDisplayString(), entry.numberOfTimesVisited, entry.lastVisited);
+    }
+
+    QStringList matches;
+    QBENCHMARK {
+        matches = substring ? index.substringMatches(text) : index.prefixMatches(text);
+    }
+    QVERIFY(!matches.isEmpty());
+}
+
+void HistoryBenchmark::benchmarkHistoryModel_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::addColumn<bool>("fetchAll");
+    const QList<int> counts{1000, 10000, 100000};
+    for (int count : counts) {
+        const QByteArray size = QByteArray::number(count / 1000) + "k";
+        QTest::newRow((size + " groups").constData()) << count << false;
+        QTest::newRow((size + " all").constData()) << count << true;
+    }
+}
+
+void HistoryBenchmark::benchmarkHistoryModel()
+{
+    QFETCH(int, count);
+    QFETCH(bool, fetchAll);
+    writeHistory(count);
+
+    KonqHistoryManager mgr(nullptr);
+    QTRY_VERIFY_WITH_TIMEOUT(mgr.isFullyLoaded(), s_timeout);
+    QBENCHMARK {
+        KonqHistoryModel model;
+        if (fetchAll) {
+            model.fetchAll();
+        }
+        QCOMPARE(model.rowCount(), qMin(count, 1000));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const char privateBusVariable[] = "KONQ_HISTORYBENCHMARK_PRIVATE_BUS";
+    if (qEnvironmentVariableIsEmpty(privateBusVariable)) {
+        qputenv(privateBusVariable, "1");
+        if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+        }
+        QList<char *> args{const_cast<char *>("dbus-run-session"), const_cast<char *>("--")};
+        for (int i = 0; i < argc; ++i) {
+            args.append(argv[i]);
+        }
+        args.append(nullptr);
+        execvp(args.first(), args.data());
+        fprintf(stderr, "historybenchmark: can't run dbus-run-session: %s\n", strerror(errno));
+        return 1;
+    }
+
+    QGuiApplication app(argc, argv);
+    HistoryBenchmark benchmark;
+    return QTest::qExec(&benchmark, argc, argv);
+}
+
+#include "historybenchmark.moc"
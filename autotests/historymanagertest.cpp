@@ -7,10 +7,17 @@
 #include <QTest>
 #include <QSignalSpy>
 #include <konqhistorymanager.h>
+#include <konqcompletionindex.h>
+#include <konqhistorymodel.h>
+#include <konq_historyindex_p.h>
 
+#include <QDataStream>
+#include <QFile>
 #include <QObject>
 #include <QStandardPaths>
 
+#include <algorithm>
+
 class HistoryManagerTest : public QObject
 {
     Q_OBJECT
@@ -20,6 +27,14 @@ private Q_SLOTS:
     void testGetSetMaxCount();
     void testGetSetMaxAge();
     void testAddHistoryEntry();
+    void testHistoryListIndex();
+    void testCompletionIndex();
+    void testHistoryModel();
+    void testLoadHistoryInBackground();
+    void benchmarkFindEntry_data();
+    void benchmarkFindEntry();
+    void benchmarkRemoveOldest_data();
+    void benchmarkRemoveOldest();
 };
 
 QTEST_MAIN(HistoryManagerTest)
@@ -128,4 +143,274 @@ void HistoryManagerTest::testAddHistoryEntry()
     QCOMPARE(int(entry.numberOfTimesVisited), 1);
 }
 
+void HistoryManagerTest::testHistoryModel()
+{
+    KonqHistoryManager mgr(nullptr);
+    KonqHistoryModel model;
+    const QString host = QStringLiteral("historymodeltest.org");
+    const QUrl url1(QStringLiteral("http://historymodeltest.org/one"));
+    const QUrl url2(QStringLiteral("http://historymodeltest.org/two"));
+    const QUrl url3(QStringLiteral("http://historymodeltest.org/three"));
+
+    auto findGroup = [&model, &host]() {
+        for (int row = 0; row < model.rowCount(); ++row) {
+            const QModelIndex index = model.index(row, 0);
+            if (index.data().toString() == host) {
+                return index;
+            }
+        }
+        return QModelIndex();
+    };
+
+    mgr.addPending(url1, QString(), QString());
+    waitForAddedSignal(&mgr);
+    mgr.addPending(url2, QString(), QString());
+    waitForAddedSignal(&mgr);
+
+    // The entries of a new group only get rows when it's fetched
+    QTRY_VERIFY(findGroup().isValid());
+    QModelIndex group = findGroup();
+    QVERIFY(model.hasChildren(group));
+    QCOMPARE(model.rowCount(group), 0);
+    QVERIFY(model.canFetchMore(group));
+    model.fetchMore(group);
+    QCOMPARE(model.rowCount(group), 2);
+    QVERIFY(!model.canFetchMore(group));
+    QCOMPARE(model.index(1, 0, group).parent(), group);
+
+    // Then new entries are inserted right away
+    mgr.addPending(url3, QString(), QString());
+    waitForAddedSignal(&mgr);
+    QTRY_COMPARE(model.rowCount(findGroup()), 3);
+
+    mgr.emitRemoveListFromHistory(QList<QUrl>{url1, url2, url3});
+    QTRY_VERIFY(!findGroup().isValid());
+}
+
+void HistoryManagerTest::testLoadHistoryInBackground()
+{
+    // More than the entries loaded right away
+    const int count = 300;
+    QList<QUrl> urls;
+    {
+        KonqHistoryManager mgr(nullptr);
+        QTRY_VERIFY(mgr.isFullyLoaded());
+        for (int i = 0; i < count; ++i) {
+            urls.append(QUrl(QStringLiteral("http://loadtest.example.org/page%1").arg(i)));
+            mgr.addPending(urls.last(), QString(), QString());
+        }
+        QTRY_VERIFY(mgr.constFindEntry(urls.last()) != mgr.entries().constEnd());
+    } // saves the history
+
+    // in a format older versions can read
+    QFile file(QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QLatin1String("/konqueror/konq_history"));
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QDataStream stream(&file);
+    quint32 version;
+    stream >> version;
+    QCOMPARE(version, 4u);
+    file.close();
+
+    KonqHistoryManager mgr(nullptr);
+    QSignalSpy loadedSpy(&mgr, &KonqHistoryProvider::entriesLoaded);
+    QSignalSpy fullyLoadedSpy(&mgr, &KonqHistoryProvider::fullyLoaded);
+    // The most recent entries are there right away
+    QVERIFY(mgr.constFindEntry(urls.last()) != mgr.entries().constEnd());
+    QTRY_VERIFY(mgr.isFullyLoaded());
+    QVERIFY(!loadedSpy.isEmpty());
+    QCOMPARE(fullyLoadedSpy.count(), 1);
+
+    for (const QUrl &url : std::as_const(urls)) {
+        QVERIFY(mgr.constFindEntry(url) != mgr.entries().constEnd());
+    }
+    const KonqHistoryList &entries = mgr.entries();
+    QVERIFY(std::is_sorted(entries.constBegin(), entries.constEnd(), [](const KonqHistoryEntry &lhs, const KonqHistoryEntry &rhs) {
+        return lhs.lastVisited < rhs.lastVisited;
+    }));
+
+    mgr.emitRemoveListFromHistory(urls);
+    QTRY_VERIFY(mgr.constFindEntry(urls.first()) == mgr.entries().constEnd());
+}
+
+static QUrl historyListUrl(int i)
+{
+    return QUrl(QStringLiteral("http://host%1.example.org/page/%2").arg(i % 1000).arg(i));
+}
+
+static KonqHistoryIndex createHistoryIndex(int count)
+{
+    KonqHistoryIndex index;
+    const QDateTime start = QDateTime::currentDateTime().addDays(-30);
+    for (int i = 0; i < count; ++i) {
+        KonqHistoryEntry entry;
+        entry.url = historyListUrl(i);
+        entry.firstVisited = start.addSecs(i);
+        entry.lastVisited = entry.firstVisited;
+        index.append(entry);
+    }
+    return index;
+}
+
+static qsizetype positionOf(const KonqHistoryIndex &index, int i)
+{
+    const KonqHistoryList::const_iterator it = index.constFind(historyListUrl(i));
+    return it == index.constEnd() ? -1 : it - index.entries().constBegin();
+}
+
+void HistoryManagerTest::testHistoryListIndex()
+{
+    KonqHistoryIndex index = createHistoryIndex(100);
+    QCOMPARE(index.constFind(historyListUrl(42))->url, historyListUrl(42));
+
+    index.removeOldest(10);
+    QCOMPARE(index.count(), 90);
+    QCOMPARE(positionOf(index, 5), -1);
+    QCOMPARE(positionOf(index, 10), 0);
+    QCOMPARE(positionOf(index, 99), 89);
+
+    // near the front and near the back, to exercise both renumbering strategies
+    index.erase(index.find(historyListUrl(12)));
+    index.erase(index.find(historyListUrl(95)));
+    QCOMPARE(index.count(), 88);
+    for (int i = 10; i < 100; ++i) {
+        KonqHistoryList::const_iterator it = index.constFind(historyListUrl(i));
+        if (i == 12 || i == 95) {
+            QVERIFY(it == index.constEnd());
+        } else {
+            QVERIFY(it != index.constEnd());
+            QCOMPARE(it->url, historyListUrl(i));
+        }
+    }
+
+    // a revisit updates the entry where it is
+    KonqHistoryList::iterator it = index.find(historyListUrl(50));
+    it->numberOfTimesVisited = 2;
+    QCOMPARE(positionOf(index, 50), 39);
+    QCOMPARE(index.at(39).numberOfTimesVisited, 2u);
+
+    // entries loaded later are older ones, they go to the front
+    KonqHistoryEntry older;
+    older.url = historyListUrl(1);
+    index.prepend({older});
+    QCOMPARE(positionOf(index, 1), 0);
+    QCOMPARE(positionOf(index, 10), 1);
+
+    index.setEntries(index.entries().mid(10));
+    QCOMPARE(positionOf(index, 1), -1);
+    QCOMPARE(positionOf(index, 20), 0);
+    index.clear();
+    QCOMPARE(positionOf(index, 20), -1);
+}
+
+void HistoryManagerTest::testCompletionIndex()
+{
+    KonqCompletionIndex index;
+    const QDateTime now = QDateTime::currentDateTime();
+    index.addItem(QStringLiteral("https://www.kde.org/"), 5, now);
+    index.addItem(QStringLiteral("http://kde.org"), 1, now.addDays(-100));
+    index.addItem(QStringLiteral("https://planet.kde.org/"), 2, now);
+    index.addItem(QStringLiteral("https://kdenlive.org/"), 1, now.addDays(-20));
+    QCOMPARE(index.count(), 3);
+
+    // scheme and www. don't matter, variants of one url are returned once, best first
+    const QStringList expected = {QStringLiteral("https://www.kde.org/"), QStringLiteral("https://kdenlive.org/")};
+    QCOMPARE(index.prefixMatches(QStringLiteral("kde")), expected);
+    QCOMPARE(index.prefixMatches(QStringLiteral("www.kde")), expected);
+    QCOMPARE(index.prefixMatches(QStringLiteral("http://kde")), QStringList{QStringLiteral("http://kde.org")});
+    QVERIFY(index.prefixMatches(QStringLiteral("https://www.")).isEmpty());
+
+    QCOMPARE(index.substringMatches(QStringLiteral("kde.org")),
+             (QStringList{QStringLiteral("https://www.kde.org/"), QStringLiteral("https://planet.kde.org/")}));
+
+    index.removeItem(QStringLiteral("https://www.kde.org/"));
+    QCOMPARE(index.prefixMatches(QStringLiteral("kde.")), QStringList{QStringLiteral("http://kde.org")});
+    index.removeItem(QStringLiteral("http://kde.org"));
+    QVERIFY(index.prefixMatches(QStringLiteral("kde.")).isEmpty());
+    QCOMPARE(index.count(), 2);
+
+    // ftp hosts and local files are found without their prefixes too
+    index.addItem(QStringLiteral("ftp://ftp.kde.org/pub"), 1, now);
+    index.addItem(QStringLiteral("ftp.kde.org/pub"), 1, now);
+    index.addItem(QStringLiteral("file:///usr/share"), 1, now);
+    QCOMPARE(index.count(), 4);
+    QCOMPARE(index.prefixMatches(QStringLiteral("kde.org/p")), QStringList{QStringLiteral("ftp://ftp.kde.org/pub")});
+    QCOMPARE(index.prefixMatches(QStringLiteral("/usr")), QStringList{QStringLiteral("file:///usr/share")});
+    QCOMPARE(index.substringMatches(QStringLiteral("org")),
+             (QStringList{QStringLiteral("https://planet.kde.org/"), QStringLiteral("ftp://ftp.kde.org/pub"), QStringLiteral("https://kdenlive.org/")}));
+
+    // removing many keys, which get dropped from the indexes meanwhile, and adding one again
+    for (int i = 0; i < 100; ++i) {
+        index.addItem(QStringLiteral("https://site%1.example.com/").arg(i), 1, now);
+    }
+    for (int i = 0; i < 80; ++i) {
+        index.removeItem(QStringLiteral("https://site%1.example.com/").arg(i));
+    }
+    index.addItem(QStringLiteral("https://site0.example.com/"), 1, now);
+    QCOMPARE(index.count(), 25);
+    QCOMPARE(index.prefixMatches(QStringLiteral("site0.")), QStringList{QStringLiteral("https://site0.example.com/")});
+    QCOMPARE(index.substringMatches(QStringLiteral("site0.")), QStringList{QStringLiteral("https://site0.example.com/")});
+    QCOMPARE(index.prefixMatches(QStringLiteral("site")).count(), 21);
+    QCOMPARE(index.substringMatches(QStringLiteral("example.com")).count(), 21);
+    QVERIFY(index.substringMatches(QStringLiteral("site1.")).isEmpty());
+}
+
+void HistoryManagerTest::benchmarkFindEntry_data()
+{
+    QTest::addColumn<bool>("indexed");
+    QTest::newRow("linear") << false;
+    QTest::newRow("indexed") << true;
+}
+
+void HistoryManagerTest::benchmarkFindEntry()
+{
+    QFETCH(bool, indexed);
+    const int count = 100000;
+    const KonqHistoryIndex index = createHistoryIndex(count);
+    const KonqHistoryList &list = index.entries();
+    // old entries are the worst case for the backwards search
+    const QUrl url = historyListUrl(count / 10);
+
+    KonqHistoryList::const_iterator it;
+    if (indexed) {
+        QBENCHMARK {
+            it = index.constFind(url);
+        }
+    } else {
+        QBENCHMARK {
+            it = list.constFindEntry(url);
+        }
+    }
+    QCOMPARE(it->url, url);
+}
+
+void HistoryManagerTest::benchmarkRemoveOldest_data()
+{
+    QTest::addColumn<bool>("bulk");
+    QTest::newRow("one by one") << false;
+    QTest::newRow("bulk") << true;
+}
+
+void HistoryManagerTest::benchmarkRemoveOldest()
+{
+    QFETCH(bool, bulk);
+    const int count = 100000;
+    const int expired = count / 10;
+    KonqHistoryIndex index = createHistoryIndex(count);
+
+    if (bulk) {
+        QBENCHMARK_ONCE {
+            index.removeOldest(expired);
+        }
+    } else {
+        // what adjustSize() used to do
+        QBENCHMARK_ONCE {
+            for (int i = 0; i < expired; ++i) {
+                index.erase(index.find(historyListUrl(i)));
+            }
+        }
+    }
+    QCOMPARE(index.count(), count - expired);
+    QCOMPARE(positionOf(index, expired), 0);
+}
+
 #include "historymanagertest.moc"
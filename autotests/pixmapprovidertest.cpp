@@ -0,0 +1,111 @@
+/*
+    This file is part of the KDE project.
+
+    SPDX-FileCopyrightText: 2026 Konqueror Developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include <QTest>
+#include <konqpixmapprovider.h>
+
+#include <KConfig>
+#include <KConfigGroup>
+
+#include <QFile>
+#include <QObject>
+#include <QStandardPaths>
+
+class PixmapProviderTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testCacheFile();
+    void testInvalidCacheFile();
+    void testPixmapCache();
+};
+
+QTEST_MAIN(PixmapProviderTest)
+
+static const QString s_legacyKey = QStringLiteral("ComboIconCache");
+
+void PixmapProviderTest::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+    QFile::remove(KonqPixmapProvider::cacheFileName());
+}
+
+void PixmapProviderTest::testCacheFile()
+{
+    KonqPixmapProvider *provider = KonqPixmapProvider::self();
+    const QUrl url = QUrl::fromUserInput(QStringLiteral("https://www.kde.org"));
+
+    // Without a cache file, the old config entry is imported
+    KConfig config(QString(), KConfig::SimpleConfig);
+    KConfigGroup group(&config, QStringLiteral("Location Bar"));
+    group.writePathEntry(s_legacyKey, QStringList{url.toString(), QStringLiteral("test-icon")});
+    provider->load(group, s_legacyKey);
+    QVERIFY(!group.hasKey(s_legacyKey));
+    QVERIFY(QFile::exists(KonqPixmapProvider::cacheFileName()));
+    QCOMPARE(provider->iconNameFor(url), QStringLiteral("test-icon"));
+
+    // Then the cache file is used
+    provider->clear();
+    provider->load(group, s_legacyKey);
+    QCOMPARE(provider->iconNameFor(url), QStringLiteral("test-icon"));
+
+    // Only the given items are saved
+    provider->save(QStringList());
+    provider->load(group, s_legacyKey);
+    QVERIFY(provider->iconNameFor(url) != QLatin1String("test-icon"));
+}
+
+void PixmapProviderTest::testInvalidCacheFile()
+{
+    KonqPixmapProvider *provider = KonqPixmapProvider::self();
+    const QUrl url = QUrl::fromUserInput(QStringLiteral("https://www.kde.org"));
+    QFile::remove(KonqPixmapProvider::cacheFileName());
+
+    KConfig config(QString(), KConfig::SimpleConfig);
+    KConfigGroup group(&config, QStringLiteral("Location Bar"));
+    group.writePathEntry(s_legacyKey, QStringList{url.toString(), QStringLiteral("test-icon")});
+    provider->load(group, s_legacyKey);
+
+    // A truncated file is ignored as a whole
+    QFile file(KonqPixmapProvider::cacheFileName());
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QVERIFY(file.resize(file.size() - 2));
+    file.close();
+    provider->load(group, s_legacyKey);
+    QVERIFY(provider->iconNameFor(url) != QLatin1String("test-icon"));
+}
+
+void PixmapProviderTest::testPixmapCache()
+{
+    KonqPixmapProvider *provider = KonqPixmapProvider::self();
+    provider->clear();
+    provider->setPixmapCacheBudget(KonqPixmapProvider::s_defaultPixmapCacheBudget);
+    provider->resetPixmapCacheStatistics();
+
+    const QString url = QStringLiteral("file:///");
+    provider->pixmapFor(url, 16);
+    provider->pixmapFor(url, 16);
+    provider->pixmapFor(url, 22);
+    KonqPixmapProvider::PixmapCacheStatistics statistics = provider->pixmapCacheStatistics();
+    QCOMPARE(statistics.hits, quint64(1));
+    QCOMPARE(statistics.misses, quint64(2));
+    QCOMPARE(statistics.evictions, quint64(0));
+
+    // Going over the budget drops pixmaps
+    provider->setPixmapCacheBudget(0);
+    statistics = provider->pixmapCacheStatistics();
+    QCOMPARE(statistics.evictions, quint64(2));
+    provider->pixmapFor(url, 16);
+    QCOMPARE(provider->pixmapCacheStatistics().misses, quint64(3));
+
+    provider->setPixmapCacheBudget(KonqPixmapProvider::s_defaultPixmapCacheBudget);
+}
+
+#include "pixmapprovidertest.moc"
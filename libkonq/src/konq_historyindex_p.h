@@ -0,0 +1,182 @@
+/* This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 Konqueror Developers
+
+    SPDX-License-Identifier: LGPL-2.0-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#ifndef KONQ_HISTORYINDEX_H
+#define KONQ_HISTORYINDEX_H
+
+#include "konq_historyentry.h"
+
+#include <QHash>
+
+/**
+ * @internal
+ * A KonqHistoryList together with an index of its entries by url, so that
+ * looking up an entry doesn't walk the list. The list can only be changed
+ * through this class, which keeps the index in sync.
+ *
+ * Updating an entry in place and removing entries at the front are O(1) per
+ * entry; removing an entry elsewhere renumbers the shorter side of the list.
+ */
+class KonqHistoryIndex
+{
+public:
+    const KonqHistoryList &entries() const
+    {
+        return m_entries;
+    }
+
+    qsizetype count() const
+    {
+        return m_entries.count();
+    }
+
+    bool isEmpty() const
+    {
+        return m_entries.isEmpty();
+    }
+
+    const KonqHistoryEntry &at(qsizetype i) const
+    {
+        return m_entries.at(i);
+    }
+
+    bool contains(const QUrl &url) const
+    {
+        return m_positions.contains(url);
+    }
+
+    KonqHistoryList::iterator end()
+    {
+        return m_entries.end();
+    }
+
+    KonqHistoryList::const_iterator constEnd() const
+    {
+        return m_entries.constEnd();
+    }
+
+    /**
+     * Finds an entry by URL. Its url must not be changed through the iterator.
+     * @returns an iterator to it, or the end of entries() if there isn't any
+     */
+    KonqHistoryList::iterator find(const QUrl &url)
+    {
+        const auto it = m_positions.constFind(url);
+        return it == m_positions.constEnd() ? m_entries.end() : m_entries.begin() + (*it - m_base);
+    }
+
+    KonqHistoryList::const_iterator constFind(const QUrl &url) const
+    {
+        const auto it = m_positions.constFind(url);
+        return it == m_positions.constEnd() ? m_entries.constEnd() : m_entries.constBegin() + (*it - m_base);
+    }
+
+    /**
+     * Replaces all the entries. If urls occur more than once, the last one is found.
+     */
+    void setEntries(const KonqHistoryList &entries)
+    {
+        m_entries = entries;
+        m_positions.clear();
+        m_positions.reserve(m_entries.count());
+        m_base = 0;
+        for (qsizetype i = 0; i < m_entries.count(); ++i) {
+            m_positions.insert(m_entries.at(i).url, i);
+        }
+    }
+
+    /**
+     * Appends @p entry, whose url must not be in the list yet.
+     */
+    void append(const KonqHistoryEntry &entry)
+    {
+        m_entries.append(entry);
+        m_positions.insert(entry.url, m_entries.count() - 1 + m_base);
+    }
+
+    /**
+     * Inserts @p entries at the beginning of the list. Those whose url is
+     * already in the list can't be found.
+     */
+    void prepend(const QList<KonqHistoryEntry> &entries)
+    {
+        m_entries.reserve(m_entries.count() + entries.count());
+        // moving the base down by one keeps the positions of the others right
+        for (auto it = entries.crbegin(); it != entries.crend(); ++it) {
+            m_entries.prepend(*it);
+            --m_base;
+            if (!m_positions.contains(it->url)) {
+                m_positions.insert(it->url, m_base);
+            }
+        }
+    }
+
+    /**
+     * Removes the entry at @p it.
+     * @returns an iterator to the entry following the removed one
+     */
+    KonqHistoryList::iterator erase(KonqHistoryList::iterator it)
+    {
+        const qsizetype pos = it - m_entries.begin();
+        removePosition(pos);
+        m_entries.erase(it);
+
+        // Renumber whichever side of the gap is shorter
+        if (pos < m_entries.count() - pos) {
+            // moving the base shifts everything by one, put the head back where it was
+            ++m_base;
+            for (qsizetype i = 0; i < pos; ++i) {
+                m_positions[m_entries.at(i).url] = i + m_base;
+            }
+        } else {
+            for (qsizetype i = pos; i < m_entries.count(); ++i) {
+                m_positions[m_entries.at(i).url] = i + m_base;
+            }
+        }
+        return m_entries.begin() + pos;
+    }
+
+    /**
+     * Removes the @p count first entries in one go.
+     */
+    void removeOldest(qsizetype count)
+    {
+        count = qMin(count, m_entries.count());
+        if (count <= 0) {
+            return;
+        }
+        for (qsizetype i = 0; i < count; ++i) {
+            removePosition(i);
+        }
+        m_entries.remove(0, count);
+        m_base += count;
+    }
+
+    void clear()
+    {
+        m_entries.clear();
+        m_positions.clear();
+        m_base = 0;
+    }
+
+private:
+    void removePosition(qsizetype pos)
+    {
+        // a url prepended twice is only indexed once
+        const auto it = m_positions.constFind(m_entries.at(pos).url);
+        if (it != m_positions.constEnd() && *it == pos + m_base) {
+            m_positions.erase(it);
+        }
+    }
+
+    KonqHistoryList m_entries;
+    // Position of each url in m_entries, offset by m_base. Removing entries
+    // from the front only needs to move the base instead of renumbering the rest.
+    QHash<QUrl, qsizetype> m_positions;
+    qsizetype m_base = 0;
+};
+
+#endif /* KONQ_HISTORYINDEX_H */
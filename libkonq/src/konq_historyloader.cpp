@@ -6,11 +6,15 @@
 
 #include "konq_historyloader_p.h"
 #include "konq_historyentry.h"
+#include "konq_historyindex_p.h"
 
 #include <QDataStream>
 #include <QFile>
+#include <QSet>
 #include <QStandardPaths>
 
+#include <memory>
+
 #include <zlib.h> // for crc32
 
 #include "libkonq_debug.h"
@@ -18,13 +22,23 @@
 class KonqHistoryLoaderPrivate
 {
 public:
+    bool loadSnapshot(KonqHistoryLoader::LoadMode mode);
+    bool loadRecentEntries(QDataStream &fileStream);
+    bool replayJournal();
+
     KonqHistoryList m_history;
+
+    // The history file, positioned at the block of the entries not loaded yet, after loadHistory(LoadRecent)
+    std::unique_ptr<QFile> m_remainingFile;
+    // The number of entries at the end of that block which were loaded already
+    qsizetype m_recentCount = 0;
+    // The urls removed or revisited according to the journal, whose older entries are obsolete
+    QSet<QUrl> m_journalUrls;
 };
 
 KonqHistoryLoader::KonqHistoryLoader(QObject *parent)
     : QObject(parent), d(new KonqHistoryLoaderPrivate)
 {
-    loadHistory();
 }
 
 KonqHistoryLoader::~KonqHistoryLoader()
@@ -41,87 +55,233 @@ static bool lastVisitedOrder(const KonqHistoryEntry &lhs, const KonqHistoryEntry
     return lhs.lastVisited < rhs.lastVisited;
 }
 
-bool KonqHistoryLoader::loadHistory()
+bool KonqHistoryLoader::loadHistory(LoadMode mode)
 {
     d->m_history.clear();
+    d->m_remainingFile.reset();
+    d->m_recentCount = 0;
+    d->m_journalUrls.clear();
 
-    const QString filename = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QLatin1String("/konqueror/konq_history");
-    QFile file(filename);
-    if (!file.open(QIODevice::ReadOnly)) {
-        if (file.exists()) {
+    const bool snapshotLoaded = d->loadSnapshot(mode);
+    const bool journalReplayed = d->replayJournal();
+    if (!snapshotLoaded && !journalReplayed) {
+        return false;
+    }
+
+    std::sort(d->m_history.begin(), d->m_history.end(), lastVisitedOrder);
+
+    // Theoretically, we should emit update() here, but as we only ever
+    // load items on startup up to now, this doesn't make much sense.
+    // emit KParts::HistoryProvider::update(some list);
+    return true;
+}
+
+/**
+ * Reads a block of entries written by writeEntryBlock(),
+ * i.e. a checksum followed by the serialized entries
+ */
+static bool readEntryBlock(QDataStream &fileStream, QList<KonqHistoryEntry> &entries)
+{
+    quint32 crc;
+    QByteArray data;
+    fileStream >> crc >> data;
+    if (fileStream.status() != QDataStream::Ok
+        || crc32(0, reinterpret_cast<unsigned char *>(data.data()), data.size()) != crc) {
+        return false;
+    }
+
+    QDataStream stream(data);
+    while (!stream.atEnd()) {
+        KonqHistoryEntry entry;
+        // Use QUrl marshalling for V4 format.
+        entry.load(stream, KonqHistoryEntry::NoFlags);
+        // qCDebug(LIBKONQ_LOG) << "loaded entry:" << entry.url << ", Title:" << entry.title;
+        entries.append(entry);
+    }
+    return true;
+}
+
+bool KonqHistoryLoaderPrivate::loadSnapshot(KonqHistoryLoader::LoadMode mode)
+{
+    const QString filename = KonqHistoryLoader::historyFileName();
+    auto file = std::make_unique<QFile>(filename);
+    if (!file->open(QIODevice::ReadOnly)) {
+        if (file->exists()) {
             qCWarning(LIBKONQ_LOG) << "Can't open" << filename;
         }
         return false;
     }
 
-    QDataStream fileStream(&file);
-    QByteArray data; // only used for version == 2
-    // we construct the stream object now but fill in the data later.
-    QDataStream crcStream(&data, QIODevice::ReadOnly);
-    KonqHistoryEntry::Flags flags = KonqHistoryEntry::NoFlags;
+    QDataStream fileStream(file.get());
+    if (fileStream.atEnd()) {
+        return true;
+    }
 
-    if (!fileStream.atEnd()) {
-        quint32 version;
-        fileStream >> version;
+    quint32 version;
+    fileStream >> version;
 
-        QDataStream *stream = &fileStream;
+    // We can't read v3 history anymore, because operator<<(KURL) disappeared.
+    // V4 has all the entries in one block, which may be followed by a copy of the
+    // most recent entries, which older versions don't read, so that LoadRecent
+    // can skip the first block and load it later.
 
-        bool crcChecked = false;
-        bool crcOk = false;
+    if (KonqHistoryLoader::historyVersion() != int(version)) {
+        qCWarning(LIBKONQ_LOG) << "The history version doesn't match, aborting loading";
+        return false;
+    }
 
-        if (version >= 2 && version <= 4) {
-            quint32 crc;
-            crcChecked = true;
-            fileStream >> crc >> data;
-            crcOk = crc32(0, reinterpret_cast<unsigned char *>(data.data()), data.size()) == crc;
-            stream = &crcStream; // pick up the right stream
-        }
+    const qint64 allEntriesPos = file->pos();
+    if (mode == KonqHistoryLoader::LoadRecent && loadRecentEntries(fileStream)) {
+        file->seek(allEntriesPos);
+        m_remainingFile = std::move(file);
+        return true;
+    }
 
-        // We can't read v3 history anymore, because operator<<(KURL) disappeared.
+    // All of them, or we couldn't find the recent ones
+    file->seek(allEntriesPos);
+    fileStream.resetStatus();
+    if (!readEntryBlock(fileStream, m_history)) {
+        qCWarning(LIBKONQ_LOG) << "The history checksum doesn't match, aborting loading";
+        m_history.clear();
+        return false;
+    }
 
-        if (version == 4) {
-            // Use QUrl marshalling for V4 format.
-            flags = KonqHistoryEntry::NoFlags;
-        }
+    //qCDebug(LIBKONQ_LOG) << "loaded:" << m_history.count() << "entries.";
+    return true;
+}
+
+bool KonqHistoryLoaderPrivate::loadRecentEntries(QDataStream &fileStream)
+{
+    // Skip the block with all the entries, without reading them
+    quint32 crc;
+    quint32 size;
+    fileStream >> crc >> size;
+    if (size == 0xffffffff) { // null QByteArray
+        size = 0;
+    }
+    if (fileStream.status() != QDataStream::Ok || fileStream.skipRawData(size) != int(size) || fileStream.atEnd()) {
+        // No copy of the recent entries, written by an older version, or with few entries
+        return false;
+    }
+
+    QList<KonqHistoryEntry> recent;
+    if (!readEntryBlock(fileStream, recent)) {
+        qCWarning(LIBKONQ_LOG) << "The checksum of the recent history entries doesn't match, loading all of them";
+        return false;
+    }
+    m_history.append(recent);
+    m_recentCount = recent.count();
+    return true;
+}
+
+bool KonqHistoryLoader::hasRemaining() const
+{
+    return d->m_remainingFile != nullptr;
+}
+
+void KonqHistoryLoader::loadRemaining(int batchSize, const std::function<void(const QList<KonqHistoryEntry> &)> &batchLoaded)
+{
+    if (!d->m_remainingFile) {
+        return;
+    }
+    const std::unique_ptr<QFile> file = std::move(d->m_remainingFile);
+
+    QDataStream fileStream(file.get());
+    QList<KonqHistoryEntry> entries;
+    if (!readEntryBlock(fileStream, entries)) {
+        qCWarning(LIBKONQ_LOG) << "The history checksum doesn't match, older entries not loaded";
+        return;
+    }
+    file->close();
 
-#if 0 // who cares for versions 1 and 2 nowadays...
-        if (version != 0 && version < 3) { //Versions 1,2 (but not 0) are also valid
-            //Turn on backwards compatibility mode..
-            marshalURLAsStrings = true;
-            // it doesn't make sense to save to save maxAge and maxCount  in the
-            // binary file, this would make backups impossible (they would clear
-            // themselves on startup, because all entries expire).
-            // [But V1 and V2 formats did it, so we do a dummy read]
-            quint32 dummy;
-            *stream >> dummy;
-            *stream >> dummy;
-
-            //OK.
-            version = 3;
+    // The block has all the entries, sorted by date, the most recent ones were loaded already
+    entries.resize(qMax<qsizetype>(0, entries.count() - d->m_recentCount));
+    std::sort(entries.begin(), entries.end(), lastVisitedOrder);
+
+    qsizetype end = entries.count();
+    while (end > 0) {
+        const qsizetype begin = qMax<qsizetype>(0, end - batchSize);
+        QList<KonqHistoryEntry> batch;
+        batch.reserve(end - begin);
+        for (qsizetype i = begin; i < end; ++i) {
+            if (!d->m_journalUrls.contains(entries.at(i).url)) {
+                batch.append(entries.at(i));
+            }
+        }
+        if (!batch.isEmpty()) {
+            batchLoaded(batch);
         }
-#endif
+        end = begin;
+    }
+}
+
+/**
+ * Applies the changes recorded in the journal since the snapshot was written.
+ * Visit records carry the complete entry, so replaying a record twice (e.g. when
+ * we crashed between writing a snapshot and truncating the journal) is harmless.
+ */
+bool KonqHistoryLoaderPrivate::replayJournal()
+{
+    QFile file(KonqHistoryLoader::journalFileName());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(KonqHistoryLoader::journalStreamVersion());
+    quint32 version;
+    stream >> version;
+    if (stream.status() != QDataStream::Ok || int(version) != KonqHistoryLoader::journalVersion()) {
+        qCWarning(LIBKONQ_LOG) << "The history journal version doesn't match, ignoring" << file.fileName();
+        return false;
+    }
 
-        if (historyVersion() != int(version) || (crcChecked && !crcOk)) {
-            qCWarning(LIBKONQ_LOG) << "The history version doesn't match, aborting loading";
-            file.close();
-            return false;
+    KonqHistoryIndex history;
+    history.setEntries(m_history);
+    while (!stream.atEnd()) {
+        quint8 type;
+        QByteArray payload;
+        quint32 crc;
+        stream >> type >> payload >> crc;
+        if (stream.status() != QDataStream::Ok || crc32(0, reinterpret_cast<const unsigned char *>(payload.constData()), payload.size()) != crc) {
+            // Most likely a record cut short by a crash while appending; everything before it is fine
+            qCWarning(LIBKONQ_LOG) << "Ignoring truncated record in" << file.fileName();
+            break;
         }
 
-        while (!stream->atEnd()) {
+        QDataStream recordStream(payload);
+        recordStream.setVersion(KonqHistoryLoader::journalStreamVersion());
+        switch (type) {
+        case KonqHistoryLoader::JournalVisit: {
             KonqHistoryEntry entry;
-            entry.load(*stream, flags);
-            // qCDebug(LIBKONQ_LOG) << "loaded entry:" << entry.url << ", Title:" << entry.title;
-            d->m_history.append(entry);
+            entry.load(recordStream, KonqHistoryEntry::NoFlags);
+            m_journalUrls.insert(entry.url);
+            // the order doesn't matter, the entries get sorted after loading
+            const KonqHistoryList::iterator existingEntry = history.find(entry.url);
+            if (existingEntry != history.end()) {
+                *existingEntry = entry;
+            } else {
+                history.append(entry);
+            }
+            break;
+        }
+        case KonqHistoryLoader::JournalRemove: {
+            QUrl url;
+            recordStream >> url;
+            const KonqHistoryList::iterator existingEntry = history.find(url);
+            if (existingEntry != history.end()) {
+                history.erase(existingEntry);
+            }
+            m_journalUrls.insert(url);
+            break;
+        }
+        default:
+            qCWarning(LIBKONQ_LOG) << "Unknown history journal record type" << type;
+            break;
         }
-
-        //qCDebug(LIBKONQ_LOG) << "loaded:" << m_history.count() << "entries.";
-
-        std::sort(d->m_history.begin(), d->m_history.end(), lastVisitedOrder);
     }
 
-    // Theoretically, we should emit update() here, but as we only ever
-    // load items on startup up to now, this doesn't make much sense.
-    // emit KParts::HistoryProvider::update(some list);
+    m_history = history.entries();
     return true;
 }
 
@@ -134,3 +294,68 @@ int KonqHistoryLoader::historyVersion()
 {
     return 4;
 }
+
+/**
+ * Writes the entries of @p entries from @p begin to @p end as one checksummed block
+ */
+static void writeEntryBlock(QDataStream &fileStream, const KonqHistoryList &entries, qsizetype begin, qsizetype end)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    for (qsizetype i = begin; i < end; ++i) {
+        //We use QUrl for marshalling URLs in entries in the V4
+        //file format
+        entries.at(i).save(stream, KonqHistoryEntry::NoFlags);
+    }
+
+    quint32 crc = crc32(0, reinterpret_cast<unsigned char *>(data.data()), data.size());
+    fileStream << crc << data;
+}
+
+void KonqHistoryLoader::writeHistory(QDataStream &stream, const KonqHistoryList &entries)
+{
+    stream << historyVersion();
+
+    // Revisited entries are updated where they are, so the list isn't in date order
+    KonqHistoryList sorted = entries;
+    std::stable_sort(sorted.begin(), sorted.end(), lastVisitedOrder);
+
+    // All the entries, as older versions expect them
+    writeEntryBlock(stream, sorted, 0, sorted.count());
+
+    // Followed by a copy of the most recent ones, so that LoadRecent can skip the others.
+    // Older versions stop reading before it.
+    if (sorted.count() > recentEntryCount()) {
+        writeEntryBlock(stream, sorted, sorted.count() - recentEntryCount(), sorted.count());
+    }
+}
+
+int KonqHistoryLoader::recentEntryCount()
+{
+    return 250;
+}
+
+int KonqHistoryLoader::journalVersion()
+{
+    return 1;
+}
+
+int KonqHistoryLoader::journalStreamVersion()
+{
+    return QDataStream::Qt_6_0;
+}
+
+QString KonqHistoryLoader::historyFileName()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QLatin1String("/konqueror/konq_history");
+}
+
+QString KonqHistoryLoader::journalFileName()
+{
+    return historyFileName() + QLatin1String(".journal");
+}
+
+QString KonqHistoryLoader::journalLockFileName()
+{
+    return journalFileName() + QLatin1String(".lock");
+}
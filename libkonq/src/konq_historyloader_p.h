@@ -8,17 +8,23 @@
 #define KONQ_HISTORYLOADER_H
 
 #include "libkonq_export.h"
+#include <QList>
 #include <QObject>
 
+#include <functional>
+
+class KonqHistoryEntry;
+class QDataStream;
 class KonqHistoryList;
 class KonqHistoryLoaderPrivate;
 
 /**
  * @internal
  * This class loads the Konqueror history file.
+ * Exported only for the history benchmark in autotests.
  * @since 4.3
  */
-class KonqHistoryLoader : public QObject
+class LIBKONQ_EXPORT KonqHistoryLoader : public QObject
 {
     Q_OBJECT
 
@@ -26,10 +32,30 @@ public:
     explicit KonqHistoryLoader(QObject *parent = nullptr);
     ~KonqHistoryLoader() override;
 
+    enum LoadMode {
+        LoadAll,    ///< load all the entries
+        LoadRecent, ///< only load the most recent entries, the others are left for loadRemaining()
+    };
+
     /**
      * Load the history. No need to call this more than once...
      */
-    bool loadHistory();
+    bool loadHistory(LoadMode mode = LoadAll);
+
+    /**
+     * @returns whether loadHistory(LoadRecent) left entries for loadRemaining()
+     */
+    bool hasRemaining() const;
+
+    /**
+     * Loads the entries left out by loadHistory(LoadRecent), which are all older than
+     * those in entries(). They are passed to @p batchLoaded @p batchSize at a time,
+     * most recent batch first, each batch sorted by date. Entries which the journal
+     * removed or replaced are left out.
+     *
+     * This can be called from another thread, as long as the loader isn't used otherwise meanwhile.
+     */
+    void loadRemaining(int batchSize, const std::function<void(const QList<KonqHistoryEntry> &)> &batchLoaded);
 
     /**
      * @returns the list of all history entries, sorted by date
@@ -39,6 +65,50 @@ public:
 
     static int historyVersion();
 
+    /**
+     * Writes @p entries to @p stream in the format of the history file,
+     * version historyVersion()
+     */
+    static void writeHistory(QDataStream &stream, const KonqHistoryList &entries);
+
+    /**
+     * @returns the number of most recent entries of which the history file has
+     * a copy in a block of their own after all the entries, for loadHistory(LoadRecent)
+     */
+    static int recentEntryCount();
+
+    /**
+     * @returns the path of the history snapshot file
+     */
+    static QString historyFileName();
+
+    /**
+     * @returns the path of the journal file which records the changes made
+     * to the history since the snapshot was last written
+     */
+    static QString journalFileName();
+
+    static int journalVersion();
+
+    /**
+     * @returns the QDataStream::Version of the journal file and its records
+     */
+    static int journalStreamVersion();
+
+    /**
+     * @returns the path of the lock file held while writing the journal, or
+     * while replacing it with a new snapshot
+     */
+    static QString journalLockFileName();
+
+    /**
+     * The kind of a record in the journal file
+     */
+    enum JournalRecordType {
+        JournalVisit = 1,  ///< payload is a KonqHistoryEntry, replacing any entry with the same url
+        JournalRemove = 2, ///< payload is the QUrl of the entry to remove
+    };
+
 private:
     KonqHistoryLoaderPrivate *const d;
 };
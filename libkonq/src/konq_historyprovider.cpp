@@ -9,16 +9,28 @@
 
 #include <kconfiggroup.h>
 #include <ksharedconfig.h>
+#include "konq_historyindex_p.h"
 #include "konq_historyloader_p.h"
 #include <KSharedConfig>
 
 #include <QDBusConnection>
 #include <QDBusContext>
 #include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
+#include <QDBusServiceWatcher>
 #include <QDataStream>
 #include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QMutex>
 #include <QSaveFile>
+#include <QSet>
 #include <QStandardPaths>
+#include <QThread>
+#include <QTimer>
+
+#include <memory>
 
 #include <zlib.h> // for crc32
 
@@ -34,14 +46,125 @@ public:
     /**
      * Resizes the history list to contain less or equal than m_maxCount
      * entries. The first (oldest) entries are removed.
+     * @returns the urls of the removed entries
      */
-    void adjustSize();
+    QList<QUrl> adjustSize();
 
     /**
-     * Saves the entire history.
+     * Saves the entire history as a new snapshot and discards the journal.
      */
     bool saveHistory();
 
+    /**
+     * Persists a new or updated entry: appended to the journal in journaled mode,
+     * otherwise by saving the entire history.
+     */
+    bool recordVisit(const KonqHistoryEntry &entry);
+
+    /**
+     * Persists the removal of @p urls, like recordVisit().
+     */
+    bool recordRemovals(const QList<QUrl> &urls);
+
+    /**
+     * Appends already serialized @p records to the journal file,
+     * compacting it into a new snapshot once it has grown too long.
+     */
+    bool appendToJournal(const QByteArray &records);
+
+    /**
+     * While writes are deferred, recordVisit() and recordRemovals() collect
+     * their records, which endDeferredWrites() then writes in one go.
+     */
+    void beginDeferredWrites();
+    void endDeferredWrites();
+
+    /**
+     * Queues @p entry for the next batch broadcast to all instances.
+     */
+    void queueEntry(const KonqHistoryEntry &entry);
+
+    /**
+     * Broadcasts the queued entries right away. Called by the batch timer,
+     * and before any other change is broadcast, to keep the order of changes.
+     */
+    void flushPendingEntries();
+
+    /**
+     * Merges the visit @p e into the history
+     * @returns the resulting entry
+     */
+    KonqHistoryEntry addVisit(const KonqHistoryEntry &e);
+
+    /**
+     * Trims the history after @p entries were added to it, then lets the
+     * provider and the rest of the world know about them.
+     */
+    void announceEntries(const QList<KonqHistoryEntry> &entries, bool isSender);
+
+    /**
+     * Brings the history in line with the one on disk, after we found out
+     * that we missed some updates of @p sender, up to its batch @p sequence.
+     * The history is re-read once @p sender has saved that batch.
+     */
+    void requestResync(const QString &sender, quint32 sequence);
+    void resyncFromDisk();
+
+    /**
+     * Called once we handled our own batch @p sequence, and so saved it
+     */
+    void batchHandled(quint32 sequence);
+
+    /**
+     * @returns whether the change we are handling was made by us, and so must be saved by us
+     */
+    bool isSender() const;
+
+    /**
+     * Replaces the history with what @p loader loaded
+     */
+    void setHistory(const KonqHistoryLoader &loader);
+
+    /**
+     * Adds the url of @p entry to the dict of HistoryProvider
+     */
+    void insertUrl(const KonqHistoryEntry &entry);
+
+    /**
+     * Loads the entries left out by @p loader in a background thread,
+     * taking ownership of @p loader
+     */
+    void startLoading(KonqHistoryLoader *loader);
+
+    /**
+     * Adds the batches loaded in the background so far to the history
+     */
+    void mergeLoadedBatches();
+    void mergeLoadedEntries(const QList<KonqHistoryEntry> &batch);
+
+    /**
+     * Called once the background thread is done, adds what's left to the history
+     */
+    void endLoading();
+
+    /**
+     * Waits for the background thread, if any, and adds all its entries to the history
+     */
+    void finishLoading();
+
+    bool isLoading() const
+    {
+        return m_loaderThread != nullptr;
+    }
+
+public Q_SLOTS: // DBUS methods, they have to match org.kde.Konqueror.HistoryManager.xml
+    /**
+     * Returns once we handled, and so saved, our batch @p sequence of
+     * notifyHistoryEntries(). Called by instances which missed that batch,
+     * before they re-read the history.
+     */
+    Q_SCRIPTABLE void waitForBatch(uint sequence);
+
 Q_SIGNALS: // DBUS methods/signals,  they have to match org.kde.Konqueror.HistoryManager.xml
     friend class KonqHistoryProvider;
     /**
@@ -52,9 +175,24 @@ Q_SIGNALS: // DBUS methods/signals,  they have to match org.kde.Konqueror.Histor
      * @param e the new history entry
      * @param saveId is the dbus service of the sender so that
      * only the sender saves the new history.
+     *
+     * Still sent after notifyHistoryEntries(), for each of its entries, for
+     * older versions which don't know it. Instances knowing it ignore the
+     * ones from senders of notifyHistoryEntries().
      */
     void notifyHistoryEntry(const QByteArray &historyEntry);
 
+    /**
+     * Like notifyHistoryEntry(), for all the entries added by the sender
+     * during a short period, so that loading a page doesn't cause a flood
+     * of messages to every konqueror instance.
+     *
+     * @param batch the format version, a per-sender sequence number, the
+     * number of entries and the entries themselves. Receivers re-read the
+     * history from disk when they notice a gap in the sequence numbers.
+     */
+    void notifyHistoryEntries(const QByteArray &batch);
+
     /**
      * Called when the configuration of the maximum count changed.
      * Called via DBUS by some config-module
@@ -86,11 +224,13 @@ Q_SIGNALS: // DBUS methods/signals,  they have to match org.kde.Konqueror.Histor
 
 private Q_SLOTS: // connected to DBUS signals
     void slotNotifyHistoryEntry(const QByteArray &historyEntry);
+    void slotNotifyHistoryEntries(const QByteArray &batch);
     void slotNotifyMaxCount(int count);
     void slotNotifyMaxAge(int days);
     void slotNotifyClear();
     void slotNotifyRemove(const QString &url);
     void slotNotifyRemoveList(const QStringList &urls);
+    void slotSenderUnregistered(const QString &sender);
 
 public:
     KSharedConfig::Ptr konqConfig()
@@ -100,10 +240,61 @@ public:
         return KSharedConfig::openConfig(QStringLiteral("konquerorrc"));
     }
 
-    KonqHistoryList m_history;
+    KonqHistoryIndex m_history;
     int m_maxCount;   // maximum of history entries
     int m_maxAgeDays; // maximum age of a history entry
+    bool m_useJournal; // append changes to a journal instead of rewriting the whole file
+    bool m_journalDirty = false; // whether we appended to the journal, or failed to save, since the last snapshot
+    bool m_deferWrites = false;
+    bool m_deferredSave = false; // a full save is due once writes aren't deferred anymore
+    QByteArray m_deferredRecords; // journal records waiting for endDeferredWrites()
+
+    QList<KonqHistoryEntry> m_pendingEntries; // entries waiting for the next batch
+    QHash<QUrl, qsizetype> m_pendingIndex; // position of each url in m_pendingEntries
+    QTimer m_batchTimer;
+    quint32 m_batchSequence = 0; // sequence number of the next batch we send
+    QHash<QString, quint32> m_lastSequences; // sequence number of the last batch received, per sender
+    QDBusServiceWatcher m_senderWatcher; // forgets the senders of m_lastSequences leaving the bus
+    QList<QPair<quint32, QList<KonqHistoryEntry>>> m_sentBatches; // batches we sent, but didn't handle yet
+    quint32 m_handledSequence = quint32(-1); // sequence number of the last batch of ours we handled
+    QList<QPair<quint32, QDBusMessage>> m_batchWaiters; // delayed replies to waitForBatch()
+    int m_pendingResyncs = 0;
+    int m_clearCount = 0; // a resync requested before clearing the history is pointless
+    QSet<QUrl> m_changedBeforeResync; // changed while a resync was pending, newer than the disk
+
+    // Loading in the background, see KonqHistoryProvider::loadHistoryInBackground()
+    KonqHistoryLoader *m_loader = nullptr;
+    QThread *m_loaderThread = nullptr;
+    QMutex m_loadedMutex;
+    QList<QList<KonqHistoryEntry>> m_loadedBatches; // guarded by m_loadedMutex
+    bool m_saveWhenLoaded = false; // saving the history was postponed until all entries are loaded
+    bool m_clearedWhileLoading = false;
+    QSet<QUrl> m_removedWhileLoading; // their older entries must not come back
+    QSet<QUrl> m_visitedWhileLoading; // their older entries must be merged into the new ones
+
     KonqHistoryProvider *q;
+
+    /**
+     * Size of the journal file, in bytes, after which it is folded into a new snapshot.
+     * All instances append to the same file, so this is checked against its actual size.
+     */
+    static constexpr qint64 s_maxJournalSize = 256 * 1024;
+
+    /**
+     * How long we wait for another instance to finish writing the journal, in milliseconds
+     */
+    static constexpr int s_journalLockTimeout = 5000;
+
+    /**
+     * How long new entries are collected before they are broadcast, in milliseconds
+     */
+    static constexpr int s_batchInterval = 200;
+    static constexpr quint8 s_batchVersion = 1;
+
+    /**
+     * Number of entries handed over at once by the background thread
+     */
+    static constexpr int s_loadBatchSize = 500;
 };
 
 KonqHistoryProviderPrivate::KonqHistoryProviderPrivate(KonqHistoryProvider *qq)
@@ -114,14 +305,25 @@ KonqHistoryProviderPrivate::KonqHistoryProviderPrivate(KonqHistoryProvider *qq)
     m_maxCount = cs.readEntry("Maximum of History entries", 500);
     m_maxCount = qMax(1, m_maxCount);
     m_maxAgeDays = cs.readEntry("Maximum age of History entries", 90);
+    m_useJournal = cs.readEntry("Journaled history", true);
+
+    // Not restarted by new entries, so that nothing waits longer than one interval
+    m_batchTimer.setSingleShot(true);
+    m_batchTimer.setInterval(s_batchInterval);
+    connect(&m_batchTimer, &QTimer::timeout, this, &KonqHistoryProviderPrivate::flushPendingEntries);
+
+    m_senderWatcher.setConnection(QDBusConnection::sessionBus());
+    m_senderWatcher.setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
+    connect(&m_senderWatcher, &QDBusServiceWatcher::serviceUnregistered, this, &KonqHistoryProviderPrivate::slotSenderUnregistered);
 
     const QString dbusPath = QStringLiteral("/KonqHistoryManager");
     const QString dbusInterface = QStringLiteral("org.kde.Konqueror.HistoryManager");
 
     QDBusConnection dbus = QDBusConnection::sessionBus();
-    dbus.registerObject(dbusPath, this, QDBusConnection::ExportAllSignals);
+    dbus.registerObject(dbusPath, this, QDBusConnection::ExportAllSignals | QDBusConnection::ExportScriptableSlots);
     dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyClear"), this, SLOT(slotNotifyClear()));
     dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyHistoryEntry"), this, SLOT(slotNotifyHistoryEntry(QByteArray)));
+    dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyHistoryEntries"), this, SLOT(slotNotifyHistoryEntries(QByteArray)));
     dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyMaxAge"), this, SLOT(slotNotifyMaxAge(int)));
     dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyMaxCount"), this, SLOT(slotNotifyMaxCount(int)));
     dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyRemove"), this, SLOT(slotNotifyRemove(QString)));
@@ -137,61 +339,232 @@ KonqHistoryProvider::KonqHistoryProvider(QObject *parent)
 
 KonqHistoryProvider::~KonqHistoryProvider()
 {
+    {
+        // Whoever listens to us may be gone already
+        const QSignalBlocker blocker(this);
+        d->finishLoading();
+    }
+
+    // We won't be around to receive our last batch, so apply it ourselves:
+    // the others only save what they're told by the sender.
+    const bool hadPendingEntries = !d->m_pendingEntries.isEmpty();
+    if (hadPendingEntries) {
+        const QList<KonqHistoryEntry> pending = d->m_pendingEntries;
+        d->flushPendingEntries();
+        for (const KonqHistoryEntry &entry : pending) {
+            d->addVisit(entry);
+        }
+    }
+
+    // Fold what we journaled into a snapshot, so that the next start has less to replay
+    if (hadPendingEntries || d->m_journalDirty) {
+        d->saveHistory();
+    }
     delete d;
 }
 
 const KonqHistoryList &KonqHistoryProvider::entries() const
 {
-    return d->m_history;
+    return d->m_history.entries();
 }
 
 bool KonqHistoryProvider::loadHistory()
 {
+    d->finishLoading();
+
     KonqHistoryLoader loader;
     if (!loader.loadHistory()) {
         return false;
     }
 
-    d->m_history = loader.entries();
+    d->setHistory(loader);
+    return true;
+}
+
+bool KonqHistoryProvider::loadHistoryInBackground()
+{
+    d->finishLoading();
+
+    auto loader = std::make_unique<KonqHistoryLoader>();
+    if (!loader->loadHistory(KonqHistoryLoader::LoadRecent)) {
+        return false;
+    }
+
+    d->setHistory(*loader);
+    if (loader->hasRemaining()) {
+        d->startLoading(loader.release());
+    }
+    return true;
+}
+
+bool KonqHistoryProvider::isFullyLoaded() const
+{
+    return !d->isLoading();
+}
 
-    d->adjustSize();
+void KonqHistoryProviderPrivate::setHistory(const KonqHistoryLoader &loader)
+{
+    m_history.setEntries(loader.entries());
 
-    QListIterator<KonqHistoryEntry> it(d->m_history);
-    while (it.hasNext()) {
-        const KonqHistoryEntry &entry = it.next();
+    adjustSize();
 
+    for (const KonqHistoryEntry &entry : m_history.entries()) {
         // Fill the entries into HistoryProvider.
-        const QString urlString = entry.url.url();
-        HistoryProvider::insert(urlString);
-        // DF: also insert the "pretty" version if different
-        // This helps getting 'visited' links on websites which don't use fully-escaped urls.
-        const QString prettyUrlString = entry.url.toDisplayString();
-        if (urlString != prettyUrlString) {
-            HistoryProvider::insert(prettyUrlString);
+        insertUrl(entry);
+    }
+}
+
+void KonqHistoryProviderPrivate::insertUrl(const KonqHistoryEntry &entry)
+{
+    const QString urlString = entry.url.url();
+    q->HistoryProvider::insert(urlString);
+    // DF: also insert the "pretty" version if different
+    // This helps getting 'visited' links on websites which don't use fully-escaped urls.
+    const QString prettyUrlString = entry.url.toDisplayString();
+    if (urlString != prettyUrlString) {
+        q->HistoryProvider::insert(prettyUrlString);
+    }
+}
+
+void KonqHistoryProviderPrivate::startLoading(KonqHistoryLoader *loader)
+{
+    m_loader = loader;
+    m_loaderThread = QThread::create([this, loader]() {
+        loader->loadRemaining(s_loadBatchSize, [this](const QList<KonqHistoryEntry> &batch) {
+            {
+                QMutexLocker locker(&m_loadedMutex);
+                m_loadedBatches.append(batch);
+            }
+            QMetaObject::invokeMethod(this, &KonqHistoryProviderPrivate::mergeLoadedBatches, Qt::QueuedConnection);
+        });
+    });
+    QThread *thread = m_loaderThread;
+    connect(thread, &QThread::finished, this, [this, thread]() {
+        // finishLoading() might have been quicker
+        if (thread == m_loaderThread) {
+            endLoading();
         }
+    });
+    m_loaderThread->start(QThread::LowPriority);
+}
+
+void KonqHistoryProviderPrivate::mergeLoadedBatches()
+{
+    QList<QList<KonqHistoryEntry>> batches;
+    {
+        QMutexLocker locker(&m_loadedMutex);
+        batches.swap(m_loadedBatches);
+    }
+    for (const QList<KonqHistoryEntry> &batch : std::as_const(batches)) {
+        mergeLoadedEntries(batch);
     }
+}
 
-    return true;
+void KonqHistoryProviderPrivate::mergeLoadedEntries(const QList<KonqHistoryEntry> &batch)
+{
+    if (m_clearedWhileLoading) {
+        return;
+    }
+
+    QList<KonqHistoryEntry> added;
+    QList<KonqHistoryEntry> loaded;
+    added.reserve(batch.count());
+    loaded.reserve(batch.count());
+    for (const KonqHistoryEntry &entry : batch) {
+        if (m_removedWhileLoading.contains(entry.url)) {
+            continue;
+        }
+        if (m_visitedWhileLoading.contains(entry.url)) {
+            // The entry was created by the new visit, as if the url had never been visited before
+            KonqHistoryList::iterator current = m_history.find(entry.url);
+            if (current == m_history.end()) {
+                continue; // expired meanwhile
+            }
+            current->firstVisited = entry.firstVisited;
+            current->numberOfTimesVisited += entry.numberOfTimesVisited;
+            if (current->typedUrl.isEmpty()) {
+                current->typedUrl = entry.typedUrl;
+            }
+            if (current->title.isEmpty()) {
+                current->title = entry.title;
+            }
+            // What we journaled for the new visit misses the older ones
+            m_saveWhenLoaded = true;
+        } else {
+            added.append(entry);
+            insertUrl(entry);
+        }
+        loaded.append(entry);
+    }
+
+    m_history.prepend(added);
+    if (!loaded.isEmpty()) {
+        emit q->entriesLoaded(loaded);
+    }
 }
 
-void KonqHistoryProviderPrivate::adjustSize()
+void KonqHistoryProviderPrivate::endLoading()
 {
-    if (m_history.isEmpty()) {
+    if (!m_loaderThread) {
         return;
     }
+    mergeLoadedBatches();
+
+    m_loaderThread->deleteLater();
+    m_loaderThread = nullptr;
+    delete m_loader;
+    m_loader = nullptr;
+    m_clearedWhileLoading = false;
+    m_removedWhileLoading.clear();
+    m_visitedWhileLoading.clear();
+
+    adjustSize();
+    if (m_saveWhenLoaded) {
+        m_saveWhenLoaded = false;
+        saveHistory();
+    }
+    emit q->fullyLoaded();
+}
+
+void KonqHistoryProviderPrivate::finishLoading()
+{
+    if (m_loaderThread) {
+        m_loaderThread->wait();
+        endLoading();
+    }
+}
+
+QList<QUrl> KonqHistoryProviderPrivate::adjustSize()
+{
+    if (m_history.isEmpty()) {
+        return {};
+    }
 
-    KonqHistoryEntry entry = m_history.first();
     const QDateTime expirationDate(QDate::currentDate().addDays(-m_maxAgeDays).startOfDay());
+    auto isExpired = [&](const KonqHistoryEntry &entry) {
+        return m_maxAgeDays > 0 && entry.lastVisited.isValid() && entry.lastVisited < expirationDate;
+    };
+
+    // The oldest entries come first, so everything to drop is at the front
+    qsizetype count = qMax<qsizetype>(0, m_history.count() - m_maxCount);
+    while (count < m_history.count() && isExpired(m_history.at(count))) {
+        ++count;
+    }
+    if (count == 0) {
+        return {};
+    }
 
-    while (m_history.count() > qint32(m_maxCount) ||
-            (m_maxAgeDays > 0 && entry.lastVisited.isValid() && entry.lastVisited < expirationDate)) { // i.e. entry is expired
-        q->removeEntry(m_history.begin());
+    const QList<KonqHistoryEntry> removed = m_history.entries().mid(0, count);
+    m_history.removeOldest(count);
 
-        if (m_history.isEmpty()) {
-            break;
-        }
-        entry = m_history.first();
+    QList<QUrl> urls;
+    urls.reserve(removed.count());
+    for (const KonqHistoryEntry &entry : removed) {
+        q->HistoryProvider::remove(entry.url.url());
+        emit q->entryRemoved(entry);
+        urls.append(entry.url);
     }
+    return urls;
 }
 
 static QString dbusService()
@@ -199,21 +572,84 @@ static QString dbusService()
     return QDBusConnection::sessionBus().baseService();
 }
 
+/**
+ * Merges a new @p visit of the url of @p entry into @p entry
+ */
+static void mergeVisit(KonqHistoryEntry &entry, const KonqHistoryEntry &visit)
+{
+    if (!visit.typedUrl.isEmpty()) {
+        entry.typedUrl = visit.typedUrl;
+    }
+    if (!visit.title.isEmpty()) {
+        entry.title = visit.title;
+    }
+    entry.numberOfTimesVisited += visit.numberOfTimesVisited;
+    entry.lastVisited = visit.lastVisited;
+}
+
 void KonqHistoryProvider::emitAddToHistory(const KonqHistoryEntry &entry)
+{
+    d->queueEntry(entry);
+}
+
+void KonqHistoryProviderPrivate::queueEntry(const KonqHistoryEntry &entry)
 {
     QByteArray data;
     QDataStream stream(&data, QIODevice::WriteOnly);
     entry.save(stream, KonqHistoryEntry::MarshalUrlAsStrings);
-    stream << dbusService();
     // Protection against very long urls (like data:)
     if (data.size() > 4096) {
         return;
     }
-    emit d->notifyHistoryEntry(data);
+
+    // Adding and confirming a pending entry usually happen within one batch,
+    // merge them here like the receivers would
+    const auto pending = m_pendingIndex.constFind(entry.url);
+    if (pending != m_pendingIndex.constEnd()) {
+        mergeVisit(m_pendingEntries[*pending], entry);
+        return;
+    }
+
+    m_pendingIndex.insert(entry.url, m_pendingEntries.count());
+    m_pendingEntries.append(entry);
+    if (!m_batchTimer.isActive()) {
+        m_batchTimer.start();
+    }
+}
+
+void KonqHistoryProviderPrivate::flushPendingEntries()
+{
+    m_batchTimer.stop();
+    if (m_pendingEntries.isEmpty()) {
+        return;
+    }
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << s_batchVersion << m_batchSequence++ << quint32(m_pendingEntries.count());
+    for (const KonqHistoryEntry &entry : std::as_const(m_pendingEntries)) {
+        entry.save(stream, KonqHistoryEntry::MarshalUrlAsStrings);
+    }
+    m_sentBatches.append(qMakePair(m_batchSequence - 1, m_pendingEntries));
+    const QList<KonqHistoryEntry> entries = m_pendingEntries;
+    m_pendingEntries.clear();
+    m_pendingIndex.clear();
+
+    emit notifyHistoryEntries(data);
+
+    // For older versions still running, during an upgrade. They come after the batch,
+    // so instances knowing batches know by then that we send them, and ignore these
+    for (const KonqHistoryEntry &entry : entries) {
+        QByteArray legacyData;
+        QDataStream legacyStream(&legacyData, QIODevice::WriteOnly);
+        entry.save(legacyStream, KonqHistoryEntry::MarshalUrlAsStrings);
+        emit notifyHistoryEntry(legacyData);
+    }
 }
 
 void KonqHistoryProvider::emitRemoveFromHistory(const QUrl &url)
 {
+    d->flushPendingEntries();
     emit d->notifyRemove(url.url());
 }
 
@@ -223,21 +659,25 @@ void KonqHistoryProvider::emitRemoveListFromHistory(const QList<QUrl> &urls)
     for (const QUrl &url: urls) {
         result << url.url();
     }
+    d->flushPendingEntries();
     emit d->notifyRemoveList(result);
 }
 
 void KonqHistoryProvider::emitClear()
 {
+    d->flushPendingEntries();
     emit d->notifyClear();
 }
 
 void KonqHistoryProvider::emitSetMaxCount(int count)
 {
+    d->flushPendingEntries();
     emit d->notifyMaxCount(count);
 }
 
 void KonqHistoryProvider::emitSetMaxAge(int days)
 {
+    d->flushPendingEntries();
     emit d->notifyMaxAge(days);
 }
 
@@ -249,8 +689,18 @@ static bool isSenderOfSignal(const QDBusMessage &msg)
     return dbusService() == msg.service();
 }
 
+bool KonqHistoryProviderPrivate::isSender() const
+{
+    return isSenderOfSignal(message());
+}
+
 void KonqHistoryProviderPrivate::slotNotifyHistoryEntry(const QByteArray &data)
 {
+    // Sent for older versions, we had the entry in a batch already
+    if (m_lastSequences.contains(message().service())) {
+        return;
+    }
+
     KonqHistoryEntry e;
     QDataStream stream(const_cast<QByteArray *>(&data), QIODevice::ReadOnly);
 
@@ -261,9 +711,89 @@ void KonqHistoryProviderPrivate::slotNotifyHistoryEntry(const QByteArray &data)
     e.load(stream, KonqHistoryEntry::MarshalUrlAsStrings);
     //qCDebug(LIBKONQ_LOG) << "Got new entry from Broadcast:" << e.url;
 
+    announceEntries({addVisit(e)}, isSender());
+}
+
+void KonqHistoryProviderPrivate::slotNotifyHistoryEntries(const QByteArray &batch)
+{
+    QDataStream stream(batch);
+    quint8 version;
+    quint32 sequence;
+    quint32 count;
+    stream >> version >> sequence >> count;
+    if (stream.status() != QDataStream::Ok || version != s_batchVersion) {
+        qCWarning(LIBKONQ_LOG) << "Ignoring history batch with unknown format" << version;
+        return;
+    }
+
+    const QString sender = message().service();
+    const auto lastSequence = m_lastSequences.constFind(sender);
+    const bool missedBatches = lastSequence != m_lastSequences.constEnd() && sequence != *lastSequence + 1;
+    if (lastSequence == m_lastSequences.constEnd()) {
+        m_senderWatcher.addWatchedService(sender);
+    }
+    m_lastSequences.insert(sender, sequence);
+    if (missedBatches) {
+        qCDebug(LIBKONQ_LOG) << "Missed history updates from" << sender << "re-reading the history";
+        requestResync(sender, sequence - 1);
+    }
+
+    QList<KonqHistoryEntry> added;
+    added.reserve(qMin(count, quint32(1024)));
+    for (quint32 i = 0; i < count && !stream.atEnd(); ++i) {
+        KonqHistoryEntry e;
+        e.load(stream, KonqHistoryEntry::MarshalUrlAsStrings);
+        added.append(addVisit(e));
+    }
+
+    announceEntries(added, isSender());
+    if (isSender()) {
+        batchHandled(sequence);
+    }
+}
+
+void KonqHistoryProviderPrivate::slotSenderUnregistered(const QString &sender)
+{
+    // Unique names aren't reused, nothing more comes from it
+    m_senderWatcher.removeWatchedService(sender);
+    m_lastSequences.remove(sender);
+}
+
+void KonqHistoryProviderPrivate::batchHandled(quint32 sequence)
+{
+    m_handledSequence = sequence;
+    while (!m_sentBatches.isEmpty() && qint32(sequence - m_sentBatches.first().first) >= 0) {
+        m_sentBatches.removeFirst();
+    }
+
+    for (auto it = m_batchWaiters.begin(); it != m_batchWaiters.end();) {
+        if (qint32(sequence - it->first) >= 0) {
+            QDBusConnection::sessionBus().send(it->second.createReply());
+            it = m_batchWaiters.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void KonqHistoryProviderPrivate::waitForBatch(uint sequence)
+{
+    // Handled already, or not even sent
+    if (qint32(m_handledSequence - sequence) >= 0 || qint32(sequence - m_batchSequence) >= 0) {
+        return;
+    }
+    setDelayedReply(true);
+    m_batchWaiters.append(qMakePair(quint32(sequence), message()));
+}
+
+KonqHistoryEntry KonqHistoryProviderPrivate::addVisit(const KonqHistoryEntry &e)
+{
     KonqHistoryList::iterator existingEntry = q->findEntry(e.url);
     QString urlString = e.url.url();
     const bool newEntry = existingEntry == m_history.end();
+    if (m_pendingResyncs > 0) {
+        m_changedBeforeResync.insert(e.url);
+    }
 
     KonqHistoryEntry entry;
 
@@ -274,28 +804,119 @@ void KonqHistoryProviderPrivate::slotNotifyHistoryEntry(const QByteArray &data)
         entry.firstVisited = e.firstVisited;
         entry.numberOfTimesVisited = 0; // will get set to 1 below
         q->HistoryProvider::insert(urlString);
+        if (isLoading()) {
+            m_visitedWhileLoading.insert(e.url);
+        }
     }
 
-    if (!e.typedUrl.isEmpty()) {
-        entry.typedUrl = e.typedUrl;
+    mergeVisit(entry, e);
+
+    if (!newEntry) {
+        *existingEntry = entry;
+    } else {
+        m_history.append(entry);
     }
-    if (!e.title.isEmpty()) {
-        entry.title = e.title;
+    return entry;
+}
+
+void KonqHistoryProviderPrivate::announceEntries(const QList<KonqHistoryEntry> &entries, bool isSender)
+{
+    const QList<QUrl> trimmed = adjustSize();
+
+    // one write for the whole batch
+    beginDeferredWrites();
+    // Every instance trims the same entries, but only the sender records it,
+    // so that replaying the journal doesn't bring them back
+    if (isSender && !trimmed.isEmpty()) {
+        recordRemovals(trimmed);
+    }
+    for (const KonqHistoryEntry &entry : entries) {
+        if (!m_history.contains(entry.url)) {
+            continue; // expired right away
+        }
+        q->finishAddingEntry(entry, isSender);
+        emit q->entryAdded(entry);
     }
-    entry.numberOfTimesVisited += e.numberOfTimesVisited;
-    entry.lastVisited = e.lastVisited;
+    endDeferredWrites();
+}
+
+void KonqHistoryProviderPrivate::requestResync(const QString &sender, quint32 sequence)
+{
+    // Our copy of the batches we missed is on disk only once the sender handled them.
+    // It handles its batches in order with our call, so asking it is enough to wait for that.
+    QDBusMessage call = QDBusMessage::createMethodCall(sender,
+                                                       QStringLiteral("/KonqHistoryManager"),
+                                                       QStringLiteral("org.kde.Konqueror.HistoryManager"),
+                                                       QStringLiteral("waitForBatch"));
+    call << uint(sequence);
+    ++m_pendingResyncs;
+    const int clearCount = m_clearCount;
+    auto *watcher = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(call), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, clearCount](QDBusPendingCallWatcher *watcher) {
+        watcher->deleteLater();
+        // If the sender is gone, it saved the history when quitting
+        if (clearCount == m_clearCount) {
+            resyncFromDisk();
+        }
+        if (--m_pendingResyncs == 0) {
+            m_changedBeforeResync.clear();
+        }
+    });
+}
+
+void KonqHistoryProviderPrivate::resyncFromDisk()
+{
+    finishLoading();
 
-    if (newEntry) {
+    KonqHistoryLoader loader;
+    if (!loader.loadHistory()) {
+        return;
+    }
+    KonqHistoryIndex onDisk;
+    onDisk.setEntries(loader.entries());
+
+    // What changed since we asked for the resync may not be on disk yet, we know better
+    QList<QUrl> gone;
+    for (const KonqHistoryEntry &entry : m_history.entries()) {
+        if (!onDisk.contains(entry.url) && !m_changedBeforeResync.contains(entry.url)) {
+            gone.append(entry.url);
+        }
+    }
+    for (const QUrl &url : std::as_const(gone)) {
+        q->removeEntry(m_history.find(url));
+    }
+
+    QList<KonqHistoryEntry> changed;
+    for (const KonqHistoryEntry &entry : onDisk.entries()) {
+        if (m_changedBeforeResync.contains(entry.url)) {
+            continue;
+        }
+        KonqHistoryList::iterator existingEntry = m_history.find(entry.url);
+        if (existingEntry != m_history.end()) {
+            if (*existingEntry == entry) {
+                continue;
+            }
+            // Its old weight goes away with it, the new one is added below
+            q->removeEntry(existingEntry);
+        }
+        q->HistoryProvider::insert(entry.url.url());
         m_history.append(entry);
-    } else {
-        *existingEntry = entry;
+        changed.append(entry);
     }
 
     adjustSize();
 
-    q->finishAddingEntry(entry, isSenderOfSignal(message()));
-
-    emit q->entryAdded(entry);
+    // Unlike new visits, these entries count with all their visits, like loaded ones
+    QList<KonqHistoryEntry> loaded;
+    loaded.reserve(changed.count());
+    for (const KonqHistoryEntry &entry : std::as_const(changed)) {
+        if (m_history.contains(entry.url)) {
+            loaded.append(entry);
+        }
+    }
+    if (!loaded.isEmpty()) {
+        emit q->entriesLoaded(loaded);
+    }
 }
 
 void KonqHistoryProviderPrivate::slotNotifyMaxCount(int count)
@@ -307,7 +928,7 @@ void KonqHistoryProviderPrivate::slotNotifyMaxCount(int count)
     KConfigGroup cs(konqConfig(), "HistorySettings");
     cs.writeEntry("Maximum of History entries", m_maxCount);
 
-    if (isSenderOfSignal(message())) {
+    if (isSender()) {
         saveHistory();
         cs.sync();
     }
@@ -322,7 +943,7 @@ void KonqHistoryProviderPrivate::slotNotifyMaxAge(int days)
     KConfigGroup cs(konqConfig(), "HistorySettings");
     cs.writeEntry("Maximum age of History entries", m_maxAgeDays);
 
-    if (isSenderOfSignal(message())) {
+    if (isSender()) {
         saveHistory();
         cs.sync();
     }
@@ -331,8 +952,12 @@ void KonqHistoryProviderPrivate::slotNotifyMaxAge(int days)
 void KonqHistoryProviderPrivate::slotNotifyClear()
 {
     m_history.clear();
+    ++m_clearCount;
+    if (isLoading()) {
+        m_clearedWhileLoading = true;
+    }
 
-    if (isSenderOfSignal(message())) {
+    if (isSender()) {
         saveHistory();
     }
 
@@ -344,29 +969,46 @@ void KonqHistoryProviderPrivate::slotNotifyRemove(const QString &urlStr)
     QUrl url(urlStr);
 
     KonqHistoryList::iterator existingEntry = q->findEntry(url);
-    if (existingEntry != m_history.end()) {
+    const bool found = existingEntry != m_history.end();
+    if (found) {
         q->removeEntry(existingEntry);
-        if (isSenderOfSignal(message())) {
-            saveHistory();
-        }
+    }
+    if (m_pendingResyncs > 0) {
+        m_changedBeforeResync.insert(url);
+    }
+    // While loading, an older entry for the url may still be on its way
+    if (isLoading()) {
+        m_removedWhileLoading.insert(url);
+    }
+    if ((found || isLoading()) && isSender()) {
+        recordRemovals({url});
     }
 }
 
 void KonqHistoryProviderPrivate::slotNotifyRemoveList(const QStringList &urls)
 {
-    bool doSave = false;
+    QList<QUrl> removed;
     QStringList::const_iterator it = urls.begin();
     for (; it != urls.end(); ++it) {
         QUrl url(*it);
-        KonqHistoryList::iterator existingEntry = m_history.findEntry(url);
+        KonqHistoryList::iterator existingEntry = m_history.find(url);
         if (existingEntry != m_history.end()) {
             q->removeEntry(existingEntry);
-            doSave = true;
+            removed.append(url);
+        } else if (isLoading()) {
+            // an older entry for the url may still be on its way
+            removed.append(url);
+        }
+        if (isLoading()) {
+            m_removedWhileLoading.insert(url);
+        }
+        if (m_pendingResyncs > 0) {
+            m_changedBeforeResync.insert(url);
         }
     }
 
-    if (doSave && isSenderOfSignal(message())) {
-        saveHistory();
+    if (!removed.isEmpty() && isSender()) {
+        recordRemovals(removed);
     }
 }
 
@@ -393,32 +1035,168 @@ int KonqHistoryProvider::maxAge() const
 
 bool KonqHistoryProviderPrivate::saveHistory()
 {
-    const QString dir = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QLatin1String("/konqueror");
-    QDir().mkpath(dir);
-    const QString filename = dir + QLatin1String("/konq_history");
+    // Saving now would lose the entries which aren't loaded yet
+    if (isLoading() && !m_clearedWhileLoading) {
+        m_saveWhenLoaded = true;
+        return true;
+    }
+
+    const QString filename = KonqHistoryLoader::historyFileName();
+    QDir().mkpath(QFileInfo(filename).absolutePath());
+
+    // Nobody may append to the journal between writing the snapshot and removing the
+    // journal, or what they appended would be lost. Without the lock, the journal is
+    // kept, and the snapshot is written the next time
+    QLockFile lock(KonqHistoryLoader::journalLockFileName());
+    if (!lock.tryLock(s_journalLockTimeout)) {
+        qCWarning(LIBKONQ_LOG) << "Can't lock the history journal, not saving the history:" << lock.error();
+        m_journalDirty = true;
+        return false;
+    }
+
     QSaveFile file(filename);
     if (!file.open(QIODevice::WriteOnly)) {
         qCWarning(LIBKONQ_LOG) << "Can't open" << file.fileName() << "for saving history";
+        m_journalDirty = true;
         return false;
     }
 
     QDataStream fileStream(&file);
-    fileStream << KonqHistoryLoader::historyVersion();
+    KonqHistoryLoader::writeHistory(fileStream, m_history.entries());
 
-    QByteArray data;
-    QDataStream stream(&data, QIODevice::WriteOnly);
+    if (!file.commit()) {
+        m_journalDirty = true;
+        return false;
+    }
+
+    // Everything in the journal is part of the snapshot now
+    QFile::remove(KonqHistoryLoader::journalFileName());
+    m_journalDirty = false;
+    return true;
+}
+
+static void writeJournalRecord(QDataStream &stream, KonqHistoryLoader::JournalRecordType type, const QByteArray &payload)
+{
+    const quint32 crc = crc32(0, reinterpret_cast<const unsigned char *>(payload.constData()), payload.size());
+    stream << quint8(type) << payload << crc;
+}
 
-    QListIterator<KonqHistoryEntry> it(m_history);
-    while (it.hasNext()) {
-        //We use QUrl for marshalling URLs in entries in the V4
-        //file format
-        it.next().save(stream, KonqHistoryEntry::NoFlags);
+bool KonqHistoryProviderPrivate::recordVisit(const KonqHistoryEntry &entry)
+{
+    if (!m_useJournal) {
+        if (m_deferWrites) {
+            m_deferredSave = true;
+            return true;
+        }
+        return saveHistory();
     }
 
-    quint32 crc = crc32(0, reinterpret_cast<unsigned char *>(data.data()), data.size());
-    fileStream << crc << data;
+    QByteArray payload;
+    QDataStream payloadStream(&payload, QIODevice::WriteOnly);
+    payloadStream.setVersion(KonqHistoryLoader::journalStreamVersion());
+    entry.save(payloadStream, KonqHistoryEntry::NoFlags);
+
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream.setVersion(KonqHistoryLoader::journalStreamVersion());
+    writeJournalRecord(stream, KonqHistoryLoader::JournalVisit, payload);
+    if (m_deferWrites) {
+        m_deferredRecords += record;
+        return true;
+    }
+    return appendToJournal(record);
+}
 
-    return file.commit();
+void KonqHistoryProviderPrivate::beginDeferredWrites()
+{
+    m_deferWrites = true;
+}
+
+void KonqHistoryProviderPrivate::endDeferredWrites()
+{
+    m_deferWrites = false;
+
+    const QByteArray records = m_deferredRecords;
+    m_deferredRecords.clear();
+
+    if (m_deferredSave) {
+        m_deferredSave = false;
+        saveHistory();
+    } else if (!records.isEmpty()) {
+        appendToJournal(records);
+    }
+}
+
+bool KonqHistoryProviderPrivate::recordRemovals(const QList<QUrl> &urls)
+{
+    if (!m_useJournal) {
+        if (m_deferWrites) {
+            m_deferredSave = true;
+            return true;
+        }
+        return saveHistory();
+    }
+
+    QByteArray records;
+    QDataStream stream(&records, QIODevice::WriteOnly);
+    stream.setVersion(KonqHistoryLoader::journalStreamVersion());
+    for (const QUrl &url : urls) {
+        QByteArray payload;
+        QDataStream payloadStream(&payload, QIODevice::WriteOnly);
+        payloadStream.setVersion(KonqHistoryLoader::journalStreamVersion());
+        payloadStream << url;
+        writeJournalRecord(stream, KonqHistoryLoader::JournalRemove, payload);
+    }
+    if (m_deferWrites) {
+        m_deferredRecords += records;
+        return true;
+    }
+    return appendToJournal(records);
+}
+
+bool KonqHistoryProviderPrivate::appendToJournal(const QByteArray &records)
+{
+    const QString filename = KonqHistoryLoader::journalFileName();
+    QDir().mkpath(QFileInfo(filename).absolutePath());
+
+    // The snapshot has the records too, as they are in memory already. No snapshot while
+    // loading, see saveHistory(), nor without the lock: keep appending until then
+    if (QFileInfo(filename).size() + records.size() > s_maxJournalSize && !isLoading() && saveHistory()) {
+        return true;
+    }
+
+    // See saveHistory()
+    QLockFile lock(KonqHistoryLoader::journalLockFileName());
+    if (!lock.tryLock(s_journalLockTimeout)) {
+        qCWarning(LIBKONQ_LOG) << "Can't lock the history journal, appending anyway:" << lock.error();
+    }
+
+    QFile file(filename);
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qCWarning(LIBKONQ_LOG) << "Can't open" << file.fileName() << "for appending, saving the whole history instead";
+        lock.unlock();
+        return saveHistory();
+    }
+
+    QByteArray data;
+    if (file.size() == 0) {
+        QDataStream header(&data, QIODevice::WriteOnly);
+        header.setVersion(KonqHistoryLoader::journalStreamVersion());
+        header << quint32(KonqHistoryLoader::journalVersion());
+    }
+    data += records;
+
+    // Write everything at once, so that appends from other processes can't end up in the middle
+    if (file.write(data) != data.size()) {
+        qCWarning(LIBKONQ_LOG) << "Can't append to" << file.fileName() << "saving the whole history instead";
+        file.close();
+        lock.unlock();
+        return saveHistory();
+    }
+
+    m_journalDirty = true;
+    return true;
 }
 
 KonqHistoryList::iterator KonqHistoryProvider::findEntry(const QUrl &url)
@@ -427,7 +1205,7 @@ KonqHistoryList::iterator KonqHistoryProvider::findEntry(const QUrl &url)
     if (!HistoryProvider::contains(url.url())) {
         return d->m_history.end();
     }
-    return d->m_history.findEntry(url);
+    return d->m_history.find(url);
 }
 
 KonqHistoryList::const_iterator KonqHistoryProvider::constFindEntry(const QUrl &url) const
@@ -436,15 +1214,46 @@ KonqHistoryList::const_iterator KonqHistoryProvider::constFindEntry(const QUrl &
     if (!HistoryProvider::contains(url.url())) {
         return d->m_history.constEnd();
     }
-    return d->m_history.constFindEntry(url);
+    return d->m_history.constFind(url);
+}
+
+KonqHistoryEntry KonqHistoryProvider::upcomingEntry(const QUrl &url) const
+{
+    KonqHistoryEntry entry;
+    const KonqHistoryList::const_iterator current = constFindEntry(url);
+    if (current != entries().constEnd()) {
+        entry = *current;
+    }
+
+    // Like KonqHistoryProviderPrivate::addVisit() will do, once our batches come back
+    auto addVisit = [&entry, &url](const KonqHistoryEntry &visit) {
+        if (visit.url != url) {
+            return;
+        }
+        if (entry.url.isEmpty()) {
+            entry.url = visit.url;
+            entry.firstVisited = visit.firstVisited;
+            entry.numberOfTimesVisited = 0;
+        }
+        mergeVisit(entry, visit);
+    };
+    for (const auto &batch : std::as_const(d->m_sentBatches)) {
+        for (const KonqHistoryEntry &visit : batch.second) {
+            addVisit(visit);
+        }
+    }
+    const auto pending = d->m_pendingIndex.constFind(url);
+    if (pending != d->m_pendingIndex.constEnd()) {
+        addVisit(d->m_pendingEntries.at(*pending));
+    }
+    return entry;
 }
 
 void KonqHistoryProvider::finishAddingEntry(const KonqHistoryEntry &entry, bool isSender)
 {
-    Q_UNUSED(entry); // this arg is used by konq's reimplementation
     if (isSender) {
         // we are the sender of the broadcast, so we save
-        d->saveHistory();
+        d->recordVisit(entry);
     }
 }
 
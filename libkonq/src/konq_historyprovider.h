@@ -48,6 +48,12 @@ public:
      */
     const KonqHistoryList &entries() const;
 
+    /**
+     * Finds the entry for @p url without traversing entries().
+     * @returns an iterator into entries(), or its end if @p url isn't in the history
+     */
+    KonqHistoryList::const_iterator constFindEntry(const QUrl &url) const;
+
     /**
      * @returns the current maximum number of history entries.
      */
@@ -106,6 +112,19 @@ public:
      */
     bool loadHistory();
 
+    /**
+     * Like loadHistory(), but only the most recent entries are loaded right
+     * away, the others are loaded in a background thread and added to
+     * entries() in batches, see entriesLoaded(). Call this instead of
+     * loadHistory(), exactly once.
+     */
+    bool loadHistoryInBackground();
+
+    /**
+     * @returns false while loadHistoryInBackground() is still loading entries
+     */
+    bool isFullyLoaded() const;
+
 Q_SIGNALS:
     /**
      * Emitted after a new entry was added
@@ -119,6 +138,23 @@ Q_SIGNALS:
      */
     void entryRemoved(const KonqHistoryEntry &entry);
 
+    /**
+     * Emitted after a batch of entries loaded in the background was added to
+     * the history. They are older than all the entries loaded before them.
+     * If an url was visited again meanwhile, its entry in entries() also
+     * counts the visits in @p entries.
+     *
+     * Also emitted with the entries which changed when the history was
+     * re-read from disk, after updates from another instance got lost.
+     * Those replace the entries of their urls, which were removed first.
+     */
+    void entriesLoaded(const QList<KonqHistoryEntry> &entries);
+
+    /**
+     * Emitted once all the entries loaded in the background were added
+     */
+    void fullyLoaded();
+
 protected: // only to be used by konqueror's KonqHistoryManager
 
     virtual void finishAddingEntry(const KonqHistoryEntry &entry, bool isSender);
@@ -126,12 +162,18 @@ protected: // only to be used by konqueror's KonqHistoryManager
 
     /**
      * a little optimization for KonqHistoryList::findEntry(),
-     * checking the dict of KParts::HistoryProvider before traversing the list.
+     * checking the dict of KParts::HistoryProvider before looking the url up.
      * Can't be used everywhere, because it always returns end() for "pending"
      * entries, as those are not added to the dict, currently.
      */
     KonqHistoryList::iterator findEntry(const QUrl &url);
-    KonqHistoryList::const_iterator constFindEntry(const QUrl &url) const;
+
+    /**
+     * @returns the entry for @p url as it will be once the visits passed to
+     * emitAddToHistory() so far are in entries(), or an entry with an empty
+     * url if there won't be any
+     */
+    KonqHistoryEntry upcomingEntry(const QUrl &url) const;
 
     /**
      * Notifies all running instances about a new HistoryEntry via D-Bus.
@@ -11,9 +11,11 @@
 #include "fsview.h"
 
 #include <QDir>
+#include <QSet>
 #include <QTimer>
 #include <QApplication>
 #include <QDebug>
+#include <QThread>
 
 #include <KLocalizedString>
 #include <kconfig.h>
@@ -23,6 +25,10 @@
 #include <kauthorized.h>
 #include <kurlauthorized.h>
 
+#include <algorithm>
+
+#include "scancache.h"
+#include "scanwatcher.h"
 #include "fsviewdebug.h"
 
 // FSView
@@ -40,6 +46,8 @@ FSView::FSView(Inode *base, QWidget *parent)
     setFieldType(5, i18n("Owner"));
     setFieldType(6, i18n("Group"));
     setFieldType(7, i18n("Mime Type"));
+    setFieldType(8, i18n("Apparent Size"));
+    setFieldType(9, i18n("Disk Usage"));
 
     // defaults
     setVisibleWidth(4, true);
@@ -98,6 +106,33 @@ FSView::FSView(Inode *base, QWidget *parent)
     }
 
     _sm.setListener(this);
+
+    // read directories in worker threads, the GUI thread only adds what they read
+    KConfigGroup gconfig(_config, "General");
+    if (gconfig.readEntry("SizeMode") == QLatin1String("DiskUsage")) {
+        _sm.setSizeMode(ScanManager::DiskUsage);
+    }
+    _sm.setOneFileSystem(gconfig.readEntry("OneFileSystem", false));
+
+    const int threads = gconfig.readEntry("ScanThreads", QThread::idealThreadCount());
+    _sm.setThreadCount(threads, this, [this]() {
+        doUpdate();
+    });
+
+    // the totals of directories from the last scan are shown while scanning them again
+    KConfigGroup scconfig(_config, "ScanCache");
+    if (scconfig.readEntry("Enabled", true)) {
+        auto cache = std::make_shared<ScanCache>(ScanCache::defaultFileName());
+        cache->setLimits(scconfig.readEntry("MaxSize", 64) * qint64(1024 * 1024),
+                         scconfig.readEntry("MaxAge", 30));
+        _sm.setCache(cache);
+    }
+
+    _watcher = new ScanWatcher(this);
+    _watcher->setBudget(gconfig.readEntry("MaxWatches", 8192));
+    connect(_watcher, &ScanWatcher::dirsChanged, this, &FSView::dirsChanged);
+    _watching = ScanWatcher::isSupported() && gconfig.readEntry("Watch", false);
+    _updatingDirs = false;
 }
 
 FSView::~FSView()
@@ -108,6 +143,20 @@ FSView::~FSView()
 void FSView::stop()
 {
     _sm.stopScan();
+
+    // read them with the next change
+    if (_updatingDirs) {
+        for (const QString &path : std::as_const(_updatedDirs)) {
+            _dirtyDirs.insert(path);
+        }
+        _updatedDirs.clear();
+        _updatingDirs = false;
+    }
+
+    // doUpdate() might be waiting for the scanning threads, which won't report anymore
+    if (_sm.threadCount() > 0) {
+        QTimer::singleShot(0, this, SLOT(doUpdate()));
+    }
 }
 
 void FSView::setPath(const QString &p)
@@ -121,6 +170,8 @@ void FSView::setPath(const QString &p)
 
     // stop any previous updating
     stop();
+    _watcher->unwatchAll();
+    _dirtyDirs.clear();
 
     QFileInfo fi(p);
     _path = fi.absoluteFilePath();
@@ -197,6 +248,19 @@ void FSView::requestUpdate(Inode *i)
         return;
     }
 
+    // the rescan covers the changes below
+    if (_updatingDirs) {
+        stop();
+    }
+    const QString path = i->path();
+    for (auto it = _dirtyDirs.begin(); it != _dirtyDirs.end();) {
+        if (*it == path || it->startsWith(path + QLatin1Char('/'))) {
+            it = _dirtyDirs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
     peer->clear();
     i->clear();
 
@@ -271,6 +335,18 @@ void FSView::scanFinished(ScanDir *d)
                               << _progressSize;
 }
 
+void FSView::cacheLoaded()
+{
+    Inode *b = (Inode *)base();
+    if (!b) {
+        return;
+    }
+
+    // the directories shown before had no estimation yet
+    b->reloadEstimations();
+    redraw();
+}
+
 void FSView::selected(TreeMapItem *i)
 {
     setPath(((Inode *)i)->path());
@@ -317,6 +393,17 @@ void FSView::contextMenu(TreeMapItem *i, const QPoint &p)
     addVisualizationItems(vpopup, 1301);
     popup.addMenu(vpopup);
 
+    QAction *actionDiskUsage = popup.addAction(i18n("Show Disk Usage"));
+    actionDiskUsage->setCheckable(true);
+    actionDiskUsage->setChecked(sizeMode() == ScanManager::DiskUsage);
+    QAction *actionOneFileSystem = popup.addAction(i18n("Stay on One File System"));
+    actionOneFileSystem->setCheckable(true);
+    actionOneFileSystem->setChecked(oneFileSystem());
+    QAction *actionWatch = popup.addAction(i18n("Update Automatically"));
+    actionWatch->setCheckable(true);
+    actionWatch->setChecked(isWatching());
+    actionWatch->setEnabled(ScanWatcher::isSupported());
+
     _allowRefresh = false;
     QAction *action = popup.exec(mapToGlobal(p));
     _allowRefresh = true;
@@ -339,6 +426,12 @@ void FSView::contextMenu(TreeMapItem *i, const QPoint &p)
         if (i) {
             requestUpdate(i);
         }
+    } else if (action == actionDiskUsage) {
+        setSizeMode(action->isChecked() ? ScanManager::DiskUsage : ScanManager::ApparentSize);
+    } else if (action == actionOneFileSystem) {
+        setOneFileSystem(action->isChecked());
+    } else if (action == actionWatch) {
+        setWatching(action->isChecked());
     }
 }
 
@@ -366,6 +459,31 @@ void FSView::setColorMode(FSView::ColorMode cm)
     redraw();
 }
 
+void FSView::setSizeMode(ScanManager::SizeMode mode)
+{
+    if (_sm.sizeMode() == mode) {
+        return;
+    }
+
+    // both sizes are known already
+    _sm.setSizeMode(mode);
+    resort();
+    redraw();
+}
+
+void FSView::setOneFileSystem(bool oneFileSystem)
+{
+    if (_sm.oneFileSystem() == oneFileSystem) {
+        return;
+    }
+
+    _sm.setOneFileSystem(oneFileSystem);
+    Inode *b = (Inode *)base();
+    if (b) {
+        requestUpdate(b);
+    }
+}
+
 bool FSView::setColorMode(const QString &mode)
 {
     if (mode == QLatin1String("None")) {
@@ -455,6 +573,10 @@ void FSView::saveFSOptions()
 
     KConfigGroup gconfig(_config, "General");
     gconfig.writeEntry("Path", _path);
+    gconfig.writeEntry("SizeMode", (sizeMode() == ScanManager::DiskUsage) ?
+                       QStringLiteral("DiskUsage") : QStringLiteral("ApparentSize"));
+    gconfig.writeEntry("OneFileSystem", oneFileSystem());
+    gconfig.writeEntry("Watch", isWatching());
 
     KConfigGroup cconfig(_config, "MetricCache");
     saveMetric(&cconfig);
@@ -503,6 +625,11 @@ void FSView::doRedraw()
 
 void FSView::doUpdate()
 {
+    // a late call, e.g. by the scanning threads after stop()
+    if (_progressPhase == 0 && !_updatingDirs) {
+        return;
+    }
+
     for (int i = 0; i < 5; i++) {
         switch (_progressPhase) {
         case 1:
@@ -573,9 +700,99 @@ void FSView::doUpdate()
     }
 
     if (_sm.scanRunning()) {
-        QTimer::singleShot(0, this, SLOT(doUpdate()));
+        // the scanning threads call us once they read more
+        if (_sm.threadCount() == 0 || _sm.hasResults()) {
+            QTimer::singleShot(0, this, SLOT(doUpdate()));
+        }
+    } else if (_progressPhase == 0) {
+        updateDirsFinished();
     } else {
+        _progressPhase = 0;
+        _sm.saveCache();
         emit completed(_dirsFinished);
+
+        if (_watching) {
+            _watcher->watch(_sm.top());
+            updateDirtyDirs();
+        }
+    }
+}
+
+void FSView::setWatching(bool watching)
+{
+    if (_watching == watching || !ScanWatcher::isSupported()) {
+        return;
+    }
+
+    _watching = watching;
+    if (!_watching) {
+        stop();
+        _watcher->unwatchAll();
+        _dirtyDirs.clear();
+    } else if (_progressPhase == 0) {
+        // otherwise once the scan is done
+        _watcher->watch(_sm.top());
+    }
+}
+
+void FSView::dirsChanged(const QStringList &paths)
+{
+    for (const QString &path : paths) {
+        _dirtyDirs.insert(path);
     }
+    updateDirtyDirs();
+}
+
+void FSView::updateDirtyDirs()
+{
+    // changes during a scan are read after it
+    if (_dirtyDirs.isEmpty() || _progressPhase != 0 || _updatingDirs) {
+        return;
+    }
+
+    // updating a directory moves its subdirectories in memory,
+    // so the ones below another changed directory have to wait
+    QStringList paths(_dirtyDirs.cbegin(), _dirtyDirs.cend());
+    std::sort(paths.begin(), paths.end());
+    QSet<QString> updated;
+    for (const QString &path : std::as_const(paths)) {
+        bool below = false;
+        for (int pos = path.lastIndexOf(QLatin1Char('/')); pos > 0 && !below;
+             pos = path.lastIndexOf(QLatin1Char('/'), pos - 1)) {
+            below = updated.contains(path.left(pos));
+        }
+        if (below || updated.contains(QStringLiteral("/"))) {
+            continue;
+        }
+
+        _dirtyDirs.remove(path);
+        ScanDir *dir = _sm.findDir(path);
+        // e.g. removed by now, or not scanned because of the one file system option
+        if (!dir || !dir->scanFinished()) {
+            continue;
+        }
+        _sm.updateDir(dir);
+        updated.insert(path);
+        _updatedDirs.append(path);
+    }
+
+    if (_updatedDirs.isEmpty()) {
+        return;
+    }
+    _updatingDirs = true;
+    QTimer::singleShot(0, this, SLOT(doUpdate()));
+}
+
+void FSView::updateDirsFinished()
+{
+    _updatingDirs = false;
+
+    // watch new subdirectories
+    for (const QString &path : std::as_const(_updatedDirs)) {
+        _watcher->watch(_sm.findDir(path));
+    }
+    _updatedDirs.clear();
+
+    updateDirtyDirs();
 }
 
@@ -13,6 +13,7 @@
 
 #include <QMap>
 #include <QFileInfo>
+#include <QSet>
 #include <QString>
 
 #include <kconfiggroup.h>
@@ -23,6 +24,7 @@
 
 class QMenu;
 class KConfig;
+class ScanWatcher;
 
 /* Cached Metric info config */
 class MetricEntry
@@ -85,11 +87,50 @@ public:
     bool setColorMode(const QString &);
     QString colorModeString() const;
 
+    /* sizes shown and used as area, see ScanManager::SizeMode */
+    void setSizeMode(ScanManager::SizeMode);
+    ScanManager::SizeMode sizeMode() const
+    {
+        return _sm.sizeMode();
+    }
+
+    /* don't scan other file systems than the one of path(); rescans */
+    void setOneFileSystem(bool);
+    bool oneFileSystem() const
+    {
+        return _sm.oneFileSystem();
+    }
+
+    /* Update directories changing after the scan, see ScanWatcher */
+    void setWatching(bool);
+    bool isWatching() const
+    {
+        return _watching;
+    }
+    /* whether directories reported by the watcher are read again */
+    bool isUpdatingDirs() const
+    {
+        return _updatingDirs;
+    }
+
     void requestUpdate(Inode *);
 
+    /* totals of directories from earlier scans, or nullptr */
+    ScanCache *scanCache()
+    {
+        return _sm.cache();
+    }
+
+    /* approximate bytes taken by the scanned tree */
+    qint64 memoryUsage()
+    {
+        return _sm.memoryUsage();
+    }
+
     /* Implementation of listener interface of ScanManager.
      * Used to calculate progress info */
     void scanFinished(ScanDir *) override;
+    void cacheLoaded() override;
 
     void stop();
 
@@ -110,6 +151,7 @@ public slots:
     void doUpdate();
     void doRedraw();
     void colorActivated(QAction *);
+    void dirsChanged(const QStringList &);
 
 signals:
     void started();
@@ -120,6 +162,9 @@ protected:
     void keyPressEvent(QKeyEvent *) override;
 
 private:
+    void updateDirtyDirs();
+    void updateDirsFinished();
+
     KConfig *_config;
     ScanManager _sm;
 
@@ -141,6 +186,12 @@ private:
 
     ColorMode _colorMode;
     int _colorID;
+
+    // watching for changes after the scan
+    ScanWatcher *_watcher;
+    bool _watching, _updatingDirs;
+    QSet<QString> _dirtyDirs;     // changed, to be read again
+    QStringList _updatedDirs;     // being read again
 };
 
 #endif // FSVIEW_H
@@ -27,6 +27,7 @@
 #include <KIO/Paste>
 #include <kmessagebox.h>
 #include <kactionmenu.h>
+#include <ktoggleaction.h>
 #include <kactioncollection.h>
 #include <kpropertiesdialog.h>
 #include <KMimeTypeEditor>
@@ -43,6 +44,7 @@
 #include <QApplication>
 #include <QMimeData>
 
+#include "scanwatcher.h"
 #include "fsviewdebug.h"
 
 K_PLUGIN_CLASS_WITH_JSON(FSViewPart, "fsview_part.json")
@@ -71,7 +73,8 @@ void FSJob::progressSlot(int percent, int dirs, const QString &cDir)
                                     "Read %1 folders, in %2",
                                     dirs, cDir));
     } else {
-        slotInfoMessage(this, i18np("1 folder", "%1 folders", dirs));
+        slotInfoMessage(this, i18np("1 folder, %2 in memory", "%1 folders, %2 in memory",
+                                    dirs, KIO::convertSize(_view->memoryUsage())));
     }
 }
 
@@ -89,7 +92,8 @@ FSViewPart::FSViewPart(QWidget *parentWidget,
                              "by using a tree map visualization.</p>"
                              "<p>Note that in this mode, automatic updating "
                              "when filesystem changes are made "
-                             "is intentionally <b>not</b> done.</p>"
+                             "is only done with 'Update Automatically' "
+                             "in the View menu.</p>"
                              "<p>For details on usage and options available, "
                              "see the online help under "
                              "menu 'Help/FSView Manual'.</p>"));
@@ -114,6 +118,32 @@ FSViewPart::FSViewPart(QWidget *parentWidget,
                                  actionCollection());
     actionCollection()->addAction(QStringLiteral("treemap_colordir"), _colorMenu);
 
+    _diskUsageAction = new KToggleAction(i18n("Show Disk Usage"), actionCollection());
+    _diskUsageAction->setToolTip(i18n("Show allocated sizes instead of file sizes"));
+    _diskUsageAction->setWhatsThis(i18n("Shows the space the files take on disk, like "
+                                        "the 'du' command: whole blocks, without the holes "
+                                        "of sparse files, and files with several hard links "
+                                        "counted only once."));
+    _diskUsageAction->setChecked(_view->sizeMode() == ScanManager::DiskUsage);
+    actionCollection()->addAction(QStringLiteral("treemap_diskusage"), _diskUsageAction);
+    connect(_diskUsageAction, &QAction::toggled, this, &FSViewPart::slotDiskUsage);
+
+    _oneFileSystemAction = new KToggleAction(i18n("Stay on One File System"), actionCollection());
+    _oneFileSystemAction->setToolTip(i18n("Don't scan directories on other file systems"));
+    _oneFileSystemAction->setChecked(_view->oneFileSystem());
+    actionCollection()->addAction(QStringLiteral("treemap_onefilesystem"), _oneFileSystemAction);
+    connect(_oneFileSystemAction, &QAction::toggled, this, &FSViewPart::slotOneFileSystem);
+
+    _watchAction = new KToggleAction(i18n("Update Automatically"), actionCollection());
+    _watchAction->setToolTip(i18n("Show changes of files and directories after the scan"));
+    _watchAction->setWhatsThis(i18n("Watches the scanned directories, and reads the ones "
+                                    "which change again. Only the directories nearest to "
+                                    "the top are watched in very large trees."));
+    _watchAction->setChecked(_view->isWatching());
+    _watchAction->setEnabled(ScanWatcher::isSupported());
+    actionCollection()->addAction(QStringLiteral("treemap_watch"), _watchAction);
+    connect(_watchAction, &QAction::toggled, this, &FSViewPart::slotWatch);
+
     QAction *action;
     action = actionCollection()->addAction(QStringLiteral("help_fsview"));
     action->setText(i18n("&FSView Manual"));
@@ -200,9 +230,10 @@ QString FSViewPart::componentName() const
 void FSViewPart::showInfo()
 {
     QString info;
-    info = i18n("FSView intentionally does not support automatic updates "
+    info = i18n("By default, FSView does not update automatically "
                 "when changes are made to files or directories, "
                 "currently visible in FSView, from the outside.\n"
+                "Enable 'View/Update Automatically' for this.\n"
                 "For details, see the 'Help/FSView Manual'.");
 
     KMessageBox::information(_view, info, QString(), QStringLiteral("ShowFSViewInfo"));
@@ -261,6 +292,21 @@ void FSViewPart::slotShowColorMenu()
     _view->addColorItems(_colorMenu->menu(), 1401);
 }
 
+void FSViewPart::slotDiskUsage(bool diskUsage)
+{
+    _view->setSizeMode(diskUsage ? ScanManager::DiskUsage : ScanManager::ApparentSize);
+}
+
+void FSViewPart::slotOneFileSystem(bool oneFileSystem)
+{
+    _view->setOneFileSystem(oneFileSystem);
+}
+
+void FSViewPart::slotWatch(bool watch)
+{
+    _view->setWatching(watch);
+}
+
 bool FSViewPart::openFile() // never called since openUrl is reimplemented
 {
     qCDebug(FSVIEWLOG) << localFilePath();
@@ -20,6 +20,7 @@
 #include "browserextension.h"
 
 class KActionMenu;
+class KToggleAction;
 
 class FSViewPart;
 
@@ -111,6 +112,9 @@ public slots:
     void slotShowDepthMenu();
     void slotShowColorMenu();
     void slotProperties();
+    void slotDiskUsage(bool);
+    void slotOneFileSystem(bool);
+    void slotWatch(bool);
 
 protected:
     /**
@@ -128,6 +132,7 @@ private:
     FSJob *_job;
     FSViewNavigationExtension *_ext;
     KActionMenu *_visMenu, *_areaMenu, *_depthMenu, *_colorMenu;
+    KToggleAction *_diskUsageAction, *_oneFileSystemAction, *_watchAction;
 };
 
 #endif // FSVIEW_PART_H
@@ -17,6 +17,7 @@
 
 #include "fsview.h"
 #include "fsviewdebug.h"
+#include "scancache.h"
 
 // Inode
 
@@ -101,13 +102,7 @@ void Inode::init(const QString &path)
 
     _info = QFileInfo(path);
 
-    if (!FSView::getDirMetric(path, _sizeEstimation,
-                              _fileCountEstimation,
-                              _dirCountEstimation)) {
-        _sizeEstimation = 0.0;
-        _fileCountEstimation = 0;
-        _dirCountEstimation = 0;
-    }
+    loadEstimation(path);
 
     _mimeSet = false;
     _mimePixmapSet = false;
@@ -128,6 +123,46 @@ void Inode::init(const QString &path)
     }
 }
 
+void Inode::loadEstimation(const QString &path)
+{
+    _sizeEstimation = 0.0;
+    _allocatedSizeEstimation = 0.0;
+    _fileCountEstimation = 0;
+    _dirCountEstimation = 0;
+
+    // the totals of the last scan, maybe in an earlier session
+    FSView *view = (FSView *)widget();
+    ScanCache *cache = view ? view->scanCache() : nullptr;
+    ScanCache::Metric metric;
+    if (_dirPeer && cache && cache->lookup(path, metric)) {
+        _sizeEstimation = metric.size;
+        _allocatedSizeEstimation = metric.allocatedSize;
+        _fileCountEstimation = metric.fileCount;
+        _dirCountEstimation = metric.dirCount;
+        return;
+    }
+
+    FSView::getDirMetric(path, _sizeEstimation,
+                         _fileCountEstimation, _dirCountEstimation);
+}
+
+void Inode::reloadEstimations()
+{
+    if (!_dirPeer || _dirPeer->scanFinished()) {
+        return;
+    }
+
+    loadEstimation(path());
+
+    TreeMapItemList *list = createdChildren();
+    if (list) {
+        for (TreeMapItem *i : std::as_const(*list)) {
+            ((Inode *)i)->reloadEstimations();
+        }
+        _resortNeeded = true;
+    }
+}
+
 /* ScanListener interface */
 void Inode::sizeChanged(ScanDir *d)
 {
@@ -144,8 +179,15 @@ void Inode::scanFinished(ScanDir *d)
 
     _resortNeeded = true;
 
+    /* a directory changed after the scan: only repaint around it */
+    FSView *view = (FSView *)widget();
+    if (view && view->isUpdatingDirs()) {
+        view->redraw(parent() ? parent() : this);
+    }
+
     /* no estimation any longer */
     _sizeEstimation = 0.0;
+    _allocatedSizeEstimation = 0.0;
     _fileCountEstimation = 0;
     _dirCountEstimation = 0;
 
@@ -160,9 +202,23 @@ void Inode::scanFinished(ScanDir *d)
         }
     }
 
+    // the cache is for apparent sizes, see size()
     FSView::setDirMetric(path(), d->size(), files, dirs);
 }
 
+void Inode::aboutToUpdate(ScanDir *d)
+{
+    if (0) qCDebug(FSVIEWLOG) << "Inode::aboutToUpdate [" << path() << "] in "
+                              << d->name();
+
+    // the children refer to the files and directories of d
+    clear();
+    _resortNeeded = false;
+    if (widget()) {
+        widget()->redraw(parent() ? parent() : this);
+    }
+}
+
 void Inode::destroyed(ScanDir *d)
 {
     if (_dirPeer == d) {
@@ -223,18 +279,43 @@ TreeMapItemList *Inode::children()
     return _children;
 }
 
+ScanManager::SizeMode Inode::sizeMode() const
+{
+    FSView *view = (FSView *)widget();
+    return view ? view->sizeMode() : ScanManager::ApparentSize;
+}
+
 double Inode::size() const
 {
+    const ScanManager::SizeMode mode = sizeMode();
+
     // sizes of files are always correct
     if (_filePeer) {
-        return _filePeer->size();
+        return _filePeer->size(mode);
     }
     if (!_dirPeer) {
         return 0;
     }
 
-    double size = _dirPeer->size();
-    return (_sizeEstimation > size) ? _sizeEstimation : size;
+    double size = _dirPeer->size(mode);
+    double estimation = (mode == ScanManager::DiskUsage) ? _allocatedSizeEstimation : _sizeEstimation;
+    return (estimation > size) ? estimation : size;
+}
+
+KIO::fileoffset_t Inode::apparentSize() const
+{
+    if (_filePeer) {
+        return _filePeer->size();
+    }
+    return _dirPeer ? _dirPeer->size() : 0;
+}
+
+KIO::fileoffset_t Inode::allocatedSize() const
+{
+    if (_filePeer) {
+        return _filePeer->allocatedSize();
+    }
+    return _dirPeer ? _dirPeer->allocatedSize() : 0;
 }
 
 double Inode::value() const
@@ -332,7 +413,8 @@ QString Inode::text(int i) const
                 name += QLatin1Char('/');
             }
         } else if (_filePeer) {
-            name = _filePeer->name();
+            // decoded once already, for the path
+            name = _info.fileName();
         }
 
         return name;
@@ -345,6 +427,19 @@ QString Inode::text(int i) const
         return text;
     }
 
+    if ((i == 8) || (i == 9)) {
+        /* unknown until the directory was read */
+        if (_dirPeer && !_dirPeer->scanStarted()) {
+            return QString();
+        }
+
+        QString text = KIO::convertSize(static_cast<KIO::filesize_t>((i == 8) ? apparentSize() : allocatedSize()));
+        if (_dirPeer && _dirPeer->scanRunning()) {
+            text += QChar::fromLatin1('+');
+        }
+        return text;
+    }
+
     if ((i == 2) || (i == 3)) {
         /* file/dir count makes no sense for files */
         if (_filePeer) {
@@ -40,10 +40,17 @@ public:
 
     void setPeer(ScanDir *);
 
+    /* Look up the estimated totals again, here and in the created
+     * children, for the directories which are still being scanned */
+    void reloadEstimations();
+
     TreeMapItemList *children() override;
 
     double value() const override;
+    // in the size mode of the view
     double size() const;
+    KIO::fileoffset_t apparentSize() const;
+    KIO::fileoffset_t allocatedSize() const;
     unsigned int fileCount() const;
     unsigned int dirCount() const;
     QString path() const;
@@ -71,17 +78,20 @@ public:
 
     void sizeChanged(ScanDir *) override;
     void scanFinished(ScanDir *) override;
+    void aboutToUpdate(ScanDir *) override;
     void destroyed(ScanDir *) override;
     void destroyed(ScanFile *) override;
 
 private:
     void setMetrics(double, unsigned int);
+    void loadEstimation(const QString &);
+    ScanManager::SizeMode sizeMode() const;
 
     QFileInfo _info;
     ScanDir *_dirPeer;
     ScanFile *_filePeer;
 
-    double _sizeEstimation;
+    double _sizeEstimation, _allocatedSizeEstimation;
     unsigned int _fileCountEstimation, _dirCountEstimation;
 
     bool _resortNeeded;
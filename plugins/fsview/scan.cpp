@@ -6,36 +6,178 @@
 
 #include "scan.h"
 
+#include <QAtomicInt>
 #include <QDir>
+#include <QMutex>
+#include <QObject>
+#include <QRunnable>
 #include <QStringList>
 #include <QSet>
+#include <QThreadPool>
+#include <QVarLengthArray>
 #include <qplatformdefs.h>
 
+#include <string.h>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include <kauthorized.h>
 #include <kurlauthorized.h>
 
 #include "inode.h"
+#include "scancache.h"
 #include "fsviewdebug.h"
 
+// ScanHandoff
+
+/* A directory read by a worker thread */
+struct ScanResult {
+    ScanDir *dir;
+    ScanDirContents contents;
+};
+
+/*
+ * Shared between a ScanManager and its worker threads: the worker
+ * threads append what they read, and scan() takes it from here.
+ */
+struct ScanHandoff {
+    QMutex mutex;
+    QList<ScanResult> results;
+    // whether resultsReady was called since scan() took all results
+    bool notified = false;
+    // whether the ScanCache was loaded since scan() told the listener
+    bool cacheLoaded = false;
+    // incremented by stopScan(), so that older results are dropped
+    QAtomicInt generation;
+
+    // outlives the worker threads, see ~ScanManager()
+    QObject *context = nullptr;
+    std::function<void()> resultsReady;
+};
+
+// Number of results scan() adds at most, so that the GUI stays responsive
+static const int s_resultsPerScan = 64;
+
 // ScanManager
 
 ScanManager::ScanManager()
 {
     _topDir = nullptr;
     _listener = nullptr;
+    _pool = nullptr;
+    _sizeMode = ApparentSize;
+    _oneFileSystem = false;
+    _topDevice = 0;
 }
 
 ScanManager::ScanManager(const QString &path)
 {
     _topDir = nullptr;
     _listener = nullptr;
+    _pool = nullptr;
+    _sizeMode = ApparentSize;
+    _oneFileSystem = false;
+    _topDevice = 0;
     setTop(path);
 }
 
 ScanManager::~ScanManager()
 {
     stopScan();
+    // waits for the worker threads
+    delete _pool;
     delete _topDir;
+    if (_cache) {
+        _cache->save();
+    }
+}
+
+void ScanManager::setThreadCount(int threadCount, QObject *context,
+                                 const std::function<void()> &resultsReady)
+{
+    stopScan();
+    delete _pool;
+    _pool = nullptr;
+    _handoff.reset();
+
+    if (threadCount <= 0) {
+        return;
+    }
+
+    _pool = new QThreadPool;
+    _pool->setMaxThreadCount(threadCount);
+    _handoff = std::make_shared<ScanHandoff>();
+    _handoff->context = context;
+    _handoff->resultsReady = resultsReady;
+}
+
+void ScanManager::setCache(const std::shared_ptr<ScanCache> &cache)
+{
+    stopScan();
+    _cache = cache;
+    loadCache();
+}
+
+void ScanManager::loadCache()
+{
+    if (!_cache || !_topDir) {
+        return;
+    }
+
+    const QString path = _topDir->path();
+    _cache->setScope(path);
+    if (!_pool) {
+        _cache->load(path);
+        return;
+    }
+
+    const std::shared_ptr<ScanHandoff> handoff = _handoff;
+    const std::shared_ptr<ScanCache> cache = _cache;
+    _pool->start([handoff, cache, path]() {
+        cache->load(path);
+
+        QMutexLocker locker(&handoff->mutex);
+        handoff->cacheLoaded = true;
+        // not counted as notified, as there may be no results for scan() to take
+        if (handoff->context && handoff->resultsReady) {
+            QMetaObject::invokeMethod(handoff->context, handoff->resultsReady, Qt::QueuedConnection);
+        }
+    });
+}
+
+void ScanManager::saveCache()
+{
+    if (!_cache) {
+        return;
+    }
+    if (!_pool) {
+        _cache->save();
+        return;
+    }
+
+    const std::shared_ptr<ScanCache> cache = _cache;
+    _pool->start([cache]() {
+        cache->save();
+    });
+}
+
+int ScanManager::threadCount() const
+{
+    return _pool ? _pool->maxThreadCount() : 0;
+}
+
+bool ScanManager::hasResults() const
+{
+    if (!_handoff) {
+        return false;
+    }
+    QMutexLocker locker(&_handoff->mutex);
+    return !_handoff->results.isEmpty();
 }
 
 void ScanManager::setListener(ScanListener *l)
@@ -50,17 +192,54 @@ ScanDir *ScanManager::setTop(const QString &path, int data)
         delete _topDir;
         _topDir = nullptr;
     }
+    _inodes.clear();
     if (!path.isEmpty()) {
         _topDir = new ScanDir(path, this, nullptr, data);
+        loadCache();
     }
     return _topDir;
 }
 
+bool ScanManager::acceptDevice(ScanDir *dir, quint64 device)
+{
+    if (dir == _topDir) {
+        _topDevice = device;
+        return true;
+    }
+    return !_oneFileSystem || device == _topDevice;
+}
+
+bool ScanManager::claimInode(const ScanInodeId &id)
+{
+    if (_inodes.contains(id)) {
+        return false;
+    }
+    _inodes.insert(id);
+    return true;
+}
+
+void ScanManager::releaseInode(const ScanInodeId &id)
+{
+    _inodes.remove(id);
+}
+
+qint64 ScanManager::memoryUsage()
+{
+    if (!_topDir) {
+        return 0;
+    }
+    return sizeof(ScanDir) + _topDir->memoryUsage() + _inodes.capacity() * sizeof(ScanInodeId);
+}
+
 bool ScanManager::scanRunning()
 {
     if (!_topDir) {
         return false;
     }
+    // the top directory only counts as started once it was read
+    if (!_running.isEmpty() || !_list.isEmpty()) {
+        return true;
+    }
 
     return _topDir->scanRunning();
 }
@@ -86,6 +265,47 @@ void ScanManager::startScan(ScanDir *from)
     _list.append(new ScanItem(from->path(), from));
 }
 
+void ScanManager::updateDir(ScanDir *dir)
+{
+    _list.append(new ScanItem(dir->path(), dir, true));
+}
+
+ScanDir *ScanManager::findDir(const QString &absPath)
+{
+    if (!_topDir) {
+        return nullptr;
+    }
+
+    QString prefix = _topDir->path();
+    if (absPath == prefix) {
+        return _topDir;
+    }
+    if (!prefix.endsWith(QLatin1Char('/'))) {
+        prefix += QLatin1Char('/');
+    }
+    if (!absPath.startsWith(prefix)) {
+        return nullptr;
+    }
+
+    ScanDir *dir = _topDir;
+    const auto names = QStringView(absPath).mid(prefix.length()).split(QLatin1Char('/'), Qt::SkipEmptyParts);
+    for (const QStringView &name : names) {
+        ScanDir *child = nullptr;
+        ScanDirVector::iterator it;
+        for (it = dir->dirs().begin(); it != dir->dirs().end(); ++it) {
+            if ((*it).name() == name) {
+                child = &(*it);
+                break;
+            }
+        }
+        if (!child) {
+            return nullptr;
+        }
+        dir = child;
+    }
+    return dir;
+}
+
 void ScanManager::stopScan()
 {
     if (!_topDir) {
@@ -95,15 +315,35 @@ void ScanManager::stopScan()
     if (0) qCDebug(FSVIEWLOG) << "ScanManager::stopScan, scanLength "
                               << _list.count();
 
+    if (_pool) {
+        // threads still reading drop what they read
+        _handoff->generation.ref();
+        _pool->clear();
+        QMutexLocker locker(&_handoff->mutex);
+        _handoff->results.clear();
+        _handoff->notified = false;
+    }
+
     while (!_list.isEmpty()) {
         ScanItem *si = _list.takeFirst();
         si->dir->finish();
         delete si;
     }
+
+    const ScanItemList running = _running.values();
+    _running.clear();
+    for (ScanItem *si : running) {
+        si->dir->finish();
+        delete si;
+    }
 }
 
 int ScanManager::scan(int data)
 {
+    if (_pool) {
+        return scanThreaded(data);
+    }
+
     if (_list.isEmpty()) {
         return false;
     }
@@ -115,18 +355,159 @@ int ScanManager::scan(int data)
     return newCount;
 }
 
+int ScanManager::scanThreaded(int data)
+{
+    // hand the directories to scan over to the worker threads
+    while (!_list.isEmpty()) {
+        ScanItem *si = _list.takeFirst();
+        if (!ScanDir::isScannable(si->absPath)) {
+            if (!si->update) {
+                si->dir->skipScan();
+            }
+            delete si;
+            continue;
+        }
+
+        _running.insert(si->dir, si);
+        const std::shared_ptr<ScanHandoff> handoff = _handoff;
+        const int generation = handoff->generation.loadRelaxed();
+        const QString absPath = si->absPath;
+        ScanDir *dir = si->dir;
+        _pool->start([handoff, generation, absPath, dir]() {
+            if (handoff->generation.loadRelaxed() != generation) {
+                return;
+            }
+            ScanResult result{dir, {}};
+            ScanDir::readDir(absPath, result.contents);
+
+            QMutexLocker locker(&handoff->mutex);
+            if (handoff->generation.loadRelaxed() != generation) {
+                return;
+            }
+            handoff->results.append(std::move(result));
+            if (!handoff->notified && handoff->context && handoff->resultsReady) {
+                handoff->notified = true;
+                QMetaObject::invokeMethod(handoff->context, handoff->resultsReady, Qt::QueuedConnection);
+            }
+        });
+    }
+
+    // add what they read to the tree
+    QList<ScanResult> results;
+    bool cacheLoaded;
+    {
+        QMutexLocker locker(&_handoff->mutex);
+        cacheLoaded = _handoff->cacheLoaded;
+        _handoff->cacheLoaded = false;
+        const qsizetype count = qMin<qsizetype>(_handoff->results.count(), s_resultsPerScan);
+        results = _handoff->results.mid(0, count);
+        _handoff->results.remove(0, count);
+        if (_handoff->results.isEmpty()) {
+            _handoff->notified = false;
+        }
+    }
+
+    if (cacheLoaded && _listener) {
+        _listener->cacheLoaded();
+    }
+
+    int newCount = 0;
+    for (ScanResult &result : results) {
+        ScanItem *si = _running.take(result.dir);
+        if (!si) {
+            continue;
+        }
+        if (si->update) {
+            newCount += si->dir->updateContents(si, result.contents, _list, data);
+        } else {
+            newCount += si->dir->setContents(si, result.contents, _list, data);
+        }
+        delete si;
+    }
+
+    return newCount;
+}
+
+// ScanNameArena
+
+ScanNameArena::ScanNameArena(int size)
+{
+    _free = nullptr;
+    _left = 0;
+    _blockSize = 256;
+    _used = 0;
+    _allocated = 0;
+
+    if (size > 0) {
+        _blocks.emplace_back(new char[size]);
+        _free = _blocks.back().get();
+        _left = size;
+        _allocated = size;
+    }
+}
+
+const char *ScanNameArena::add(const char *name, int length)
+{
+    if (length + 1 > _left) {
+        // blocks get larger for directories with many files
+        const int size = qMax(length + 1, _blockSize);
+        _blockSize = qMin(2 * _blockSize, 64 * 1024);
+        _blocks.emplace_back(new char[size]);
+        _free = _blocks.back().get();
+        _left = size;
+        _allocated += size;
+    }
+
+    char *copy = _free;
+    memcpy(copy, name, length);
+    copy[length] = 0;
+    _free += length + 1;
+    _left -= length + 1;
+    _used += length + 1;
+    return copy;
+}
+
+// ScanDirContents
+
+void ScanDirContents::appendFile(const char *name, int length, KIO::fileoffset_t size,
+                                 KIO::fileoffset_t allocated)
+{
+    if (!names) {
+        names = std::make_shared<ScanNameArena>();
+    }
+    files.append(ScanFile(names->add(name, length), size, allocated));
+}
+
+void ScanDirContents::squeeze()
+{
+    files.squeeze();
+    if (!names || names->isCompact()) {
+        return;
+    }
+
+    // nothing points to the names yet but the files
+    auto compact = std::make_shared<ScanNameArena>(int(names->usedSize()));
+    for (ScanFile &file : files) {
+        file._name = compact->add(file._name, qstrlen(file._name));
+    }
+    names = compact;
+}
+
 // ScanFile
 
 ScanFile::ScanFile()
 {
+    _name = "";
     _size = 0;
+    _allocatedSize = 0;
     _listener = nullptr;
 }
 
-ScanFile::ScanFile(const QString &n, KIO::fileoffset_t s)
+ScanFile::ScanFile(const char *name, KIO::fileoffset_t s, KIO::fileoffset_t allocated)
 {
-    _name = n;
+    _name = name;
     _size = s;
+    _allocatedSize = allocated;
     _listener = nullptr;
 }
 
@@ -142,7 +523,11 @@ ScanFile::~ScanFile()
 ScanDir::ScanDir()
 {
     _dirty = true;
+    _stopped = false;
     _dirsFinished = -1; /* scan not started */
+    _fileSize = 0;
+    _allocatedFileSize = 0;
+    _readable = false;
 
     _parent = nullptr;
     _manager = nullptr;
@@ -155,7 +540,11 @@ ScanDir::ScanDir(const QString &n, ScanManager *m,
     : _name(n)
 {
     _dirty = true;
+    _stopped = false;
     _dirsFinished = -1; /* scan not started */
+    _fileSize = 0;
+    _allocatedFileSize = 0;
+    _readable = false;
 
     _parent = p;
     _manager = m;
@@ -177,24 +566,50 @@ void ScanDir::setListener(ScanListener *l)
 
 QString ScanDir::path()
 {
-    if (_parent) {
-        QString p = _parent->path();
-        if (!p.endsWith(QLatin1Char('/'))) {
+    // the names up to the top, to build the path in one allocation
+    QVarLengthArray<ScanDir *, 32> dirs;
+    qsizetype length = 0;
+    for (ScanDir *d = this; d; d = d->_parent) {
+        dirs.append(d);
+        length += d->_name.length() + 1;
+    }
+
+    QString p;
+    p.reserve(length);
+    for (qsizetype i = dirs.count() - 1; i >= 0; i--) {
+        if (i < dirs.count() - 1 && !p.endsWith(QLatin1Char('/'))) {
             p += QLatin1Char('/');
         }
-        return p + _name;
+        p += dirs[i]->_name;
     }
-
-    return _name;
+    return p;
 }
 
 void ScanDir::clear()
 {
     _dirty = true;
+    _stopped = false;
     _dirsFinished = -1; /* scan not started */
 
+    releaseInodes();
     _files.clear();
     _dirs.clear();
+    _names.reset();
+}
+
+void ScanDir::releaseInodes()
+{
+    if (_manager) {
+        for (const ScanInodeId &id : std::as_const(_inodes)) {
+            _manager->releaseInode(id);
+        }
+    }
+    _inodes.clear();
+
+    ScanDirVector::iterator it;
+    for (it = _dirs.begin(); it != _dirs.end(); ++it) {
+        (*it).releaseInodes();
+    }
 }
 
 void ScanDir::update()
@@ -207,11 +622,22 @@ void ScanDir::update()
     _fileCount = 0;
     _dirCount = 0;
     _size = 0;
+    _allocatedSize = 0;
+    _memoryUsage = 2 * _name.capacity();
 
     if (_dirsFinished == -1) {
         return;
     }
 
+    // files and subdirectories are stored in the vectors
+    _memoryUsage += _files.capacity() * sizeof(ScanFile) + _dirs.capacity() * sizeof(ScanDir) +
+                    _inodes.capacity() * sizeof(ScanInodeId);
+    if (_names) {
+        _memoryUsage += _names->memoryUsage();
+    }
+
+    // also counts the blocks of the directory itself
+    _allocatedSize = _allocatedFileSize;
     if (_files.count() > 0) {
         _fileCount += _files.count();
         _size = _fileSize;
@@ -224,11 +650,13 @@ void ScanDir::update()
             _fileCount += (*it)._fileCount;
             _dirCount  += (*it)._dirCount;
             _size      += (*it)._size;
+            _allocatedSize += (*it)._allocatedSize;
+            _memoryUsage += (*it)._memoryUsage;
         }
     }
 }
 
-bool ScanDir::isForbiddenDir(QString &d)
+bool ScanDir::isForbiddenDir(const QString &d)
 {
     static QSet<QString> *s = nullptr;
 
@@ -243,52 +671,217 @@ bool ScanDir::isForbiddenDir(QString &d)
     return (s->contains(d));
 }
 
-int ScanDir::scan(ScanItem *si, ScanItemList &list, int data)
+bool ScanDir::isScannable(const QString &absPath)
+{
+    if (isForbiddenDir(absPath)) {
+        return false;
+    }
+
+    QUrl u = QUrl::fromLocalFile(absPath);
+    return KUrlAuthorized::authorizeUrlAction(QStringLiteral("list"), QUrl(), u);
+}
+
+void ScanDir::skipScan()
 {
     clear();
     _dirsFinished = 0;
     _fileSize = 0;
-    _dirty = true;
+    _allocatedFileSize = 0;
 
-    if (isForbiddenDir(si->absPath)) {
-        if (_parent) {
-            _parent->subScanFinished();
-        }
-        return 0;
+    if (_parent) {
+        _parent->subScanFinished();
     }
+}
 
-    QUrl u = QUrl::fromLocalFile(si->absPath);
-    if (!KUrlAuthorized::authorizeUrlAction(QStringLiteral("list"), QUrl(), u)) {
-        if (_parent) {
-            _parent->subScanFinished();
-        }
+// st_blocks is in units of 512 bytes, whatever the block size of the file system
+template<typename Stat>
+static KIO::fileoffset_t allocatedSize(const Stat &buff)
+{
+#ifdef Q_OS_WIN
+    return buff.st_size;
+#else
+    return KIO::fileoffset_t(buff.st_blocks) * 512;
+#endif
+}
 
-        return 0;
+template<typename Stat>
+static void addFile(ScanDirContents &contents, const char *name, int length, const Stat &buff)
+{
+    const KIO::fileoffset_t allocated = allocatedSize(buff);
+#ifndef Q_OS_WIN
+    if (buff.st_nlink > 1) {
+        contents.links.append(qMakePair(int(contents.files.count()),
+                                        ScanInodeId(buff.st_dev, buff.st_ino)));
     }
+#endif
+    contents.appendFile(name, length, buff.st_size, allocated);
+    contents.fileSize += buff.st_size;
+    contents.allocatedSize += allocated;
+}
 
-    QDir d(si->absPath);
+void ScanDir::readDir(const QString &absPath, ScanDirContents &contents)
+{
+#ifdef Q_OS_LINUX
+    readDirLinux(absPath, contents);
+#else
+    readDirGeneric(absPath, contents);
+#endif
+    contents.squeeze();
+}
+
+void ScanDir::readDirGeneric(const QString &absPath, ScanDirContents &contents)
+{
+    QT_STATBUF dirBuff;
+    if (QT_STAT(QFile::encodeName(absPath).constData(), &dirBuff) == 0) {
+        contents.device = dirBuff.st_dev;
+        contents.allocatedSize = allocatedSize(dirBuff);
+    }
+
+    QDir d(absPath);
+    contents.readable = d.isReadable();
     const QStringList fileList = d.entryList(QDir::Files |
                                  QDir::Hidden | QDir::NoSymLinks);
 
     if (fileList.count() > 0) {
         QT_STATBUF buff;
 
-        _files.reserve(fileList.count());
+        contents.files.reserve(fileList.count());
 
         QStringList::ConstIterator it;
         for (it = fileList.constBegin(); it != fileList.constEnd(); ++it) {
-            QString tmp(si->absPath + QLatin1Char('/') + (*it));
+            QString tmp(absPath + QLatin1Char('/') + (*it));
             if (QT_LSTAT(tmp.toStdString().c_str(), &buff) != 0) {
                 continue;
             }
-            _files.append(ScanFile(*it, buff.st_size));
-            _fileSize += buff.st_size;
+            const QByteArray name = QFile::encodeName(*it);
+            addFile(contents, name.constData(), name.length(), buff);
+        }
+    }
+
+    contents.dirs = d.entryList(QDir::Dirs |
+                                QDir::Hidden | QDir::NoSymLinks | QDir::NoDotAndDotDot);
+}
+
+#ifdef Q_OS_LINUX
+// The record returned by getdents64, which glibc only declares in recent versions
+struct LinuxDirent64 {
+    quint64 d_ino;
+    qint64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1]; // null terminated, as long as d_reclen allows
+};
+
+void ScanDir::readDirLinux(const QString &absPath, ScanDirContents &contents)
+{
+    const int fd = QT_OPEN(QFile::encodeName(absPath).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    contents.readable = true;
+
+    struct stat dirBuff;
+    if (fstat(fd, &dirBuff) == 0) {
+        contents.device = dirBuff.st_dev;
+        contents.allocatedSize = allocatedSize(dirBuff);
+    }
+
+    // large enough for some hundred entries per call
+    alignas(LinuxDirent64) char buffer[32 * 1024];
+    for (;;) {
+        const long read = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+        if (read <= 0) {
+            break;
+        }
+
+        for (long pos = 0; pos < read;) {
+            const auto *entry = reinterpret_cast<const LinuxDirent64 *>(buffer + pos);
+            pos += entry->d_reclen;
+
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+                continue;
+            }
+
+            unsigned char type = entry->d_type;
+            struct stat buff;
+            bool statDone = false;
+            if (type == DT_UNKNOWN) {
+                // some filesystems don't tell
+                if (fstatat(fd, name, &buff, AT_SYMLINK_NOFOLLOW) != 0) {
+                    continue;
+                }
+                statDone = true;
+                type = S_ISREG(buff.st_mode) ? DT_REG : S_ISDIR(buff.st_mode) ? DT_DIR : DT_UNKNOWN;
+            }
+
+            // like QDir::Files | QDir::Dirs | QDir::NoSymLinks: skip symlinks, sockets, devices...
+            if (type == DT_DIR) {
+                contents.dirs.append(QFile::decodeName(name));
+            } else if (type == DT_REG) {
+                if (!statDone && fstatat(fd, name, &buff, AT_SYMLINK_NOFOLLOW) != 0) {
+                    continue;
+                }
+                addFile(contents, name, qstrlen(name), buff);
+            }
+        }
+    }
+
+    QT_CLOSE(fd);
+}
+#endif
+
+int ScanDir::scan(ScanItem *si, ScanItemList &list, int data)
+{
+    if (!isScannable(si->absPath)) {
+        if (!si->update) {
+            skipScan();
         }
+        return 0;
+    }
+
+    ScanDirContents contents;
+    readDir(si->absPath, contents);
+    if (si->update) {
+        return updateContents(si, contents, list, data);
+    }
+    return setContents(si, contents, list, data);
+}
+
+void ScanDir::claimInodes(const QVector<QPair<int, ScanInodeId>> &links)
+{
+    // count the blocks of files with several hard links only once per scan
+    for (const auto &link : links) {
+        if (_manager && !_manager->claimInode(link.second)) {
+            // only written to here, as writing would copy a shared vector
+            _allocatedFileSize -= _files.at(link.first).allocatedSize();
+            _files[link.first].setAllocatedSize(0);
+        } else {
+            _inodes.append(link.second);
+        }
+    }
+}
+
+int ScanDir::setContents(ScanItem *si, ScanDirContents &contents, ScanItemList &list, int data)
+{
+    if (_manager && !_manager->acceptDevice(this, contents.device)) {
+        skipScan();
+        return 0;
     }
 
-    const QStringList dirList = d.entryList(QDir::Dirs |
-                                            QDir::Hidden | QDir::NoSymLinks | QDir::NoDotAndDotDot);
+    clear();
+    _dirsFinished = 0;
+    _dirty = true;
+
+    _files.swap(contents.files);
+    _names.swap(contents.names);
+    _fileSize = contents.fileSize;
+    _allocatedFileSize = contents.allocatedSize;
+    _readable = contents.readable;
+
+    claimInodes(contents.links);
 
+    const QStringList &dirList = contents.dirs;
     if (dirList.count() > 0) {
         _dirs.reserve(dirList.count());
 
@@ -309,6 +902,7 @@ int ScanDir::scan(ScanItem *si, ScanItemList &list, int data)
     callSizeChanged();
 
     if (_dirs.count() == 0) {
+        storeInCache();
         callScanFinished();
 
         if (_parent) {
@@ -319,6 +913,94 @@ int ScanDir::scan(ScanItem *si, ScanItemList &list, int data)
     return _dirs.count();
 }
 
+int ScanDir::updateContents(ScanItem *si, ScanDirContents &contents, ScanItemList &list, int data)
+{
+    callAboutToUpdate();
+
+    // files
+
+    if (_manager) {
+        for (const ScanInodeId &id : std::as_const(_inodes)) {
+            _manager->releaseInode(id);
+        }
+    }
+    _inodes.clear();
+
+    _files.swap(contents.files);
+    _names.swap(contents.names);
+    contents.files.clear();
+    _fileSize = contents.fileSize;
+    _allocatedFileSize = contents.allocatedSize;
+    _readable = contents.readable;
+    claimInodes(contents.links);
+
+    // subdirectories, keeping the ones which still exist
+
+    QHash<QString, int> oldDirs;
+    for (int i = 0; i < _dirs.count(); i++) {
+        oldDirs.insert(_dirs.at(i)._name, i);
+    }
+
+    ScanDirVector dirs;
+    dirs.reserve(contents.dirs.count());
+    QVector<int> newDirs;
+    for (const QString &name : std::as_const(contents.dirs)) {
+        const int i = oldDirs.value(name, -1);
+        if (i >= 0) {
+            dirs.append(_dirs.at(i));
+            oldDirs.remove(name);
+        } else {
+            dirs.append(ScanDir(name, _manager, this, data));
+            newDirs.append(dirs.count() - 1);
+        }
+    }
+    for (const int i : std::as_const(oldDirs)) {
+        _dirs[i].releaseInodes();
+    }
+
+    // the kept directories share their subdirectories with the old copies,
+    // which have to be gone before these are touched
+    _dirs.swap(dirs);
+    dirs.clear();
+
+    _dirsFinished = 0;
+    ScanDirVector::iterator it;
+    for (it = _dirs.begin(); it != _dirs.end(); ++it) {
+        ScanDirVector::iterator sub;
+        for (sub = (*it)._dirs.begin(); sub != (*it)._dirs.end(); ++sub) {
+            (*sub)._parent = &(*it);
+        }
+        if ((*it).scanFinished()) {
+            _dirsFinished++;
+        }
+    }
+
+    for (const int i : std::as_const(newDirs)) {
+        QString newpath = si->absPath;
+        if (!newpath.endsWith(QChar('/'))) {
+            newpath.append("/");
+        }
+        newpath.append(_dirs.at(i)._name);
+        list.append(new ScanItem(newpath, &_dirs[i]));
+    }
+
+    _dirty = true;
+    callSizeChanged();
+
+    if (scanFinished()) {
+        storeInCache();
+        callScanFinished();
+    } else {
+        // running again until the new subdirectories are scanned
+        callScanStarted();
+        if (_parent) {
+            _parent->setupChildRescan();
+        }
+    }
+
+    return newDirs.count();
+}
+
 void ScanDir::subScanFinished()
 {
     _dirsFinished++;
@@ -332,6 +1014,7 @@ void ScanDir::subScanFinished()
     }
 
     /* all subdirs read */
+    storeInCache();
     callScanFinished();
 
     if (_parent) {
@@ -342,6 +1025,8 @@ void ScanDir::subScanFinished()
 void ScanDir::finish()
 {
     if (scanRunning()) {
+        // the totals miss what wasn't read
+        _stopped = true;
         _dirsFinished = _dirs.count();
         callScanFinished();
     }
@@ -372,6 +1057,22 @@ void ScanDir::setupChildRescan()
     callScanStarted();
 }
 
+void ScanDir::storeInCache()
+{
+    ScanCache *cache = _manager ? _manager->cache() : nullptr;
+    // nor the totals of directories which couldn't be read
+    if (!cache || _stopped || !_readable) {
+        return;
+    }
+
+    ScanCache::Metric metric;
+    metric.size = size();
+    metric.allocatedSize = allocatedSize();
+    metric.fileCount = fileCount();
+    metric.dirCount = dirCount();
+    cache->insert(path(), metric);
+}
+
 void ScanDir::callScanStarted()
 {
     if (0) qCDebug(FSVIEWLOG) << "ScanDir:Started [" << path()
@@ -408,6 +1109,18 @@ void ScanDir::callSizeChanged()
     }
 }
 
+void ScanDir::callAboutToUpdate()
+{
+    ScanListener *mListener = _manager ? _manager->listener() : nullptr;
+
+    if (_listener) {
+        _listener->aboutToUpdate(this);
+    }
+    if (mListener) {
+        mListener->aboutToUpdate(this);
+    }
+}
+
 void ScanDir::callScanFinished()
 {
     if (0) qCDebug(FSVIEWLOG) << "ScanDir:Finished [" << path()
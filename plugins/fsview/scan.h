@@ -12,27 +12,45 @@
 #define KONQ_PLUGIN_SCAN_H
 
 #include <QFile>
+#include <QHash>
+#include <QPair>
+#include <QSet>
+#include <QStringList>
 #include <QVector>
 #include <kio/global.h>
 
+#include <functional>
+#include <memory>
+#include <vector>
+
+class QObject;
+class QThreadPool;
+class ScanCache;
 class ScanDir;
 class ScanFile;
+struct ScanHandoff;
 
 class ScanItem
 {
 public:
-    ScanItem(const QString &p, ScanDir *d)
+    ScanItem(const QString &p, ScanDir *d, bool u = false)
     {
         absPath = p;
         dir = d;
+        update = u;
     }
 
     QString absPath;
     ScanDir *dir;
+    // whether dir was scanned before, see ScanDir::updateContents()
+    bool update;
 };
 
 typedef QList<ScanItem *> ScanItemList;
 
+/* Device and inode number of a file */
+typedef QPair<quint64, quint64> ScanInodeId;
+
 /**
  * Listener for events from directory scanning.
  *
@@ -42,6 +60,13 @@ typedef QList<ScanItem *> ScanItemList;
  *
  * sizeChanged is called when a scan of a subdirectory
  * finished.
+ *
+ * aboutToUpdate is called before the files and subdirectories
+ * of a scanned directory are replaced by ScanManager::updateDir().
+ * Pointers to them, and to any directory below, become invalid.
+ *
+ * cacheLoaded is called once the ScanCache has the totals of the
+ * directories below the top directory from former sessions.
  */
 class ScanListener
 {
@@ -50,6 +75,8 @@ public:
     virtual void scanStarted(ScanDir *) {}
     virtual void sizeChanged(ScanDir *) {}
     virtual void scanFinished(ScanDir *) {}
+    virtual void aboutToUpdate(ScanDir *) {}
+    virtual void cacheLoaded() {}
     // destroyed events are not delivered to listeners of ScanManager
     virtual void destroyed(ScanDir *) {}
     virtual void destroyed(ScanFile *) {}
@@ -63,10 +90,24 @@ public:
  *   ScanManager m("/opt");
  *   m.startScan();
  *   while(m.scan());
+ *
+ * With setThreadCount(), directories are read by worker threads.
+ * scan() then hands the directories to scan over to them, and adds what
+ * they read to the ScanDir tree. The tree and all listener callbacks
+ * stay in the thread calling scan().
  */
 class ScanManager
 {
 public:
+    /**
+     * What sizes of files and directories count.
+     * Both are read during a scan, so switching doesn't need a rescan.
+     */
+    enum SizeMode {
+        ApparentSize, // the sizes of the files, like "du --apparent-size"
+        DiskUsage     // the allocated blocks, counting hard links once, like "du"
+    };
+
     ScanManager();
     ScanManager(const QString &path);
     ~ScanManager();
@@ -83,7 +124,7 @@ public:
     bool scanRunning();
     int scanLength() const
     {
-        return _list.count();
+        return _list.count() + _running.count();
     }
 
     /**
@@ -96,6 +137,20 @@ public:
      */
     void startScan(ScanDir *from = nullptr);
 
+    /**
+     * Read the scanned directory dir again, keeping what was read
+     * below its subdirectories which still exist, and scan new ones.
+     * Like startScan(), it happens in scan(), but doesn't stop a
+     * running scan.
+     *
+     * dir must not be below a directory with a pending update,
+     * as the update of that one moves dir in memory.
+     */
+    void updateDir(ScanDir *dir);
+
+    /* The scanned directory at absPath, or nullptr */
+    ScanDir *findDir(const QString &absPath);
+
     /** Stop a current running scan.
      * Make all directories to finish their scan.
      */
@@ -108,6 +163,18 @@ public:
      */
     int scan(int data);
 
+    /**
+     * Read directories in @p threadCount worker threads, 0 to read them in scan().
+     * @p resultsReady is called in the thread of @p context whenever the
+     * threads read directories while there were none waiting for scan().
+     */
+    void setThreadCount(int threadCount, QObject *context = nullptr,
+                        const std::function<void()> &resultsReady = {});
+    int threadCount() const;
+
+    /* Whether worker threads read directories which scan() didn't add yet */
+    bool hasResults() const;
+
     /* set listener to get a callbacks from this ScanDir */
     void setListener(ScanListener *);
     ScanListener *listener()
@@ -115,27 +182,141 @@ public:
         return _listener;
     }
 
+    void setSizeMode(SizeMode mode)
+    {
+        _sizeMode = mode;
+    }
+    SizeMode sizeMode() const
+    {
+        return _sizeMode;
+    }
+
+    /**
+     * Don't scan directories on other file systems than the top directory,
+     * like "du -x". Takes effect with the next scan.
+     */
+    void setOneFileSystem(bool oneFileSystem)
+    {
+        _oneFileSystem = oneFileSystem;
+    }
+    bool oneFileSystem() const
+    {
+        return _oneFileSystem;
+    }
+
+    /* Store the totals of scanned directories in cache, nullptr for none.
+     * The entries below the top directory are loaded in a worker thread
+     * if there are any, see ScanListener::cacheLoaded(). */
+    void setCache(const std::shared_ptr<ScanCache> &cache);
+    ScanCache *cache() const
+    {
+        return _cache.get();
+    }
+    /* Write the cache file; in a worker thread if there are any */
+    void saveCache();
+
+    /* Whether the contents of dir, on the given device, are to be added.
+     * Remembers the device of the top directory. */
+    bool acceptDevice(ScanDir *dir, quint64 device);
+
+    /* Returns false if the inode was claimed in this scan before,
+     * i.e. it is another hard link to a file already counted */
+    bool claimInode(const ScanInodeId &id);
+    void releaseInode(const ScanInodeId &id);
+
+    /* Approximate bytes taken by the scanned tree */
+    qint64 memoryUsage();
+
 private:
+    int scanThreaded(int data);
+    void loadCache();
+
     ScanItemList _list;
     ScanDir *_topDir;
     ScanListener *_listener;
+
+    // Reading directories in worker threads
+    QThreadPool *_pool;
+    std::shared_ptr<ScanHandoff> _handoff;
+    QHash<ScanDir *, ScanItem *> _running; // directories being read
+    std::shared_ptr<ScanCache> _cache;
+
+    SizeMode _sizeMode;
+    bool _oneFileSystem;
+    quint64 _topDevice;
+    QSet<ScanInodeId> _inodes; // of the files with several hard links
+};
+
+/**
+ * Storage for the names of the files of a directory, in the 8-bit
+ * encoding of file names and null terminated. Names are copied into
+ * few blocks instead of one allocation each, and keep their address,
+ * so a ScanFile just points to its name.
+ */
+class ScanNameArena
+{
+public:
+    explicit ScanNameArena(int size = 0);
+
+    /* Copy of the length bytes at name */
+    const char *add(const char *name, int length);
+
+    /* Bytes of the names, and allocated */
+    qint64 usedSize() const
+    {
+        return _used;
+    }
+    qint64 memoryUsage() const
+    {
+        return _allocated;
+    }
+    /* Whether all names are in one block without space left */
+    bool isCompact() const
+    {
+        return _blocks.size() <= 1 && _left == 0;
+    }
+
+private:
+    std::vector<std::unique_ptr<char[]>> _blocks;
+    char *_free;
+    int _left, _blockSize;
+    qint64 _used, _allocated;
 };
 
 class ScanFile
 {
 public:
     ScanFile();
-    ScanFile(const QString &n, KIO::fileoffset_t s);
+    /* name is kept by a ScanNameArena */
+    ScanFile(const char *name, KIO::fileoffset_t s, KIO::fileoffset_t allocated);
     ~ScanFile();
 
-    const QString &name()
+    /* Decodes the name each time, keep it instead of calling this again */
+    QString name() const
+    {
+        return QFile::decodeName(_name);
+    }
+    const char *encodedName() const
     {
         return _name;
     }
-    KIO::fileoffset_t size()
+    KIO::fileoffset_t size() const
     {
         return _size;
     }
+    /* 0 for further hard links to a file counted before */
+    KIO::fileoffset_t allocatedSize() const
+    {
+        return _allocatedSize;
+    }
+    void setAllocatedSize(KIO::fileoffset_t s)
+    {
+        _allocatedSize = s;
+    }
+    KIO::fileoffset_t size(ScanManager::SizeMode mode)
+    {
+        return (mode == ScanManager::DiskUsage) ? _allocatedSize : _size;
+    }
 
     /* set listener to get callbacks from this ScanDir */
     void setListener(ScanListener *l)
@@ -148,14 +329,41 @@ public:
     }
 
 private:
-    QString _name;
-    KIO::fileoffset_t _size;
+    friend struct ScanDirContents;
+
+    const char *_name;
+    KIO::fileoffset_t _size, _allocatedSize;
     ScanListener *_listener;
 };
 
 typedef QVector<ScanFile> ScanFileVector;
 typedef QVector<ScanDir> ScanDirVector;
 
+/**
+ * The entries of a directory, as read by ScanDir::readDir()
+ */
+struct ScanDirContents {
+    /* Append a file, with a copy of the length bytes of name */
+    void appendFile(const char *name, int length, KIO::fileoffset_t size,
+                    KIO::fileoffset_t allocated);
+    /* Drop unused space once all files are appended */
+    void squeeze();
+
+    ScanFileVector files;
+    // of the files, handed over to the ScanDir
+    std::shared_ptr<ScanNameArena> names;
+    KIO::fileoffset_t fileSize = 0;
+    // of the files and the directory itself
+    KIO::fileoffset_t allocatedSize = 0;
+    QStringList dirs;
+    // the files with several hard links: index in files, and inode
+    QVector<QPair<int, ScanInodeId>> links;
+    // of the directory
+    quint64 device = 0;
+    // whether the directory could be read
+    bool readable = false;
+};
+
 /**
  * A directory to scan.
  * You can attribute a directory to scan with a
@@ -177,6 +385,34 @@ public:
      */
     int scan(ScanItem *si, ScanItemList &list, int data);
 
+    /* Like scan(), with the entries read before, maybe in another thread */
+    int setContents(ScanItem *si, ScanDirContents &contents, ScanItemList &list, int data);
+
+    /* Like setContents(), for a directory scanned before: subdirectories
+     * which still exist keep their contents, only new ones are appended
+     * to the todo list. Calls aboutToUpdate first. */
+    int updateContents(ScanItem *si, ScanDirContents &contents, ScanItemList &list, int data);
+
+    /* Read the entries of the directory at absPath.
+     * Doesn't touch any ScanDir, so it can be called in any thread. */
+    static void readDir(const QString &absPath, ScanDirContents &contents);
+
+    /* readDir() using QDir, which lists the directory twice and
+     * stats every file by its absolute path */
+    static void readDirGeneric(const QString &absPath, ScanDirContents &contents);
+
+#ifdef Q_OS_LINUX
+    /* readDir() listing the directory once with getdents64, and only
+     * stat-ing regular files, relative to the directory */
+    static void readDirLinux(const QString &absPath, ScanDirContents &contents);
+#endif
+
+    /* Whether the directory at absPath is to be scanned at all */
+    static bool isScannable(const QString &absPath);
+
+    /* Mark the directory as scanned, without entries, because it is not scannable */
+    void skipScan();
+
     /* clear scan objects below */
     void clear();
 
@@ -185,7 +421,7 @@ public:
      */
     void setupChildRescan();
 
-    /* Absolute path. Warning: Slow, loops to top parent. */
+    /* Absolute path. Loops to top parent, use the path of ScanItem if possible. */
     QString path();
 
     /* get integer data attribute */
@@ -215,6 +451,15 @@ public:
         update();
         return _size;
     }
+    KIO::fileoffset_t allocatedSize()
+    {
+        update();
+        return _allocatedSize;
+    }
+    KIO::fileoffset_t size(ScanManager::SizeMode mode)
+    {
+        return (mode == ScanManager::DiskUsage) ? allocatedSize() : size();
+    }
     unsigned int fileCount()
     {
         update();
@@ -225,6 +470,13 @@ public:
         update();
         return _dirCount;
     }
+    /* Approximate bytes taken by the directories and files below,
+     * not counting this object itself */
+    qint64 memoryUsage()
+    {
+        update();
+        return _memoryUsage;
+    }
     ScanDir *parent()
     {
         return _parent;
@@ -258,20 +510,33 @@ public:
 
 private:
     void update();
-    bool isForbiddenDir(QString &);
+    static bool isForbiddenDir(const QString &);
+    /* give the inodes claimed here and below back to the manager */
+    void releaseInodes();
+    /* claim the inodes of files with several hard links */
+    void claimInodes(const QVector<QPair<int, ScanInodeId>> &links);
+    /* put the totals into the ScanCache, once all below was read */
+    void storeInCache();
 
     /* this propagates file count and size to upper dirs */
     void subScanFinished();
     void callScanStarted();
     void callSizeChanged();
     void callScanFinished();
+    void callAboutToUpdate();
 
     ScanFileVector _files;
     ScanDirVector _dirs;
+    std::shared_ptr<ScanNameArena> _names;
 
     QString _name;
     bool _dirty; /* needs a call to update() */
+    bool _stopped; /* finish() was called before all below was read */
+    bool _readable; /* see ScanDirContents */
     KIO::fileoffset_t _size, _fileSize;
+    KIO::fileoffset_t _allocatedSize, _allocatedFileSize;
+    QVector<ScanInodeId> _inodes; /* claimed by files of this directory */
+    qint64 _memoryUsage;
     unsigned int _fileCount, _dirCount;
     int _dirsFinished, _data;
     ScanDir *_parent;
@@ -0,0 +1,339 @@
+/*
+    This file is part of the KDE project.
+
+    SPDX-FileCopyrightText: 2026 Konqueror Developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include "scancache.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QVector>
+
+#include <algorithm>
+
+#include "fsviewdebug.h"
+
+static const quint32 s_magic = 0x46535643; // "FSVC"
+static const quint32 s_version = 4;
+
+// How long save() waits for another instance writing the file, in ms
+static const int s_lockTimeout = 2000;
+
+// Unchanged entries are written again after that many seconds, to keep them from expiring
+static const qint64 s_touchInterval = 24 * 3600;
+
+// Bytes of an entry in the file, besides its path
+static const qint64 s_entrySize = 4 + 8 + 2 * 8 + 2 * 4;
+
+static bool operator==(const ScanCache::Metric &m1, const ScanCache::Metric &m2)
+{
+    return m1.size == m2.size && m1.allocatedSize == m2.allocatedSize &&
+           m1.fileCount == m2.fileCount && m1.dirCount == m2.dirCount;
+}
+
+static void writeEntry(QDataStream &stream, const QString &absPath,
+                       const ScanCache::Metric &metric, qint64 lastUsed)
+{
+    stream << absPath << lastUsed
+           << qint64(metric.size) << qint64(metric.allocatedSize)
+           << quint32(metric.fileCount) << quint32(metric.dirCount);
+}
+
+static bool readEntry(QDataStream &stream, QString &absPath,
+                      ScanCache::Metric &metric, qint64 &lastUsed)
+{
+    qint64 size, allocatedSize;
+    quint32 fileCount, dirCount;
+    stream >> absPath >> lastUsed
+           >> size >> allocatedSize >> fileCount >> dirCount;
+    metric.size = size;
+    metric.allocatedSize = allocatedSize;
+    metric.fileCount = fileCount;
+    metric.dirCount = dirCount;
+    return stream.status() == QDataStream::Ok;
+}
+
+ScanCache::ScanCache(const QString &fileName)
+    : _fileName(fileName)
+{
+    _maxSize = 64 * 1024 * 1024;
+    _maxAge = 30;
+}
+
+ScanCache::~ScanCache()
+{
+}
+
+QString ScanCache::defaultFileName()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+           + QLatin1String("/fsview/scancache");
+}
+
+void ScanCache::setLimits(qint64 maxSize, int maxAge)
+{
+    QMutexLocker locker(&_mutex);
+    _maxSize = maxSize;
+    _maxAge = maxAge;
+}
+
+qint64 ScanCache::maxSize() const
+{
+    return _maxSize;
+}
+
+int ScanCache::maxAge() const
+{
+    return _maxAge;
+}
+
+bool ScanCache::isInScope(const QString &absPath, const QString &scope)
+{
+    if (scope.isEmpty() || absPath == scope) {
+        return true;
+    }
+    if (!absPath.startsWith(scope)) {
+        return false;
+    }
+    // "/" ends with the separator already
+    return scope.endsWith(QLatin1Char('/')) || absPath.at(scope.length()) == QLatin1Char('/');
+}
+
+void ScanCache::setScope(const QString &absPath)
+{
+    QMutexLocker locker(&_mutex);
+    _scope = absPath;
+    for (auto it = _entries.begin(); it != _entries.end();) {
+        if (isInScope(it.key(), _scope)) {
+            ++it;
+        } else {
+            it = _entries.erase(it);
+        }
+    }
+}
+
+bool ScanCache::readEntries(const QString &fileName, const QString &scope,
+                            qint64 oldest, QHash<QString, Entry> &entries)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_6_0);
+
+    quint32 magic, version;
+    stream >> magic >> version;
+    if (stream.status() != QDataStream::Ok || magic != s_magic || version != s_version) {
+        qCDebug(FSVIEWLOG) << "Ignoring scan cache" << fileName << "of version" << version;
+        return false;
+    }
+
+    // later entries replace earlier ones; an entry being appended ends the file
+    QString absPath;
+    Entry entry;
+    while (!stream.atEnd() && readEntry(stream, absPath, entry.metric, entry.lastUsed)) {
+        if (entry.lastUsed >= oldest && isInScope(absPath, scope)) {
+            entries.insert(absPath, entry);
+        } else {
+            entries.remove(absPath);
+        }
+    }
+    return true;
+}
+
+void ScanCache::load(const QString &absPath)
+{
+    qint64 oldest = 0;
+    {
+        QMutexLocker locker(&_mutex);
+        if (_maxAge > 0) {
+            oldest = QDateTime::currentSecsSinceEpoch() - qint64(_maxAge) * 24 * 3600;
+        }
+    }
+
+    // without the lock, lookups don't wait for reading the file
+    QHash<QString, Entry> entries;
+    readEntries(_fileName, absPath, oldest, entries);
+
+    QMutexLocker locker(&_mutex);
+    if (_scope != absPath) {
+        return;
+    }
+    // inserted meanwhile, so more recent
+    for (auto it = _entries.cbegin(); it != _entries.cend(); ++it) {
+        entries.insert(it.key(), it.value());
+    }
+    _entries.swap(entries);
+}
+
+bool ScanCache::lookup(const QString &absPath, Metric &metric)
+{
+    QMutexLocker locker(&_mutex);
+    auto it = _entries.constFind(absPath);
+    if (it == _entries.constEnd()) {
+        return false;
+    }
+    metric = it->metric;
+    return true;
+}
+
+void ScanCache::insert(const QString &absPath, const Metric &metric)
+{
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+
+    QMutexLocker locker(&_mutex);
+    auto it = _entries.constFind(absPath);
+    if (it != _entries.constEnd() && it->metric == metric && it->lastUsed > now - s_touchInterval) {
+        return;
+    }
+
+    const Entry entry{metric, now};
+    if (isInScope(absPath, _scope)) {
+        _entries.insert(absPath, entry);
+    }
+    _pending.insert(absPath, entry);
+}
+
+int ScanCache::count()
+{
+    QMutexLocker locker(&_mutex);
+    return _entries.count();
+}
+
+bool ScanCache::save()
+{
+    QHash<QString, Entry> pending;
+    qint64 maxSize;
+    {
+        QMutexLocker locker(&_mutex);
+        if (_pending.isEmpty()) {
+            return true;
+        }
+        pending.swap(_pending);
+        maxSize = _maxSize;
+    }
+
+    // try again with the next save(), unless inserted again meanwhile
+    auto restorePending = [this, &pending]() {
+        QMutexLocker locker(&_mutex);
+        for (auto it = pending.cbegin(); it != pending.cend(); ++it) {
+            if (!_pending.contains(it.key())) {
+                _pending.insert(it.key(), it.value());
+            }
+        }
+    };
+
+    QDir().mkpath(QFileInfo(_fileName).absolutePath());
+
+    // other instances append to the same file
+    QLockFile lock(_fileName + QLatin1String(".lock"));
+    if (!lock.tryLock(s_lockTimeout)) {
+        qCWarning(FSVIEWLOG) << "Can't lock scan cache" << _fileName;
+        restorePending();
+        return false;
+    }
+
+    QFile file(_fileName);
+    if (!file.open(QIODevice::ReadWrite)) {
+        qCWarning(FSVIEWLOG) << "Can't write scan cache" << _fileName << file.errorString();
+        restorePending();
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_6_0);
+
+    quint32 magic = 0, version = 0;
+    stream >> magic >> version;
+    if (magic != s_magic || version != s_version) {
+        // empty, or of an older version
+        file.resize(0);
+        file.seek(0);
+        stream.resetStatus();
+        stream << s_magic << s_version;
+        file.flush();
+    }
+    const qint64 oldSize = file.size();
+    file.seek(oldSize);
+
+    for (auto it = pending.cbegin(); it != pending.cend(); ++it) {
+        writeEntry(stream, it.key(), it->metric, it->lastUsed);
+    }
+
+    if (stream.status() != QDataStream::Ok || !file.flush()) {
+        qCWarning(FSVIEWLOG) << "Can't write scan cache" << _fileName << file.errorString();
+        // a partial entry would hide the ones appended after it
+        file.resize(oldSize);
+        restorePending();
+        return false;
+    }
+
+    const qint64 size = file.size();
+    file.close();
+    if (maxSize > 0 && size > maxSize) {
+        return compact();
+    }
+    return true;
+}
+
+bool ScanCache::compact()
+{
+    qint64 maxSize, oldest = 0;
+    {
+        QMutexLocker locker(&_mutex);
+        maxSize = _maxSize;
+        if (_maxAge > 0) {
+            oldest = QDateTime::currentSecsSinceEpoch() - qint64(_maxAge) * 24 * 3600;
+        }
+    }
+
+    QHash<QString, Entry> entries;
+    readEntries(_fileName, QString(), oldest, entries);
+
+    // keep the most recently used ones, leaving room to append to
+    QVector<QPair<qint64, QString>> byUse;
+    byUse.reserve(entries.count());
+    qint64 size = 0;
+    for (auto it = entries.cbegin(); it != entries.cend(); ++it) {
+        byUse.append(qMakePair(it->lastUsed, it.key()));
+        size += s_entrySize + it.key().size() * 2;
+    }
+    std::sort(byUse.begin(), byUse.end());
+    for (const auto &used : std::as_const(byUse)) {
+        if (size <= maxSize * 3 / 4) {
+            break;
+        }
+        size -= s_entrySize + used.second.size() * 2;
+        entries.remove(used.second);
+    }
+
+    QSaveFile file(_fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(FSVIEWLOG) << "Can't write scan cache" << _fileName << file.errorString();
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream << s_magic << s_version;
+    for (auto it = entries.cbegin(); it != entries.cend(); ++it) {
+        writeEntry(stream, it.key(), it->metric, it->lastUsed);
+    }
+
+    if (!file.commit()) {
+        qCWarning(FSVIEWLOG) << "Can't write scan cache" << _fileName << file.errorString();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,104 @@
+/*
+    This file is part of the KDE project.
+
+    SPDX-FileCopyrightText: 2026 Konqueror Developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+/*
+ * Persistent cache of the totals of scanned directories
+ */
+
+#ifndef FSVIEW_SCANCACHE_H
+#define FSVIEW_SCANCACHE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+#include <kio/global.h>
+
+/**
+ * The totals of directories scanned before, stored in a file across
+ * sessions and keyed by absolute path. They are shown until the scan,
+ * which reads the directories again, has the current ones.
+ *
+ * They are not used to skip reading directories which didn't change:
+ * the modification and status change times of a directory only change
+ * with its own entries, not when one of its files grows or shrinks, nor
+ * with anything further below. Telling that the totals are still right
+ * would need the sizes of all the files, which is the scan itself.
+ *
+ * Only the entries at and below the directory given to load() are kept
+ * in memory. New entries are appended to the file by save(), under a
+ * lock file, so that several FSView instances can share it. Once the
+ * file is larger than maxSize(), it is rewritten without duplicates,
+ * entries not used for maxAge() days and the least recently used ones.
+ *
+ * All methods can be called from any thread.
+ */
+class ScanCache
+{
+public:
+    /* The totals of a directory and everything below, as of its last scan */
+    struct Metric {
+        KIO::fileoffset_t size = 0;
+        KIO::fileoffset_t allocatedSize = 0;
+        unsigned int fileCount = 0;
+        unsigned int dirCount = 0;
+    };
+
+    explicit ScanCache(const QString &fileName);
+    ~ScanCache();
+
+    /* The default file, below the cache directory of the user */
+    static QString defaultFileName();
+
+    /* Limits, applied when saving. maxSize is in bytes of the file. */
+    void setLimits(qint64 maxSize, int maxAge);
+    qint64 maxSize() const;
+    int maxAge() const;
+
+    /* Drop the entries in memory which are not at or below absPath */
+    void setScope(const QString &absPath);
+
+    /* Read the entries at and below absPath from the file, unless the
+     * scope changed meanwhile. Slow, call it in a worker thread. */
+    void load(const QString &absPath);
+
+    /* Returns false if the cache has no entry for absPath */
+    bool lookup(const QString &absPath, Metric &metric);
+
+    /* Remember the totals of a finished scan, for the next save() */
+    void insert(const QString &absPath, const Metric &metric);
+
+    /* entries in memory */
+    int count();
+
+    /* Append the entries inserted since the last save() to the file */
+    bool save();
+
+private:
+    struct Entry {
+        Metric metric;
+        qint64 lastUsed; // seconds since epoch
+    };
+
+    static bool isInScope(const QString &absPath, const QString &scope);
+    /* Read the entries in scope and not older than oldest from fileName */
+    static bool readEntries(const QString &fileName, const QString &scope,
+                            qint64 oldest, QHash<QString, Entry> &entries);
+    /* Rewrite the file, while locked, without duplicate, expired and least recently used entries */
+    bool compact();
+
+    QMutex _mutex;
+    QString _fileName;
+    QString _scope;
+    QHash<QString, Entry> _entries; // at and below _scope
+    QHash<QString, Entry> _pending; // not saved yet
+    qint64 _maxSize;
+    int _maxAge;
+};
+
+#endif // FSVIEW_SCANCACHE_H
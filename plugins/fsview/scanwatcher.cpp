@@ -0,0 +1,220 @@
+/*
+    This file is part of the KDE project.
+
+    SPDX-FileCopyrightText: 2026 Konqueror Developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include "scanwatcher.h"
+
+#include <QFile>
+#include <QQueue>
+#include <QSocketNotifier>
+#include <QTimer>
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "scan.h"
+#include "fsviewdebug.h"
+
+// Changes are collected that long, as e.g. writing a file gives lots of events
+static const int s_changeDelay = 1000;
+
+#ifdef Q_OS_LINUX
+static const uint32_t s_watchMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                    IN_MODIFY | IN_CLOSE_WRITE | IN_MOVE_SELF |
+                                    IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+#endif
+
+ScanWatcher::ScanWatcher(QObject *parent)
+    : QObject(parent)
+{
+    _fd = -1;
+    _notifier = nullptr;
+    _budget = 8192;
+
+    _timer = new QTimer(this);
+    _timer->setSingleShot(true);
+    _timer->setInterval(s_changeDelay);
+    connect(_timer, &QTimer::timeout, this, &ScanWatcher::emitChanged);
+
+#ifdef Q_OS_LINUX
+    _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_fd < 0) {
+        qCWarning(FSVIEWLOG) << "Can't watch directories:" << qt_error_string(errno);
+        return;
+    }
+    _notifier = new QSocketNotifier(_fd, QSocketNotifier::Read, this);
+    connect(_notifier, &QSocketNotifier::activated, this, &ScanWatcher::readEvents);
+#endif
+}
+
+ScanWatcher::~ScanWatcher()
+{
+#ifdef Q_OS_LINUX
+    if (_fd >= 0) {
+        // removes all watches
+        close(_fd);
+    }
+#endif
+}
+
+bool ScanWatcher::isSupported()
+{
+#ifdef Q_OS_LINUX
+    return true;
+#else
+    return false;
+#endif
+}
+
+void ScanWatcher::setBudget(int budget)
+{
+    _budget = budget;
+}
+
+void ScanWatcher::watch(ScanDir *dir)
+{
+    if (_fd < 0 || !dir) {
+        return;
+    }
+
+    QQueue<QPair<ScanDir *, QString>> queue;
+    queue.enqueue(qMakePair(dir, dir->path()));
+    while (!queue.isEmpty() && _watches.count() < _budget) {
+        const QPair<ScanDir *, QString> next = queue.dequeue();
+        if (!next.first->scanStarted()) {
+            continue;
+        }
+        if (!_watches.contains(next.second) && !addWatch(next.second)) {
+            // e.g. the limit of the system is reached
+            return;
+        }
+
+        QString prefix = next.second;
+        if (!prefix.endsWith(QLatin1Char('/'))) {
+            prefix += QLatin1Char('/');
+        }
+        ScanDirVector &dirs = next.first->dirs();
+        ScanDirVector::iterator it;
+        for (it = dirs.begin(); it != dirs.end(); ++it) {
+            queue.enqueue(qMakePair(&(*it), prefix + (*it).name()));
+        }
+    }
+}
+
+void ScanWatcher::unwatchAll()
+{
+#ifdef Q_OS_LINUX
+    for (auto it = _paths.constBegin(); it != _paths.constEnd(); ++it) {
+        inotify_rm_watch(_fd, it.key());
+    }
+#endif
+    _paths.clear();
+    _watches.clear();
+    _changed.clear();
+    _timer->stop();
+}
+
+bool ScanWatcher::addWatch(const QString &path)
+{
+#ifdef Q_OS_LINUX
+    const int wd = inotify_add_watch(_fd, QFile::encodeName(path).constData(), s_watchMask);
+    if (wd < 0) {
+        // the directory may be gone, which its parent reports
+        if (errno == ENOSPC) {
+            qCWarning(FSVIEWLOG) << "No more inotify watches, watching" << _watches.count() << "directories";
+            return false;
+        }
+        return true;
+    }
+    // watching the same directory by another path gives the same descriptor
+    if (_paths.contains(wd)) {
+        _watches.remove(_paths.value(wd));
+    }
+    _paths.insert(wd, path);
+    _watches.insert(path, wd);
+    return true;
+#else
+    Q_UNUSED(path)
+    return false;
+#endif
+}
+
+/* Removes the watches of path and of the directories below */
+void ScanWatcher::removeWatches(const QString &path)
+{
+    const QString prefix = path + QLatin1Char('/');
+    for (auto it = _watches.begin(); it != _watches.end();) {
+        if (it.key() == path || it.key().startsWith(prefix)) {
+#ifdef Q_OS_LINUX
+            inotify_rm_watch(_fd, it.value());
+#endif
+            _paths.remove(it.value());
+            it = _watches.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void ScanWatcher::readEvents()
+{
+#ifdef Q_OS_LINUX
+    alignas(struct inotify_event) char buffer[64 * 1024];
+    for (;;) {
+        const ssize_t read = ::read(_fd, buffer, sizeof(buffer));
+        if (read <= 0) {
+            break;
+        }
+
+        for (ssize_t pos = 0; pos < read;) {
+            const auto *event = reinterpret_cast<const struct inotify_event *>(buffer + pos);
+            pos += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // events were lost: everything might have changed
+                for (auto it = _watches.constBegin(); it != _watches.constEnd(); ++it) {
+                    _changed.insert(it.key());
+                }
+                continue;
+            }
+
+            const QString path = _paths.value(event->wd);
+            if (path.isEmpty()) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                // the directory was removed
+                _paths.remove(event->wd);
+                _watches.remove(path);
+                continue;
+            }
+            if (event->mask & IN_MOVE_SELF) {
+                // its old path is wrong now, and the new one is watched once scanned
+                removeWatches(path);
+                continue;
+            }
+
+            _changed.insert(path);
+        }
+    }
+
+    if (!_changed.isEmpty() && !_timer->isActive()) {
+        _timer->start();
+    }
+#endif
+}
+
+void ScanWatcher::emitChanged()
+{
+    QStringList paths(_changed.cbegin(), _changed.cend());
+    _changed.clear();
+    if (!paths.isEmpty()) {
+        emit dirsChanged(paths);
+    }
+}
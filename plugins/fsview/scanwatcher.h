@@ -0,0 +1,85 @@
+/*
+    This file is part of the KDE project.
+
+    SPDX-FileCopyrightText: 2026 Konqueror Developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+/*
+ * Watching scanned directories for changes
+ */
+
+#ifndef FSVIEW_SCANWATCHER_H
+#define FSVIEW_SCANWATCHER_H
+
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+
+class QSocketNotifier;
+class QTimer;
+class ScanDir;
+
+/**
+ * Watches scanned directories with inotify, and reports the ones
+ * whose entries or files changed.
+ *
+ * Every watched directory takes one of the inotify watches of the
+ * user, so at most budget() directories are watched: the ones nearest
+ * to the top, as changes deeper down would mostly show as tiny areas.
+ *
+ * Only supported on Linux. fanotify would need a single mark for a
+ * whole file system, but needs CAP_SYS_ADMIN for that.
+ */
+class ScanWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ScanWatcher(QObject *parent = nullptr);
+    ~ScanWatcher() override;
+
+    static bool isSupported();
+
+    /* Maximal number of watched directories */
+    void setBudget(int budget);
+    int budget() const
+    {
+        return _budget;
+    }
+    int count() const
+    {
+        return _watches.count();
+    }
+
+    /* Watch the scanned directory dir and the ones below, breadth-first,
+     * while the budget allows. Directories watched already are skipped. */
+    void watch(ScanDir *dir);
+
+    void unwatchAll();
+
+signals:
+    /* Directories with changes, collected for a moment */
+    void dirsChanged(const QStringList &paths);
+
+private slots:
+    void readEvents();
+    void emitChanged();
+
+private:
+    bool addWatch(const QString &path);
+    void removeWatches(const QString &path);
+
+    int _fd;
+    QSocketNotifier *_notifier;
+    QTimer *_timer;
+    int _budget;
+
+    QHash<int, QString> _paths; // by watch descriptor
+    QHash<QString, int> _watches;
+    QSet<QString> _changed;
+};
+
+#endif // FSVIEW_SCANWATCHER_H
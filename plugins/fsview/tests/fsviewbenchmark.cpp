@@ -0,0 +1,329 @@
+/*
+    This file is part of the KDE project.
+
+    SPDX-FileCopyrightText: 2026 Konqueror Developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include <QApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QObject>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QTest>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include "scan.h"
+#include "treemap.h"
+
+/**
+ * Benchmarks of FSView: scanning and updating synthetic directory
+ * trees, and laying out and painting a TreeMapWidget offscreen.
+ *
+ * The trees are generated in a temporary directory, the same for the
+ * same parameters, so results can be compared between runs. Scanning
+ * them a first time fills the caches of the file system, so the
+ * benchmarks measure FSView rather than the disk. The files are
+ * sparse, so that the trees take little space.
+ *
+ * Not run by ctest, as it takes minutes: run it by hand.
+ */
+class FSViewBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void benchmarkScan_data();
+    void benchmarkScan();
+    void benchmarkUpdate_data();
+    void benchmarkUpdate();
+    void benchmarkLayout_data();
+    void benchmarkLayout();
+    void benchmarkHitTest_data();
+    void benchmarkHitTest();
+};
+
+// Pixels of the offscreen treemap
+static const QSize s_viewSize(1280, 1024);
+
+// Waiting for a layout of 100k items in the layout thread
+static const int s_timeout = 60000;
+
+/* Creates depth levels of fanOut directories, each with files sparse files
+ * of varying size and links hard links to a file of the top directory */
+static void createTree(const QString &path, int depth, int fanOut, int files, int links,
+                       const QString &linkTarget = QString())
+{
+    QDir dir(path);
+    for (int i = 0; i < files; i++) {
+        QFile file(dir.filePath(QStringLiteral("file%1").arg(i)));
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QVERIFY(file.resize((i * 397) % 20000));
+    }
+
+    QString target = linkTarget;
+    if (target.isEmpty() && links > 0) {
+        target = dir.filePath(QStringLiteral("linked"));
+        QFile file(target);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        // with blocks, to see that they count once
+        file.write(QByteArray(100000, 'x'));
+    }
+#ifdef Q_OS_UNIX
+    for (int i = 0; i < links; i++) {
+        const QByteArray link = QFile::encodeName(dir.filePath(QStringLiteral("link%1").arg(i)));
+        QVERIFY(::link(QFile::encodeName(target).constData(), link.constData()) == 0);
+    }
+#endif
+
+    if (depth == 0) {
+        return;
+    }
+    for (int i = 0; i < fanOut; i++) {
+        const QString sub = QStringLiteral("dir%1").arg(i);
+        QVERIFY(dir.mkdir(sub));
+        createTree(dir.filePath(sub), depth - 1, fanOut, files, links, target);
+    }
+}
+
+static void scanAll(ScanManager &m)
+{
+    m.startScan();
+    // with threads, scan() returns before they read anything
+    while (m.scanRunning()) {
+        m.scan(1);
+    }
+}
+
+/* Peak resident set size of the process in kB, -1 if not known */
+static qint64 peakRss()
+{
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        return usage.ru_maxrss; // in kB on Linux
+    }
+#endif
+    return -1;
+}
+
+static void addTreeColumns()
+{
+    QTest::addColumn<int>("depth");
+    QTest::addColumn<int>("fanOut");
+    QTest::addColumn<int>("files");
+    QTest::addColumn<int>("links");
+}
+
+void FSViewBenchmark::benchmarkScan_data()
+{
+    addTreeColumns();
+    QTest::addColumn<int>("threads");
+    QTest::newRow("2k") << 3 << 5 << 12 << 0 << 0;
+    QTest::newRow("2k threads") << 3 << 5 << 12 << 0 << 4;
+    QTest::newRow("2k links") << 3 << 5 << 8 << 4 << 0;
+    QTest::newRow("80k") << 4 << 6 << 50 << 0 << 0;
+    QTest::newRow("80k threads") << 4 << 6 << 50 << 0 << 4;
+}
+
+void FSViewBenchmark::benchmarkScan()
+{
+    QFETCH(int, depth);
+    QFETCH(int, fanOut);
+    QFETCH(int, files);
+    QFETCH(int, links);
+    QFETCH(int, threads);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    createTree(dir.path(), depth, fanOut, files, links);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+
+    ScanManager m(dir.path());
+    m.setThreadCount(threads);
+    scanAll(m); // warm up the caches
+
+    qint64 entries = 0, ms = 0;
+    QBENCHMARK {
+        QElapsedTimer timer;
+        timer.start();
+        scanAll(m);
+        ms += timer.elapsed();
+        entries += m.top()->fileCount() + m.top()->dirCount();
+    }
+
+    if (links > 0) {
+        // the linked file only counts once
+        QVERIFY(m.top()->allocatedSize() < m.top()->size() / 2);
+    }
+    qInfo("%lld entries per second, peak RSS %lld kB", ms > 0 ? entries * 1000 / ms : entries * 1000, peakRss());
+}
+
+void FSViewBenchmark::benchmarkUpdate_data()
+{
+    addTreeColumns();
+    QTest::newRow("2k") << 3 << 5 << 12 << 0;
+    QTest::newRow("2k links") << 3 << 5 << 8 << 4;
+    QTest::newRow("80k") << 4 << 6 << 50 << 0;
+}
+
+void FSViewBenchmark::benchmarkUpdate()
+{
+    QFETCH(int, depth);
+    QFETCH(int, fanOut);
+    QFETCH(int, files);
+    QFETCH(int, links);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    createTree(dir.path(), depth, fanOut, files, links);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+
+    ScanManager m(dir.path());
+    scanAll(m);
+    const unsigned int fileCount = m.top()->fileCount();
+
+    // a new file in every directory of the second level,
+    // like the ScanWatcher would report them
+    QStringList changed;
+    for (int i = 0; i < fanOut; i++) {
+        for (int j = 0; j < fanOut; j++) {
+            const QString path = dir.filePath(QStringLiteral("dir%1/dir%2").arg(i).arg(j));
+            QFile file(path + QStringLiteral("/new"));
+            QVERIFY(file.open(QIODevice::WriteOnly));
+            changed.append(path);
+        }
+    }
+
+    QBENCHMARK_ONCE {
+        for (const QString &path : std::as_const(changed)) {
+            ScanDir *d = m.findDir(path);
+            QVERIFY(d);
+            m.updateDir(d);
+        }
+        while (m.scanRunning()) {
+            m.scan(1);
+        }
+    }
+    QCOMPARE(m.top()->fileCount(), fileCount + changed.count());
+}
+
+/* Items of depth levels with fanOut children each, of varying size */
+static double createItems(TreeMapItem *parent, int depth, int fanOut, int &count)
+{
+    double sum = 0;
+    for (int i = 0; i < fanOut; i++) {
+        count++;
+        auto *item = new TreeMapItem(parent, 0, QStringLiteral("Item %1").arg(count),
+                                     QString::number(count));
+        double value = 1 + (count * 7919) % 1000;
+        if (depth > 1) {
+            value = createItems(item, depth - 1, fanOut, count);
+        }
+        item->setValue(value);
+        sum += value;
+    }
+    parent->setSorting(-2, false);
+    return sum;
+}
+
+void FSViewBenchmark::benchmarkLayout_data()
+{
+    QTest::addColumn<int>("depth");
+    QTest::addColumn<int>("fanOut");
+    QTest::newRow("1k") << 3 << 10;
+    QTest::newRow("10k") << 4 << 10;
+    QTest::newRow("100k") << 5 << 10;
+}
+
+void FSViewBenchmark::benchmarkLayout()
+{
+    QFETCH(int, depth);
+    QFETCH(int, fanOut);
+
+    auto *base = new TreeMapItem(nullptr, 0, QStringLiteral("Base"));
+    int count = 0;
+    base->setValue(createItems(base, depth, fanOut, count));
+
+    TreeMapWidget widget(base);
+    widget.setFieldVisible(1, true);
+    widget.resize(s_viewSize);
+    QSignalSpy spy(&widget, &TreeMapWidget::laidOut);
+    widget.show();
+    QVERIFY(QTest::qWaitForWindowExposed(&widget));
+    QVERIFY(spy.wait(s_timeout));
+
+    qint64 layoutMs = 0, paintMs = 0;
+    QBENCHMARK {
+        QElapsedTimer timer;
+        timer.start();
+        // the next paint event starts the layout, in another thread if possible
+        widget.redraw();
+        QVERIFY(spy.wait(s_timeout));
+        layoutMs += timer.restart();
+        // all tiles are drawn again for a new layout
+        widget.repaint();
+        paintMs += timer.elapsed();
+    }
+    QVERIFY(base->itemRect().isValid());
+    qInfo("%d items: layout %lld ms, paint %lld ms in total", count, layoutMs, paintMs);
+}
+
+void FSViewBenchmark::benchmarkHitTest_data()
+{
+    benchmarkLayout_data();
+}
+
+void FSViewBenchmark::benchmarkHitTest()
+{
+    QFETCH(int, depth);
+    QFETCH(int, fanOut);
+
+    auto *base = new TreeMapItem(nullptr, 0, QStringLiteral("Base"));
+    int count = 0;
+    base->setValue(createItems(base, depth, fanOut, count));
+
+    TreeMapWidget widget(base);
+    widget.resize(s_viewSize);
+    QSignalSpy spy(&widget, &TreeMapWidget::laidOut);
+    widget.show();
+    QVERIFY(QTest::qWaitForWindowExposed(&widget));
+    QVERIFY(spy.wait(s_timeout));
+
+    // like moving the mouse over the whole widget
+    int found = 0;
+    QBENCHMARK {
+        for (int y = 0; y < s_viewSize.height(); y += 7) {
+            for (int x = 0; x < s_viewSize.width(); x += 7) {
+                if (widget.item(x, y) != base) {
+                    found++;
+                }
+            }
+        }
+    }
+    QVERIFY(found > 0);
+}
+
+int main(int argc, char *argv[])
+{
+    // no display needed
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app(argc, argv);
+    FSViewBenchmark benchmark;
+    return QTest::qExec(&benchmark, argc, argv);
+}
+
+#include "fsviewbenchmark.moc"
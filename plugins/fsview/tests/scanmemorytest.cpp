@@ -0,0 +1,104 @@
+/*
+    This file is part of the KDE project.
+
+    SPDX-FileCopyrightText: 2026 Konqueror Developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include <QDir>
+#include <QFile>
+#include <QObject>
+#include <QTemporaryDir>
+#include <QTest>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "scan.h"
+
+/**
+ * Checks the memory taken by a scanned tree per file or directory,
+ * as allocated from the heap, not as estimated by the scan.
+ */
+class ScanMemoryTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testBytesPerEntry();
+};
+
+// Bytes per scanned file or directory, names of usual length included
+static const qint64 s_bytesPerEntry = 64;
+
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 33)
+#define HAVE_MALLINFO2 1
+static qint64 allocatedBytes()
+{
+    const struct mallinfo2 info = mallinfo2();
+    // small chunks, and the large ones which get pages of their own
+    return qint64(info.uordblks) + qint64(info.hblkhd);
+}
+#endif
+#endif
+
+/* Creates depth levels of fanOut directories, each with some empty files */
+static void createTree(const QString &path, int depth, int fanOut, int files)
+{
+    QDir dir(path);
+    for (int i = 0; i < files; i++) {
+        QFile file(dir.filePath(QStringLiteral("file%1").arg(i)));
+        QVERIFY(file.open(QIODevice::WriteOnly));
+    }
+
+    if (depth == 0) {
+        return;
+    }
+    for (int i = 0; i < fanOut; i++) {
+        const QString sub = QStringLiteral("dir%1").arg(i);
+        QVERIFY(dir.mkdir(sub));
+        createTree(dir.filePath(sub), depth - 1, fanOut, files);
+    }
+}
+
+static void scanAll(ScanManager &m)
+{
+    m.startScan();
+    while (m.scanRunning()) {
+        m.scan(1);
+    }
+}
+
+void ScanMemoryTest::testBytesPerEntry()
+{
+#ifndef HAVE_MALLINFO2
+    QSKIP("Needs mallinfo2() of glibc");
+#else
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    createTree(dir.path(), 3, 6, 50);
+
+    // allocations made once, e.g. by KUrlAuthorized, don't count
+    {
+        ScanManager m(dir.path());
+        scanAll(m);
+    }
+
+    const qint64 before = allocatedBytes();
+    ScanManager m(dir.path());
+    scanAll(m);
+    const qint64 bytes = allocatedBytes() - before;
+
+    const qint64 entries = m.top()->fileCount() + m.top()->dirCount() + 1;
+    QCOMPARE(entries, qint64(259 * 50 + 259));
+    QVERIFY2(bytes <= s_bytesPerEntry * entries,
+             qPrintable(QStringLiteral("%1 bytes per entry").arg(bytes / entries)));
+#endif
+}
+
+QTEST_GUILESS_MAIN(ScanMemoryTest)
+
+#include "scanmemorytest.moc"
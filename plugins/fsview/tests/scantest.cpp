@@ -4,13 +4,32 @@
     SPDX-License-Identifier: GPL-2.0-only
 */
 
-/* Test Directory Scanning. Usually not build. */
+/* Test Directory Scanning. Usually not build.
+ *
+ * scantest [dir]            scans dir, printing the scan events
+ * scantest --compare [dir]  reads all the directories below dir (by default
+ *                           a generated tree) with the QDir based and the
+ *                           platform specific code, and compares entries and timing.
+ *                           Also checks that a scan cache written and loaded again
+ *                           has the totals of a scan
+ * scantest --update         scans a generated tree, changes it, updates the changed
+ *                           directories, and compares with a new scan
+ *
+ * The memory taken per entry is checked by scanmemorytest.
+ */
 
 #include <stdio.h>
 
 #include <QApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+
+#include <algorithm>
 
 #include "scan.h"
+#include "scancache.h"
 
 class MyListener: public ScanListener
 {
@@ -25,7 +44,8 @@ public:
         printf("Change in %s: Dirs %d, Files %d ",
                qPrintable(d->name()),
                d->dirCount(), d->fileCount());
-        printf("Size %llu\n", (unsigned long long int)d->size());
+        printf("Size %llu, Disk Usage %llu\n", (unsigned long long int)d->size(),
+               (unsigned long long int)d->allocatedSize());
     }
 
     void scanFinished(ScanDir *d) override
@@ -34,10 +54,224 @@ public:
     }
 };
 
+typedef void (*ReadDirFunction)(const QString &, ScanDirContents &);
+
+/* Creates depth levels of fanOut directories, each with some files */
+static void createTree(const QString &path, int depth, int fanOut, int files)
+{
+    QDir dir(path);
+    for (int i = 0; i < files; i++) {
+        QFile file(dir.filePath(QStringLiteral("file%1").arg(i)));
+        if (file.open(QIODevice::WriteOnly)) {
+            file.write(QByteArray(i * 100, 'x'));
+        }
+    }
+    QFile hidden(dir.filePath(QStringLiteral(".hidden")));
+    if (hidden.open(QIODevice::WriteOnly)) {
+        hidden.write("hidden");
+    }
+    // neither files nor directories for FSView
+    QFile::link(dir.filePath(QStringLiteral("file0")), dir.filePath(QStringLiteral("link")));
+
+    if (depth == 0) {
+        return;
+    }
+    for (int i = 0; i < fanOut; i++) {
+        const QString sub = QStringLiteral("dir%1").arg(i);
+        dir.mkdir(sub);
+        createTree(dir.filePath(sub), depth - 1, fanOut, files);
+    }
+    QFile::link(dir.filePath(QStringLiteral("dir0")), dir.filePath(QStringLiteral("dirlink")));
+}
+
+/* Reads all directories below path, returns their contents in one string per entry */
+static QStringList readTree(const QString &path, ReadDirFunction readDir, int &count)
+{
+    ScanDirContents contents;
+    readDir(path, contents);
+    count++;
+
+    QStringList entries;
+    for (ScanFile &file : contents.files) {
+        entries.append(QStringLiteral("%1/%2 %3 %4").arg(path, file.name())
+                       .arg(file.size()).arg(file.allocatedSize()));
+    }
+    for (const QString &dir : std::as_const(contents.dirs)) {
+        const QString subPath = path + QLatin1Char('/') + dir;
+        entries.append(subPath + QLatin1Char('/'));
+        entries += readTree(subPath, readDir, count);
+    }
+    return entries;
+}
+
+static QStringList timeReadTree(const char *name, const QString &path, ReadDirFunction readDir)
+{
+    int count = 0;
+    readTree(path, readDir, count); // warm up the caches
+    count = 0;
+    QElapsedTimer timer;
+    timer.start();
+    QStringList entries = readTree(path, readDir, count);
+    const qint64 ms = timer.elapsed();
+    printf("%-8s %d directories, %lld entries in %lld ms\n", name, count,
+           (long long)entries.count(), (long long)ms);
+    std::sort(entries.begin(), entries.end());
+    return entries;
+}
+
+static bool entriesDiffer(const char *name1, const QStringList &entries1,
+                          const char *name2, const QStringList &entries2)
+{
+    if (entries1 == entries2) {
+        return false;
+    }
+    printf("Entries differ!\n");
+    for (const QString &entry : entries1) {
+        if (!entries2.contains(entry)) {
+            printf("  only %-8s %s\n", name1, qPrintable(entry));
+        }
+    }
+    for (const QString &entry : entries2) {
+        if (!entries1.contains(entry)) {
+            printf("  only %-8s %s\n", name2, qPrintable(entry));
+        }
+    }
+    return true;
+}
+
+/* One string per directory of the scanned tree, with its totals */
+static QStringList scannedTree(ScanDir *dir)
+{
+    QStringList entries(QStringLiteral("%1 %2 %3 %4 %5").arg(dir->path())
+                        .arg(dir->size()).arg(dir->allocatedSize())
+                        .arg(dir->fileCount()).arg(dir->dirCount()));
+    ScanDirVector::iterator it;
+    for (it = dir->dirs().begin(); it != dir->dirs().end(); ++it) {
+        // would be wrong after moving the directories in memory
+        if ((*it).parent() != dir) {
+            entries.append(QStringLiteral("wrong parent: %1").arg((*it).name()));
+        }
+        entries += scannedTree(&(*it));
+    }
+    std::sort(entries.begin(), entries.end());
+    return entries;
+}
+
+/* Like scannedTree(), with the totals from cache */
+static QStringList cachedTree(ScanDir *dir, ScanCache &cache)
+{
+    const QString path = dir->path();
+    ScanCache::Metric metric;
+    QStringList entries(cache.lookup(path, metric)
+                        ? QStringLiteral("%1 %2 %3 %4 %5").arg(path)
+                          .arg(metric.size).arg(metric.allocatedSize)
+                          .arg(metric.fileCount).arg(metric.dirCount)
+                        : QStringLiteral("not cached: %1").arg(path));
+    ScanDirVector::iterator it;
+    for (it = dir->dirs().begin(); it != dir->dirs().end(); ++it) {
+        entries += cachedTree(&(*it), cache);
+    }
+    std::sort(entries.begin(), entries.end());
+    return entries;
+}
+
+static int compare(const QString &path)
+{
+    const QStringList generic = timeReadTree("QDir", path, ScanDir::readDirGeneric);
+    const QStringList native = timeReadTree("native", path, ScanDir::readDir);
+    if (entriesDiffer("QDir", generic, "native", native)) {
+        return 1;
+    }
+
+    printf("Entries match\n");
+
+    QTemporaryDir cacheDir;
+    const QString cacheFile = cacheDir.filePath(QStringLiteral("scancache"));
+    ScanManager m(path);
+    m.setCache(std::make_shared<ScanCache>(cacheFile));
+    m.startScan();
+    while (m.scanRunning()) {
+        m.scan(1);
+    }
+    m.saveCache();
+
+    ScanCache cache(cacheFile);
+    cache.setScope(path);
+    cache.load(path);
+    printf("%d directories in cache\n", cache.count());
+    if (entriesDiffer("scanned", scannedTree(m.top()), "cache", cachedTree(m.top(), cache))) {
+        return 1;
+    }
+
+    printf("Cached totals match\n");
+    return 0;
+}
+
+static int update()
+{
+    QTemporaryDir dir;
+    createTree(dir.path(), 2, 3, 10);
+
+    ScanManager m(dir.path());
+    m.startScan();
+    while (m.scanRunning()) {
+        m.scan(1);
+    }
+
+    // a new directory, a removed one, a new file, and a deep change
+    QDir top(dir.path());
+    top.mkdir(QStringLiteral("new"));
+    createTree(top.filePath(QStringLiteral("new")), 1, 2, 5);
+    QDir(top.filePath(QStringLiteral("dir1"))).removeRecursively();
+    QFile file(top.filePath(QStringLiteral("dir2/newfile")));
+    if (file.open(QIODevice::WriteOnly)) {
+        file.write(QByteArray(5000, 'x'));
+        file.close();
+    }
+    QFile::remove(top.filePath(QStringLiteral("dir0/dir0/file1")));
+
+    // parents first, like FSView does
+    m.updateDir(m.findDir(dir.path()));
+    while (m.scanRunning()) {
+        m.scan(1);
+    }
+    m.updateDir(m.findDir(top.filePath(QStringLiteral("dir2"))));
+    m.updateDir(m.findDir(top.filePath(QStringLiteral("dir0/dir0"))));
+    while (m.scanRunning()) {
+        m.scan(1);
+    }
+
+    ScanManager fresh(dir.path());
+    fresh.startScan();
+    while (fresh.scanRunning()) {
+        fresh.scan(1);
+    }
+
+    const QStringList updated = scannedTree(m.top());
+    const QStringList scanned = scannedTree(fresh.top());
+    if (entriesDiffer("updated", updated, "scanned", scanned)) {
+        return 1;
+    }
+    printf("Updated tree matches\n");
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     QApplication app(argc, argv);
 
+    if (argc > 1 && qstrcmp(argv[1], "--compare") == 0) {
+        if (argc > 2) {
+            return compare(QFile::decodeName(argv[2]));
+        }
+        QTemporaryDir dir;
+        createTree(dir.path(), 3, 6, 50);
+        return compare(dir.path());
+    }
+    if (argc > 1 && qstrcmp(argv[1], "--update") == 0) {
+        return update();
+    }
+
     ScanManager m(QStringLiteral("/opt"));
     if (argc > 1) {
         m.setTop(argv[1]);
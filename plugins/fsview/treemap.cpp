@@ -12,25 +12,35 @@
 #include "treemap.h"
 
 #include <math.h>
+#include <algorithm>
+#include <climits>
+#include <memory>
 
 #include <QApplication>
 #include <QDebug>
+#include <QFontDatabase>
 #include <QPainter>
 #include <QStyle>
 #include <QShowEvent>
 #include <QToolTip>
 #include <QStylePainter>
 #include <QStyleOptionFocusRect>
+#include <QThreadPool>
+#include <QTransform>
 
 #include <KLocalizedString>
 #include <kconfig.h>
 
 #include "fsviewdebug.h"
+#include "treemaplayout.h"
 
 // set this to 1 to enable debug output
 #define DEBUG_DRAWING 0
 #define MAX_FIELD 12
 
+// the widget is drawn in tiles of this size
+static const int s_tileSize = 256;
+
 //
 // StoredDrawParams
 //
@@ -639,10 +649,7 @@ bool RectDrawing::drawField(QPainter *p, int f, DrawParams *dp)
     }
 
     // stop as soon as possible when there is no space for "..."
-    static int dotW = 0;
-    if (!dotW) {
-        dotW = _fm->horizontalAdvance(QStringLiteral("..."));
-    }
+    static const int dotW = _fm->horizontalAdvance(QStringLiteral("..."));
     if (width < dotW) {
         return false;
     }
@@ -653,11 +660,18 @@ bool RectDrawing::drawField(QPainter *p, int f, DrawParams *dp)
     if (name.isEmpty()) {
         return 0;
     }
-    QPixmap pix = dp->pixmap(f);
+    QPixmap pix;
+    QSize pixSize;
+    if (p) {
+        pix = dp->pixmap(f);
+        pixSize = pix.size();
+    } else {
+        pixSize = dp->pixmapSize(f);
+    }
 
     // check if pixmap can be drawn
-    int pixW = pix.width();
-    int pixH = pix.height();
+    int pixW = pixSize.isValid() ? pixSize.width() : 0;
+    int pixH = pixSize.isValid() ? pixSize.height() : 0;
     int pixY = 0;
     bool pixDrawn = true;
     if (pixW > 0) {
@@ -694,15 +708,17 @@ bool RectDrawing::drawField(QPainter *p, int f, DrawParams *dp)
         }
     }
 
-    p->save();
-    p->setPen((qGray(dp->backColor().rgb()) > 100) ? Qt::black : Qt::white);
-    p->setFont(dp->font());
-    if (rotate) {
-        //p->translate(r.x()+2, r.y()+r.height());
-        p->translate(r.x(), r.y() + r.height() - 2);
-        p->rotate(270);
-    } else {
-        p->translate(r.x() + 2, r.y());
+    if (p) {
+        p->save();
+        p->setPen((qGray(dp->backColor().rgb()) > 100) ? Qt::black : Qt::white);
+        p->setFont(dp->font());
+        if (rotate) {
+            //p->translate(r.x()+2, r.y()+r.height());
+            p->translate(r.x(), r.y() + r.height() - 2);
+            p->rotate(270);
+        } else {
+            p->translate(r.x() + 2, r.y());
+        }
     }
 
     // adjust available lines according to maxLines
@@ -771,7 +787,9 @@ bool RectDrawing::drawField(QPainter *p, int f, DrawParams *dp)
                 pixY = isBottom ? y - (pixH - h) : y;
             }
 
-            p->drawPixmap(x, pixY, pix);
+            if (p) {
+                p->drawPixmap(x, pixY, pix);
+            }
 
             // for distance to next text
             pixY = isBottom ? (pixY - h - 2) : (pixY + pixH + 2);
@@ -781,9 +799,11 @@ bool RectDrawing::drawField(QPainter *p, int f, DrawParams *dp)
         if (0) qCDebug(FSVIEWLOG) << "  Drawing '" << name << "' at "
                                   << x + pixW << "/" << y;
 
-        p->drawText(x + pixW, y,
-                    width - pixW, h,
-                    Qt::AlignLeft, name);
+        if (p) {
+            p->drawText(x + pixW, y,
+                        width - pixW, h,
+                        Qt::AlignLeft, name);
+        }
         y = isBottom ? (y - h) : (y + h);
         lines--;
 
@@ -836,7 +856,9 @@ bool RectDrawing::drawField(QPainter *p, int f, DrawParams *dp)
         }
     }
 
-    p->restore();
+    if (p) {
+        p->restore();
+    }
 
     return true;
 }
@@ -898,6 +920,7 @@ TreeMapItem::TreeMapItem(TreeMapItem *parent, double value)
     _index = -1;
     _depth = -1; // not set
     _unused_self = 0;
+    _childCache = nullptr;
 
     if (_parent) {
         // take sorting from parent
@@ -934,6 +957,7 @@ TreeMapItem::TreeMapItem(TreeMapItem *parent, double value,
     _index = -1;
     _depth = -1; // not set
     _unused_self = 0;
+    _childCache = nullptr;
 
     if (_parent) {
         _parent->addItem(this);
@@ -947,6 +971,7 @@ TreeMapItem::~TreeMapItem()
         delete _children;
         _children = nullptr;
     }
+    delete _childCache;
 
     // finally, notify widget about deletion
     if (_widget) {
@@ -1005,6 +1030,7 @@ void TreeMapItem::clear()
         delete _children;
         _children = nullptr;
     }
+    invalidateChildCache();
 }
 
 // invalidates current children and forces redraw
@@ -1062,6 +1088,7 @@ void TreeMapItem::addItem(TreeMapItem *i)
     }
 
     i->setParent(this);
+    invalidateChildCache();
 
     _children->append(i); // preserve insertion order
     if (sorting(nullptr) != -1) {
@@ -1134,6 +1161,7 @@ void TreeMapItem::setSorting(int textNo, bool ascending)
     }
     _sortAscending = ascending;
     _sortTextNo = textNo;
+    invalidateChildCache();
 
     if (_children && _sortTextNo != -1) {
         std::sort(_children->begin(), _children->end(), treeMapItemLessThan);
@@ -1145,6 +1173,8 @@ void TreeMapItem::resort(bool recursive)
     if (!_children) {
         return;
     }
+    // values changed
+    invalidateChildCache();
 
     if (_sortTextNo != -1) {
         std::sort(_children->begin(), _children->end(), treeMapItemLessThan);
@@ -1179,6 +1209,117 @@ TreeMapItemList *TreeMapItem::children()
     return _children;
 }
 
+struct TreeMapItem::ChildCache {
+    double sum;
+    // sorted by value, the sums of the values of the first i children
+    bool byValue, ascending;
+    QVector<double> sums;
+    // children below limit; without sorting by value, limit is rounded
+    // down to its bucket, so that a resize doesn't rescan them
+    int bucket;
+    double limit;
+    int smallCount;
+    double smallValue;
+    bool rectsCleared;
+};
+
+// Buckets of the limit of smallChildren() per doubling
+static const int s_limitBuckets = 32;
+
+void TreeMapItem::invalidateChildCache()
+{
+    delete _childCache;
+    _childCache = nullptr;
+}
+
+double TreeMapItem::childSum()
+{
+    if (!_childCache) {
+        bool ascending;
+        const bool byValue = (sorting(&ascending) == -2);
+        _childCache = new ChildCache{0, byValue, ascending, {}, INT_MIN, -1, 0, 0, false};
+        if (_children) {
+            if (byValue) {
+                _childCache->sums.reserve(_children->count() + 1);
+                _childCache->sums.append(0);
+            }
+            for (TreeMapItem *i: std::as_const(*_children)) {
+                _childCache->sum += i->value();
+                if (byValue) {
+                    _childCache->sums.append(_childCache->sum);
+                }
+            }
+        }
+    }
+    return _childCache->sum;
+}
+
+int TreeMapItem::smallChildren(double *limit, double *value)
+{
+    childSum();
+    ChildCache *c = _childCache;
+
+    if (c->byValue && _children) {
+        // the small children are at one end
+        const int count = _children->count();
+        int smallCount;
+        if (c->ascending) {
+            smallCount = std::partition_point(_children->cbegin(), _children->cend(), [limit](TreeMapItem *i) {
+                return i->value() < *limit;
+            }) - _children->cbegin();
+            c->smallValue = c->sums[smallCount];
+        } else {
+            const int first = std::partition_point(_children->cbegin(), _children->cend(), [limit](TreeMapItem *i) {
+                return i->value() >= *limit;
+            }) - _children->cbegin();
+            smallCount = count - first;
+            c->smallValue = c->sums[count] - c->sums[first];
+        }
+        if (smallCount != c->smallCount) {
+            c->rectsCleared = false;
+        }
+        c->limit = *limit;
+        c->smallCount = smallCount;
+    } else {
+        const int bucket = int(floor(log2(*limit) * s_limitBuckets));
+        if (c->bucket != bucket) {
+            c->bucket = bucket;
+            c->limit = exp2(double(bucket) / s_limitBuckets);
+            c->smallCount = 0;
+            c->smallValue = 0;
+            c->rectsCleared = false;
+            if (_children) {
+                for (TreeMapItem *i: std::as_const(*_children)) {
+                    if (i->value() < c->limit) {
+                        c->smallCount++;
+                        c->smallValue += i->value();
+                    }
+                }
+            }
+        }
+    }
+
+    *limit = c->limit;
+    if (value) {
+        *value = c->smallValue;
+    }
+    return c->smallCount;
+}
+
+void TreeMapItem::clearSmallChildRects()
+{
+    // they keep no rect until they aren't small anymore
+    if (!_childCache || _childCache->rectsCleared || !_children) {
+        return;
+    }
+    for (TreeMapItem *i: std::as_const(*_children)) {
+        if (i->value() < _childCache->limit) {
+            i->clearItemRect();
+        }
+    }
+    _childCache->rectsCleared = true;
+}
+
 void TreeMapItem::clearItemRect()
 {
     _rect = QRect();
@@ -1257,6 +1398,7 @@ TreeMapWidget::TreeMapWidget(TreeMapItem *base,
     _maxSelectDepth = -1; // unlimited
     _maxDrawingDepth = -1; // unlimited
     _minimalArea = -1; // unlimited
+    _lodArea = 4;
     _markNo = 0;
 
     for (int i = 0; i < 4; i++) {
@@ -1275,13 +1417,25 @@ TreeMapWidget::TreeMapWidget(TreeMapItem *base,
     _lastOver = nullptr;
     _needsRefresh = _base;
 
+    _layout = new TreeMapLayout;
+    _hitIndex = new TreeMapHitIndex;
+    _layoutPool = new QThreadPool(this);
+    _layoutPool->setMaxThreadCount(1);
+    _layoutRunning = false;
+    _layoutRoot = nullptr;
+
     setAttribute(Qt::WA_NoSystemBackground, true);
     setFocusPolicy(Qt::StrongFocus);
 }
 
 TreeMapWidget::~TreeMapWidget()
 {
+    // the result of a running layout is dropped
+    _layoutPool->waitForDone();
+
     delete _base;
+    delete _layout;
+    delete _hitIndex;
 }
 
 const QFont &TreeMapWidget::currentFont() const
@@ -1650,6 +1804,16 @@ void TreeMapWidget::setMinimalArea(int area)
     redraw();
 }
 
+void TreeMapWidget::setLodArea(int area)
+{
+    if (_lodArea == area) {
+        return;
+    }
+
+    _lodArea = area;
+    redraw();
+}
+
 void TreeMapWidget::deletingItem(TreeMapItem *i)
 {
     // remove any references to the item to be deleted
@@ -1668,6 +1832,7 @@ void TreeMapWidget::deletingItem(TreeMapItem *i)
     if (_lastOver == i) {
         _lastOver = nullptr;
     }
+    _hitIndex->invalidate();
 
     // do not redraw a deleted item
     if (_needsRefresh == i) {
@@ -1675,6 +1840,14 @@ void TreeMapWidget::deletingItem(TreeMapItem *i)
         // from child to parent; i.e. i->parent() is existing.
         _needsRefresh = i->parent();
     }
+
+    // the layout being computed must not be set into deleted items
+    if (_layoutRunning) {
+        _deletedItems.insert(i);
+        if (_layoutRoot == i) {
+            _layoutRoot = i->parent();
+        }
+    }
 }
 
 QString TreeMapWidget::tipString(TreeMapItem *i) const
@@ -1711,58 +1884,25 @@ TreeMapItem *TreeMapWidget::item(int x, int y) const
     if (!rect().contains(x, y)) {
         return nullptr;
     }
-    if (DEBUG_DRAWING) {
-        qCDebug(FSVIEWLOG) << "item(" << x << "," << y << "):";
-    }
-
-    TreeMapItem *p = _base;
-    TreeMapItem *i;
-    while (1) {
-        TreeMapItemList *list = p->children();
-        i = nullptr;
-        if (list) {
-            int idx;
-            for (idx = 0; idx < list->size(); idx++) {
-                i = list->at(idx);
-
-                if (DEBUG_DRAWING)
-                    qCDebug(FSVIEWLOG) << "  Checking " << i->path(0).join(QStringLiteral("/")) << " ("
-                                       << i->itemRect().x() << "/" << i->itemRect().y()
-                                       << "-" << i->itemRect().width()
-                                       << "x" << i->itemRect().height() << ")";
 
-                if (i->itemRect().contains(x, y)) {
-
-                    if (DEBUG_DRAWING) {
-                        qCDebug(FSVIEWLOG) << "  .. Got. Index " << idx;
-                    }
-
-                    p->setIndex(idx);
-                    break;
-                }
-            }
-            if (idx == list->size()) {
-                i = nullptr;    // not contained in child
-            }
-        }
+    // built on first use after a layout
+    if (!_hitIndex->isValid() || _hitIndex->area() != rect()) {
+        _hitIndex->build(_base, rect());
+    }
 
-        if (!i) {
-            static TreeMapItem *last = nullptr;
-            if (p != last) {
-                last = p;
+    TreeMapItem *i = _hitIndex->item(QPoint(x, y));
+    if (!i) {
+        // not contained in any child
+        i = _base;
+    }
 
-                if (DEBUG_DRAWING)
-                    qCDebug(FSVIEWLOG) << "item(" << x << "," << y << "): Got "
-                                       << p->path(0).join(QStringLiteral("/")) << " (Size "
-                                       << p->itemRect().width() << "x" << p->itemRect().height()
-                                       << ", Val " << p->value() << ")";
-            }
+    if (DEBUG_DRAWING)
+        qCDebug(FSVIEWLOG) << "item(" << x << "," << y << "): Got "
+                           << i->path(0).join(QStringLiteral("/")) << " (Size "
+                           << i->itemRect().width() << "x" << i->itemRect().height()
+                           << ", Val " << i->value() << ")";
 
-            return p;
-        }
-        p = i;
-    }
-    return nullptr;
+    return i;
 }
 
 TreeMapItem *TreeMapWidget::possibleSelection(TreeMapItem *i) const
@@ -2421,57 +2561,42 @@ bool TreeMapWidget::event(QEvent *event)
     return QWidget::event(event);
 }
 
-void TreeMapWidget::paintEvent(QPaintEvent *)
+void TreeMapWidget::paintEvent(QPaintEvent *e)
+{
+    drawTreeMap(e->rect());
+}
+
+QRect TreeMapWidget::baseRect() const
 {
-    drawTreeMap();
+    return QRect(3, 3, QWidget::width() - 6, QWidget::height() - 6);
 }
 
-// Updates screen from shadow buffer,
-// but redraws before if needed
-void TreeMapWidget::drawTreeMap()
+// Updates screen from the tiles, drawing missing ones from the
+// last layout, and starts a new layout if needed
+void TreeMapWidget::drawTreeMap(const QRect &area)
 {
     // no need to draw if hidden
     if (!isVisible()) {
         return;
     }
 
-    if (_pixmap.size() != size()) {
+    if (_tilesSize != size()) {
+        _tilesSize = size();
+        _tiles.clear();
         _needsRefresh = _base;
     }
 
-    if (_needsRefresh) {
-
-        if (DEBUG_DRAWING) {
-            qCDebug(FSVIEWLOG) << "Redrawing " << _needsRefresh->path(0).join(QStringLiteral("/"));
-        }
-
-        if (_needsRefresh == _base) {
-            // redraw whole widget
-            _pixmap = QPixmap(size());
-            _pixmap.fill(palette().color(backgroundRole()));
-        }
-        QPainter p(&_pixmap);
-        if (_needsRefresh == _base) {
-            p.setPen(Qt::black);
-            p.drawRect(QRect(2, 2, QWidget::width() - 5, QWidget::height() - 5));
-            _base->setItemRect(QRect(3, 3, QWidget::width() - 6, QWidget::height() - 6));
-        } else {
-            // only subitem
-            if (!_needsRefresh->itemRect().isValid()) {
-                return;
-            }
-        }
-
-        // reset cached font object; it could have been changed
-        _font = font();
-        _fontHeight = fontMetrics().height();
-
-        drawItems(&p, _needsRefresh);
-        _needsRefresh = nullptr;
+    if (_needsRefresh && !_layoutRunning) {
+        startLayout();
     }
 
+    const QRect r = area.isValid() ? area.intersected(rect()) : rect();
     QStylePainter p(this);
-    p.drawPixmap(0, 0, width(), height(), _pixmap);
+    for (int y = r.top() / s_tileSize; !r.isEmpty() && y <= r.bottom() / s_tileSize; y++) {
+        for (int x = r.left() / s_tileSize; x <= r.right() / s_tileSize; x++) {
+            p.drawPixmap(x * s_tileSize, y * s_tileSize, tile(x, y));
+        }
+    }
 
     if (hasFocus()) {
         QStyleOptionFocusRect opt;
@@ -2482,6 +2607,57 @@ void TreeMapWidget::drawTreeMap()
     }
 }
 
+QPixmap TreeMapWidget::tile(int x, int y)
+{
+    const QPoint key(x, y);
+    auto it = _tiles.constFind(key);
+    if (it != _tiles.constEnd()) {
+        return *it;
+    }
+
+    const QRect tileRect(x * s_tileSize, y * s_tileSize, s_tileSize, s_tileSize);
+    QPixmap pix(s_tileSize, s_tileSize);
+    pix.fill(palette().color(backgroundRole()));
+
+    QPainter p(&pix);
+    p.translate(-tileRect.topLeft());
+    p.setPen(Qt::black);
+    p.drawRect(QRect(2, 2, QWidget::width() - 5, QWidget::height() - 5));
+
+    const QRect from = _layout->rect();
+    const QRect to = baseRect();
+    if (!from.isEmpty() && !to.isEmpty()) {
+        QRect clip = tileRect;
+        if (from != to) {
+            // while resizing, the last layout is scaled until the new one is there
+            QTransform t;
+            t.translate(to.x(), to.y());
+            t.scale(qreal(to.width()) / from.width(), qreal(to.height()) / from.height());
+            t.translate(-from.x(), -from.y());
+            p.setTransform(t, true);
+            clip = t.inverted().mapRect(tileRect);
+        }
+        _layout->draw(&p, clip, _pixmaps);
+    }
+    p.end();
+
+    _tiles.insert(key, pix);
+    return pix;
+}
+
+void TreeMapWidget::dropTiles(const QRect &r)
+{
+    for (auto it = _tiles.begin(); it != _tiles.end();) {
+        const QRect tileRect(it.key().x() * s_tileSize, it.key().y() * s_tileSize,
+                             s_tileSize, s_tileSize);
+        if (tileRect.intersects(r)) {
+            it = _tiles.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
 void TreeMapWidget::redraw(TreeMapItem *i)
 {
     if (!i) {
@@ -2502,633 +2678,389 @@ void TreeMapWidget::redraw(TreeMapItem *i)
     }
 }
 
-void TreeMapWidget::drawItem(QPainter *p,
-                             TreeMapItem *item)
+/* Lays out the item needing a refresh, in a thread of _layoutPool
+ * if possible: the items are copied for that first. */
+void TreeMapWidget::startLayout()
 {
-    bool isSelected = false;
+    TreeMapItem *root = _needsRefresh;
+    _needsRefresh = nullptr;
 
-    if (_markNo > 0) {
-        for (TreeMapItem *i = item; i; i = i->parent()) {
-            if (i->isMarked(_markNo)) {
-                isSelected = true;
-                break;
-            }
-        }
+    QRect r;
+    if (root == _base) {
+        r = baseRect();
     } else {
-        for (TreeMapItem *i: _tmpSelection) {
-            if (item->isChildOf(i)) {
-                isSelected = true;
-                break;
-            }
+        // only subitem
+        r = root->itemRect();
+        if (!r.isValid()) {
+            return;
         }
     }
 
-    bool isCurrent = _current && item->isChildOf(_current);
-    int dd = item->depth();
-    if (isTransparent(dd)) {
-        return;
-    }
-
-    RectDrawing d(item->itemRect());
-    item->setSelected(isSelected);
-    item->setCurrent(isCurrent);
-    item->setShaded(_shading);
-    item->drawFrame(drawFrame(dd));
-    d.drawBack(p, item);
-}
-
-bool TreeMapWidget::horizontal(TreeMapItem *i, const QRect &r)
-{
-    switch (i->splitMode()) {
-    case TreeMapItem::HAlternate:
-        return (i->depth() % 2) == 1;
-    case TreeMapItem::VAlternate:
-        return (i->depth() % 2) == 0;
-    case TreeMapItem::Horizontal:
-        return true;
-    case TreeMapItem::Vertical:
-        return false;
-    default:
-        return r.width() > r.height();
+    if (DEBUG_DRAWING) {
+        qCDebug(FSVIEWLOG) << "Redrawing " << root->path(0).join(QStringLiteral("/"));
     }
-    return false;
-}
 
-/**
- * Draw TreeMapItems recursive, starting from item
- */
-void TreeMapWidget::drawItems(QPainter *p,
-                              TreeMapItem *item)
-{
-    if (DEBUG_DRAWING)
-        qCDebug(FSVIEWLOG) << "+drawItems(" << item->path(0).join(QStringLiteral("/")) << ", "
-                           << item->itemRect().x() << "/" << item->itemRect().y()
-                           << "-" << item->itemRect().width() << "x"
-                           << item->itemRect().height() << "), Val " << item->value()
-                           << ", Sum " << item->sum();
-
-    drawItem(p, item);
-    item->clearFreeRects();
-
-    QRect origRect = item->itemRect();
-    int bw = item->borderWidth();
-    QRect r = QRect(origRect.x() + bw, origRect.y() + bw,
-                    origRect.width() - 2 * bw, origRect.height() - 2 * bw);
-
-    TreeMapItemList *list = item->children();
+    // reset cached font object; it could have been changed
+    _font = font();
+    _fontHeight = fontMetrics().height();
 
-    bool stopDrawing = false;
+    auto snapshot = std::make_shared<TreeMapSnapshot>();
+    takeSnapshot(root, r, *snapshot);
+    _layoutRunning = true;
+    _layoutRoot = root;
 
-    // only subdivide if there are children
-    if (!list || list->count() == 0) {
-        stopDrawing = true;
+    // laying out measures texts
+    if (!QFontDatabase::supportsThreadedFontRendering()) {
+        TreeMapLayout layout;
+        layout.compute(*snapshot);
+        layoutFinished(*snapshot, layout);
+        return;
     }
 
-    // only subdivide if there is enough space
-    if (!stopDrawing && (r.width() <= 0 || r.height() <= 0)) {
-        stopDrawing = true;
-    }
+    _layoutPool->start([this, snapshot]() {
+        auto layout = std::make_shared<TreeMapLayout>();
+        layout->compute(*snapshot);
+        QMetaObject::invokeMethod(this, [this, snapshot, layout]() {
+            layoutFinished(*snapshot, *layout);
+        }, Qt::QueuedConnection);
+    });
+}
 
-    // stop drawing if maximum depth is reached
-    if (!stopDrawing &&
-            (_maxDrawingDepth >= 0 && item->depth() >= _maxDrawingDepth)) {
-        stopDrawing = true;
-    }
+void TreeMapWidget::takeSnapshot(TreeMapItem *root, const QRect &r, TreeMapSnapshot &s)
+{
+    s.rect = r;
+    s.font = _font;
+    s.fontHeight = _fontHeight;
+    s.visibleWidth = _visibleWidth;
+    s.minimalArea = _minimalArea;
+    s.skipIncorrectBorder = _skipIncorrectBorder;
+    s.drawSeparators = _drawSeparators;
+    s.allowRotation = _allowRotation;
 
-    // stop drawing if stopAtText is reached
-    if (!stopDrawing)
-        for (int no = 0; no < _attr.size(); no++) {
-            QString stopAt = fieldStop(no);
-            if (!stopAt.isEmpty() && (item->text(no) == stopAt)) {
-                stopDrawing = true;
+    // items inside of selected or current ones are drawn like them
+    bool selected = false;
+    if (_markNo > 0) {
+        for (TreeMapItem *i = root->parent(); i; i = i->parent()) {
+            if (i->isMarked(_markNo)) {
+                selected = true;
                 break;
             }
         }
-
-    // area size is checked later...
-#if 0
-    // stop drawing if minimal area size is reached
-    if (!stopDrawing &&
-            (_minimalArea > 0) &&
-            (r.width() * r.height() < _minimalArea)) {
-        stopDrawing = true;
-    }
-#endif
-
-    if (stopDrawing) {
-        if (list) {
-            // invalidate rects
-            for (TreeMapItem *i: *list) {
-                i->clearItemRect();
+    } else {
+        for (TreeMapItem *i: std::as_const(_tmpSelection)) {
+            if (root->parent() && root->parent()->isChildOf(i)) {
+                selected = true;
+                break;
             }
         }
-        // tooltip appears on whole item rect
-        item->addFreeRect(item->itemRect());
+    }
+    bool current = _current && root->parent() && root->parent()->isChildOf(_current);
 
-        // if we have space for text...
-        if ((r.height() < _fontHeight) || (r.width() < _fontHeight)) {
-            return;
-        }
+    // the area of an item is at most its share of the area of its parent
+    QVector<double> areas;
+    addSnapshotNode(s, root, double(r.width()) * r.height(), selected, current);
+    areas.append(double(r.width()) * r.height());
 
-        RectDrawing d(r);
-        item->setRotated(_allowRotation && (r.height() > r.width()));
-        for (int no = 0; no < _attr.size(); no++) {
-            if (!fieldVisible(no)) {
-                continue;
-            }
-            d.drawField(p, no, item);
+    // breadth first, so that children are stored one after the other
+    for (int n = 0; n < s.nodes.count(); n++) {
+        const TreeMapSnapshot::Node node = s.nodes[n];
+        TreeMapItem *item = node.item;
+        if (node.aggregated > 0) {
+            continue;
         }
-        r = d.remainingRect(item);
 
-        if (DEBUG_DRAWING) {
-            qCDebug(FSVIEWLOG) << "-drawItems(" << item->path(0).join(QStringLiteral("/")) << ")";
+        // space for children is inside of the border
+        const int inner = 2 * node.borderWidth + 1;
+        if (2 * areas[n] < inner * inner) {
+            continue;
         }
-        return;
-    }
-
-    double user_sum, child_sum, self;
 
-    // user supplied sum
-    user_sum = item->sum();
-
-    // own sum
-    child_sum = 0;
-    for (TreeMapItem *i: *list) {
-        child_sum += i->value();
-        if (DEBUG_DRAWING)
-            qCDebug(FSVIEWLOG) << "  child: " << i->text(0) << ", value "
-                               << i->value();
-    }
-
-    QRect orig = r;
-
-    // if we have space for text...
-    if ((r.height() >= _fontHeight) && (r.width() >= _fontHeight)) {
+        // stop drawing if maximum depth is reached
+        if (_maxDrawingDepth >= 0 && node.depth >= _maxDrawingDepth) {
+            continue;
+        }
 
-        RectDrawing d(r);
-        item->setRotated(_allowRotation && (r.height() > r.width()));
+        // stop drawing if stopAtText is reached
+        bool stop = false;
         for (int no = 0; no < _attr.size(); no++) {
-            if (!fieldVisible(no)) {
-                continue;
-            }
-            if (!fieldForced(no)) {
-                continue;
+            QString stopAt = fieldStop(no);
+            if (!stopAt.isEmpty() && (item->text(no) == stopAt)) {
+                stop = true;
+                break;
             }
-            d.drawField(p, no, item);
         }
-        r = d.remainingRect(item);
-    }
-
-    if (orig.x() == r.x()) {
-        // Strings on top
-        item->addFreeRect(QRect(orig.x(), orig.y(),
-                                orig.width(), orig.height() - r.height()));
-    } else {
-        // Strings on the left
-        item->addFreeRect(QRect(orig.x(), orig.y(),
-                                orig.width() - r.width(), orig.height()));
-    }
-
-    if (user_sum == 0) {
-        // user did not supply any sum
-        user_sum = child_sum;
-        self = 0;
-    } else {
-        self = user_sum - child_sum;
-
-        if (user_sum < child_sum) {
-            //qCDebug(FSVIEWLOG) << "TreeMWidget " <<
-            //       item->path() << ": User sum " << user_sum << " < Child Items sum " << child_sum;
-
-            // invalid user supplied sum: ignore and use calculate sum
-            user_sum = child_sum;
-            self = 0.0;
-        } else {
-            // Try to put the border waste in self
-            // percent of wasted space on border...
-            float borderArea = origRect.width() * origRect.height();
-            borderArea = (borderArea - r.width() * r.height()) / borderArea;
-            unsigned borderValue = (unsigned)(borderArea * user_sum);
-
-            if (borderValue > self) {
-                if (_skipIncorrectBorder) {
-                    r = origRect;
-                    // should add my self to nested self and set my self =0
-                } else {
-                    self = 0.0;
-                }
-            } else {
-                self -= borderValue;
-            }
-
-            user_sum = child_sum + self;
+        if (stop) {
+            continue;
         }
-    }
 
-    bool rotate = (_allowRotation && (r.height() > r.width()));
-    int self_length = (int)(((rotate) ? r.width() : r.height()) *
-                            self / user_sum + .5);
-    if (self_length > 0) {
-        // take space for self cost
-        QRect sr = r;
-        if (rotate) {
-            sr.setWidth(self_length);
-            r.setRect(r.x() + sr.width(), r.y(), r.width() - sr.width(), r.height());
-        } else {
-            sr.setHeight(self_length);
-            r.setRect(r.x(), r.y() + sr.height(), r.width(), r.height() - sr.height());
+        TreeMapItemList *list = item->children();
+        if (!list || list->isEmpty()) {
+            continue;
         }
 
-        // set selfRect (not occupied by children) for tooltip
-        item->addFreeRect(sr);
-
-        if (0) qCDebug(FSVIEWLOG) << "Item " << item->path(0).join(QStringLiteral("/")) << ": SelfR "
-                                  << sr.x() << "/" << sr.y() << "-" << sr.width()
-                                  << "/" << sr.height() << ", self " << self << "/"
-                                  << user_sum;
+        const double child_sum = item->childSum();
 
-        if ((sr.height() >= _fontHeight) && (sr.width() >= _fontHeight)) {
-
-            RectDrawing d(sr);
-            item->setRotated(_allowRotation && (r.height() > r.width()));
-            for (int no = 0; no < _attr.size(); no++) {
-                if (!fieldVisible(no)) {
-                    continue;
-                }
-                if (fieldForced(no)) {
-                    continue;
-                }
-                d.drawField(p, no, item);
+        // children too small for lodArea are one node, drawn last
+        double limit = 0, smallValue = 0;
+        int smallCount = 0;
+        if (_lodArea > 0 && child_sum > 0) {
+            limit = _lodArea * child_sum / areas[n];
+            smallCount = item->smallChildren(&limit, &smallValue);
+            if (smallCount < 2) {
+                smallCount = 0;
             }
         }
 
-        user_sum -= self;
-    }
-
-    bool goBack;
-    if (item->sorting(&goBack) == -1) {
-        // noSorting
-        goBack = false;
-    }
-
-    int idx = goBack ? (list->size() - 1) : 0;
-
-    if (item->splitMode() == TreeMapItem::Columns) {
-        int len = list->count();
-        bool drawDetails = true;
-
-        while (len > 0 && user_sum > 0) {
-            int firstIdx = idx;
-            double valSum = 0;
-            int lenLeft = len;
-            int columns = (int)(sqrt((double)len * r.width() / r.height()) + .5);
-            if (columns == 0) {
-                columns = 1;    //should never be needed
-            }
-
-            while (lenLeft > 0 && ((double)valSum * (len - lenLeft) <
-                                   (double)len * user_sum / columns / columns)) {
-                valSum += list->at(idx)->value();
-                if (goBack) {
-                    --idx;
-                } else {
-                    ++idx;
-                }
-                lenLeft--;
-            }
-
-            // we always split horizontally
-            int nextPos = (int)((double)r.width() * valSum / user_sum);
-            QRect firstRect = QRect(r.x(), r.y(), nextPos, r.height());
-
-            if (nextPos < _visibleWidth) {
-                if (item->sorting(nullptr) == -1) {
-                    // fill current rect with hash pattern
-                    drawFill(item, p, firstRect);
-                } else {
-                    // fill rest with hash pattern
-                    drawFill(item, p, r, list, firstIdx, len, goBack);
-                    break;
-                }
+        // sorted by value, the small children are at one end
+        int first = 0, last = list->count();
+        bool ascending;
+        const bool byValue = (item->sorting(&ascending) == -2);
+        if (smallCount > 0 && byValue) {
+            if (ascending) {
+                first = smallCount;
             } else {
-                drawDetails = drawItemArray(p, item, firstRect,
-                                            valSum, list, firstIdx, len - lenLeft, goBack);
+                last -= smallCount;
             }
-            r.setRect(r.x() + nextPos, r.y(), r.width() - nextPos, r.height());
-            user_sum -= valSum;
-            len = lenLeft;
+        }
 
-            if (!drawDetails) {
-                if (item->sorting(nullptr) == -1) {
-                    drawDetails = true;
-                } else {
-                    drawFill(item, p, r, list, idx, len, goBack);
-                    break;
-                }
-            }
+        s.nodes[n].expanded = true;
+        s.nodes[n].firstChild = s.nodes.count();
+        if (smallCount > 0 && node.goBack) {
+            addSnapshotAggregate(s, n, smallCount, smallValue, areas[n] * smallValue / child_sum);
+            areas.append(areas[n] * smallValue / child_sum);
         }
-    } else if (item->splitMode() == TreeMapItem::Rows) {
-        int len = list->count();
-        bool drawDetails = true;
-
-        while (len > 0 && user_sum > 0) {
-            int firstIdx = idx;
-            double valSum = 0;
-            int lenLeft = len;
-            int rows = (int)(sqrt((double)len * r.height() / r.width()) + .5);
-            if (rows == 0) {
-                rows = 1;    //should never be needed
+        for (int idx = first; idx < last; idx++) {
+            TreeMapItem *i = list->at(idx);
+            if (smallCount > 0 && !byValue && i->value() < limit) {
+                continue;
             }
+            const double area = (child_sum > 0) ? areas[n] * i->value() / child_sum : 0;
+            addSnapshotNode(s, i, area, node.selected, node.current);
+            areas.append(area);
+        }
+        if (smallCount > 0 && !node.goBack) {
+            addSnapshotAggregate(s, n, smallCount, smallValue, areas[n] * smallValue / child_sum);
+            areas.append(areas[n] * smallValue / child_sum);
+        }
+        s.nodes[n].childCount = s.nodes.count() - s.nodes[n].firstChild;
+    }
+}
+
+void TreeMapWidget::addSnapshotNode(TreeMapSnapshot &s, TreeMapItem *i, double area,
+                                    bool selected, bool current)
+{
+    TreeMapSnapshot::Node node;
+    node.item = i;
+    node.value = i->value();
+    node.sum = 0;
+    node.depth = 0;
+    node.borderWidth = 0;
+    node.splitMode = TreeMapItem::Best;
+    node.noSorting = true;
+    node.goBack = false;
+    node.expanded = false;
+    node.aggregated = 0;
+    node.firstChild = 0;
+    node.childCount = 0;
+    node.firstField = s.fields.count();
+    node.fieldCount = 0;
+    node.selected = false;
+    node.current = false;
+    node.shaded = false;
+    node.frame = false;
+    node.transparent = false;
+
+    // an item smaller than half a pixel doesn't get a rectangle
+    if (2 * area < 1) {
+        s.nodes.append(node);
+        return;
+    }
 
-            while (lenLeft > 0 && ((double)valSum * (len - lenLeft) <
-                                   (double)len * user_sum / rows / rows)) {
-                valSum += list->at(idx)->value();
-                if (goBack) {
-                    --idx;
-                } else {
-                    ++idx;
-                }
-                lenLeft--;
-            }
+    node.sum = i->sum();
+    node.depth = i->depth();
+    node.borderWidth = i->borderWidth();
+    node.splitMode = i->splitMode();
+    bool goBack;
+    node.noSorting = (i->sorting(&goBack) == -1);
+    node.goBack = !node.noSorting && goBack;
 
-            // we always split horizontally
-            int nextPos = (int)((double)r.height() * valSum / user_sum);
-            QRect firstRect = QRect(r.x(), r.y(), r.width(), nextPos);
+    if (_markNo > 0) {
+        node.selected = selected || i->isMarked(_markNo);
+    } else {
+        node.selected = selected || _tmpSelection.contains(i);
+    }
+    node.current = current || (i == _current);
+    node.shaded = _shading;
+    node.frame = drawFrame(node.depth);
+    node.transparent = isTransparent(node.depth);
 
-            if (nextPos < _visibleWidth) {
-                if (item->sorting(nullptr) == -1) {
-                    drawFill(item, p, firstRect);
-                } else {
-                    drawFill(item, p, r, list, firstIdx, len, goBack);
-                    break;
-                }
-            } else {
-                drawDetails = drawItemArray(p, item, firstRect,
-                                            valSum, list, firstIdx, len - lenLeft, goBack);
-            }
-            r.setRect(r.x(), r.y() + nextPos, r.width(), r.height() - nextPos);
-            user_sum -= valSum;
-            len = lenLeft;
+    i->setSelected(node.selected);
+    i->setCurrent(node.current);
+    i->setShaded(node.shaded);
+    i->drawFrame(node.frame);
+    node.backColor = i->backColor();
 
-            if (!drawDetails) {
-                if (item->sorting(nullptr) == -1) {
-                    drawDetails = true;
-                } else {
-                    drawFill(item, p, r, list, idx, len, goBack);
-                    break;
-                }
+    // texts need at least one line
+    if (2 * area >= _fontHeight * _fontHeight) {
+        for (int no = 0; no < _attr.size(); no++) {
+            if (!fieldVisible(no)) {
+                continue;
             }
+            const QPixmap pix = i->pixmap(no);
+            s.fields.append({no, i->text(no), snapshotPixmap(pix), pix.size(),
+                             i->position(no), i->maxLines(no), fieldForced(no)});
         }
-    } else {
-        drawItemArray(p, item, r, user_sum, list, idx, list->count(), goBack);
+        node.fieldCount = s.fields.count() - node.firstField;
     }
 
-    if (DEBUG_DRAWING) {
-        qCDebug(FSVIEWLOG) << "-drawItems(" << item->path(0).join(QStringLiteral("/")) << ")";
-    }
+    s.nodes.append(node);
 }
 
-// fills area with a pattern if to small to draw children
-void TreeMapWidget::drawFill(TreeMapItem *i, QPainter *p, const QRect &r)
+void TreeMapWidget::addSnapshotAggregate(TreeMapSnapshot &s, int parent, int count,
+                                         double value, double area)
 {
-    p->setBrush(Qt::Dense4Pattern);
-    p->setPen(Qt::NoPen);
-    p->drawRect(QRect(r.x(), r.y(), r.width() - 1, r.height() - 1));
-    i->addFreeRect(r);
-}
-
-// fills area with a pattern if to small to draw children
-void TreeMapWidget::drawFill(TreeMapItem *i, QPainter *p, const QRect &r,
-                             TreeMapItemList *list, int idx, int len, bool goBack)
-{
-    if (DEBUG_DRAWING)
-        qCDebug(FSVIEWLOG) << "  +drawFill(" << r.x() << "/" << r.y()
-                           << "-" << r.width() << "x" << r.height()
-                           << ", len " << len << ")";
-
-    p->setBrush(Qt::Dense4Pattern);
-    p->setPen(Qt::NoPen);
-    p->drawRect(QRect(r.x(), r.y(), r.width() - 1, r.height() - 1));
-    i->addFreeRect(r);
+    const TreeMapSnapshot::Node &p = s.nodes[parent];
+    TreeMapSnapshot::Node node = p;
+    node.value = value;
+    node.sum = 0;
+    node.depth = p.depth + 1;
+    node.noSorting = true;
+    node.goBack = false;
+    node.expanded = false;
+    node.aggregated = count;
+    node.firstChild = 0;
+    node.childCount = 0;
+    node.firstField = s.fields.count();
+    node.fieldCount = 0;
+    node.frame = drawFrame(node.depth);
+    node.transparent = false;
 
-    // reset rects
-    while (len > 0 && (i = list->value(idx))) {
-
-        if (DEBUG_DRAWING) {
-            qCDebug(FSVIEWLOG) << "   Reset Rect " << i->path(0).join(QStringLiteral("/"));
-        }
-
-        i->clearItemRect();
-        if (goBack) {
-            --idx;
-        } else {
-            ++idx;
-        }
-        len--;
+    if (2 * area >= _fontHeight * _fontHeight && fieldVisible(0)) {
+        s.fields.append({0, i18np("%1 small item", "%1 small items", count), -1, QSize(),
+                         p.item->position(0), 0, false});
+        node.fieldCount = 1;
     }
-    if (DEBUG_DRAWING)
-        qCDebug(FSVIEWLOG) << "  -drawFill(" << r.x() << "/" << r.y()
-                           << "-" << r.width() << "x" << r.height()
-                           << ", len " << len << ")";
+    s.nodes.append(node);
 }
 
-// returns false if rect gets to small
-bool TreeMapWidget::drawItemArray(QPainter *p, TreeMapItem *item,
-                                  const QRect &r, double user_sum,
-                                  TreeMapItemList *list, int idx, int len,
-                                  bool goBack)
+int TreeMapWidget::snapshotPixmap(const QPixmap &pix)
 {
-    if (user_sum == 0) {
-        return false;
+    if (pix.isNull()) {
+        return -1;
     }
 
-    static bool b2t = true;
-
-    // stop recursive bisection for small rectangles
-    if (((r.height() < _visibleWidth) &&
-            (r.width() < _visibleWidth)) ||
-            ((_minimalArea > 0) &&
-             (r.width() * r.height() < _minimalArea))) {
+    auto it = _pixmapIndex.constFind(pix.cacheKey());
+    if (it != _pixmapIndex.constEnd()) {
+        return *it;
+    }
+    _pixmaps.append(pix);
+    _pixmapIndex.insert(pix.cacheKey(), _pixmaps.count() - 1);
+    return _pixmaps.count() - 1;
+}
 
-        drawFill(item, p, r, list, idx, len, goBack);
-        return false;
+// drop pixmaps not used by the layout anymore
+void TreeMapWidget::compactPixmaps()
+{
+    if (_pixmaps.count() < 256) {
+        return;
     }
 
-    if (DEBUG_DRAWING)
-        qCDebug(FSVIEWLOG) << " +drawItemArray(" << item->path(0).join(QStringLiteral("/"))
-                           << ", " << r.x() << "/" << r.y() << "-" << r.width()
-                           << "x" << r.height() << ")";
-
-    if (len > 2 && (item->splitMode() == TreeMapItem::Bisection)) {
-
-        int firstIdx = idx;
-        double valSum = 0;
-        int lenLeft = len;
-        //while (lenLeft>0 && valSum<user_sum/2) {
-        while (lenLeft > len / 2) {
-            valSum += list->at(idx)->value();
-            if (goBack) {
-                --idx;
-            } else {
-                ++idx;
-            }
-            lenLeft--;
+    QVector<int> map(_pixmaps.count(), -1);
+    QVector<QPixmap> pixmaps;
+    _pixmapIndex.clear();
+    for (const TreeMapField &field : _layout->fields()) {
+        if (field.pixmap < 0 || map[field.pixmap] >= 0) {
+            continue;
         }
+        map[field.pixmap] = pixmaps.count();
+        _pixmapIndex.insert(_pixmaps[field.pixmap].cacheKey(), pixmaps.count());
+        pixmaps.append(_pixmaps[field.pixmap]);
+    }
+    _pixmaps = pixmaps;
+    _layout->remapPixmaps(map);
+}
 
-        // draw first half...
-        bool drawOn;
-        QRect secondRect;
+void TreeMapWidget::layoutFinished(const TreeMapSnapshot &s, TreeMapLayout &layout)
+{
+    TreeMapItem *root = s.nodes.first().item;
+    TreeMapItem *layoutRoot = _layoutRoot;
+    _layoutRunning = false;
+    _layoutRoot = nullptr;
 
-        if (r.width() > r.height()) {
-            int halfPos = (int)((double)r.width() * valSum / user_sum);
-            QRect firstRect = QRect(r.x(), r.y(), halfPos, r.height());
-            drawOn = drawItemArray(p, item, firstRect,
-                                   valSum, list, firstIdx, len - lenLeft, goBack);
-            secondRect.setRect(r.x() + halfPos, r.y(), r.width() - halfPos, r.height());
-        } else {
-            int halfPos = (int)((double)r.height() * valSum / user_sum);
-            QRect firstRect = QRect(r.x(), r.y(), r.width(), halfPos);
-            drawOn = drawItemArray(p, item, firstRect,
-                                   valSum, list, firstIdx, len - lenLeft, goBack);
-            secondRect.setRect(r.x(), r.y() + halfPos, r.width(), r.height() - halfPos);
+    if (layoutRoot != root) {
+        // the item laid out was deleted meanwhile
+        _deletedItems.clear();
+        if (layoutRoot) {
+            redraw(layoutRoot);
         }
+        return;
+    }
 
-        // if no sorting, do not stop drawing
-        if (item->sorting(nullptr) == -1) {
-            drawOn = true;
-        }
+    applyLayout(s, layout);
+    _hitIndex->invalidate();
+    _deletedItems.clear();
+    layout.clearResults();
 
-        // second half
-        if (drawOn)
-            drawOn = drawItemArray(p, item, secondRect, user_sum - valSum,
-                                   list, idx, lenLeft, goBack);
-        else {
-            drawFill(item, p, secondRect, list, idx, len, goBack);
+    if (root == _base) {
+        *_layout = layout;
+        compactPixmaps();
+        _tiles.clear();
+        update();
+    } else if (_layout->replace(layout)) {
+        if (_layout->rect() == baseRect()) {
+            dropTiles(layout.rect());
+            update(layout.rect());
+        } else {
+            _tiles.clear();
+            update();
         }
-
-        if (DEBUG_DRAWING)
-            qCDebug(FSVIEWLOG) << " -drawItemArray(" << item->path(0).join(QStringLiteral("/"))
-                               << ")";
-
-        return drawOn;
+    } else {
+        redraw(_base);
     }
 
-    bool hor = horizontal(item, r);
-
-    TreeMapItem *i;
-    QRect fullRect = r;
-    while (len > 0) {
-        i = list->at(idx);
-        if (user_sum <= 0) {
-
-            if (DEBUG_DRAWING) {
-                qCDebug(FSVIEWLOG) << "drawItemArray: Reset " << i->path(0).join(QStringLiteral("/"));
-            }
+    if (_needsRefresh) {
+        update();
+    }
+    emit laidOut();
+}
 
-            i->clearItemRect();
-            if (goBack) {
-                --idx;
-            } else {
-                ++idx;
-            }
-            len--;
+void TreeMapWidget::applyLayout(const TreeMapSnapshot &s, const TreeMapLayout &layout)
+{
+    const QVector<QRect> &rects = layout.itemRects();
+    for (int n = 0; n < s.nodes.count(); n++) {
+        const TreeMapSnapshot::Node &node = s.nodes[n];
+        TreeMapItem *i = node.item;
+        if (_deletedItems.contains(i)) {
             continue;
         }
-
-        // stop drawing for small rectangles
-        if (((fullRect.height() < _visibleWidth) &&
-                (fullRect.width() < _visibleWidth)) ||
-                ((_minimalArea > 0) &&
-                 (fullRect.width() * fullRect.height() < _minimalArea))) {
-
-            drawFill(item, p, fullRect, list, idx, len, goBack);
-            if (DEBUG_DRAWING)
-                qCDebug(FSVIEWLOG) << " -drawItemArray(" << item->path(0).join(QStringLiteral("/"))
-                                   << "): Stop";
-            return false;
-        }
-
-        if (i->splitMode() == TreeMapItem::AlwaysBest) {
-            hor = fullRect.width() > fullRect.height();
-        }
-
-        int lastPos = hor ? fullRect.width() : fullRect.height();
-        double val = i->value();
-        int nextPos = (user_sum <= 0.0) ? 0 : (int)(lastPos * val / user_sum + .5);
-        if (nextPos > lastPos) {
-            nextPos = lastPos;
-        }
-
-        if ((item->sorting(nullptr) != -1) && (nextPos < _visibleWidth)) {
-            drawFill(item, p, fullRect, list, idx, len, goBack);
-            if (DEBUG_DRAWING)
-                qCDebug(FSVIEWLOG) << " -drawItemArray(" << item->path(0).join(QStringLiteral("/"))
-                                   << "): Stop";
-            return false;
-        }
-
-        QRect currRect = fullRect;
-
-        if (hor) {
-            currRect.setWidth(nextPos);
-        } else {
-            if (b2t) {
-                currRect.setRect(fullRect.x(), fullRect.bottom() - nextPos + 1, fullRect.width(), nextPos);
-            } else {
-                currRect.setHeight(nextPos);
-            }
+        // the area of small children of i
+        if (node.aggregated > 0) {
+            i->clearSmallChildRects();
+            continue;
         }
 
-        // do not draw very small rectangles:
-        if (nextPos >= _visibleWidth) {
-            i->setItemRect(currRect);
-            drawItems(p, i);
+        if (rects[n].isValid()) {
+            i->setItemRect(rects[n]);
+            i->clearFreeRects();
+            i->setRotated(layout.rotated()[n]);
         } else {
             i->clearItemRect();
-            drawFill(item, p, currRect);
         }
 
-        // draw Separator
-        if (_drawSeparators && (nextPos < lastPos)) {
-            p->setPen(Qt::black);
-            if (hor) {
-                if (fullRect.top() <= fullRect.bottom()) {
-                    p->drawLine(fullRect.x() + nextPos, fullRect.top(), fullRect.x() + nextPos, fullRect.bottom());
-                }
-            } else {
-                if (fullRect.left() <= fullRect.right()) {
-                    p->drawLine(fullRect.left(), fullRect.y() + nextPos, fullRect.right(), fullRect.y() + nextPos);
-                }
+        // children not laid out must not be found by item()
+        if (!node.expanded && i->createdChildren()) {
+            for (TreeMapItem *child: *i->createdChildren()) {
+                child->clearItemRect();
             }
-            nextPos++;
-        }
-
-        if (hor)
-            fullRect.setRect(fullRect.x() + nextPos, fullRect.y(),
-                             lastPos - nextPos, fullRect.height());
-        else {
-            if (b2t)
-                fullRect.setRect(fullRect.x(), fullRect.y(),
-                                 fullRect.width(), lastPos - nextPos);
-            else
-                fullRect.setRect(fullRect.x(), fullRect.y() + nextPos,
-                                 fullRect.width(), lastPos - nextPos);
         }
+    }
 
-        user_sum -= val;
-        if (goBack) {
-            --idx;
-        } else {
-            ++idx;
+    for (const auto &free : layout.freeRects()) {
+        TreeMapItem *i = s.nodes[free.first].item;
+        if (!_deletedItems.contains(i)) {
+            i->addFreeRect(free.second);
         }
-        len--;
     }
-
-    if (DEBUG_DRAWING)
-        qCDebug(FSVIEWLOG) << " -drawItemArray(" << item->path(0).join(QStringLiteral("/"))
-                           << "): Continue";
-
-    return true;
 }
 
 /*----------------------------------------------------------------
@@ -3532,6 +3464,7 @@ void TreeMapWidget::saveOptions(KConfigGroup *config, const QString &prefix)
     config->writeEntry(prefix + "BorderWidth", borderWidth());
     config->writeEntry(prefix + "MaxDepth", maxDrawingDepth());
     config->writeEntry(prefix + "MinimalArea", minimalArea());
+    config->writeEntry(prefix + "LodArea", lodArea());
 
     int f, fCount = _attr.size();
     config->writeEntry(prefix + "FieldCount", fCount);
@@ -3588,6 +3521,11 @@ void TreeMapWidget::restoreOptions(KConfigGroup *config, const QString &prefix)
         setMinimalArea(num);
     }
 
+    num = config->readEntry(prefix + "LodArea", -2);
+    if (num != -2) {
+        setLodArea(num);
+    }
+
     num = config->readEntry(prefix + "FieldCount", -2);
     if (num <= 0 || num > MAX_FIELD) {
         return;
@@ -22,6 +22,8 @@
 #include <QWidget>
 #include <QPixmap>
 #include <QColor>
+#include <QHash>
+#include <QSet>
 #include <QStringList>
 #include <QPaintEvent>
 #include <QKeyEvent>
@@ -30,9 +32,13 @@
 #include <QMouseEvent>
 #include <kconfiggroup.h>
 
+class QThreadPool;
 class TreeMapWidget;
 class TreeMapItem;
 class TreeMapItemList;
+class TreeMapHitIndex;
+class TreeMapLayout;
+class TreeMapSnapshot;
 
 /**
  * Drawing parameters for an object.
@@ -62,6 +68,11 @@ public:
 
     virtual QString  text(int) const = 0;
     virtual QPixmap  pixmap(int) const = 0;
+    // enough for laying out, also outside of the GUI thread
+    virtual QSize    pixmapSize(int f) const
+    {
+        return pixmap(f).size();
+    }
     virtual Position position(int) const = 0;
     // 0: no limit, negative: leave at least -maxLines() free
     virtual int      maxLines(int) const
@@ -225,7 +236,8 @@ public:
     // draw on a given QPainter, use this class as info provider per default
     void drawBack(QPainter *, DrawParams *dp = nullptr);
     /* Draw field at position() from pixmap()/text() with maxLines().
-     * Returns true if something was drawn
+     * Returns true if something was drawn.
+     * Without painter, only the space taken is updated.
      */
     bool drawField(QPainter *, int f, DrawParams *dp = nullptr);
 
@@ -444,6 +456,26 @@ public:
     virtual int rtti() const;
     // not const as this can create children on demand
     virtual TreeMapItemList *children();
+    // the children created so far, without creating any
+    TreeMapItemList *createdChildren() const
+    {
+        return _children;
+    }
+
+    /**
+     * Sum of the values of the children, and the number and value sum
+     * of the children with a value below *limit. Both are cached until
+     * the children change or are resorted, so call resort() when their
+     * values change. Only to be called when children() exist.
+     *
+     * Unless the children are sorted by value, *limit is rounded down
+     * to one of a few steps per doubling, so that the children are
+     * only counted again when it changes by some percent.
+     */
+    double childSum();
+    int smallChildren(double *limit, double *value);
+    // clear the rects of the children counted by smallChildren()
+    void clearSmallChildRects();
 
 protected:
     TreeMapItemList *_children;
@@ -466,6 +498,10 @@ private:
 
     // index of last active subitem
     int _index;
+
+    struct ChildCache;
+    void invalidateChildCache();
+    ChildCache *_childCache;
 };
 
 /**
@@ -662,6 +698,18 @@ public:
         return _minimalArea;
     }
 
+    /**
+     * Children which would get less than this area in pixels are
+     * drawn together as one area, without looking at them one by one.
+     * They are shown again when their parent gets larger, e.g. when
+     * zooming in. 0 disables this.
+     */
+    void setLodArea(int area);
+    int lodArea() const
+    {
+        return _lodArea;
+    }
+
     /* defaults for text attributes */
     QString defaultFieldType(int) const;
     QString defaultFieldStop(int) const;
@@ -788,7 +836,7 @@ public:
     }
 
     // internal
-    void drawTreeMap();
+    void drawTreeMap(const QRect &area = QRect());
 
     // used internally when items are destroyed
     void deletingItem(TreeMapItem *);
@@ -817,6 +865,12 @@ signals:
     void rightButtonPressed(TreeMapItem *, const QPoint &);
     void contextMenuRequested(TreeMapItem *, const QPoint &);
 
+    /**
+     * This signal is emitted when the areas of items were laid out
+     * anew, i.e. itemRect() of the items is up to date
+     */
+    void laidOut();
+
 protected:
     void mousePressEvent(QMouseEvent *) override;
     void contextMenuEvent(QContextMenuEvent *) override;
@@ -840,14 +894,19 @@ private:
                                       TreeMapItem *i2, bool selected);
     bool isTmpSelected(TreeMapItem *i);
 
-    void drawItem(QPainter *p, TreeMapItem *);
-    void drawItems(QPainter *p, TreeMapItem *);
-    bool horizontal(TreeMapItem *i, const QRect &r);
-    void drawFill(TreeMapItem *, QPainter *p, const QRect &r);
-    void drawFill(TreeMapItem *, QPainter *p, const QRect &r,
-                  TreeMapItemList *list, int idx, int len, bool goBack);
-    bool drawItemArray(QPainter *p, TreeMapItem *, const QRect &r, double,
-                       TreeMapItemList *list, int idx, int len, bool);
+    QRect baseRect() const;
+    void startLayout();
+    void takeSnapshot(TreeMapItem *root, const QRect &r, TreeMapSnapshot &s);
+    void addSnapshotNode(TreeMapSnapshot &s, TreeMapItem *i, double area,
+                         bool selected, bool current);
+    void addSnapshotAggregate(TreeMapSnapshot &s, int parent, int count,
+                              double value, double area);
+    int snapshotPixmap(const QPixmap &);
+    void layoutFinished(const TreeMapSnapshot &s, TreeMapLayout &layout);
+    void applyLayout(const TreeMapSnapshot &s, const TreeMapLayout &layout);
+    void compactPixmaps();
+    QPixmap tile(int x, int y);
+    void dropTiles(const QRect &r);
     bool resizeAttr(int);
 
     TreeMapItem *_base;
@@ -864,7 +923,7 @@ private:
 
     SelectionMode _selectionMode;
     TreeMapItem::SplitMode _splitMode;
-    int _visibleWidth, _stopArea, _minimalArea, _borderWidth;
+    int _visibleWidth, _stopArea, _minimalArea, _lodArea, _borderWidth;
     bool _reuseSpace, _skipIncorrectBorder, _drawSeparators, _shading;
     bool _allowRotation;
     bool _transparent[4], _drawFrame[4];
@@ -886,8 +945,21 @@ private:
     QFont _font;
     int _fontHeight;
 
-    // back buffer pixmap
-    QPixmap _pixmap;
+    // last layout, drawn into tiles of the widget
+    TreeMapLayout *_layout;
+    // for item(), of the rectangles set by the last layout
+    TreeMapHitIndex *_hitIndex;
+    QHash<QPoint, QPixmap> _tiles;
+    QSize _tilesSize;
+    // pixmaps of the fields in layouts
+    QVector<QPixmap> _pixmaps;
+    QHash<qint64, int> _pixmapIndex;
+
+    // layout being computed in _layoutPool
+    QThreadPool *_layoutPool;
+    bool _layoutRunning;
+    TreeMapItem *_layoutRoot;
+    QSet<TreeMapItem *> _deletedItems;
 };
 
 #endif
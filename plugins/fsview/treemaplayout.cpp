@@ -0,0 +1,865 @@
+/*
+    This file is part of the KDE project.
+
+    SPDX-FileCopyrightText: 2026 Konqueror Developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include "treemaplayout.h"
+
+#include <math.h>
+
+#include <QPainter>
+
+// fields of an item drawn at once by RectDrawing
+enum FieldMode { AllFields, ForcedFields, UnforcedFields };
+
+/*
+ * DrawParams of fields laid out before. Without pixmaps, only the
+ * space needed is known, which is enough for laying out.
+ */
+class FieldParams: public DrawParams
+{
+public:
+    FieldParams(const TreeMapField *fields, int count, const QFont &font,
+                const QColor &backColor, bool rotated,
+                const QVector<QPixmap> *pixmaps = nullptr)
+        : _fields(fields), _count(count), _font(font),
+          _backColor(backColor), _rotated(rotated), _pixmaps(pixmaps)
+    {
+    }
+
+    QString text(int f) const override
+    {
+        const TreeMapField *field = find(f);
+        return field ? field->text : QString();
+    }
+    QPixmap pixmap(int f) const override
+    {
+        const TreeMapField *field = find(f);
+        if (!field || field->pixmap < 0 || !_pixmaps) {
+            return QPixmap();
+        }
+        return _pixmaps->value(field->pixmap);
+    }
+    QSize pixmapSize(int f) const override
+    {
+        const TreeMapField *field = find(f);
+        return field ? field->pixmapSize : QSize();
+    }
+    Position position(int f) const override
+    {
+        const TreeMapField *field = find(f);
+        return field ? field->pos : Default;
+    }
+    int maxLines(int f) const override
+    {
+        const TreeMapField *field = find(f);
+        return field ? field->maxLines : 0;
+    }
+    QColor backColor() const override
+    {
+        return _backColor;
+    }
+    const QFont &font() const override
+    {
+        return _font;
+    }
+    bool rotated() const override
+    {
+        return _rotated;
+    }
+
+private:
+    const TreeMapField *find(int f) const
+    {
+        for (int i = 0; i < _count; i++) {
+            if (_fields[i].no == f) {
+                return _fields + i;
+            }
+        }
+        return nullptr;
+    }
+
+    const TreeMapField *_fields;
+    int _count;
+    const QFont &_font;
+    QColor _backColor;
+    bool _rotated;
+    const QVector<QPixmap> *_pixmaps;
+};
+
+TreeMapLayout::TreeMapLayout()
+{
+    _snapshot = nullptr;
+}
+
+void TreeMapLayout::compute(const TreeMapSnapshot &snapshot)
+{
+    _snapshot = &snapshot;
+    _font = snapshot.font;
+
+    _cells.clear();
+    _fields.clear();
+    _freeRects.clear();
+    _itemRects.fill(QRect(), snapshot.nodes.count());
+    _rotated.fill(false, snapshot.nodes.count());
+
+    if (!snapshot.nodes.isEmpty()) {
+        layoutItems(0, snapshot.rect);
+    }
+    _snapshot = nullptr;
+}
+
+void TreeMapLayout::clearResults()
+{
+    _itemRects.clear();
+    _rotated.clear();
+    _freeRects.clear();
+}
+
+bool TreeMapLayout::horizontal(const TreeMapSnapshot::Node &node, const QRect &r) const
+{
+    switch (node.splitMode) {
+    case TreeMapItem::HAlternate:
+        return (node.depth % 2) == 1;
+    case TreeMapItem::VAlternate:
+        return (node.depth % 2) == 0;
+    case TreeMapItem::Horizontal:
+        return true;
+    case TreeMapItem::Vertical:
+        return false;
+    default:
+        return r.width() > r.height();
+    }
+    return false;
+}
+
+void TreeMapLayout::addFreeRect(int n, const QRect &r)
+{
+    if ((r.width() < 1) || (r.height() < 1)) {
+        return;
+    }
+    _freeRects.append(qMakePair(n, r));
+}
+
+// fills area with a pattern if to small to draw children
+void TreeMapLayout::addFill(int n, const QRect &r)
+{
+    Cell cell;
+    cell.type = FillCell;
+    cell.rect = r;
+    cell.item = _snapshot->nodes[n].item;
+    _cells.append(cell);
+
+    addFreeRect(n, r);
+}
+
+void TreeMapLayout::addText(int n, const QRect &r, bool rotated, int mode)
+{
+    const TreeMapSnapshot::Node &node = _snapshot->nodes[n];
+    _rotated[n] = rotated;
+
+    Cell cell;
+    cell.type = TextCell;
+    cell.rect = r;
+    cell.item = node.item;
+    cell.backColor = node.backColor;
+    cell.rotated = rotated;
+    cell.firstField = _fields.count();
+    for (int f = 0; f < node.fieldCount; f++) {
+        const TreeMapField &field = _snapshot->fields[node.firstField + f];
+        if ((mode == ForcedFields && !field.forced) ||
+                (mode == UnforcedFields && field.forced)) {
+            continue;
+        }
+        _fields.append(field);
+    }
+    cell.fieldCount = _fields.count() - cell.firstField;
+    if (cell.fieldCount > 0) {
+        _cells.append(cell);
+    }
+}
+
+/**
+ * Lay out an item and its children recursive, as
+ * TreeMapWidget::drawItems() did
+ */
+void TreeMapLayout::layoutItems(int n, const QRect &origRect)
+{
+    const TreeMapSnapshot &s = *_snapshot;
+    const TreeMapSnapshot::Node &node = s.nodes[n];
+
+    _itemRects[n] = origRect;
+
+    const int itemCell = _cells.count();
+    Cell cell;
+    cell.rect = origRect;
+    cell.item = node.item;
+    cell.backColor = node.backColor;
+    cell.selected = node.selected;
+    cell.current = node.current;
+    cell.shaded = node.shaded;
+    cell.frame = node.frame;
+    cell.transparent = node.transparent;
+    _cells.append(cell);
+
+    int bw = node.borderWidth;
+    QRect r = QRect(origRect.x() + bw, origRect.y() + bw,
+                    origRect.width() - 2 * bw, origRect.height() - 2 * bw);
+
+    // only subdivide if there are children and enough space.
+    // Items at maximal depth or with a stop text are not expanded.
+    if (!node.expanded || node.childCount == 0 ||
+            r.width() <= 0 || r.height() <= 0) {
+        // tooltip appears on whole item rect
+        addFreeRect(n, origRect);
+
+        // many small items: hash pattern, as for areas too small to draw
+        if (node.aggregated > 0 && r.width() > 0 && r.height() > 0) {
+            Cell fill;
+            fill.type = FillCell;
+            fill.rect = r;
+            fill.item = node.item;
+            _cells.append(fill);
+        }
+
+        // if we have space for text...
+        if ((r.height() >= s.fontHeight) && (r.width() >= s.fontHeight)) {
+            addText(n, r, s.allowRotation && (r.height() > r.width()), AllFields);
+        }
+        _cells[itemCell].end = _cells.count();
+        return;
+    }
+
+    double user_sum, child_sum, self;
+
+    // user supplied sum
+    user_sum = node.sum;
+
+    // own sum
+    child_sum = 0;
+    for (int i = 0; i < node.childCount; i++) {
+        child_sum += s.nodes[node.firstChild + i].value;
+    }
+
+    QRect orig = r;
+
+    // if we have space for text...
+    if ((r.height() >= s.fontHeight) && (r.width() >= s.fontHeight)) {
+        bool rotated = s.allowRotation && (r.height() > r.width());
+
+        // forced texts take their space before the children
+        FieldParams dp(s.fields.constData() + node.firstField, node.fieldCount,
+                       s.font, node.backColor, rotated);
+        RectDrawing d(r);
+        for (int f = 0; f < node.fieldCount; f++) {
+            const TreeMapField &field = s.fields[node.firstField + f];
+            if (field.forced) {
+                d.drawField(nullptr, field.no, &dp);
+            }
+        }
+        addText(n, r, rotated, ForcedFields);
+        r = d.remainingRect(&dp);
+    }
+
+    if (orig.x() == r.x()) {
+        // Strings on top
+        addFreeRect(n, QRect(orig.x(), orig.y(),
+                             orig.width(), orig.height() - r.height()));
+    } else {
+        // Strings on the left
+        addFreeRect(n, QRect(orig.x(), orig.y(),
+                             orig.width() - r.width(), orig.height()));
+    }
+
+    if (user_sum == 0) {
+        // user did not supply any sum
+        user_sum = child_sum;
+        self = 0;
+    } else {
+        self = user_sum - child_sum;
+
+        if (user_sum < child_sum) {
+            // invalid user supplied sum: ignore and use calculate sum
+            user_sum = child_sum;
+            self = 0.0;
+        } else {
+            // Try to put the border waste in self
+            // percent of wasted space on border...
+            float borderArea = origRect.width() * origRect.height();
+            borderArea = (borderArea - r.width() * r.height()) / borderArea;
+            unsigned borderValue = (unsigned)(borderArea * user_sum);
+
+            if (borderValue > self) {
+                if (s.skipIncorrectBorder) {
+                    r = origRect;
+                    // should add my self to nested self and set my self =0
+                } else {
+                    self = 0.0;
+                }
+            } else {
+                self -= borderValue;
+            }
+
+            user_sum = child_sum + self;
+        }
+    }
+
+    bool rotate = (s.allowRotation && (r.height() > r.width()));
+    int self_length = (int)(((rotate) ? r.width() : r.height()) *
+                            self / user_sum + .5);
+    if (self_length > 0) {
+        // take space for self cost
+        QRect sr = r;
+        if (rotate) {
+            sr.setWidth(self_length);
+            r.setRect(r.x() + sr.width(), r.y(), r.width() - sr.width(), r.height());
+        } else {
+            sr.setHeight(self_length);
+            r.setRect(r.x(), r.y() + sr.height(), r.width(), r.height() - sr.height());
+        }
+
+        // set selfRect (not occupied by children) for tooltip
+        addFreeRect(n, sr);
+
+        if ((sr.height() >= s.fontHeight) && (sr.width() >= s.fontHeight)) {
+            addText(n, sr, s.allowRotation && (r.height() > r.width()), UnforcedFields);
+        }
+
+        user_sum -= self;
+    }
+
+    bool goBack = node.goBack;
+    int idx = goBack ? (node.childCount - 1) : 0;
+
+    if (node.splitMode == TreeMapItem::Columns) {
+        int len = node.childCount;
+        bool drawDetails = true;
+
+        while (len > 0 && user_sum > 0) {
+            int firstIdx = idx;
+            double valSum = 0;
+            int lenLeft = len;
+            int columns = (int)(sqrt((double)len * r.width() / r.height()) + .5);
+            if (columns == 0) {
+                columns = 1;    //should never be needed
+            }
+
+            while (lenLeft > 0 && ((double)valSum * (len - lenLeft) <
+                                   (double)len * user_sum / columns / columns)) {
+                valSum += s.nodes[node.firstChild + idx].value;
+                if (goBack) {
+                    --idx;
+                } else {
+                    ++idx;
+                }
+                lenLeft--;
+            }
+
+            // we always split horizontally
+            int nextPos = (int)((double)r.width() * valSum / user_sum);
+            QRect firstRect = QRect(r.x(), r.y(), nextPos, r.height());
+
+            if (nextPos < s.visibleWidth) {
+                // fill current rect or the rest with hash pattern
+                if (node.noSorting) {
+                    addFill(n, firstRect);
+                } else {
+                    addFill(n, r);
+                    break;
+                }
+            } else {
+                drawDetails = layoutItemArray(n, firstRect,
+                                              valSum, firstIdx, len - lenLeft, goBack);
+            }
+            r.setRect(r.x() + nextPos, r.y(), r.width() - nextPos, r.height());
+            user_sum -= valSum;
+            len = lenLeft;
+
+            if (!drawDetails) {
+                if (node.noSorting) {
+                    drawDetails = true;
+                } else {
+                    addFill(n, r);
+                    break;
+                }
+            }
+        }
+    } else if (node.splitMode == TreeMapItem::Rows) {
+        int len = node.childCount;
+        bool drawDetails = true;
+
+        while (len > 0 && user_sum > 0) {
+            int firstIdx = idx;
+            double valSum = 0;
+            int lenLeft = len;
+            int rows = (int)(sqrt((double)len * r.height() / r.width()) + .5);
+            if (rows == 0) {
+                rows = 1;    //should never be needed
+            }
+
+            while (lenLeft > 0 && ((double)valSum * (len - lenLeft) <
+                                   (double)len * user_sum / rows / rows)) {
+                valSum += s.nodes[node.firstChild + idx].value;
+                if (goBack) {
+                    --idx;
+                } else {
+                    ++idx;
+                }
+                lenLeft--;
+            }
+
+            // we always split horizontally
+            int nextPos = (int)((double)r.height() * valSum / user_sum);
+            QRect firstRect = QRect(r.x(), r.y(), r.width(), nextPos);
+
+            if (nextPos < s.visibleWidth) {
+                if (node.noSorting) {
+                    addFill(n, firstRect);
+                } else {
+                    addFill(n, r);
+                    break;
+                }
+            } else {
+                drawDetails = layoutItemArray(n, firstRect,
+                                              valSum, firstIdx, len - lenLeft, goBack);
+            }
+            r.setRect(r.x(), r.y() + nextPos, r.width(), r.height() - nextPos);
+            user_sum -= valSum;
+            len = lenLeft;
+
+            if (!drawDetails) {
+                if (node.noSorting) {
+                    drawDetails = true;
+                } else {
+                    addFill(n, r);
+                    break;
+                }
+            }
+        }
+    } else {
+        layoutItemArray(n, r, user_sum, idx, node.childCount, goBack);
+    }
+
+    _cells[itemCell].end = _cells.count();
+}
+
+// returns false if rect gets to small
+bool TreeMapLayout::layoutItemArray(int n, const QRect &r, double user_sum,
+                                    int idx, int len, bool goBack)
+{
+    if (user_sum == 0) {
+        return false;
+    }
+
+    const TreeMapSnapshot &s = *_snapshot;
+    const TreeMapSnapshot::Node &node = s.nodes[n];
+    const bool b2t = true;
+
+    // stop recursive bisection for small rectangles
+    if (((r.height() < s.visibleWidth) &&
+            (r.width() < s.visibleWidth)) ||
+            ((s.minimalArea > 0) &&
+             (r.width() * r.height() < s.minimalArea))) {
+
+        addFill(n, r);
+        return false;
+    }
+
+    if (len > 2 && (node.splitMode == TreeMapItem::Bisection)) {
+
+        int firstIdx = idx;
+        double valSum = 0;
+        int lenLeft = len;
+        while (lenLeft > len / 2) {
+            valSum += s.nodes[node.firstChild + idx].value;
+            if (goBack) {
+                --idx;
+            } else {
+                ++idx;
+            }
+            lenLeft--;
+        }
+
+        // first half...
+        bool drawOn;
+        QRect secondRect;
+
+        if (r.width() > r.height()) {
+            int halfPos = (int)((double)r.width() * valSum / user_sum);
+            QRect firstRect = QRect(r.x(), r.y(), halfPos, r.height());
+            drawOn = layoutItemArray(n, firstRect,
+                                     valSum, firstIdx, len - lenLeft, goBack);
+            secondRect.setRect(r.x() + halfPos, r.y(), r.width() - halfPos, r.height());
+        } else {
+            int halfPos = (int)((double)r.height() * valSum / user_sum);
+            QRect firstRect = QRect(r.x(), r.y(), r.width(), halfPos);
+            drawOn = layoutItemArray(n, firstRect,
+                                     valSum, firstIdx, len - lenLeft, goBack);
+            secondRect.setRect(r.x(), r.y() + halfPos, r.width(), r.height() - halfPos);
+        }
+
+        // if no sorting, do not stop drawing
+        if (node.noSorting) {
+            drawOn = true;
+        }
+
+        // second half
+        if (drawOn) {
+            drawOn = layoutItemArray(n, secondRect, user_sum - valSum,
+                                     idx, lenLeft, goBack);
+        } else {
+            addFill(n, secondRect);
+        }
+
+        return drawOn;
+    }
+
+    bool hor = horizontal(node, r);
+
+    QRect fullRect = r;
+    while (len > 0) {
+        const int child = node.firstChild + idx;
+        if (user_sum <= 0) {
+            // no rectangle for the child
+            if (goBack) {
+                --idx;
+            } else {
+                ++idx;
+            }
+            len--;
+            continue;
+        }
+
+        // stop drawing for small rectangles
+        if (((fullRect.height() < s.visibleWidth) &&
+                (fullRect.width() < s.visibleWidth)) ||
+                ((s.minimalArea > 0) &&
+                 (fullRect.width() * fullRect.height() < s.minimalArea))) {
+
+            addFill(n, fullRect);
+            return false;
+        }
+
+        if (s.nodes[child].splitMode == TreeMapItem::AlwaysBest) {
+            hor = fullRect.width() > fullRect.height();
+        }
+
+        int lastPos = hor ? fullRect.width() : fullRect.height();
+        double val = s.nodes[child].value;
+        int nextPos = (user_sum <= 0.0) ? 0 : (int)(lastPos * val / user_sum + .5);
+        if (nextPos > lastPos) {
+            nextPos = lastPos;
+        }
+
+        if (!node.noSorting && (nextPos < s.visibleWidth)) {
+            addFill(n, fullRect);
+            return false;
+        }
+
+        QRect currRect = fullRect;
+
+        if (hor) {
+            currRect.setWidth(nextPos);
+        } else {
+            if (b2t) {
+                currRect.setRect(fullRect.x(), fullRect.bottom() - nextPos + 1, fullRect.width(), nextPos);
+            } else {
+                currRect.setHeight(nextPos);
+            }
+        }
+
+        // do not draw very small rectangles:
+        if (nextPos >= s.visibleWidth) {
+            layoutItems(child, currRect);
+        } else {
+            addFill(n, currRect);
+        }
+
+        // Separator
+        if (s.drawSeparators && (nextPos < lastPos)) {
+            Cell separator;
+            separator.type = SeparatorCell;
+            separator.item = node.item;
+            if (hor) {
+                if (fullRect.top() <= fullRect.bottom()) {
+                    separator.rect = QRect(QPoint(fullRect.x() + nextPos, fullRect.top()),
+                                           QPoint(fullRect.x() + nextPos, fullRect.bottom()));
+                    _cells.append(separator);
+                }
+            } else {
+                if (fullRect.left() <= fullRect.right()) {
+                    separator.rect = QRect(QPoint(fullRect.left(), fullRect.y() + nextPos),
+                                           QPoint(fullRect.right(), fullRect.y() + nextPos));
+                    _cells.append(separator);
+                }
+            }
+            nextPos++;
+        }
+
+        if (hor)
+            fullRect.setRect(fullRect.x() + nextPos, fullRect.y(),
+                             lastPos - nextPos, fullRect.height());
+        else {
+            if (b2t)
+                fullRect.setRect(fullRect.x(), fullRect.y(),
+                                 fullRect.width(), lastPos - nextPos);
+            else
+                fullRect.setRect(fullRect.x(), fullRect.y() + nextPos,
+                                 fullRect.width(), lastPos - nextPos);
+        }
+
+        user_sum -= val;
+        if (goBack) {
+            --idx;
+        } else {
+            ++idx;
+        }
+        len--;
+    }
+
+    return true;
+}
+
+void TreeMapLayout::draw(QPainter *p, const QRect &clip,
+                         const QVector<QPixmap> &pixmaps) const
+{
+    int i = 0;
+    while (i < _cells.count()) {
+        const Cell &cell = _cells[i];
+        if (!cell.rect.intersects(clip)) {
+            // children are inside of an item
+            i = (cell.type == ItemCell) ? cell.end : i + 1;
+            continue;
+        }
+
+        switch (cell.type) {
+        case ItemCell:
+            if (!cell.transparent) {
+                StoredDrawParams dp(cell.backColor, cell.selected, cell.current);
+                dp.setShaded(cell.shaded);
+                dp.drawFrame(cell.frame);
+                RectDrawing d(cell.rect);
+                d.drawBack(p, &dp);
+            }
+            break;
+
+        case TextCell: {
+            FieldParams dp(_fields.constData() + cell.firstField, cell.fieldCount,
+                           _font, cell.backColor, cell.rotated, &pixmaps);
+            RectDrawing d(cell.rect);
+            for (int f = 0; f < cell.fieldCount; f++) {
+                d.drawField(p, _fields[cell.firstField + f].no, &dp);
+            }
+            break;
+        }
+
+        case FillCell:
+            p->setBrush(Qt::Dense4Pattern);
+            p->setPen(Qt::NoPen);
+            p->drawRect(QRect(cell.rect.x(), cell.rect.y(),
+                              cell.rect.width() - 1, cell.rect.height() - 1));
+            break;
+
+        case SeparatorCell:
+            p->setPen(Qt::black);
+            p->drawLine(cell.rect.topLeft(), cell.rect.bottomRight());
+            break;
+        }
+        i++;
+    }
+}
+
+bool TreeMapLayout::replace(const TreeMapLayout &other)
+{
+    if (other.isEmpty()) {
+        return false;
+    }
+
+    const Cell &root = other._cells.first();
+    int first = -1;
+    for (int i = 0; i < _cells.count(); i++) {
+        const Cell &cell = _cells[i];
+        if (cell.type == ItemCell && cell.item == root.item && cell.rect == root.rect) {
+            first = i;
+            break;
+        }
+    }
+    if (first < 0) {
+        return false;
+    }
+
+    const int last = _cells[first].end;
+    const int delta = other._cells.count() - (last - first);
+    const int fieldOffset = _fields.count();
+
+    QVector<Cell> cells;
+    cells.reserve(_cells.count() + delta);
+    for (int i = 0; i < first; i++) {
+        Cell cell = _cells[i];
+        // the items containing the replaced one
+        if (cell.type == ItemCell && cell.end > first) {
+            cell.end += delta;
+        }
+        cells.append(cell);
+    }
+    for (Cell cell : other._cells) {
+        if (cell.type == ItemCell) {
+            cell.end += first;
+        }
+        cell.firstField += fieldOffset;
+        cells.append(cell);
+    }
+    for (int i = last; i < _cells.count(); i++) {
+        Cell cell = _cells[i];
+        if (cell.type == ItemCell) {
+            cell.end += delta;
+        }
+        cells.append(cell);
+    }
+    _cells = cells;
+    _fields += other._fields;
+
+    // the fields of the replaced cells are unused now
+    int used = 0;
+    for (const Cell &cell : std::as_const(_cells)) {
+        used += cell.fieldCount;
+    }
+    if (_fields.count() > 2 * used + 1024) {
+        QVector<TreeMapField> fields;
+        fields.reserve(used);
+        for (Cell &cell : _cells) {
+            const int firstField = fields.count();
+            for (int f = 0; f < cell.fieldCount; f++) {
+                fields.append(_fields[cell.firstField + f]);
+            }
+            cell.firstField = firstField;
+        }
+        _fields = fields;
+    }
+    return true;
+}
+
+void TreeMapLayout::remapPixmaps(const QVector<int> &map)
+{
+    for (TreeMapField &field : _fields) {
+        if (field.pixmap >= 0) {
+            field.pixmap = map.value(field.pixmap, -1);
+        }
+    }
+}
+
+// TreeMapHitIndex
+
+// Pixels per side of the cells of the grid
+static const int s_hitCellSize = 16;
+
+TreeMapHitIndex::TreeMapHitIndex()
+{
+    _valid = false;
+    _base = nullptr;
+    _cellSize = s_hitCellSize;
+    _columns = 0;
+    _rows = 0;
+}
+
+int TreeMapHitIndex::cellIndex(int x, int y) const
+{
+    return (y - _area.top()) / _cellSize * _columns + (x - _area.left()) / _cellSize;
+}
+
+void TreeMapHitIndex::build(TreeMapItem *base, const QRect &area)
+{
+    _valid = true;
+    _base = base;
+    _area = area;
+    _entries.clear();
+    _cellEntries.clear();
+    _columns = area.isEmpty() ? 0 : (area.width() + _cellSize - 1) / _cellSize;
+    _rows = area.isEmpty() ? 0 : (area.height() + _cellSize - 1) / _cellSize;
+    _cellStart.fill(0, _columns * _rows + 1);
+    if (!base || _columns == 0) {
+        return;
+    }
+
+    // breadth-first, so parents come before their children. Children
+    // not created yet have no rectangle, and neither have their children.
+    auto addChildren = [this](TreeMapItem *item, int entry) {
+        const TreeMapItemList *list = item->createdChildren();
+        if (!list) {
+            return;
+        }
+        for (int idx = 0; idx < list->count(); idx++) {
+            TreeMapItem *i = list->at(idx);
+            if (i->itemRect().isValid()) {
+                _entries.append({i->itemRect(), i, entry, idx});
+            }
+        }
+    };
+    addChildren(base, -1);
+    for (int e = 0; e < _entries.count(); e++) {
+        addChildren(_entries.at(e).item, e);
+    }
+
+    // count the entries of every cell, then fill them in
+    for (int pass = 0; pass < 2; pass++) {
+        QVector<int> next;
+        if (pass == 1) {
+            for (int c = 0; c < _columns * _rows; c++) {
+                _cellStart[c + 1] += _cellStart[c];
+            }
+            _cellEntries.resize(_cellStart.last());
+            next = _cellStart;
+        }
+        for (int e = 0; e < _entries.count(); e++) {
+            const QRect r = _entries.at(e).rect.intersected(area);
+            if (r.isEmpty()) {
+                continue;
+            }
+            const int x1 = (r.right() - area.left()) / _cellSize;
+            const int y1 = (r.bottom() - area.top()) / _cellSize;
+            for (int y = (r.top() - area.top()) / _cellSize; y <= y1; y++) {
+                for (int x = (r.left() - area.left()) / _cellSize; x <= x1; x++) {
+                    const int c = y * _columns + x;
+                    if (pass == 0) {
+                        _cellStart[c + 1]++;
+                    } else {
+                        _cellEntries[next[c]++] = e;
+                    }
+                }
+            }
+        }
+    }
+}
+
+TreeMapItem *TreeMapHitIndex::item(const QPoint &p) const
+{
+    if (!_area.contains(p)) {
+        return nullptr;
+    }
+
+    const int c = cellIndex(p.x(), p.y());
+    for (int k = _cellStart[c + 1] - 1; k >= _cellStart[c]; k--) {
+        const int e = _cellEntries[k];
+        if (!_entries[e].rect.contains(p)) {
+            continue;
+        }
+        // found by looking it up in the tree only if all parents contain p
+        int parent = _entries[e].parent;
+        while (parent >= 0 && _entries[parent].rect.contains(p)) {
+            parent = _entries[parent].parent;
+        }
+        if (parent >= 0) {
+            continue;
+        }
+
+        for (int i = e; i >= 0; i = _entries[i].parent) {
+            parent = _entries[i].parent;
+            (parent >= 0 ? _entries[parent].item : _base)->setIndex(_entries[i].index);
+        }
+        return _entries[e].item;
+    }
+    return nullptr;
+}
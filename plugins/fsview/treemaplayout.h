@@ -0,0 +1,233 @@
+/*
+    This file is part of the KDE project.
+
+    SPDX-FileCopyrightText: 2026 Konqueror Developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+/*
+ * Layout of the areas of a TreeMapWidget, apart from drawing them
+ */
+
+#ifndef TREEMAPLAYOUT_H
+#define TREEMAPLAYOUT_H
+
+#include <QColor>
+#include <QFont>
+#include <QPair>
+#include <QRect>
+#include <QSize>
+#include <QString>
+#include <QVector>
+
+#include "treemap.h"
+
+class QPainter;
+
+/**
+ * A text field of an item, as drawn by RectDrawing::drawField().
+ */
+struct TreeMapField {
+    int no;
+    QString text;
+    int pixmap; // index into the pixmaps of the widget, or -1
+    QSize pixmapSize;
+    DrawParams::Position pos;
+    int maxLines;
+    bool forced;
+};
+
+/**
+ * The items to lay out, copied from the TreeMapItem tree in the GUI
+ * thread. The layout can then be computed in another thread, while
+ * the items change.
+ *
+ * The first node is the item to lay out, into rect. Children of a
+ * node are stored one after the other, in the order of
+ * TreeMapItem::children(). Nodes too small to show their children
+ * are not expanded, and small children can be aggregated into one node.
+ */
+class TreeMapSnapshot
+{
+public:
+    struct Node {
+        TreeMapItem *item; // not to be used outside of the GUI thread
+        double value, sum;
+        int depth, borderWidth;
+        TreeMapItem::SplitMode splitMode;
+        bool noSorting, goBack;
+        bool expanded;
+        // for an area of many small children of item: their number
+        int aggregated;
+        int firstChild, childCount;
+        int firstField, fieldCount;
+        QColor backColor;
+        bool selected, current, shaded, frame, transparent;
+    };
+
+    QVector<Node> nodes;
+    QVector<TreeMapField> fields;
+
+    QRect rect;
+    QFont font;
+    int fontHeight;
+    int visibleWidth, minimalArea;
+    bool skipIncorrectBorder, drawSeparators, allowRotation;
+};
+
+/**
+ * Rectangles of the items of a TreeMapSnapshot, and a flat list of
+ * what to draw for them, in drawing order.
+ *
+ * compute() does what TreeMapWidget did while drawing, without
+ * touching the items, so it can run in any thread. The cells can then
+ * be drawn in parts, e.g. into tiles, as often as needed.
+ */
+class TreeMapLayout
+{
+public:
+    enum CellType { ItemCell, TextCell, FillCell, SeparatorCell };
+
+    struct Cell {
+        CellType type = ItemCell;
+        // for SeparatorCell the line from topLeft() to bottomRight()
+        QRect rect;
+        // ItemCell: the cells up to end are drawn inside of rect
+        int end = 0;
+        TreeMapItem *item = nullptr;
+        QColor backColor;
+        bool selected = false, current = false, shaded = false;
+        bool frame = false, transparent = false;
+        // TextCell: drawn fields
+        bool rotated = false;
+        int firstField = 0, fieldCount = 0;
+    };
+
+    TreeMapLayout();
+
+    void compute(const TreeMapSnapshot &snapshot);
+
+    bool isEmpty() const
+    {
+        return _cells.isEmpty();
+    }
+    /* The rectangle of the item laid out */
+    QRect rect() const
+    {
+        return _cells.isEmpty() ? QRect() : _cells.first().rect;
+    }
+    const QVector<Cell> &cells() const
+    {
+        return _cells;
+    }
+
+    /* Results per node of the snapshot, to be set into the items */
+    const QVector<QRect> &itemRects() const
+    {
+        return _itemRects;
+    }
+    const QVector<bool> &rotated() const
+    {
+        return _rotated;
+    }
+    const QVector<QPair<int, QRect>> &freeRects() const
+    {
+        return _freeRects;
+    }
+
+    /* Draw the cells intersecting clip. pixmaps are the ones referred
+     * to by the fields. Only to be called in the GUI thread. */
+    void draw(QPainter *p, const QRect &clip, const QVector<QPixmap> &pixmaps) const;
+
+    /* Replace the cells of the item laid out by other with the ones
+     * of other. Returns false if that item isn't in this layout. */
+    bool replace(const TreeMapLayout &other);
+
+    /* Change the pixmap indexes of the fields to the ones of map,
+     * which is indexed by the old ones */
+    void remapPixmaps(const QVector<int> &map);
+    const QVector<TreeMapField> &fields() const
+    {
+        return _fields;
+    }
+
+    /* Drop the results per node, once they are set into the items */
+    void clearResults();
+
+private:
+    void layoutItems(int n, const QRect &rect);
+    bool layoutItemArray(int n, const QRect &r, double user_sum,
+                         int idx, int len, bool goBack);
+    void addFill(int n, const QRect &r);
+    void addText(int n, const QRect &r, bool rotated, int mode);
+    bool horizontal(const TreeMapSnapshot::Node &node, const QRect &r) const;
+    void addFreeRect(int n, const QRect &r);
+
+    const TreeMapSnapshot *_snapshot;
+
+    QVector<Cell> _cells;
+    QVector<TreeMapField> _fields;
+    QFont _font;
+
+    QVector<QRect> _itemRects;
+    QVector<bool> _rotated;
+    QVector<QPair<int, QRect>> _freeRects;
+};
+
+/**
+ * Uniform grid over the rectangles of the items of a TreeMapWidget,
+ * as set by the last layout, to find the item at a point without
+ * going through the children of every item above it.
+ *
+ * Every cell of the grid lists the items intersecting it, parents
+ * before their children. As the areas of siblings don't overlap, the
+ * last one containing a point is the deepest item there.
+ */
+class TreeMapHitIndex
+{
+public:
+    TreeMapHitIndex();
+
+    /* Index the items below base with a rectangle, within area */
+    void build(TreeMapItem *base, const QRect &area);
+    /* Items will change or be deleted: build again before use */
+    void invalidate()
+    {
+        _valid = false;
+    }
+    bool isValid() const
+    {
+        return _valid;
+    }
+    QRect area() const
+    {
+        return _area;
+    }
+
+    /* The deepest item containing p, or nullptr. Sets the index of
+     * its parents to the child containing p, like looking it up in
+     * the tree did. */
+    TreeMapItem *item(const QPoint &p) const;
+
+private:
+    struct Entry {
+        QRect rect;
+        TreeMapItem *item;
+        int parent; // entry of the parent, or -1
+        int index;  // in the children of the parent
+    };
+
+    int cellIndex(int x, int y) const;
+
+    bool _valid;
+    QRect _area;
+    TreeMapItem *_base;
+    int _cellSize, _columns, _rows;
+    QVector<Entry> _entries;
+    // entries of cell c are _cellEntries[_cellStart[c]] up to _cellStart[c+1]
+    QVector<int> _cellStart;
+    QVector<int> _cellEntries;
+};
+
+#endif // TREEMAPLAYOUT_H
@@ -13,6 +13,7 @@
 #include <QDBusConnection>
 #include <QDBusMessage>
 #include <QCheckBox>
+#include <QGroupBox>
 #include <QLabel>
 #include <QTreeView>
 #include <QWhatsThis>
@@ -51,6 +52,30 @@ KCMFilter::KCMFilter(QObject *parent, const KPluginMetaData &md, const QVariantL
     mKillCheck = new QCheckBox(i18n("Hide filtered images"), widget());
     topLayout->addWidget(mKillCheck);
 
+    /** which requests are filtered, read by WebEngineSettings */
+    mTypeBox = new QGroupBox(i18n("Filter Requests For"), widget());
+    topLayout->addWidget(mTypeBox);
+    QGridLayout *typeGrid = new QGridLayout(mTypeBox);
+    const QList<QPair<QString, QString>> types = {
+        {QStringLiteral("FilterImages"), i18n("Images")},
+        {QStringLiteral("FilterScripts"), i18n("Scripts")},
+        {QStringLiteral("FilterStylesheets"), i18n("Style sheets")},
+        {QStringLiteral("FilterFrames"), i18n("Frames")},
+        {QStringLiteral("FilterConnections"), i18n("Connections opened by scripts")},
+        {QStringLiteral("FilterMedia"), i18n("Audio, video and plugins")},
+        {QStringLiteral("FilterFonts"), i18n("Fonts")},
+        {QStringLiteral("FilterPages"), i18n("Pages of other sites")},
+        {QStringLiteral("FilterOther"), i18n("Other")},
+    };
+    for (int i = 0; i < types.count(); ++i) {
+        QCheckBox *check = new QCheckBox(types.at(i).second, mTypeBox);
+        typeGrid->addWidget(check, i / 3, i % 3);
+        connect(check, &QAbstractButton::clicked, this, [this]() {
+            setNeedsSave(true);
+        });
+        mTypeChecks.insert(types.at(i).first, check);
+    }
+
     mFilterWidget = new QTabWidget(widget());
     topLayout->addWidget(mFilterWidget);
 
@@ -155,14 +180,14 @@ KCMFilter::KCMFilter(QObject *parent, const KPluginMetaData &md, const QVariantL
                                     "should be defined in the filter list for blocking to take effect."));
     mKillCheck->setToolTip(i18n("When enabled blocked images will be removed from the page completely, "
                                   "otherwise a placeholder 'blocked' image will be used."));
+    mTypeBox->setToolTip(i18n("The kinds of requests the filters are applied to. Pages are only blocked "
+                              "by filters for pages, like <tt>||example.com^$document</tt>, and never "
+                              "when following a link within a site."));
 
     // The list is no longer sensitive to order, because of the new hashed
     // matching.  So this tooltip doesn't imply that.
-    //
-    // FIXME: blocking of frames is not currently implemented by KHTML
-    mListBox->setToolTip(i18n("This is the list of URL filters that will be applied to all embedded "
-                                "images and media objects."));
-    //                              "images, objects and frames.") );
+    mListBox->setToolTip(i18n("This is the list of URL filters that will be applied to the requests "
+                                "of the kinds selected above."));
 
     mString->setToolTip(i18n("<qt><p>Enter an expression to filter. Filters can be defined as either:"
                                "<ul><li>a shell-style wildcard, e.g. <tt>http://www.example.com/ads*</tt>, the wildcards <tt>*?[]</tt> may be used</li>"
@@ -235,6 +260,7 @@ void KCMFilter::updateButton()
     mListBox->setEnabled(state);
     mString->setEnabled(state);
     mKillCheck->setEnabled(state);
+    mTypeBox->setEnabled(state);
 
     if (filterEdited) {
         if (mSelCount == 1 && mUpdateButton->isEnabled()) {
@@ -322,6 +348,9 @@ void KCMFilter::defaults()
     mListBox->clear();
     mEnableCheck->setChecked(false);
     mKillCheck->setChecked(false);
+    for (QCheckBox *check : std::as_const(mTypeChecks)) {
+        check->setChecked(true);
+    }
     mString->clear();
     updateButton();
     setRepresentsDefaults(true);
@@ -335,6 +364,9 @@ void KCMFilter::save()
 
     cg.writeEntry("Enabled", mEnableCheck->isChecked());
     cg.writeEntry("Shrink", mKillCheck->isChecked());
+    for (auto it = mTypeChecks.constBegin(); it != mTypeChecks.constEnd(); ++it) {
+        cg.writeEntry(it.key(), it.value()->isChecked());
+    }
 
     int i;
     for (i = 0; i < mListBox->count(); ++i) {
@@ -367,6 +399,9 @@ void KCMFilter::load()
 
     mEnableCheck->setChecked(cg.readEntry("Enabled", false));
     mKillCheck->setChecked(cg.readEntry("Shrink", false));
+    for (auto it = mTypeChecks.constBegin(); it != mTypeChecks.constEnd(); ++it) {
+        it.value()->setChecked(cg.readEntry(it.key(), true));
+    }
 
     QMap<QString, QString> entryMap = cg.entryMap();
     QMap<QString, QString>::ConstIterator it;
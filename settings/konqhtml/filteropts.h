@@ -7,6 +7,7 @@
 #define FILTEROPTS_H
 
 #include <QAbstractItemModel>
+#include <QMap>
 #include <QTabWidget>
 
 #include <kcmodule.h>
@@ -16,6 +17,7 @@ class QListWidget;
 class QPushButton;
 class QLineEdit;
 class QCheckBox;
+class QGroupBox;
 class QTreeView;
 class KListWidgetSearchLine;
 class KPluralHandlingSpinBox;
@@ -89,6 +91,9 @@ private:
     QLineEdit *mString;
     QCheckBox *mEnableCheck;
     QCheckBox *mKillCheck;
+    QGroupBox *mTypeBox;
+    // by their keys in the configuration
+    QMap<QString, QCheckBox *> mTypeChecks;
     QPushButton *mInsertButton;
     QPushButton *mUpdateButton;
     QPushButton *mRemoveButton;
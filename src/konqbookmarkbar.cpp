@@ -146,6 +146,7 @@ void KBookmarkBar::fillBookmarkBar(const KBookmarkGroup &parent)
         return;
     }
 
+    QList<QUrl> hosts;
     for (KBookmark bm = parent.first(); !bm.isNull(); bm = parent.next(bm)) {
         // Filtered special cases
         if (d->m_filteredToolbar) {
@@ -174,7 +175,7 @@ void KBookmarkBar::fillBookmarkBar(const KBookmarkGroup &parent)
                     connect(KonqPixmapProvider::self(), &KonqPixmapProvider::changed, action, [host, action]() {
                         action->setIcon(KonqPixmapProvider::self()->iconForUrl(host));
                     });
-                KonqPixmapProvider::self()->downloadHostIcon(host);
+                hosts.append(host);
             }
         } else {
             KBookmarkActionMenu *action = new KBookmarkActionMenu(bm, nullptr);
@@ -187,6 +188,7 @@ void KBookmarkBar::fillBookmarkBar(const KBookmarkGroup &parent)
             m_lstSubMenus.append(menu);
         }
     }
+    KonqPixmapProvider::self()->downloadAll(hosts);
 }
 
 void KBookmarkBar::removeTempSep()
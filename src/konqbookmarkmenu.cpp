@@ -105,7 +105,7 @@ void Konqueror::KonqBookmarkMenu::startFillingFavicons()
         }
     }
     connect(KonqPixmapProvider::self(), &KonqPixmapProvider::changed, this, &Konqueror::KonqBookmarkMenu::fillFavicons);
-    KonqPixmapProvider::self()->downloadHostIcons(urls);
+    KonqPixmapProvider::self()->downloadAll(urls);
 }
 
 void Konqueror::KonqBookmarkMenu::fillFavicons()
@@ -18,6 +18,9 @@
 #include <QListWidgetItem>
 #include <QEvent>
 #include <QMimeData>
+#include <QTimer>
+#include <QAbstractItemView>
+#include <QScrollBar>
 
 // KDE
 #include <kconfig.h>
@@ -40,18 +43,27 @@
 #include "konqhistorymanager.h"
 
 KConfig *KonqCombo::s_config = nullptr;
+QTimer *KonqCombo::s_syncTimer = nullptr;
 const int KonqCombo::temporary = 0;
 
+// Set on items whose title and icon have been looked up
+static const int s_resolvedRole = Qt::UserRole + 1;
+// Delay before writing the combo config file after a change, in milliseconds
+static const int s_syncDelay = 2000;
+// The cache only needs to hold the urls currently in the combo, this is plenty
+static const int s_maxCachedItems = 200;
+
 static QString titleOfURL(const QString &urlStr)
 {
     QUrl url(QUrl::fromUserInput(urlStr));
-    const KonqHistoryList &historylist = KonqHistoryManager::kself()->entries();
-    KonqHistoryList::const_iterator historyentry = historylist.constFindEntry(url);
+    KonqHistoryManager *mgr = KonqHistoryManager::kself();
+    const KonqHistoryList &historylist = mgr->entries();
+    KonqHistoryList::const_iterator historyentry = mgr->constFindEntry(url);
     if (historyentry == historylist.constEnd() && !url.url().endsWith('/')) {
         if (!url.path().endsWith('/')) {
             url.setPath(url.path() + '/');
         }
-        historyentry = historylist.constFindEntry(url);
+        historyentry = mgr->constFindEntry(url);
     }
     return historyentry != historylist.end() ? (*historyentry).title : QString();
 }
@@ -142,6 +154,7 @@ KonqCombo::KonqCombo(QWidget *parent)
     slotCompletionModeChanged(completionMode());
 
     connect(KonqHistoryManager::kself(), &HistoryProvider::cleared, this, &KonqCombo::slotCleared);
+    connect(view()->verticalScrollBar(), &QScrollBar::valueChanged, this, &KonqCombo::resolveVisibleItems);
     connect(this, &KHistoryComboBox::cleared, this, &KonqCombo::slotCleared);
     // The overload resolution is still needed until QComboBox::highlight(QString)
     // is either removed or hidden.
@@ -198,7 +211,7 @@ void KonqCombo::setURL(const QString &url)
 
 void KonqCombo::setTemporary(const QString &text)
 {
-    setTemporary(text, KonqPixmapProvider::self()->pixmapFor(text, KIconLoader::SizeSmall));
+    setTemporary(text, cachedPixmap(text));
 }
 
 void KonqCombo::setTemporary(const QString &url, const QPixmap &pix)
@@ -264,7 +277,7 @@ void KonqCombo::applyPermanent()
         }
 
         QString item = temporaryItem();
-        insertItem(KonqPixmapProvider::self()->pixmapFor(item, KIconLoader::SizeSmall), item, 1, titleOfURL(item));
+        insertItem(cachedPixmap(item), item, 1, titleOfURL(item));
         //qCDebug(KONQUEROR_LOG) << url;
 
         // Remove all duplicates starting from index = 2
@@ -281,6 +294,14 @@ void KonqCombo::insertItem(const QString &text, int index, const QString &title)
 void KonqCombo::insertItem(const QPixmap &pixmap, const QString &text, int index, const QString &title)
 {
     KHistoryComboBox::insertItem(index, pixmap, text, title);
+    // insertItem() prepends for a negative index and appends for a too large one,
+    // find out where the item actually went
+    if (index < 0) {
+        index = 0;
+    } else if (index >= count()) {
+        index = count() - 1;
+    }
+    setItemData(index, true, s_resolvedRole);
 }
 
 void KonqCombo::updateItem(const QPixmap &pix, const QString &t, int index, const QString &title)
@@ -296,6 +317,7 @@ void KonqCombo::updateItem(const QPixmap &pix, const QString &t, int index, cons
     setItemText(index, t);
     setItemIcon(index, pix);
     setItemData(index, title);
+    setItemData(index, true, s_resolvedRole);
 
     update();
 }
@@ -327,17 +349,57 @@ void KonqCombo::updatePixmaps()
 {
     saveState();
 
+    m_pixmapCache.clear();
     setUpdatesEnabled(false);
-    KonqPixmapProvider *prov = KonqPixmapProvider::self();
     for (int i = 1; i < count(); i++) {
-        setItemIcon(i, prov->pixmapFor(itemText(i), KIconLoader::SizeSmall));
+        setItemData(i, false, s_resolvedRole);
     }
     setUpdatesEnabled(true);
-    repaint();
+    update();
 
     restoreState();
 }
 
+void KonqCombo::resolveItem(int index)
+{
+    if (index < 0 || index >= count() || itemData(index, s_resolvedRole).toBool()) {
+        return;
+    }
+
+    const QString url = itemText(index);
+    // first, as the changes below make the view repaint the item
+    setItemData(index, true, s_resolvedRole);
+    setItemIcon(index, cachedPixmap(url));
+    setItemData(index, titleOfURL(url));
+}
+
+void KonqCombo::resolveVisibleItems()
+{
+    QAbstractItemView *popupView = view();
+    const QRect visible = popupView->viewport()->rect();
+    const QModelIndex first = popupView->indexAt(visible.topLeft());
+    if (!first.isValid()) {
+        return;
+    }
+    const QModelIndex last = popupView->indexAt(visible.bottomLeft());
+    const int lastRow = last.isValid() ? last.row() : count() - 1;
+    for (int row = first.row(); row <= lastRow; ++row) {
+        resolveItem(row);
+    }
+}
+
+QPixmap KonqCombo::cachedPixmap(const QString &url)
+{
+    auto it = m_pixmapCache.constFind(url);
+    if (it == m_pixmapCache.constEnd()) {
+        if (m_pixmapCache.size() >= s_maxCachedItems) {
+            m_pixmapCache.clear();
+        }
+        it = m_pixmapCache.insert(url, KonqPixmapProvider::self()->pixmapFor(url, KIconLoader::SizeSmall));
+    }
+    return *it;
+}
+
 void KonqCombo::loadItems()
 {
     clear();
@@ -348,10 +410,10 @@ void KonqCombo::loadItems()
 
     KConfigGroup locationBarGroup(s_config, "Location Bar");
     const QStringList items = locationBarGroup.readPathEntry("ComboContents", QStringList());
+    // Titles and icons are looked up in resolveItem(), once the items are shown
     for (const QString &item : items) {
         if (!item.isEmpty()) {   // only insert non-empty items
-            insertItem(KonqPixmapProvider::self()->pixmapFor(item, KIconLoader::SizeSmall),
-                       item, i++, titleOfURL(item));
+            insertItem(item, i++);
         }
     }
 
@@ -362,10 +424,8 @@ void KonqCombo::loadItems()
 
 void KonqCombo::slotSetIcon(int index)
 {
-    if (itemIcon(index).isNull())
-        // on-demand icon loading
-        setItemIcon(index, KonqPixmapProvider::self()->pixmapFor(itemText(index),
-                    KIconLoader::SizeSmall));
+    // on-demand icon loading
+    resolveItem(index);
     update();
 }
 
@@ -382,14 +442,20 @@ void KonqCombo::getStyleOption(QStyleOptionComboBox *comboOpt)
 
 void KonqCombo::popup()
 {
-    for (int i = 0; i < count(); ++i) {
-        if (itemIcon(i).isNull()) {
-            // on-demand icon loading
-            setItemIcon(i, KonqPixmapProvider::self()->pixmapFor(itemText(i),
-                        KIconLoader::SizeSmall));
-        }
+    showPopup();
+}
+
+void KonqCombo::showPopup()
+{
+    // Resolving changes the model, so it can't wait until the items are painted.
+    // The popup shows the current item, resolve everything it could show around it.
+    const int current = qMax(0, currentIndex());
+    for (int i = qMax(0, current - maxVisibleItems()); i < qMin(count(), current + maxVisibleItems()); ++i) {
+        resolveItem(i);
     }
     KHistoryComboBox::showPopup();
+    // in case the popup shows more than we guessed, scrolling is taken care of in the constructor
+    resolveVisibleItems();
 }
 
 void KonqCombo::saveItems()
@@ -403,8 +469,23 @@ void KonqCombo::saveItems()
 
     KConfigGroup locationBarGroup(s_config, "Location Bar");
     locationBarGroup.writePathEntry("ComboContents", items);
-    KonqPixmapProvider::self()->save(locationBarGroup, QStringLiteral("ComboIconCache"), items);
 
+    if (!s_syncTimer) {
+        s_syncTimer = new QTimer(qApp);
+        s_syncTimer->setSingleShot(true);
+        s_syncTimer->setInterval(s_syncDelay);
+        connect(s_syncTimer, &QTimer::timeout, qApp, &KonqCombo::syncConfig);
+    }
+    s_syncTimer->start();
+}
+
+void KonqCombo::syncConfig()
+{
+    if (!s_config) {
+        return;
+    }
+    KConfigGroup locationBarGroup(s_config, "Location Bar");
+    KonqPixmapProvider::self()->save(locationBarGroup.readPathEntry("ComboContents", QStringList()));
     s_config->sync();
 }
 
@@ -606,6 +687,10 @@ void KonqCombo::slotActivated(const QString &text)
 
 void KonqCombo::setConfig(KConfig *kc)
 {
+    if (s_syncTimer && s_syncTimer->isActive()) {
+        s_syncTimer->stop();
+        syncConfig();
+    }
     s_config = kc;
 }
 
@@ -9,9 +9,12 @@
 
 #include <khistorycombobox.h>
 
+#include <QHash>
+#include <QPixmap>
+
 class QEvent;
 class QKeyEvent;
-class QPixmap;
+class QTimer;
 class KCompletion;
 class KConfig;
 
@@ -38,9 +41,26 @@ public:
 
     void insertPermanent(const QString &);
 
+    /**
+     * Makes the items look up their icons again, when they are shown next.
+     */
     void updatePixmaps();
 
+    /**
+     * Looks up the title and the icon of the item at @p index, unless that
+     * was done already. Called when the item is about to be shown, so that
+     * loading and opening the popup don't depend on the number of items.
+     */
+    void resolveItem(int index);
+
+    void showPopup() override;
+
     void loadItems();
+
+    /**
+     * Writes the items to the config. The config file itself is written a
+     * little later, so that several changes in a row only write it once.
+     */
     void saveItems();
 
     static void setConfig(KConfig *);
@@ -90,6 +110,12 @@ private:
         return itemText(temporary);
     }
     void removeDuplicates(int index);
+    QPixmap cachedPixmap(const QString &url);
+
+    /**
+     * Resolves the items currently visible in the popup, see resolveItem()
+     */
+    void resolveVisibleItems();
 
     bool m_returnPressed;
     bool m_permanent;
@@ -100,9 +126,18 @@ private:
     QPoint m_dragStart;
     int m_pageSecurity;
 
+    // Icons looked up for the urls shown in the combo
+    QHash<QString, QPixmap> m_pixmapCache;
+
     void getStyleOption(QStyleOptionComboBox *combo);
 
+    /**
+     * Writes the config file and the icons of the items saved by saveItems()
+     */
+    static void syncConfig();
+
     static KConfig *s_config;
+    static QTimer *s_syncTimer;
     static const int temporary; // the index of our temporary item
 };
 
@@ -0,0 +1,382 @@
+/*
+    This file is part of the KDE project.
+
+    SPDX-FileCopyrightText: 2026 Konqueror Developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include "konqcompletionindex.h"
+
+#include <QElapsedTimer>
+
+#include <algorithm>
+
+// Checking the clock for every candidate would cost more than the comparison itself
+static const int s_budgetCheckInterval = 64;
+
+/**
+ * @returns the length of the scheme of @p text, including the "://" or
+ * the ":" of "file:", or 0 if @p text has no scheme
+ */
+static int schemeLength(QStringView text)
+{
+    const int pos = text.indexOf(QLatin1String("://"));
+    if (pos > 0) {
+        bool isScheme = true;
+        for (int i = 0; i < pos && isScheme; ++i) {
+            const QChar c = text.at(i);
+            isScheme = c.isLetterOrNumber() || c == QLatin1Char('+') || c == QLatin1Char('-') || c == QLatin1Char('.');
+        }
+        if (isScheme) {
+            return pos + 3;
+        }
+    }
+    // people type /usr etc., so "file:/usr" and "/usr" are the same
+    if (text.startsWith(QLatin1String("file:"))) {
+        return 5;
+    }
+    return 0;
+}
+
+KonqCompletionIndex::KonqCompletionIndex()
+{
+}
+
+KonqCompletionIndex::~KonqCompletionIndex()
+{
+}
+
+QString KonqCompletionIndex::keyFor(const QString &text)
+{
+    QStringView key(text);
+    key = key.mid(schemeLength(key));
+    if (key.startsWith(QLatin1String("www."))) {
+        key = key.mid(4);
+    } else if (key.startsWith(QLatin1String("ftp.")) && (key.size() == text.size() || text.startsWith(QLatin1String("ftp://")))) {
+        // "ftp.kde.org" and "ftp://ftp.kde.org" are the same
+        key = key.mid(4);
+    }
+    if (key.size() > 1 && key.endsWith(QLatin1Char('/'))) {
+        key.chop(1);
+    }
+    return key.toString();
+}
+
+void KonqCompletionIndex::addItem(const QString &text, int weight, const QDateTime &lastVisited)
+{
+    const QString key = keyFor(text);
+    if (key.isEmpty()) {
+        return;
+    }
+
+    auto it = m_items.find(key);
+    if (it == m_items.end()) {
+        const int id = m_keys.count();
+        it = m_items.insert(key, Item{{}, id});
+        // sorted in one go by the next query, inserting each key in place would be quadratic
+        m_sortedKeys.append(key);
+        m_keys.append(key);
+        indexTrigrams(id);
+        // just visited, so among the best until the keys are ordered again
+        if (m_scoreDate.isValid()) {
+            m_byScore.prepend(id);
+            m_ranks.append(--m_firstRank);
+        }
+    }
+
+    for (Variant &variant : it->variants) {
+        if (variant.text == text) {
+            variant.weight = weight;
+            if (lastVisited.isValid()) {
+                variant.lastVisited = lastVisited;
+            }
+            return;
+        }
+    }
+    it->variants.append({text, weight, lastVisited});
+}
+
+void KonqCompletionIndex::removeItem(const QString &text)
+{
+    const QString key = keyFor(text);
+    auto it = m_items.find(key);
+    if (it == m_items.end()) {
+        return;
+    }
+
+    QList<Variant> &variants = it->variants;
+    variants.erase(std::remove_if(variants.begin(), variants.end(), [&text](const Variant &variant) {
+        return variant.text == text;
+    }), variants.end());
+
+    if (variants.isEmpty()) {
+        // dropped from the indexes in one go, removing many keys one by one would be quadratic
+        m_keys[it->id].clear();
+        ++m_removedCount;
+        m_removedSortedKeys = true;
+        m_items.erase(it);
+        if (m_removedCount > m_keys.count() / 2) {
+            compact();
+        }
+    }
+}
+
+void KonqCompletionIndex::clear()
+{
+    m_items.clear();
+    m_sortedKeys.clear();
+    m_sortedCount = 0;
+    m_removedSortedKeys = false;
+    m_keys.clear();
+    m_removedCount = 0;
+    m_trigrams.clear();
+    m_byScore.clear();
+    m_ranks.clear();
+    m_scoreDate = QDate();
+}
+
+void KonqCompletionIndex::sortKeys() const
+{
+    if (m_removedSortedKeys) {
+        const auto isRemoved = [this](const QString &key) {
+            return !m_items.contains(key);
+        };
+        const auto sortedEnd = std::remove_if(m_sortedKeys.begin(), m_sortedKeys.begin() + m_sortedCount, isRemoved);
+        const auto addedEnd = std::remove_if(m_sortedKeys.begin() + m_sortedCount, m_sortedKeys.end(), isRemoved);
+        const auto end = std::move(m_sortedKeys.begin() + m_sortedCount, addedEnd, sortedEnd);
+        m_sortedCount = sortedEnd - m_sortedKeys.begin();
+        m_sortedKeys.erase(end, m_sortedKeys.end());
+    }
+    if (m_sortedCount == m_sortedKeys.count()) {
+        m_removedSortedKeys = false;
+        return;
+    }
+    const auto added = m_sortedKeys.begin() + m_sortedCount;
+    std::sort(added, m_sortedKeys.end());
+    std::inplace_merge(m_sortedKeys.begin(), added, m_sortedKeys.end());
+    if (m_removedSortedKeys) {
+        // keys removed and added again are in both parts
+        m_sortedKeys.erase(std::unique(m_sortedKeys.begin(), m_sortedKeys.end()), m_sortedKeys.end());
+        m_removedSortedKeys = false;
+    }
+    m_sortedCount = m_sortedKeys.count();
+}
+
+void KonqCompletionIndex::compact()
+{
+    m_keys.clear();
+    m_keys.reserve(m_items.count());
+    for (auto it = m_items.begin(); it != m_items.end(); ++it) {
+        it->id = m_keys.count();
+        m_keys.append(it.key());
+    }
+    m_removedCount = 0;
+
+    m_trigrams.clear();
+    for (int id = 0; id < m_keys.count(); ++id) {
+        indexTrigrams(id);
+    }
+    // the ids changed
+    m_byScore.clear();
+    m_ranks.clear();
+    m_scoreDate = QDate();
+}
+
+quint64 KonqCompletionIndex::trigram(QStringView key, int pos)
+{
+    return (quint64(key.at(pos).unicode()) << 32) | (quint64(key.at(pos + 1).unicode()) << 16) | key.at(pos + 2).unicode();
+}
+
+void KonqCompletionIndex::indexTrigrams(int id)
+{
+    const QString &key = m_keys.at(id);
+    for (int pos = 0; pos + 3 <= key.size(); ++pos) {
+        QList<int> &ids = m_trigrams[trigram(key, pos)];
+        // keys containing a trigram several times are listed once
+        if (ids.isEmpty() || ids.last() != id) {
+            ids.append(id);
+        }
+    }
+}
+
+void KonqCompletionIndex::sortByScore(const QDateTime &now) const
+{
+    // the scores only change with the days, or with visits
+    if (m_scoreDate == now.date()) {
+        return;
+    }
+
+    QList<QPair<qint64, int>> scores;
+    scores.reserve(m_items.count());
+    for (const Item &item : m_items) {
+        qint64 best = 0;
+        for (const Variant &variant : item.variants) {
+            best = qMax(best, score(variant, now));
+        }
+        scores.append(qMakePair(best, item.id));
+    }
+    std::sort(scores.begin(), scores.end(), [](const QPair<qint64, int> &lhs, const QPair<qint64, int> &rhs) {
+        return lhs.first > rhs.first || (lhs.first == rhs.first && lhs.second < rhs.second);
+    });
+
+    m_byScore.clear();
+    m_byScore.reserve(scores.count());
+    m_ranks.fill(0, m_keys.count());
+    for (const auto &entry : std::as_const(scores)) {
+        m_ranks[entry.second] = m_byScore.count();
+        m_byScore.append(entry.second);
+    }
+    m_firstRank = 0;
+    m_scoreDate = now.date();
+}
+
+int KonqCompletionIndex::count() const
+{
+    return m_items.count();
+}
+
+/**
+ * Frecency: the number of visits, weighted by how recently the last one was
+ */
+qint64 KonqCompletionIndex::score(const Variant &variant, const QDateTime &now)
+{
+    int recency = 1; // bookmarks which were never visited
+    if (variant.lastVisited.isValid()) {
+        const qint64 days = variant.lastVisited.daysTo(now);
+        if (days < 4) {
+            recency = 100;
+        } else if (days < 14) {
+            recency = 70;
+        } else if (days < 31) {
+            recency = 50;
+        } else if (days < 90) {
+            recency = 30;
+        } else {
+            recency = 10;
+        }
+    }
+    return qint64(qMax(1, variant.weight)) * recency;
+}
+
+/**
+ * Picks the variant of @p item to show, i.e. the best one with the given @p scheme
+ * (any if @p scheme is empty)
+ * @returns false if no variant has that scheme
+ */
+bool KonqCompletionIndex::bestMatch(const Item &item, const QString &scheme, const QDateTime &now, Match &match)
+{
+    bool found = false;
+    for (const Variant &variant : item.variants) {
+        if (!scheme.isEmpty() && !variant.text.startsWith(scheme)) {
+            continue;
+        }
+        const qint64 variantScore = score(variant, now);
+        // on equal scores, prefer the more complete text (e.g. with scheme)
+        if (!found || variantScore > match.score || (variantScore == match.score && variant.text.length() > match.text.length())) {
+            match = {variant.text, variantScore};
+            found = true;
+        }
+    }
+    return found;
+}
+
+QStringList KonqCompletionIndex::sortedMatches(QList<Match> &matches, int maxMatches)
+{
+    const qsizetype count = qMin<qsizetype>(matches.count(), maxMatches);
+    std::partial_sort(matches.begin(), matches.begin() + count, matches.end(), [](const Match &lhs, const Match &rhs) {
+        return lhs.score > rhs.score;
+    });
+
+    QStringList result;
+    result.reserve(count);
+    for (qsizetype i = 0; i < count; ++i) {
+        result.append(matches.at(i).text);
+    }
+    return result;
+}
+
+QStringList KonqCompletionIndex::prefixMatches(const QString &text, int maxMatches) const
+{
+    const QString key = keyFor(text);
+    // e.g. "http://www." alone would match everything
+    if (key.isEmpty()) {
+        return QStringList();
+    }
+    const QString scheme = text.left(schemeLength(text));
+
+    QElapsedTimer timer;
+    timer.start();
+    const QDateTime now = QDateTime::currentDateTime();
+
+    sortKeys();
+    QList<Match> matches;
+    int checked = 0;
+    for (auto it = std::lower_bound(m_sortedKeys.constBegin(), m_sortedKeys.constEnd(), key);
+         it != m_sortedKeys.constEnd() && it->startsWith(key); ++it) {
+        Match match;
+        if (bestMatch(m_items.value(*it), scheme, now, match)) {
+            matches.append(match);
+        }
+        if (++checked % s_budgetCheckInterval == 0 && timer.elapsed() > s_timeBudget) {
+            break;
+        }
+    }
+
+    return sortedMatches(matches, maxMatches);
+}
+
+QStringList KonqCompletionIndex::substringMatches(const QString &text, int maxMatches) const
+{
+    const QString key = keyFor(text);
+    if (key.isEmpty()) {
+        return QStringList();
+    }
+    const QString scheme = text.left(schemeLength(text));
+
+    QElapsedTimer timer;
+    timer.start();
+    const QDateTime now = QDateTime::currentDateTime();
+
+    // Best ranked first, so that running out of time leaves out the worst ones
+    sortByScore(now);
+    const QList<int> *candidates = &m_byScore;
+    QList<int> containing;
+    if (key.size() >= 3) {
+        // only the keys with the least frequent trigram of the query can contain it
+        const QList<int> *rarest = nullptr;
+        for (int pos = 0; pos + 3 <= key.size(); ++pos) {
+            const auto it = m_trigrams.constFind(trigram(key, pos));
+            if (it == m_trigrams.constEnd()) {
+                return QStringList();
+            }
+            if (rarest == nullptr || it->count() < rarest->count()) {
+                rarest = &*it;
+            }
+        }
+        // ordering many of the keys would take longer than going through all of them
+        if (rarest->count() < m_byScore.count() / 8) {
+            containing = *rarest;
+            std::sort(containing.begin(), containing.end(), [this](int lhs, int rhs) {
+                return m_ranks.at(lhs) < m_ranks.at(rhs);
+            });
+            candidates = &containing;
+        }
+    }
+
+    QList<Match> matches;
+    int checked = 0;
+    for (const int id : *candidates) {
+        // empty once removed
+        const QString &candidate = m_keys.at(id);
+        Match match;
+        if (!candidate.isEmpty() && candidate.contains(key) && bestMatch(m_items.value(candidate), scheme, now, match)) {
+            matches.append(match);
+        }
+        if (++checked % s_budgetCheckInterval == 0 && timer.elapsed() > s_timeBudget) {
+            break;
+        }
+    }
+
+    return sortedMatches(matches, maxMatches);
+}
@@ -0,0 +1,147 @@
+/*
+    This file is part of the KDE project.
+
+    SPDX-FileCopyrightText: 2026 Konqueror Developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#ifndef KONQCOMPLETIONINDEX_H
+#define KONQCOMPLETIONINDEX_H
+
+#include <konqprivate_export.h>
+
+#include <QDate>
+#include <QDateTime>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+
+/**
+ * Index of the URLs known to Konqueror (history and bookmarks), used for the
+ * completion popup of the location bar.
+ *
+ * URLs are keyed without their scheme (including "file:"), a leading "www."
+ * (or "ftp." for ftp URLs) and a trailing slash, so that typing "kde" finds
+ * "https://www.kde.org/", and URLs which only differ in those parts are
+ * returned only once. Matches are ranked by how often and how recently they
+ * were visited.
+ *
+ * Prefix queries look keys up in a sorted list of them. Substring queries look
+ * the least frequent trigram of the query up in an index of the trigrams of the
+ * keys, and only check the keys containing it. They check the keys from the best
+ * ranked to the worst, in an order made once a day, with keys added meanwhile
+ * first, as they were just visited.
+ *
+ * Both kinds of queries stop after a fixed time budget, so that typing in the
+ * location bar stays responsive with a large history. Substring queries leave
+ * out the worst ranked keys then.
+ *
+ * Removed keys are only dropped from the indexes once they are half of them.
+ */
+class KONQUERORPRIVATE_EXPORT KonqCompletionIndex
+{
+public:
+    KonqCompletionIndex();
+    ~KonqCompletionIndex();
+
+    /**
+     * Adds @p text to the index, or updates it if it's already there.
+     * @param weight how often @p text was visited (plus a bonus for typed urls)
+     * @param lastVisited when @p text was last visited, invalid for bookmarks
+     */
+    void addItem(const QString &text, int weight, const QDateTime &lastVisited = QDateTime());
+
+    void removeItem(const QString &text);
+
+    void clear();
+
+    /**
+     * @returns the number of distinct keys in the index
+     */
+    int count() const;
+
+    /**
+     * @returns the best items whose key starts with the key of @p text, best first
+     */
+    QStringList prefixMatches(const QString &text, int maxMatches = s_maxMatches) const;
+
+    /**
+     * @returns the best items whose key contains the key of @p text, best first
+     */
+    QStringList substringMatches(const QString &text, int maxMatches = s_maxMatches) const;
+
+    /**
+     * @returns @p text without scheme, leading "www." or "ftp." and trailing slash
+     */
+    static QString keyFor(const QString &text);
+
+    static const int s_maxMatches = 100;
+
+    /**
+     * The time a query may take, in milliseconds
+     */
+    static const int s_timeBudget = 15;
+
+private:
+    struct Variant {
+        QString text;
+        int weight;
+        QDateTime lastVisited;
+    };
+
+    // All the texts sharing one key
+    struct Item {
+        QList<Variant> variants;
+        int id; // of the key in m_keys
+    };
+
+    struct Match {
+        QString text;
+        qint64 score;
+    };
+
+    static qint64 score(const Variant &variant, const QDateTime &now);
+    static bool bestMatch(const Item &item, const QString &scheme, const QDateTime &now, Match &match);
+    static QStringList sortedMatches(QList<Match> &matches, int maxMatches);
+
+    /**
+     * Sorts the keys added since the last query into m_sortedKeys, and drops the removed ones
+     */
+    void sortKeys() const;
+
+    /**
+     * Orders the keys by score into m_byScore, unless done today already
+     */
+    void sortByScore(const QDateTime &now) const;
+
+    /**
+     * Numbers the keys again without the removed ones, and indexes their trigrams again
+     */
+    void compact();
+
+    void indexTrigrams(int id);
+    static quint64 trigram(QStringView key, int pos);
+
+    QHash<QString, Item> m_items;
+    // The keys of m_items, sorted up to m_sortedCount, followed by the keys added since,
+    // and maybe removed ones while m_removedSortedKeys is set
+    mutable QStringList m_sortedKeys;
+    mutable qsizetype m_sortedCount = 0;
+    mutable bool m_removedSortedKeys = false;
+
+    // The keys by id, empty once removed
+    QStringList m_keys;
+    int m_removedCount = 0;
+    // The ids of the keys containing each trigram, ascending
+    QHash<quint64, QList<int>> m_trigrams;
+
+    // The ids of the keys, best ranked first, and the position of each key in that order.
+    // Keys added after sorting get positions before the others.
+    mutable QList<int> m_byScore;
+    mutable QList<int> m_ranks;
+    mutable int m_firstRank = 0;
+    mutable QDate m_scoreDate;
+};
+
+#endif // KONQCOMPLETIONINDEX_H
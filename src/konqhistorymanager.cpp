@@ -7,6 +7,7 @@
 
 #include "konqhistorymanager.h"
 #include <kbookmarkmanager.h>
+#include "konqcompletionindex.h"
 #include "konqurl.h"
 
 #include <QTimer>
@@ -25,6 +26,7 @@ KonqHistoryManager::KonqHistoryManager(KBookmarkManager *bookmarkManager, QObjec
     // take care of the completion object
     m_pCompletion = new KCompletion;
     m_pCompletion->setOrder(KCompletion::Weighted);
+    m_completionIndex = new KonqCompletionIndex;
 
     // and load the history
     loadHistory();
@@ -32,11 +34,13 @@ KonqHistoryManager::KonqHistoryManager(KBookmarkManager *bookmarkManager, QObjec
     connect(m_updateTimer, &QTimer::timeout, this, &KonqHistoryManager::slotEmitUpdated);
     connect(this, &KonqHistoryManager::cleared, this, &KonqHistoryManager::slotCleared);
     connect(this, &KonqHistoryManager::entryRemoved, this, &KonqHistoryManager::slotEntryRemoved);
+    connect(this, &KonqHistoryManager::entriesLoaded, this, &KonqHistoryManager::slotEntriesLoaded);
 }
 
 KonqHistoryManager::~KonqHistoryManager()
 {
     delete m_pCompletion;
+    delete m_completionIndex;
     clearPending();
 }
 
@@ -44,8 +48,10 @@ bool KonqHistoryManager::loadHistory()
 {
     clearPending();
     m_pCompletion->clear();
+    m_completionIndex->clear();
 
-    if (!KonqHistoryProvider::loadHistory()) {
+    // Only the most recent entries are loaded right away, so that the first window shows up quickly
+    if (!KonqHistoryProvider::loadHistoryInBackground()) {
         return false;
     }
 
@@ -54,6 +60,7 @@ bool KonqHistoryManager::loadHistory()
         const KonqHistoryEntry &entry = it.next();
         const QString prettyUrlString = entry.url.toDisplayString();
         addToCompletion(prettyUrlString, entry.typedUrl, entry.numberOfTimesVisited);
+        addToCompletionIndex(entry);
     }
 
     return true;
@@ -126,9 +133,10 @@ void KonqHistoryManager::addToHistory(bool pending, const QUrl &_url,
         // We add a copy of the current history entry of the url to the
         // pending list, so that we can restore it if the user canceled.
         // If there is no entry for the url yet, we just store the url.
-        KonqHistoryList::const_iterator oldEntry = constFindEntry(url);
-        m_pending.insert(u, (oldEntry != entries().constEnd()) ?
-                         new KonqHistoryEntry(*oldEntry) : nullptr);
+        // Earlier visits may not have made it into the history yet, they count too.
+        const KonqHistoryEntry oldEntry = upcomingEntry(url);
+        m_pending.insert(u, !oldEntry.url.isEmpty() ?
+                         new KonqHistoryEntry(oldEntry) : nullptr);
     }
 
     // notify all konqueror instances about the entry
@@ -225,6 +233,19 @@ void KonqHistoryManager::removeFromCompletion(const QString &url, const QString
 {
     m_pCompletion->removeItem(url);
     m_pCompletion->removeItem(typedUrl);
+    m_completionIndex->removeItem(url);
+    if (!typedUrl.isEmpty()) {
+        m_completionIndex->removeItem(typedUrl);
+    }
+}
+
+void KonqHistoryManager::addToCompletionIndex(const KonqHistoryEntry &entry)
+{
+    m_completionIndex->addItem(entry.url.toDisplayString(), entry.numberOfTimesVisited, entry.lastVisited);
+    // typed urls have a higher priority
+    if (!entry.typedUrl.isEmpty()) {
+        m_completionIndex->addItem(entry.typedUrl, entry.numberOfTimesVisited + 10, entry.lastVisited);
+    }
 }
 
 void KonqHistoryManager::addToUpdateList(const QString &url)
@@ -239,12 +260,25 @@ void KonqHistoryManager::slotCleared()
 {
     clearPending();
     m_pCompletion->clear();
+    m_completionIndex->clear();
+}
+
+void KonqHistoryManager::slotEntriesLoaded(const QList<KonqHistoryEntry> &entries)
+{
+    for (const KonqHistoryEntry &entry : entries) {
+        // adds to the weight of an url which was visited again meanwhile
+        addToCompletion(entry.url.toDisplayString(), entry.typedUrl, entry.numberOfTimesVisited);
+        const KonqHistoryList::const_iterator current = constFindEntry(entry.url);
+        addToCompletionIndex(current != this->entries().constEnd() ? *current : entry);
+        addToUpdateList(entry.url.url());
+    }
 }
 
 void KonqHistoryManager::finishAddingEntry(const KonqHistoryEntry &entry, bool isSender)
 {
     const QString urlString = entry.url.url();
     addToCompletion(entry.url.toDisplayString(), entry.typedUrl);
+    addToCompletionIndex(entry);
     addToUpdateList(urlString);
     KonqHistoryProvider::finishAddingEntry(entry, isSender);
 
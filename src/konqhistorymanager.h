@@ -20,13 +20,15 @@
 class QTimer;
 class KBookmarkManager;
 class KCompletion;
+class KonqCompletionIndex;
 
 /**
  * This class maintains and manages a history of all URLs visited by one
  * Konqueror instance. Additionally it synchronizes the history with other
  * Konqueror instances via DBUS to keep one global and persistent history.
  *
- * It keeps the history in sync with one KCompletion object
+ * It keeps the history in sync with one KCompletion object, and with a
+ * KonqCompletionIndex for the completion popup.
  */
 class KONQUERORPRIVATE_EXPORT KonqHistoryManager : public KonqHistoryProvider
 {
@@ -88,6 +90,14 @@ public:
         return m_pCompletion;
     }
 
+    /**
+     * @returns the index used for the completion popup of the location bar
+     */
+    KonqCompletionIndex *completionIndex() const
+    {
+        return m_completionIndex;
+    }
+
     // HistoryProvider interface, let konq handle this
     /**
      * Reimplemented in such a way that all URLs that would be filtered
@@ -101,7 +111,8 @@ public:
 
 private:
     /**
-     * Loads the history and fills the completion object.
+     * Loads the history and fills the completion object. Older entries
+     * are added later, see slotEntriesLoaded().
      */
     bool loadHistory();
 
@@ -145,6 +156,7 @@ private Q_SLOTS:
 
     void slotCleared();
     void slotEntryRemoved(const KonqHistoryEntry &entry);
+    void slotEntriesLoaded(const QList<KonqHistoryEntry> &entries);
 
 private:
     void finishAddingEntry(const KonqHistoryEntry &entry, bool isSender) override;
@@ -152,6 +164,7 @@ private:
 
     void addToCompletion(const QString &url, const QString &typedUrl, int numberOfTimesVisited = 1);
     void removeFromCompletion(const QString &url, const QString &typedUrl);
+    void addToCompletionIndex(const KonqHistoryEntry &entry);
 
     /**
      * List of pending entries, which were added to the history, but not yet
@@ -162,6 +175,7 @@ private:
     QMap<QString, KonqHistoryEntry *> m_pending;
 
     KCompletion *m_pCompletion; // the completion object we sync with
+    KonqCompletionIndex *m_completionIndex;
 
     /**
      * A timer that will emit the KParts::HistoryProvider::updated() signal
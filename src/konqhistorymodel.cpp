@@ -18,6 +18,9 @@
 #include <QLocale>
 #include <QIcon>
 
+#include <algorithm>
+#include <utility>
+
 namespace KHM
 {
 
@@ -44,18 +47,19 @@ struct Entry {
 };
 
 struct HistoryEntry : public Entry {
-    HistoryEntry(const KonqHistoryEntry &_entry, GroupEntry *_parent);
+    HistoryEntry(const KonqHistoryEntry &_entry, GroupEntry *_parent, int _row);
 
     QVariant data(int role, int column) const override;
     void update(const KonqHistoryEntry &entry);
 
     KonqHistoryEntry entry;
     GroupEntry *parent;
+    int row; // the position in parent->entries
     QIcon icon;
 };
 
 struct GroupEntry : public Entry {
-    GroupEntry(const QUrl &_url, const QString &_key);
+    GroupEntry(const QUrl &_url, const QString &_key, int _row);
 
     ~GroupEntry() override
     {
@@ -63,14 +67,43 @@ struct GroupEntry : public Entry {
     }
 
     QVariant data(int role, int column) const override;
-    HistoryEntry *findChild(const KonqHistoryEntry &entry, int *index = nullptr) const;
+    HistoryEntry *findChild(const QUrl &url) const
+    {
+        return childrenByUrl.value(url);
+    }
+    HistoryEntry *appendChild(const KonqHistoryEntry &entry);
+    void removeChild(HistoryEntry *item);
+
+    void addUnfetched(const KonqHistoryEntry &entry);
+    bool removeUnfetched(const QUrl &url);
+    QList<KonqHistoryEntry> takeUnfetched();
+    bool hasUnfetched() const
+    {
+        return !unfetchedIndex.isEmpty();
+    }
+
+    void updateLastVisited(const QDateTime &dt)
+    {
+        if (dt > lastVisited) {
+            lastVisited = dt;
+        }
+    }
+    void recomputeLastVisited();
     QList<QUrl> urls() const;
 
     QList<HistoryEntry *> entries;
+    QHash<QUrl, HistoryEntry *> childrenByUrl;
+    // Entries which don't have a row yet, see KonqHistoryModel::fetchMore().
+    // Removed entries stay in the list, but not in unfetchedIndex.
+    QList<KonqHistoryEntry> unfetched;
+    QHash<QUrl, qsizetype> unfetchedIndex;
+    QDateTime lastVisited; // the latest of all entries, fetched or not
     QUrl url;
     QString key;
     QIcon icon;
+    int row; // the position in RootEntry::groups
     bool hasFavIcon : 1;
+    bool fetched : 1;
 };
 
 struct RootEntry : public Entry {
@@ -87,11 +120,9 @@ struct RootEntry : public Entry {
     QHash<QString, GroupEntry *> groupsByName;
 };
 
-HistoryEntry::HistoryEntry(const KonqHistoryEntry &_entry, GroupEntry *_parent)
-    : Entry(History), entry(_entry), parent(_parent)
+HistoryEntry::HistoryEntry(const KonqHistoryEntry &_entry, GroupEntry *_parent, int _row)
+    : Entry(History), entry(_entry), parent(_parent), row(_row)
 {
-    parent->entries.append(this);
-
     update(entry);
 }
 
@@ -142,8 +173,8 @@ void HistoryEntry::update(const KonqHistoryEntry &_entry)
     }
 }
 
-GroupEntry::GroupEntry(const QUrl &_url, const QString &_key)
-    : Entry(Group), url(_url), key(_key), hasFavIcon(false)
+GroupEntry::GroupEntry(const QUrl &_url, const QString &_key, int _row)
+    : Entry(Group), url(_url), key(_key), row(_row), hasFavIcon(false), fetched(false)
 {
     const QString iconPath = KIO::favIconForUrl(url);
     if (iconPath.isEmpty()) {
@@ -163,45 +194,83 @@ QVariant GroupEntry::data(int role, int /*column*/) const
         return icon;
     case KonqHistory::TypeRole:
         return int(KonqHistory::GroupType);
-    case KonqHistory::LastVisitedRole: {
-        if (entries.isEmpty()) {
-            return QDateTime();
-        }
-        QDateTime dt = entries.first()->entry.lastVisited;
-        for (HistoryEntry *e: entries) {
-            if (e->entry.lastVisited > dt) {
-                dt = e->entry.lastVisited;
-            }
-        }
-        return dt;
-    }
+    case KonqHistory::LastVisitedRole:
+        return lastVisited;
     }
     return QVariant();
 }
 
-HistoryEntry *GroupEntry::findChild(const KonqHistoryEntry &entry, int *index) const
+HistoryEntry *GroupEntry::appendChild(const KonqHistoryEntry &entry)
 {
-    HistoryEntry *item = nullptr;
-    QList<HistoryEntry *>::const_iterator it = entries.constBegin(), itEnd = entries.constEnd();
-    int i = 0;
-    for (; it != itEnd; ++it, ++i) {
-        if ((*it)->entry.url == entry.url) {
-            item = *it;
-            break;
+    HistoryEntry *item = new HistoryEntry(entry, this, entries.count());
+    entries.append(item);
+    childrenByUrl.insert(entry.url, item);
+    return item;
+}
+
+void GroupEntry::removeChild(HistoryEntry *item)
+{
+    entries.removeAt(item->row);
+    for (int i = item->row; i < entries.count(); ++i) {
+        entries.at(i)->row = i;
+    }
+    childrenByUrl.remove(item->entry.url);
+    delete item;
+}
+
+void GroupEntry::addUnfetched(const KonqHistoryEntry &entry)
+{
+    const auto it = unfetchedIndex.constFind(entry.url);
+    if (it == unfetchedIndex.constEnd()) {
+        unfetchedIndex.insert(entry.url, unfetched.count());
+        unfetched.append(entry);
+    } else if (!unfetched.at(*it).lastVisited.isValid()) {
+        // Same as for fetched entries, only pending ones are updated
+        unfetched[*it] = entry;
+    }
+}
+
+bool GroupEntry::removeUnfetched(const QUrl &url)
+{
+    return unfetchedIndex.remove(url);
+}
+
+QList<KonqHistoryEntry> GroupEntry::takeUnfetched()
+{
+    QList<KonqHistoryEntry> result;
+    result.reserve(unfetchedIndex.count());
+    for (qsizetype i = 0; i < unfetched.count(); ++i) {
+        const KonqHistoryEntry &entry = unfetched.at(i);
+        if (unfetchedIndex.value(entry.url, -1) == i) {
+            result.append(entry);
         }
     }
-    if (index) {
-        *index = item ? i : -1;
+    unfetched.clear();
+    unfetchedIndex.clear();
+    return result;
+}
+
+void GroupEntry::recomputeLastVisited()
+{
+    lastVisited = QDateTime();
+    for (HistoryEntry *e : std::as_const(entries)) {
+        updateLastVisited(e->entry.lastVisited);
+    }
+    for (auto it = unfetchedIndex.constBegin(); it != unfetchedIndex.constEnd(); ++it) {
+        updateLastVisited(unfetched.at(it.value()).lastVisited);
     }
-    return item;
 }
 
 QList<QUrl> GroupEntry::urls() const
 {
     QList<QUrl> list;
+    list.reserve(entries.count() + unfetchedIndex.count());
     for (HistoryEntry *e: entries) {
         list.append(e->entry.url);
     }
+    for (auto it = unfetchedIndex.constBegin(); it != unfetchedIndex.constEnd(); ++it) {
+        list.append(it.key());
+    }
     return list;
 }
 
@@ -222,20 +291,27 @@ KonqHistoryModel::KonqHistoryModel(QObject *parent)
 {
     KonqHistoryProvider *provider = KonqHistoryProvider::self();
 
+    m_addTimer.setSingleShot(true);
+    connect(&m_addTimer, &QTimer::timeout, this, &KonqHistoryModel::slotAddQueuedEntries);
+
     connect(provider, SIGNAL(cleared()), this, SLOT(clear()));
     connect(provider, SIGNAL(entryAdded(KonqHistoryEntry)),
             this, SLOT(slotEntryAdded(KonqHistoryEntry)));
     connect(provider, SIGNAL(entryRemoved(KonqHistoryEntry)),
             this, SLOT(slotEntryRemoved(KonqHistoryEntry)));
-
-    KonqHistoryList entries(provider->entries());
-
-    KonqHistoryList::const_iterator it = entries.constBegin();
-    const KonqHistoryList::const_iterator end = entries.constEnd();
-    for (; it != end; ++it) {
-        KHM::GroupEntry *group = getGroupItem((*it).url, DontEmitSignals);
-        KHM::HistoryEntry *item = new KHM::HistoryEntry((*it), group);
-        Q_UNUSED(item);
+    connect(provider, &KonqHistoryProvider::entriesLoaded, this, &KonqHistoryModel::slotEntriesLoaded);
+
+    // Only the groups are created here, their entries get rows in fetchMore()
+    const KonqHistoryList &entries = provider->entries();
+    for (const KonqHistoryEntry &entry : entries) {
+        KHM::GroupEntry *group = m_root->groupsByName.value(groupForUrl(entry.url));
+        if (!group) {
+            group = createGroup(entry.url);
+            m_root->groups.append(group);
+            m_root->groupsByName.insert(group->key, group);
+        }
+        group->addUnfetched(entry);
+        group->updateLastVisited(entry.lastVisited);
     }
 }
 
@@ -325,6 +401,49 @@ int KonqHistoryModel::rowCount(const QModelIndex &parent) const
     return 0;
 }
 
+bool KonqHistoryModel::hasChildren(const QModelIndex &parent) const
+{
+    KHM::Entry *entry = entryFromIndex(parent, true);
+    switch (entry->type) {
+    case KHM::Entry::History:
+        return false;
+    case KHM::Entry::Group: {
+        const KHM::GroupEntry *group = static_cast<KHM::GroupEntry *>(entry);
+        return !group->entries.isEmpty() || group->hasUnfetched();
+    }
+    case KHM::Entry::Root:
+        return !static_cast<KHM::RootEntry *>(entry)->groups.isEmpty();
+    }
+    return false;
+}
+
+bool KonqHistoryModel::canFetchMore(const QModelIndex &parent) const
+{
+    KHM::Entry *entry = entryFromIndex(parent);
+    if (!entry || entry->type != KHM::Entry::Group) {
+        return false;
+    }
+    const KHM::GroupEntry *group = static_cast<KHM::GroupEntry *>(entry);
+    return !group->fetched;
+}
+
+void KonqHistoryModel::fetchMore(const QModelIndex &parent)
+{
+    KHM::Entry *entry = entryFromIndex(parent);
+    if (!entry || entry->type != KHM::Entry::Group) {
+        return;
+    }
+    fetchGroup(static_cast<KHM::GroupEntry *>(entry));
+}
+
+void KonqHistoryModel::fetchAll()
+{
+    slotAddQueuedEntries();
+    for (KHM::GroupEntry *group : std::as_const(m_root->groups)) {
+        fetchGroup(group);
+    }
+}
+
 void KonqHistoryModel::deleteItem(const QModelIndex &index)
 {
     KHM::Entry *entry = entryFromIndex(index);
@@ -347,6 +466,9 @@ void KonqHistoryModel::deleteItem(const QModelIndex &index)
 
 void KonqHistoryModel::clear()
 {
+    m_queuedEntries.clear();
+    m_addTimer.stop();
+
     if (m_root->groups.isEmpty()) {
         return;
     }
@@ -359,56 +481,159 @@ void KonqHistoryModel::clear()
 
 void KonqHistoryModel::slotEntryAdded(const KonqHistoryEntry &entry)
 {
-    KHM::GroupEntry *group = getGroupItem(entry.url, EmitSignals);
-    KHM::HistoryEntry *item = group->findChild(entry);
-    if (!item) {
-        beginInsertRows(indexFor(group), group->entries.count(), group->entries.count());
-        item = new KHM::HistoryEntry(entry, group);
+    // Entries often come in bursts, e.g. while the history is loaded: add them together
+    m_queuedEntries.append(entry);
+    if (!m_addTimer.isActive()) {
+        m_addTimer.start(0);
+    }
+}
+
+void KonqHistoryModel::slotEntriesLoaded(const QList<KonqHistoryEntry> &entries)
+{
+    KonqHistoryProvider *provider = KonqHistoryProvider::self();
+    const KonqHistoryList &history = provider->entries();
+    for (const KonqHistoryEntry &entry : entries) {
+        // the url may have been visited again meanwhile, which is already in the model
+        const KonqHistoryList::const_iterator current = provider->constFindEntry(entry.url);
+        if (current != history.constEnd()) {
+            m_queuedEntries.append(*current);
+        }
+    }
+    if (!m_queuedEntries.isEmpty() && !m_addTimer.isActive()) {
+        m_addTimer.start(0);
+    }
+}
+
+void KonqHistoryModel::slotAddQueuedEntries()
+{
+    m_addTimer.stop();
+    if (m_queuedEntries.isEmpty()) {
+        return;
+    }
+    const QList<KonqHistoryEntry> queued = std::exchange(m_queuedEntries, {});
+
+    // New groups are inserted at the end, all in one go. Their entries are fetched later,
+    // those of groups which were already fetched get rows now, one range per group.
+    QList<KHM::GroupEntry *> newGroups;
+    QHash<QString, KHM::GroupEntry *> newGroupsByName;
+    QList<KHM::GroupEntry *> changedGroups;
+    QHash<KHM::GroupEntry *, QList<KonqHistoryEntry>> newRows;
+
+    for (const KonqHistoryEntry &entry : queued) {
+        const QString groupKey = groupForUrl(entry.url);
+        KHM::GroupEntry *group = m_root->groupsByName.value(groupKey);
+        if (!group) {
+            group = newGroupsByName.value(groupKey);
+            if (!group) {
+                group = createGroup(entry.url);
+                newGroups.append(group);
+                newGroupsByName.insert(groupKey, group);
+            }
+            group->addUnfetched(entry);
+            group->updateLastVisited(entry.lastVisited);
+            continue;
+        }
+
+        if (!changedGroups.contains(group)) {
+            changedGroups.append(group);
+        }
+        group->updateLastVisited(entry.lastVisited);
+
+        if (!group->fetched) {
+            group->addUnfetched(entry);
+            continue;
+        }
+
+        KHM::HistoryEntry *item = group->findChild(entry.url);
+        if (!item) {
+            QList<KonqHistoryEntry> &rows = newRows[group];
+            auto existing = std::find_if(rows.begin(), rows.end(), [&entry](const KonqHistoryEntry &e) {
+                return e.url == entry.url;
+            });
+            if (existing == rows.end()) {
+                rows.append(entry);
+            } else if (!existing->lastVisited.isValid()) {
+                *existing = entry;
+            }
+        } else {
+            // Do not update existing entries, otherwise items jump around when clicking on them (#61450)
+            if (item->entry.lastVisited.isValid()) {
+                continue;
+            }
+            item->update(entry);
+            const QModelIndex index = indexFor(item);
+            emit dataChanged(index, index);
+        }
+    }
+
+    for (auto it = newRows.constBegin(); it != newRows.constEnd(); ++it) {
+        KHM::GroupEntry *group = it.key();
+        const int first = group->entries.count();
+        beginInsertRows(indexFor(group), first, first + it.value().count() - 1);
+        for (const KonqHistoryEntry &entry : it.value()) {
+            group->appendChild(entry);
+        }
         endInsertRows();
-    } else {
-        // Do not update existing entries, otherwise items jump around when clicking on them (#61450)
-        if (item->entry.lastVisited.isValid()) {
-            return;
+    }
+
+    if (!newGroups.isEmpty()) {
+        const int first = m_root->groups.count();
+        beginInsertRows(QModelIndex(), first, first + newGroups.count() - 1);
+        for (KHM::GroupEntry *group : std::as_const(newGroups)) {
+            group->row = m_root->groups.count();
+            m_root->groups.append(group);
+            m_root->groupsByName.insert(group->key, group);
         }
-        item->update(entry);
-        const QModelIndex index = indexFor(item);
-        emit dataChanged(index, index);
+        endInsertRows();
+    }
+
+    // update the parent items, so the sorting by date is updated accordingly
+    for (KHM::GroupEntry *group : std::as_const(changedGroups)) {
+        const QModelIndex groupIndex = indexFor(group);
+        emit dataChanged(groupIndex, groupIndex);
     }
-    // update the parent item, so the sorting by date is updated accordingly
-    const QModelIndex groupIndex = indexFor(group);
-    emit dataChanged(groupIndex, groupIndex);
 }
 
 void KonqHistoryModel::slotEntryRemoved(const KonqHistoryEntry &entry)
 {
+    slotAddQueuedEntries();
+
     const QString groupKey = groupForUrl(entry.url);
     KHM::GroupEntry *group = m_root->groupsByName.value(groupKey);
     if (!group) {
         return;
     }
 
-    int index = 0;
-    KHM::HistoryEntry *item = group->findChild(entry, &index);
-    if (index == -1) {
-        return;
-    }
-
-    if (group->entries.count() > 1) {
-        beginRemoveRows(indexFor(group), index, index);
-        group->entries.removeAt(index);
-        delete item;
-        endRemoveRows();
+    QDateTime lastVisited;
+    if (group->fetched) {
+        KHM::HistoryEntry *item = group->findChild(entry.url);
+        if (!item) {
+            return;
+        }
+        lastVisited = item->entry.lastVisited;
+        if (group->entries.count() > 1) {
+            beginRemoveRows(indexFor(group), item->row, item->row);
+            group->removeChild(item);
+            endRemoveRows();
+        } else {
+            removeGroup(group);
+            return;
+        }
     } else {
-        index = m_root->groups.indexOf(group);
-        if (index == -1) {
+        if (!group->removeUnfetched(entry.url)) {
+            return;
+        }
+        lastVisited = entry.lastVisited;
+        if (!group->hasUnfetched()) {
+            removeGroup(group);
             return;
         }
+    }
 
-        beginRemoveRows(QModelIndex(), index, index);
-        m_root->groupsByName.remove(groupKey);
-        m_root->groups.removeAt(index);
-        delete group;
-        endRemoveRows();
+    if (lastVisited >= group->lastVisited) {
+        group->recomputeLastVisited();
+        const QModelIndex groupIndex = indexFor(group);
+        emit dataChanged(groupIndex, groupIndex);
     }
 }
 
@@ -420,40 +645,50 @@ KHM::Entry *KonqHistoryModel::entryFromIndex(const QModelIndex &index, bool retu
     return returnRootIfNull ? m_root : nullptr;
 }
 
-KHM::GroupEntry *KonqHistoryModel::getGroupItem(const QUrl &url, SignalEmission se)
+KHM::GroupEntry *KonqHistoryModel::createGroup(const QUrl &url) const
 {
-    const QString &groupKey = groupForUrl(url);
-    KHM::GroupEntry *group = m_root->groupsByName.value(groupKey);
-    if (!group) {
-        if (se == EmitSignals) {
-            beginInsertRows(QModelIndex(), m_root->groups.count(), m_root->groups.count());
-        }
-        group = new KHM::GroupEntry(url, groupKey);
-        m_root->groups.append(group);
-        m_root->groupsByName.insert(groupKey, group);
-        if (se == EmitSignals) {
-            endInsertRows();
-        }
+    return new KHM::GroupEntry(url, groupForUrl(url), m_root->groups.count());
+}
+
+void KonqHistoryModel::fetchGroup(KHM::GroupEntry *group)
+{
+    if (group->fetched) {
+        return;
+    }
+    group->fetched = true;
+    const QList<KonqHistoryEntry> entries = group->takeUnfetched();
+    if (entries.isEmpty()) {
+        return;
+    }
+
+    const int first = group->entries.count();
+    beginInsertRows(indexFor(group), first, first + entries.count() - 1);
+    group->entries.reserve(first + entries.count());
+    for (const KonqHistoryEntry &entry : entries) {
+        group->appendChild(entry);
     }
+    endInsertRows();
+}
 
-    return group;
+void KonqHistoryModel::removeGroup(KHM::GroupEntry *group)
+{
+    const int row = group->row;
+    beginRemoveRows(QModelIndex(), row, row);
+    m_root->groupsByName.remove(group->key);
+    m_root->groups.removeAt(row);
+    for (int i = row; i < m_root->groups.count(); ++i) {
+        m_root->groups.at(i)->row = i;
+    }
+    delete group;
+    endRemoveRows();
 }
 
 QModelIndex KonqHistoryModel::indexFor(KHM::HistoryEntry *entry) const
 {
-    const int row = entry->parent->entries.indexOf(entry);
-    if (row < 0) {
-        return QModelIndex();
-    }
-    return createIndex(row, 0, entry);
+    return createIndex(entry->row, 0, entry);
 }
 
 QModelIndex KonqHistoryModel::indexFor(KHM::GroupEntry *entry) const
 {
-    const int row = m_root->groups.indexOf(entry);
-    if (row < 0) {
-        return QModelIndex();
-    }
-    return createIndex(row, 0, entry);
+    return createIndex(entry->row, 0, entry);
 }
-
@@ -8,8 +8,10 @@
 #define KONQ_HISTORYMODEL_H
 
 #include <QAbstractItemModel>
+#include <QTimer>
 
 #include "konq_historyentry.h"
+#include "konqprivate_export.h"
 
 namespace KHM
 {
@@ -19,7 +21,14 @@ struct RootEntry;
 struct HistoryEntry;
 }
 
-class KonqHistoryModel : public QAbstractItemModel
+/**
+ * The history, grouped by host.
+ *
+ * The groups are created up front, but the entries of a group only get rows
+ * when the group is first fetched (see canFetchMore()), which views do when it's
+ * expanded. Entries added to the history are inserted in batches.
+ */
+class KONQUERORPRIVATE_EXPORT KonqHistoryModel : public QAbstractItemModel
 {
     Q_OBJECT
 
@@ -33,6 +42,14 @@ public:
     QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
     QModelIndex parent(const QModelIndex &index) const override;
     int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+
+    /**
+     * Gives rows to all entries, e.g. before filtering them
+     */
+    void fetchAll();
 
     void deleteItem(const QModelIndex &index);
 
@@ -41,16 +58,21 @@ public Q_SLOTS:
 
 private Q_SLOTS:
     void slotEntryAdded(const KonqHistoryEntry &);
+    void slotEntriesLoaded(const QList<KonqHistoryEntry> &);
     void slotEntryRemoved(const KonqHistoryEntry &);
+    void slotAddQueuedEntries();
 
 private:
-    enum SignalEmission { EmitSignals, DontEmitSignals };
     KHM::Entry *entryFromIndex(const QModelIndex &index, bool returnRootIfNull = false) const;
-    KHM::GroupEntry *getGroupItem(const QUrl &url, SignalEmission se);
+    KHM::GroupEntry *createGroup(const QUrl &url) const;
+    void fetchGroup(KHM::GroupEntry *group);
+    void removeGroup(KHM::GroupEntry *group);
     QModelIndex indexFor(KHM::HistoryEntry *entry) const;
     QModelIndex indexFor(KHM::GroupEntry *entry) const;
 
     KHM::RootEntry *m_root;
+    QList<KonqHistoryEntry> m_queuedEntries; // added to the history, but not to the model yet
+    QTimer m_addTimer;
 };
 
 #endif // KONQ_HISTORYMODEL_H
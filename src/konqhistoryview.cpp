@@ -207,6 +207,10 @@ void KonqHistoryView::slotFilterTextChanged(const QString &text)
 
 void KonqHistoryView::slotTimerTimeout()
 {
+    // The filter looks at all the entries, not only those in expanded groups
+    if (!m_searchLineEdit->text().isEmpty()) {
+        m_historyModel->fetchAll();
+    }
     m_historyProxyModel->setFilterFixedString(m_searchLineEdit->text());
 }
 
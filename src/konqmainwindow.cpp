@@ -35,6 +35,8 @@
 #include "konqbookmarkbar.h"
 #include "konqundomanager.h"
 #include "konqhistorydialog.h"
+#include "konqhistorymanager.h"
+#include "konqcompletionindex.h"
 #include <config-konqueror.h>
 #include <kstringhandler.h>
 #include "konqurl.h"
@@ -129,7 +131,6 @@
 #include <KIO/StatJob>
 #include <KIO/FileUndoManager>
 #include <KParts/OpenUrlEvent>
-#include <KCompletionMatches>
 #include <kacceleratormanager.h>
 #include <kuser.h>
 #include <kxmlguifactory.h>
@@ -267,6 +268,7 @@ KonqMainWindow::KonqMainWindow(const QUrl &initialURL)
         s_comboConfig = new KConfig(QStringLiteral("konq_history"), KConfig::NoGlobals);
         KonqCombo::setConfig(s_comboConfig);
         KConfigGroup locationBarGroup(s_comboConfig, "Location Bar");
+        prov->setPixmapCacheBudget(locationBarGroup.readEntry("PixmapCacheBudget", KonqPixmapProvider::s_defaultPixmapCacheBudget));
         prov->load(locationBarGroup, QStringLiteral("ComboIconCache"));
     }
 
@@ -357,6 +359,7 @@ KonqMainWindow::~KonqMainWindow()
     delete m_paClosedItems;
 
     if (s_lstMainWindows == nullptr) {
+        KonqCombo::setConfig(nullptr); // writes any pending changes
         delete s_comboConfig;
         s_comboConfig = nullptr;
     }
@@ -2846,17 +2849,17 @@ void KonqMainWindow::slotMakeCompletion(const QString &text)
         if (completion.isNull() && !m_pURLCompletion->isRunning()) {
             // No match() signal will come from m_pURLCompletion
             // ask the global one
-            // tell the static completion object about the current completion mode
-            completion = s_pCompletion->makeCompletion(text);
 
             // some special handling necessary for CompletionPopup
             if (m_combo->completionMode() == KCompletion::CompletionPopup ||
                     m_combo->completionMode() == KCompletion::CompletionPopupAuto) {
                 m_combo->setCompletedItems(historyPopupCompletionItems(text));
-            }
-
-            else if (!completion.isNull()) {
-                m_combo->setCompletedText(completion);
+            } else {
+                // tell the static completion object about the current completion mode
+                completion = s_pCompletion->makeCompletion(text);
+                if (!completion.isNull()) {
+                    m_combo->setCompletedText(completion);
+                }
             }
         } else {
             // To be continued in slotMatch()...
@@ -2882,7 +2885,7 @@ void KonqMainWindow::slotSubstringcompletion(const QString &text)
         items = m_pURLCompletion->substringCompletion(text);
     }
 
-    items += s_pCompletion->substringCompletion(text);
+    items += KonqHistoryManager::kself()->completionIndex()->substringMatches(text);
     if (!filesFirst && m_pURLCompletion) {
         items += m_pURLCompletion->substringCompletion(text);
     }
@@ -4961,6 +4964,8 @@ void KonqMainWindow::addBookmarksIntoCompletion(const KBookmarkGroup &group)
 
         QString u = url.toDisplayString();
         s_pCompletion->addItem(u);
+        // the index finds u when typing it without scheme, so it only needs this one
+        KonqHistoryManager::kself()->completionIndex()->addItem(u, 1);
 
         if (url.isLocalFile()) {
             s_pCompletion->addItem(url.toLocalFile());
@@ -5009,153 +5014,14 @@ static QString hp_tryPrepend(const QString &s)
     return (s.startsWith(QLatin1String("www.")) ? "http://" : "http://www.") + s;
 }
 
-static void hp_removeDupe(KCompletionMatches &l, const QString &dupe,
-                          KCompletionMatches::Iterator it_orig)
-{
-    KCompletionMatches::Iterator it = it_orig + 1;
-    while (it != l.end()) {
-        if ((*it).value() == dupe) {
-            (*it_orig).first = qMax((*it_orig).first, (*it).key());
-            it = l.erase(it);
-            continue;
-        }
-        ++it;
-    }
-}
-
-// remove duplicates like 'http://www.kde.org' and 'http://www.kde.org/'
-// (i.e. the trailing slash)
-// some duplicates are also created by prepending protocols
-static void hp_removeDuplicates(KCompletionMatches &l)
-{
-    QString http = QStringLiteral("http://");
-    QString ftp = QStringLiteral("ftp://ftp.");
-    QString file = QStringLiteral("file:");
-    QString file2 = QStringLiteral("file://");
-    l.removeDuplicates();
-    for (KCompletionMatches::Iterator it = l.begin();
-            it != l.end();
-            ++it) {
-        QString str = (*it).value();
-        if (str.startsWith(http)) {
-            if (str.indexOf('/', 7) < 0) {    // http://something<noslash>
-                hp_removeDupe(l, str + '/', it);
-                hp_removeDupe(l, str.mid(7) + '/', it);
-            } else if (str[ str.length() - 1 ] == '/') {
-                hp_removeDupe(l, str.left(str.length() - 1), it);
-                hp_removeDupe(l, str.left(str.length() - 1).mid(7), it);
-            }
-            hp_removeDupe(l, str.mid(7), it);
-        } else if (str.startsWith(ftp)) { // ftp://ftp.
-            hp_removeDupe(l, str.mid(6), it);    // remove dupes without ftp://
-        } else if (str.startsWith(file2)) {
-            hp_removeDupe(l, str.mid(7), it);    // remove dupes without file://
-        } else if (str.startsWith(file)) {
-            hp_removeDupe(l, str.mid(5), it);    // remove dupes without file:
-        }
-    }
-}
-
-static void hp_removeCommonPrefix(KCompletionMatches &l, const QString &prefix)
-{
-    for (KCompletionMatches::Iterator it = l.begin();
-            it != l.end();
-        ) {
-        if ((*it).value().startsWith(prefix)) {
-            it = l.erase(it);
-            continue;
-        }
-        ++it;
-    }
-}
-
-// don't include common prefixes like 'http://', i.e. when s == 'h', include
-// http://hotmail.com but don't include everything just starting with 'http://'
-static void hp_checkCommonPrefixes(KCompletionMatches &matches, const QString &s)
-{
-    static const char *const prefixes[] = {
-        "http://",
-        "https://",
-        "www.",
-        "ftp://",
-        "http://www.",
-        "https://www.",
-        "ftp://ftp.",
-        "file:",
-        "file://",
-        nullptr
-    };
-    for (const char *const *pos = prefixes;
-            *pos != nullptr;
-            ++pos) {
-        QString prefix = *pos;
-        if (prefix.startsWith(s)) {
-            hp_removeCommonPrefix(matches, prefix);
-        }
-    }
-}
-
 QStringList KonqMainWindow::historyPopupCompletionItems(const QString &s)
 {
-    const QString http = QStringLiteral("http://");
-    const QString https = QStringLiteral("https://");
-    const QString www = QStringLiteral("http://www.");
-    const QString wwws = QStringLiteral("https://www.");
-    const QString ftp = QStringLiteral("ftp://");
-    const QString ftpftp = QStringLiteral("ftp://ftp.");
-    const QString file = QStringLiteral("file:"); // without /, because people enter /usr etc.
-    const QString file2 = QStringLiteral("file://");
     if (s.isEmpty()) {
         return QStringList();
     }
-    KCompletionMatches matches = s_pCompletion->allWeightedMatches(s);
-    hp_checkCommonPrefixes(matches, s);
-    bool checkDuplicates = false;
-    if (!s.startsWith(ftp)) {
-        matches += s_pCompletion->allWeightedMatches(ftp + s);
-        if (QStringLiteral("ftp.").startsWith(s)) {
-            hp_removeCommonPrefix(matches, ftpftp);
-        }
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(https)) {
-        matches += s_pCompletion->allWeightedMatches(https + s);
-        if (QStringLiteral("www.").startsWith(s)) {
-            hp_removeCommonPrefix(matches, wwws);
-        }
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(http)) {
-        matches += s_pCompletion->allWeightedMatches(http + s);
-        if (QStringLiteral("www.").startsWith(s)) {
-            hp_removeCommonPrefix(matches, www);
-        }
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(www)) {
-        matches += s_pCompletion->allWeightedMatches(www + s);
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(wwws)) {
-        matches += s_pCompletion->allWeightedMatches(wwws + s);
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(ftpftp)) {
-        matches += s_pCompletion->allWeightedMatches(ftpftp + s);
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(file)) {
-        matches += s_pCompletion->allWeightedMatches(file + s);
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(file2)) {
-        matches += s_pCompletion->allWeightedMatches(file2 + s);
-        checkDuplicates = true;
-    }
-    if (checkDuplicates) {
-        hp_removeDuplicates(matches);
-    }
-    QStringList items = matches.list();
+    // The index already matches regardless of scheme and "www.", and returns
+    // each url only once
+    QStringList items = KonqHistoryManager::kself()->completionIndex()->prefixMatches(s);
     if (items.count() == 0
             && !s.contains(':') && !s.isEmpty() && s[ 0 ] != '/') {
         QString pre = hp_tryPrepend(s);
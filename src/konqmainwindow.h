@@ -619,15 +619,16 @@ private:
     void updateBookmarkBar();
 
     /**
-    * Adds all children of @p group to the static completion object
+    * Adds all children of @p group to the static completion object and
+    * to the completion index
     */
     static void addBookmarksIntoCompletion(const KBookmarkGroup &group);
 
     /**
-    * Returns all matches of the url-history for @p s. If there are no direct
-    * matches, it will try completing with http:// prepended, and if there's
-    * still no match, then http://www. Due to that, this is only usable for
-    * popupcompletion and not for manual or auto-completion.
+    * Returns the best matches of the url-history for @p s, ignoring the scheme
+    * and "www.". If there are no matches, it proposes @p s with http://www.
+    * prepended. Due to that, this is only usable for popupcompletion and not
+    * for manual or auto-completion.
     */
     static QStringList historyPopupCompletionItems(const QString &s = QString());
 
@@ -9,6 +9,13 @@
 #include <QMimeDatabase>
 #include <QMimeType>
 #include <QIcon>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
 #include "konqdebug.h"
 
 #include <KIO/FavIconRequestJob>
@@ -19,6 +26,8 @@
 
 #include <QApplication>
 
+#include <memory>
+
 class KonqPixmapProviderSingleton
 {
 public:
@@ -26,6 +35,10 @@ public:
 };
 Q_GLOBAL_STATIC(KonqPixmapProviderSingleton, globalPixmapProvider)
 
+// Identifies the cache file, followed by the format version
+static const quint32 s_cacheMagic = 0x4b464943; // "KFIC"
+static const quint32 s_cacheVersion = 1;
+
 KonqPixmapProvider *KonqPixmapProvider::self()
 {
     return &globalPixmapProvider->self;
@@ -34,6 +47,7 @@ KonqPixmapProvider *KonqPixmapProvider::self()
 KonqPixmapProvider::KonqPixmapProvider()
     : QObject()
 {
+    m_pixmaps.setMaxCost(s_defaultPixmapCacheBudget);
     connect(qApp, &QApplication::lastWindowClosed, this, &KonqPixmapProvider::cleanupDownloadsQueue);
 }
 
@@ -46,27 +60,43 @@ static bool canDownloadFavIconForScheme(const QUrl &url) {
     return url.scheme().startsWith(QLatin1String("http"));
 }
 
-void KonqPixmapProvider::downloadHostIcons(const QList<QUrl>& urls)
+void KonqPixmapProvider::downloadAll(const QList<QUrl>& urls)
 {
-    //We use a dynamic property rather than an instance variable since it's only used here
-    setProperty("modified", false);
-    auto proc = [this](KIO::FavIconRequestJob *job){
-        bool res = updateIcons(job);
-        if (res) {
-            setProperty("modified", true);
+    QList<QUrl> hostUrls;
+    QSet<QString> requestedHosts;
+    for (const QUrl &url : urls) {
+        if (!canDownloadFavIconForScheme(url)) {
+            continue;
         }
-        if (m_pendingRequests.isEmpty()) {
-            if (property("modified").toBool()) {
-                emit changed();
-            }
-            setProperty("modified", {});
+        const QString host = url.host();
+        if (requestedHosts.contains(host) || m_hostsInFlight.contains(host) || hasFreshHostIcon(host)) {
+            continue;
         }
+        requestedHosts.insert(host);
+        hostUrls.append(url);
+    }
+    if (hostUrls.isEmpty()) {
+        return;
+    }
+
+    // Shared by the callbacks of all the jobs, so that the last one to finish emits changed()
+    struct BulkDownload {
+        int remaining;
+        bool modified;
     };
-    QList<QUrl> filteredUrls;
-    std::copy_if(urls.constBegin(), urls.constEnd(), std::back_inserter(filteredUrls), &canDownloadFavIconForScheme);
-    for (const QUrl &url : filteredUrls) {
-        startFavIconJob(url, proc);
+    auto bulk = std::make_shared<BulkDownload>(BulkDownload{int(hostUrls.count()), false});
+    auto proc = [this, bulk](KIO::FavIconRequestJob *job){
+        if (updateIcons(job)) {
+            bulk->modified = true;
+        }
+        if (--bulk->remaining == 0 && bulk->modified) {
+            emit changed();
+        }
     };
+    for (const QUrl &url : std::as_const(hostUrls)) {
+        m_hostsInFlight.insert(url.host());
+        startFavIconJob(url, proc);
+    }
 }
 
 void KonqPixmapProvider::startFavIconJob(const FavIconRequestData& data)
@@ -77,7 +107,7 @@ void KonqPixmapProvider::startFavIconJob(const FavIconRequestData& data)
 void KonqPixmapProvider::startFavIconJob(const QUrl& hostUrl, FavIconRequestCallback proc, const QUrl &iconUrl)
 {
     if (m_jobs.count() >= s_maxJobs) {
-        m_pendingRequests.append({hostUrl, proc, {}});
+        m_pendingRequests.append({hostUrl, proc, iconUrl});
         return;
     }
     KIO::FavIconRequestJob *job = new KIO::FavIconRequestJob(hostUrl);
@@ -95,35 +125,55 @@ void KonqPixmapProvider::startFavIconJob(const QUrl& hostUrl, FavIconRequestCall
 
 bool KonqPixmapProvider::updateIcons(KIO::FavIconRequestJob* job, UpdateMode mode)
 {
-    bool modified = false;
     const QUrl _hostUrl = job->hostUrl();
-    QMap<QUrl, QString>::iterator itEnd = iconMap.end();
-    for (QMap<QUrl, QString>::iterator it = iconMap.begin(); it != itEnd; ++it) {
-        const QUrl url(it.key());
+    const QString host = _hostUrl.host();
+    HostData &hostData = m_hosts[host];
+    if (mode == UpdateMode::Host) {
+        m_hostsInFlight.remove(host);
+        if (!job->error()) {
+            hostData.iconFile = job->iconFile();
+            hostData.downloaded = QDateTime::currentDateTimeUtc();
+        }
+    }
+    // The file may have been downloaded again
+    if (!job->error() && !job->iconFile().isEmpty()) {
+        removeCachedPixmaps(job->iconFile());
+    }
+
+    bool modified = false;
+    for (const QUrl &url : std::as_const(hostData.urls)) {
         QString icon;
         switch (mode) {
             case UpdateMode::Host:
-                if (url.host() == _hostUrl.host()) {
-                    // For host default-icons still query the favicon manager to get
-                    // the correct icon for pages that have an own one.
-                    icon = KIO::favIconForUrl(url);
-                    modified = true;
-                }
+                // For host default-icons still query the favicon manager to get
+                // the correct icon for pages that have an own one.
+                icon = KIO::favIconForUrl(url);
                 break;
             case UpdateMode::Page:
-                if (url.host() == _hostUrl.host() && url.path() == _hostUrl.path()) {
+                if (url.path() == _hostUrl.path()) {
                     icon = job->iconFile();
-                    modified = true;
                 }
                 break;
         }
-        if (modified && !icon.isEmpty() && *it != icon) {
-            *it = icon;
+        if (icon.isEmpty()) {
+            continue;
+        }
+        QString &cachedIcon = iconMap[url];
+        if (cachedIcon != icon) {
+            cachedIcon = icon;
+            modified = true;
         }
     }
     return modified;
 }
 
+bool KonqPixmapProvider::hasFreshHostIcon(const QString &host) const
+{
+    const auto it = m_hosts.constFind(host);
+    return it != m_hosts.constEnd() && !it->iconFile.isEmpty() && it->downloaded.isValid()
+        && it->downloaded.secsTo(QDateTime::currentDateTimeUtc()) < s_hostIconMaxAge;
+}
+
 void KonqPixmapProvider::downloadNextFavIcon()
 {
     if (m_pendingRequests.isEmpty()) {
@@ -138,10 +188,11 @@ void KonqPixmapProvider::downloadNextFavIcon()
 
 void KonqPixmapProvider::downloadHostIcon(const QUrl &hostUrl)
 {
-    if (!canDownloadFavIconForScheme(hostUrl)) {
+    if (!canDownloadFavIconForScheme(hostUrl) || m_hostsInFlight.contains(hostUrl.host())) {
         return;
     }
 
+    m_hostsInFlight.insert(hostUrl.host());
     auto proc = [this](KIO::FavIconRequestJob *job) {
         if (updateIcons(job)) {
             emit changed();
@@ -153,6 +204,7 @@ void KonqPixmapProvider::downloadHostIcon(const QUrl &hostUrl)
 void KonqPixmapProvider::cleanupDownloadsQueue()
 {
     m_pendingRequests.clear();
+    m_hostsInFlight.clear();
     QList<KIO::FavIconRequestJob*> jobs = findChildren<KIO::FavIconRequestJob*>();
     for (auto o : m_jobs) {
         auto j = qobject_cast<KIO::FavIconRequestJob*>(o);
@@ -167,6 +219,13 @@ void KonqPixmapProvider::cleanupDownloadsQueue()
 
 void KonqPixmapProvider::setIconForUrl(const QUrl &hostUrl, const QUrl &iconUrl)
 {
+    // The site changed its icon, the default one of the host may have changed too
+    HostData &hostData = m_hosts[hostUrl.host()];
+    if (hostData.announcedIconUrl.isValid() && hostData.announcedIconUrl != iconUrl) {
+        hostData.downloaded = QDateTime();
+    }
+    hostData.announcedIconUrl = iconUrl;
+
     auto callback = [this] (KIO::FavIconRequestJob *job) {
         if (updateIcons(job, UpdateMode::Page)) {
             emit changed();
@@ -181,9 +240,9 @@ void KonqPixmapProvider::setIconForUrl(const QUrl &hostUrl, const QUrl &iconUrl)
 // finally, inserts the url/icon pair into the cache
 QString KonqPixmapProvider::iconNameFor(const QUrl &url)
 {
-    QMap<QUrl, QString>::iterator it = iconMap.find(url);
+    QHash<QUrl, QString>::const_iterator it = iconMap.constFind(url);
     QString icon;
-    if (it != iconMap.end()) {
+    if (it != iconMap.constEnd()) {
         icon = it.value();
         if (!icon.isEmpty()) {
             return icon;
@@ -199,7 +258,7 @@ QString KonqPixmapProvider::iconNameFor(const QUrl &url)
     }
 
     // cache the icon found for url
-    iconMap.insert(url, icon);
+    cacheIconName(url, icon);
 
     return icon;
 }
@@ -209,9 +268,65 @@ QPixmap KonqPixmapProvider::pixmapFor(const QString &url, int size)
     return loadIcon(iconNameFor(QUrl::fromUserInput(url)), size);
 }
 
+void KonqPixmapProvider::cacheIconName(const QUrl &url, const QString &icon)
+{
+    iconMap.insert(url, icon);
+    const QString host = url.host();
+    if (!host.isEmpty()) {
+        m_hosts[host].urls.insert(url);
+    }
+}
+
+QString KonqPixmapProvider::cacheFileName()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QLatin1String("/iconcache");
+}
+
+bool KonqPixmapProvider::readCache(const QByteArray &data)
+{
+    QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_6_0);
+    quint32 magic = 0;
+    quint32 version = 0;
+    quint32 count = 0;
+    stream >> magic >> version >> count;
+    if (stream.status() != QDataStream::Ok || magic != s_cacheMagic || version != s_cacheVersion) {
+        return false;
+    }
+    for (quint32 i = 0; i < count; ++i) {
+        QUrl url;
+        QString icon;
+        stream >> url >> icon;
+        if (stream.status() != QDataStream::Ok) {
+            return false;
+        }
+        cacheIconName(url, icon);
+    }
+    return true;
+}
+
 void KonqPixmapProvider::load(KConfigGroup &kc, const QString &key)
 {
-    iconMap.clear();
+    clear();
+    m_savedCache.clear();
+
+    QFile file(cacheFileName());
+    if (file.open(QIODevice::ReadOnly)) {
+        const QByteArray data = file.readAll();
+        if (readCache(data)) {
+            m_savedCache = data;
+        } else {
+            qCWarning(KONQUEROR_LOG) << "Ignoring invalid icon cache" << file.fileName();
+            clear();
+        }
+        return;
+    }
+
+    // Older versions stored the cache in the config file
+    if (!kc.hasKey(key)) {
+        return;
+    }
+    QStringList urls;
     const QStringList list = kc.readPathEntry(key, QStringList());
     QStringList::const_iterator it = list.begin();
     QStringList::const_iterator itEnd = list.end();
@@ -221,31 +336,66 @@ void KonqPixmapProvider::load(KConfigGroup &kc, const QString &key)
             break;
         }
         const QString icon(*it);
-        iconMap.insert(QUrl::fromUserInput(url), icon);
+        cacheIconName(QUrl::fromUserInput(url), icon);
+        urls.append(url);
         ++it;
     }
+    kc.deleteEntry(key);
+    save(urls);
 }
 
 // only saves the cache for the given list of items to prevent the cache
 // from growing forever.
-void KonqPixmapProvider::save(KConfigGroup &kc, const QString &key,
-                              const QStringList &items)
+void KonqPixmapProvider::save(const QStringList &items)
 {
-    QStringList list;
-    QStringList::const_iterator itEnd = items.end();
-    for (QStringList::const_iterator it = items.begin(); it != itEnd; ++it) {
-        QMap<QUrl, QString>::const_iterator mit = iconMap.constFind(QUrl::fromUserInput(*it));
+    QList<QHash<QUrl, QString>::const_iterator> entries;
+    entries.reserve(items.count());
+    for (const QString &item : items) {
+        QHash<QUrl, QString>::const_iterator mit = iconMap.constFind(QUrl::fromUserInput(item));
         if (mit != iconMap.constEnd()) {
-            list.append(mit.key().url());
-            list.append(mit.value());
+            entries.append(mit);
         }
     }
-    kc.writePathEntry(key, list);
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream << s_cacheMagic << s_cacheVersion << quint32(entries.count());
+    for (const auto &entry : std::as_const(entries)) {
+        stream << entry.key() << entry.value();
+    }
+    if (data == m_savedCache) {
+        return;
+    }
+
+    const QString fileName = cacheFileName();
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(KONQUEROR_LOG) << "Can't write icon cache" << fileName << file.errorString();
+        return;
+    }
+    file.write(data);
+    if (file.commit()) {
+        m_savedCache = data;
+    } else {
+        qCWarning(KONQUEROR_LOG) << "Can't write icon cache" << fileName << file.errorString();
+    }
 }
 
 void KonqPixmapProvider::clear()
 {
     iconMap.clear();
+    // Keep the hosts whose favicon was downloaded, so that it isn't downloaded again
+    for (auto it = m_hosts.begin(); it != m_hosts.end();) {
+        if (it->iconFile.isEmpty()) {
+            it = m_hosts.erase(it);
+        } else {
+            it->urls.clear();
+            ++it;
+        }
+    }
+    m_pixmaps.clear();
 }
 
 QPixmap KonqPixmapProvider::loadIcon(const QString &icon, int size)
@@ -253,7 +403,54 @@ QPixmap KonqPixmapProvider::loadIcon(const QString &icon, int size)
     if (size == 0) {
         size = KIconLoader::SizeSmall;
     }
-    return QIcon::fromTheme(icon).pixmap(size);
+
+    const PixmapKey key{icon, size, qApp->devicePixelRatio()};
+    if (const QPixmap *cached = m_pixmaps.object(key)) {
+        ++m_pixmapStatistics.hits;
+        return *cached;
+    }
+    ++m_pixmapStatistics.misses;
+
+    const QPixmap pixmap = QIcon::fromTheme(icon).pixmap(QSize(size, size), key.devicePixelRatio);
+    const qsizetype cost = qMax<qsizetype>(1, qsizetype(pixmap.width()) * pixmap.height() * pixmap.depth() / 8);
+    const qsizetype countBefore = m_pixmaps.count();
+    // QCache drops the least recently used pixmaps when going over the budget
+    if (m_pixmaps.insert(key, new QPixmap(pixmap), cost)) {
+        m_pixmapStatistics.evictions += countBefore + 1 - m_pixmaps.count();
+    }
+    return pixmap;
+}
+
+void KonqPixmapProvider::removeCachedPixmaps(const QString &icon)
+{
+    const QList<PixmapKey> keys = m_pixmaps.keys();
+    for (const PixmapKey &key : keys) {
+        if (key.icon == icon) {
+            m_pixmaps.remove(key);
+        }
+    }
+}
+
+KonqPixmapProvider::PixmapCacheStatistics KonqPixmapProvider::pixmapCacheStatistics() const
+{
+    return m_pixmapStatistics;
+}
+
+void KonqPixmapProvider::resetPixmapCacheStatistics()
+{
+    m_pixmapStatistics = PixmapCacheStatistics();
+}
+
+void KonqPixmapProvider::setPixmapCacheBudget(qint64 bytes)
+{
+    const qsizetype countBefore = m_pixmaps.count();
+    m_pixmaps.setMaxCost(qMax<qint64>(0, bytes));
+    m_pixmapStatistics.evictions += countBefore - m_pixmaps.count();
+}
+
+qint64 KonqPixmapProvider::pixmapCacheBudget() const
+{
+    return m_pixmaps.maxCost();
 }
 
 QIcon KonqPixmapProvider::iconForUrl(const QUrl &url)
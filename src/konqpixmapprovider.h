@@ -10,8 +10,11 @@
 
 #include "konqprivate_export.h"
 
-#include <QMap>
+#include <QCache>
+#include <QDateTime>
+#include <QHash>
 #include <QPixmap>
+#include <QSet>
 #include <QUrl>
 #include <QObject>
 
@@ -29,12 +32,17 @@ namespace KIO {
  * corresponding URLs in a cache for quick retrieval.
  *
  * Each host can have a favicon, but pages inside that host can have different favicon.
+ * The cached URLs are indexed by host, so that when a favicon has been downloaded only the
+ * URLs of that host need to be updated.
  *
  * If downloading many favicons at the same time (for example when creating a Bookmarks menu
  * with many entries in a single folder with an empty favicon cache), there's the risk that
  * many FavIconRequestJob are created at the same time, which makes Konqueror hang. To avoid
  * this issue, at most #s_maxJobs are created at the same time: the others are queued and start
  * automatically as soon as the number of running jobs goes below that threshold.
+ *
+ * The pixmaps returned by pixmapFor() are kept in a least recently used cache, whose size is
+ * limited by pixmapCacheBudget().
  */
 class KONQUERORPRIVATE_EXPORT KonqPixmapProvider : public QObject
 {
@@ -46,25 +54,29 @@ public:
 
     /**
      * @brief Trigger a download of a default favicon
+     *
+     * Nothing is done if the favicon for the host of @p hostUrl is already being downloaded:
+     * the changed() signal will be emitted when that download finishes.
      */
     void downloadHostIcon(const QUrl &hostUrl);
 
     /**
-     * @brief Trigger a download of the default favicon for a list of URLs
+     * @brief Trigger a download of the default favicon for the hosts of a list of URLs
      *
      * This works as downloadHostIcon() except that it doesn't emit the changed()
-     * signal after each download but only after all of them have finished.
+     * signal after each download but only once, after all of them have finished.
+     *
+     * Only one download is started for each host, and none for hosts whose favicon is
+     * already being downloaded or was downloaded by this provider less than
+     * #s_hostIconMaxAge seconds ago, unless one of its pages announced a different
+     * icon since, see setIconForUrl().
      *
      * If you need to download the favicon for the host of many URLs, it's better to
      * call this rather than downloadHostIcon() as it will avoid many consecutive calls
      * to slot connected with the changed() signal.
      * @param urls the list of URLs to download the host favicon for
-     * @warning In theory, the finishedDownloadingHostIcons() signal should be emitted after
-     * all URLs in @p urls are downloaded, regardless of whether there are pending downloads
-     * for other URLs. For implementation simplicity, however, the signal is actually emitted
-     * when the download queue is empty, even if some dowlonads aren't for URLs in @p urls.
      */
-    void downloadHostIcons(const QList<QUrl> &urls);
+    void downloadAll(const QList<QUrl> &urls);
 
     /**
      * Trigger a download of a custom favicon (from the HTML page)
@@ -77,20 +89,49 @@ public:
     QPixmap pixmapFor(const QString &url, int size);
 
     /**
-     * Loads the cache to @p kc from key @p key.
+     * Loads the cache from cacheFileName().
+     *
+     * If that file doesn't exist yet, the cache is imported from key @p key of @p kc,
+     * where older versions stored it, and @p key is removed.
      */
     void load(KConfigGroup &kc, const QString &key);
     /**
-     * Saves the cache to @p kc as key @p key.
+     * Saves the cache to cacheFileName(). Nothing is written if it didn't change.
      * Only those @p items are saved, otherwise the cache would grow forever.
      */
-    void save(KConfigGroup &kc, const QString &key, const QStringList &items);
+    void save(const QStringList &items);
+
+    /**
+     * @return the file the cache is saved to
+     */
+    static QString cacheFileName();
 
     /**
      * Clears the pixmap cache
      */
     void clear();
 
+    /**
+     * @brief Counters describing how well the cache of pixmaps works
+     */
+    struct PixmapCacheStatistics {
+        quint64 hits = 0; //!< Pixmaps found in the cache
+        quint64 misses = 0; //!< Pixmaps which had to be created
+        quint64 evictions = 0; //!< Pixmaps dropped from the cache to stay within the budget
+    };
+    PixmapCacheStatistics pixmapCacheStatistics() const;
+    void resetPixmapCacheStatistics();
+
+    /**
+     * @brief Sets how much memory, in bytes, the cached pixmaps can use
+     *
+     * If the cache is larger than that, the least recently used pixmaps are dropped.
+     */
+    void setPixmapCacheBudget(qint64 bytes);
+    qint64 pixmapCacheBudget() const;
+
+    static constexpr qint64 s_defaultPixmapCacheBudget = 2 * 1024 * 1024;
+
     /**
      * Looks up an iconname for @p url. Uses a cache for the iconname of url.
      */
@@ -124,6 +165,27 @@ private Q_SLOTS:
 private:
     QPixmap loadIcon(const QString &icon, int size);
 
+    /**
+     * @brief Stores @p icon as the icon name for @p url, adding @p url to the index of its host
+     */
+    void cacheIconName(const QUrl &url, const QString &icon);
+
+    /**
+     * @brief Reads the url/icon pairs from the contents of the cache file
+     * @return `false` if @p data isn't a valid cache file
+     */
+    bool readCache(const QByteArray &data);
+
+    /**
+     * @brief Whether the default favicon of @p host was downloaded recently enough not to download it again
+     */
+    bool hasFreshHostIcon(const QString &host) const;
+
+    /**
+     * @brief Removes the pixmaps of @p icon from the pixmap cache, for example because the file changed
+     */
+    void removeCachedPixmaps(const QString &icon);
+
     /**
      * @brief Type of functions to pass as callback to startFavIconJob()
      */
@@ -162,6 +224,8 @@ private:
     /**
      * @brief Updates the cached icon URLs
      *
+     * Only the URLs with the same host as the job are looked at.
+     *
      * @param job the job used to retrieve the favicon
      * @param mode whether the update is for the generic favicon for a host or the favicon for a specific page
      * @return `true` if any of the icon URLs have changed and `false` otherwise
@@ -171,10 +235,43 @@ private:
     KonqPixmapProvider();
     friend class KonqPixmapProviderSingleton;
 
-    QMap<QUrl, QString> iconMap;
+    QHash<QUrl, QString> iconMap;
+
+    /**
+     * @brief What is known about a host
+     */
+    struct HostData {
+        QSet<QUrl> urls; //!< The URLs in #iconMap with this host
+        QString iconFile; //!< The default favicon downloaded for this host, if any
+        QDateTime downloaded; //!< When #iconFile was downloaded, invalid if it must be downloaded again
+        QUrl announcedIconUrl; //!< The icon last announced by a page of this host, see setIconForUrl()
+    };
+    QHash<QString, HostData> m_hosts; //!< The hosts of the URLs in #iconMap, and those whose favicon was downloaded
+    QSet<QString> m_hostsInFlight; //!< The hosts whose default favicon is being downloaded
+
+    QByteArray m_savedCache; //!< The contents of the cache file, to avoid writing it again unchanged
+
+    /**
+     * @brief What a cached pixmap was created from
+     */
+    struct PixmapKey {
+        QString icon;
+        int size;
+        qreal devicePixelRatio;
+        bool operator==(const PixmapKey &other) const {
+            return icon == other.icon && size == other.size && devicePixelRatio == other.devicePixelRatio;
+        }
+    };
+    friend size_t qHash(const PixmapKey &key, size_t seed) {
+        return qHashMulti(seed, key.icon, key.size, key.devicePixelRatio);
+    }
+    QCache<PixmapKey, QPixmap> m_pixmaps; //!< The pixmaps returned by loadIcon(), the cost being their size in bytes
+    PixmapCacheStatistics m_pixmapStatistics;
 
     //TODO currently the number 10 is chosen arbitrarily. There should be a better way to choose it
     int static constexpr s_maxJobs = 10; //!< The maximum number of jobs to run at the same time
+    //! After how many seconds downloadAll() checks the default favicon of a host again
+    qint64 static constexpr s_hostIconMaxAge = 24 * 3600;
     QList<FavIconRequestData> m_pendingRequests; //!< Data describing the favicon requests for which a job hasn't been started yet
     /**
      * @brief A list of the currently running jobs
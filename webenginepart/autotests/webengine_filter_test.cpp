@@ -0,0 +1,355 @@
+/*
+    This file is part of the KDE project.
+
+    SPDX-FileCopyrightText: 2026 Konqueror Developers
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "settings/webengine_filter.h"
+
+#include <QFile>
+#include <QObject>
+#include <QTemporaryDir>
+#include <QTest>
+
+using namespace KDEPrivate;
+
+class WebEngineFilterTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void shouldMatchUrls_data();
+    void shouldMatchUrls();
+    void shouldMatchManyFilters();
+    void shouldReportFilter();
+    void shouldMatchOptions_data();
+    void shouldMatchOptions();
+    void shouldFilterNavigations_data();
+    void shouldFilterNavigations();
+    void shouldIndexDomains();
+    void shouldUseCache();
+    void shouldHideElements();
+};
+
+void WebEngineFilterTest::shouldMatchUrls_data()
+{
+    QTest::addColumn<QString>("filter");
+    QTest::addColumn<QString>("url");
+    QTest::addColumn<bool>("matched");
+
+    // "/banner/" would be a regular expression
+    QTest::newRow("substring") << "/banner/*" << "http://example.org/banner/1.png" << true;
+    QTest::newRow("substring missing") << "/banner/*" << "http://example.org/banners.png" << false;
+    QTest::newRow("short") << "ad" << "http://example.org/load.js" << true;
+    QTest::newRow("white list") << "@@/banner/*" << "http://example.org/banner/1.png" << true;
+
+    QTest::newRow("wildcard") << "/ads/*.gif" << "http://example.org/ads/x/y.gif" << true;
+    QTest::newRow("wildcard order") << "/ads/*.gif" << "http://example.org/x.gif/ads/" << false;
+    QTest::newRow("wildcards") << "a*b*c" << "http://example.org/xaybzc" << true;
+    QTest::newRow("wildcards missing") << "a*b*c" << "http://example.org/xcybza" << false;
+    QTest::newRow("wildcards at the ends") << "**/ads/**" << "http://example.org/ads/" << true;
+    QTest::newRow("only wildcard") << "*" << "http://example.org/" << true;
+
+    QTest::newRow("start anchor") << "|http://ads." << "http://ads.example.org/" << true;
+    QTest::newRow("start anchor missing") << "|http://ads." << "https://x.org/?http://ads." << false;
+    QTest::newRow("end anchor") << ".swf|" << "http://example.org/movie.swf" << true;
+    QTest::newRow("end anchor missing") << ".swf|" << "http://example.org/movie.swf?x" << false;
+    QTest::newRow("both anchors") << "|http://example.org/|" << "http://example.org/" << true;
+    QTest::newRow("both anchors longer") << "|http://example.org/|" << "http://example.org/x" << false;
+    QTest::newRow("end anchor wildcard") << "/ads/*.js|" << "http://example.org/ads/1.js?2.js" << true;
+
+    QTest::newRow("domain") << "||ads.example.org^" << "https://ads.example.org/x.js" << true;
+    QTest::newRow("subdomain") << "||example.org^" << "https://ads.example.org/x.js" << true;
+    QTest::newRow("domain in path") << "||example.org^" << "https://other.org/example.org/" << false;
+    QTest::newRow("domain part") << "||example.org^" << "https://badexample.org/" << false;
+    QTest::newRow("domain with user") << "||example.org^" << "https://user@example.org/" << true;
+    QTest::newRow("domain at end") << "||example.org^" << "https://example.org" << true;
+
+    QTest::newRow("separator") << "^ads^" << "http://example.org/ads/x" << true;
+    QTest::newRow("separator query") << "^ads^" << "http://example.org/?ads=1" << true;
+    QTest::newRow("separator missing") << "^ads^" << "http://example.org/uploads/x" << false;
+    QTest::newRow("only separator") << "^" << "http://example.org/" << true;
+
+    QTest::newRow("regexp") << "/ba[n]+er/" << "http://example.org/bannner" << true;
+    QTest::newRow("regexp missing") << "/ba[n]+er/" << "http://example.org/baer" << false;
+}
+
+void WebEngineFilterTest::shouldMatchUrls()
+{
+    QFETCH(QString, filter);
+    QFETCH(QString, url);
+    QFETCH(bool, matched);
+
+    FilterSet set;
+    set.addFilter(filter);
+    QCOMPARE(set.isUrlMatched(url), matched);
+    QCOMPARE(!set.urlMatchedBy(url).isEmpty(), matched);
+}
+
+void WebEngineFilterTest::shouldMatchManyFilters()
+{
+    FilterSet set;
+    for (int i = 0; i < 1000; ++i)
+        set.addFilter(QStringLiteral("banner%1/").arg(i));
+    // keys which are suffixes of other keys
+    set.addFilter(QStringLiteral("bcd"));
+    set.addFilter(QStringLiteral("abcdef"));
+
+    QVERIFY(set.isUrlMatched(QStringLiteral("http://example.org/banner999/x")));
+    QVERIFY(set.isUrlMatched(QStringLiteral("http://example.org/banner0/x")));
+    QVERIFY(!set.isUrlMatched(QStringLiteral("http://example.org/banner1000/x")));
+    QVERIFY(set.isUrlMatched(QStringLiteral("http://example.org/abcde")));
+    QVERIFY(!set.isUrlMatched(QStringLiteral("http://example.org/abce")));
+
+    // filters added after matching
+    set.addFilter(QStringLiteral("late/"));
+    QVERIFY(set.isUrlMatched(QStringLiteral("http://example.org/late/x")));
+
+    set.clear();
+    QVERIFY(!set.isUrlMatched(QStringLiteral("http://example.org/banner0/x")));
+}
+
+void WebEngineFilterTest::shouldReportFilter()
+{
+    FilterSet set;
+    set.addFilter(QStringLiteral("||example.org^*.js|"));
+    set.addFilter(QStringLiteral("banner/"));
+    QCOMPARE(set.urlMatchedBy(QStringLiteral("https://example.org/x.js")), QStringLiteral("||example.org^*.js|"));
+    QCOMPARE(set.urlMatchedBy(QStringLiteral("https://other.org/banner/")), QStringLiteral("banner/"));
+    QCOMPARE(set.urlMatchedBy(QStringLiteral("https://other.org/")), QString());
+}
+
+void WebEngineFilterTest::shouldMatchOptions_data()
+{
+    QTest::addColumn<QString>("filter");
+    QTest::addColumn<QString>("url");
+    QTest::addColumn<QString>("page");
+    QTest::addColumn<int>("type");
+    QTest::addColumn<bool>("matched");
+
+    const QString page = QStringLiteral("https://www.example.org/");
+    const QString ad = QStringLiteral("https://ads.tracker.com/ad.js");
+    const int script = FilterRequest::ScriptType;
+    const int image = FilterRequest::ImageType;
+    const int unknown = FilterRequest::UnknownType;
+
+    QTest::newRow("no options") << "/ad.js" << ad << page << script << true;
+    QTest::newRow("no options document") << "/ad.js" << ad << page << int(FilterRequest::DocumentType) << false;
+    QTest::newRow("type") << "/ad.js$script" << ad << page << script << true;
+    QTest::newRow("other type") << "/ad.js$script" << ad << page << image << false;
+    QTest::newRow("types") << "/ad.js$image,script" << ad << page << script << true;
+    QTest::newRow("inverse type") << "/ad.js$~script" << ad << page << script << false;
+    QTest::newRow("inverse other type") << "/ad.js$~script" << ad << page << image << true;
+    QTest::newRow("type unknown") << "/ad.js$script" << ad << QString() << unknown << false;
+    QTest::newRow("document") << "||tracker.com^$document" << ad << page << int(FilterRequest::DocumentType) << true;
+
+    QTest::newRow("third-party") << "/ad.js$third-party" << ad << page << script << true;
+    QTest::newRow("third-party same site") << "/ad.js$third-party" << ad << "https://tracker.com/" << script << false;
+    QTest::newRow("third-party site domain") << "/ad.js$third-party" << "https://a.b.co.uk/ad.js" << "https://c.b.co.uk/" << script << false;
+    QTest::newRow("third-party other site domain") << "/ad.js$third-party" << "https://a.b.co.uk/ad.js" << "https://c.d.co.uk/" << script << true;
+    QTest::newRow("first-party") << "/ad.js$~third-party" << ad << page << script << false;
+    QTest::newRow("first-party same site") << "/ad.js$~third-party" << ad << "https://www.tracker.com:8080/" << script << true;
+    QTest::newRow("third-party page unknown") << "/ad.js$third-party" << ad << QString() << script << false;
+
+    QTest::newRow("domain") << "/ad.js$domain=example.org" << ad << page << script << true;
+    QTest::newRow("domain other") << "/ad.js$domain=example.com" << ad << page << script << false;
+    QTest::newRow("domain list") << "/ad.js$domain=a.org|example.org" << ad << page << script << true;
+    QTest::newRow("domain excluded") << "/ad.js$domain=~example.org" << ad << page << script << false;
+    QTest::newRow("domain not excluded") << "/ad.js$domain=~example.com" << ad << page << script << true;
+    QTest::newRow("subdomain excluded") << "/ad.js$domain=example.org|~www.example.org" << ad << page << script << false;
+    QTest::newRow("domain page unknown") << "/ad.js$domain=example.org" << ad << QString() << script << false;
+    QTest::newRow("domain without key") << "*$script,domain=example.org" << ad << page << script << true;
+    QTest::newRow("domain without key other") << "*$script,domain=example.com" << ad << page << script << false;
+
+    QTest::newRow("case") << "/AD.js" << ad << page << script << true;
+    QTest::newRow("match-case") << "/AD.js$match-case" << ad << page << script << false;
+    QTest::newRow("match-case same") << "/ad.js$match-case" << ad << page << script << true;
+    QTest::newRow("regexp with options") << "/ad\\.js$/$script" << ad << page << script << true;
+    QTest::newRow("regexp with other options") << "/ad\\.js$/$image" << ad << page << script << false;
+    QTest::newRow("regexp end") << "/ad\\.js$/" << ad << QString() << unknown << true;
+    QTest::newRow("unsupported option") << "/ad.js$popup" << ad << page << script << false;
+}
+
+void WebEngineFilterTest::shouldMatchOptions()
+{
+    QFETCH(QString, filter);
+    QFETCH(QString, url);
+    QFETCH(QString, page);
+    QFETCH(int, type);
+    QFETCH(bool, matched);
+
+    FilterSet set;
+    set.addFilter(filter);
+    const FilterRequest request(url, page, FilterRequest::ResourceType(type));
+    QCOMPARE(set.isUrlMatched(request), matched);
+    QCOMPARE(!set.urlMatchedBy(request).isEmpty(), matched);
+}
+
+void WebEngineFilterTest::shouldFilterNavigations_data()
+{
+    QTest::addColumn<QString>("url");
+    QTest::addColumn<QString>("initiator");
+    QTest::addColumn<bool>("filtered");
+    QTest::addColumn<bool>("matched");
+
+    // matched by "||tracker.com^$document,third-party"
+    QTest::newRow("link within site") << "https://tracker.com/a" << "https://tracker.com" << false << false;
+    QTest::newRow("link from other site") << "https://tracker.com/a" << "https://www.example.org" << true << true;
+    QTest::newRow("other subdomain") << "https://ads.tracker.com/a" << "https://tracker.com" << true << false;
+    QTest::newRow("other scheme") << "https://tracker.com/a" << "http://tracker.com" << true << false;
+    QTest::newRow("other port") << "https://tracker.com:8080/a" << "https://tracker.com" << true << false;
+    // the page is not known, third-party filters don't match
+    QTest::newRow("typed") << "https://tracker.com/a" << QString() << true << false;
+}
+
+void WebEngineFilterTest::shouldFilterNavigations()
+{
+    QFETCH(QString, url);
+    QFETCH(QString, initiator);
+    QFETCH(bool, filtered);
+    QFETCH(bool, matched);
+
+    // the first party of a load of the main frame is the page loaded, it tells nothing
+    QCOMPARE(FilterRequest::isFilteredNavigation(QUrl(url), QUrl(initiator)), filtered);
+
+    FilterSet set;
+    set.addFilter(QStringLiteral("||tracker.com^$document,third-party"));
+    QCOMPARE(set.isUrlMatched(FilterRequest(url, initiator, FilterRequest::DocumentType)), matched);
+}
+
+void WebEngineFilterTest::shouldIndexDomains()
+{
+    FilterSet set;
+    for (int i = 0; i < 1000; ++i)
+        set.addFilter(QStringLiteral("$script,domain=site%1.org|~www.site%1.org").arg(i));
+    set.addFilter(QStringLiteral("||tracker.com^$third-party"));
+
+    const auto request = [](const QString &url, const QString &page) {
+        return FilterRequest(url, page, FilterRequest::ScriptType);
+    };
+    QVERIFY(set.isUrlMatched(request(QStringLiteral("https://cdn.org/x.js"), QStringLiteral("https://site999.org/"))));
+    QVERIFY(set.isUrlMatched(request(QStringLiteral("https://cdn.org/x.js"), QStringLiteral("https://a.site0.org/"))));
+    QVERIFY(!set.isUrlMatched(request(QStringLiteral("https://cdn.org/x.js"), QStringLiteral("https://www.site0.org/"))));
+    QVERIFY(!set.isUrlMatched(request(QStringLiteral("https://cdn.org/x.js"), QStringLiteral("https://site1000.org/"))));
+    QVERIFY(set.isUrlMatched(request(QStringLiteral("https://tracker.com/x.js"), QStringLiteral("https://site1000.org/"))));
+    QCOMPARE(set.urlMatchedBy(request(QStringLiteral("https://cdn.org/x.js"), QStringLiteral("https://site5.org/"))),
+             QStringLiteral("$script,domain=site5.org|~www.site5.org"));
+}
+
+void WebEngineFilterTest::shouldUseCache()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString cache = dir.filePath(QStringLiteral("filters.cache"));
+    const QByteArray source("lists");
+
+    FilterSet set;
+    set.addFilter(QStringLiteral("||ads.example.org^$third-party"));
+    set.addFilter(QStringLiteral("banner/*.gif|"));
+    set.addFilter(QStringLiteral("$script,domain=example.com|~www.example.com"));
+    set.addFilter(QStringLiteral("/tr[a]+ck/$image"));
+    QVERIFY(set.saveCache(cache, source));
+
+    const FilterRequest ad(QStringLiteral("https://ads.example.org/x.js"), QStringLiteral("https://other.org/"), FilterRequest::ScriptType);
+    const FilterRequest banner(QStringLiteral("https://other.org/banner/1.gif"));
+    const FilterRequest script(QStringLiteral("https://cdn.org/x.js"), QStringLiteral("https://a.example.com/"), FilterRequest::ScriptType);
+    const FilterRequest excluded(QStringLiteral("https://cdn.org/x.js"), QStringLiteral("https://www.example.com/"), FilterRequest::ScriptType);
+    const FilterRequest image(QStringLiteral("https://other.org/traaack/1.png"), QString(), FilterRequest::ImageType);
+
+    FilterSet cached;
+    QVERIFY(!cached.loadCache(cache, QByteArray("other lists")));
+    QVERIFY(!cached.loadCache(dir.filePath(QStringLiteral("missing.cache")), source));
+    QVERIFY(cached.loadCache(cache, source));
+    QVERIFY(cached.isUrlMatched(ad));
+    QVERIFY(cached.isUrlMatched(banner));
+    QVERIFY(cached.isUrlMatched(script));
+    QVERIFY(!cached.isUrlMatched(excluded));
+    QVERIFY(cached.isUrlMatched(image));
+    QCOMPARE(cached.urlMatchedBy(ad), QStringLiteral("||ads.example.org^$third-party"));
+    QCOMPARE(cached.urlMatchedBy(image), QStringLiteral("tr[a]+ck$image"));
+
+    // filters added to a cached set
+    cached.addFilter(QStringLiteral("/late/*"));
+    QVERIFY(cached.isUrlMatched(FilterRequest(QStringLiteral("https://other.org/late/"))));
+    QVERIFY(cached.isUrlMatched(ad));
+    QVERIFY(!cached.isUrlMatched(excluded));
+
+    // a broken file
+    QFile file(cache);
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    file.resize(file.size() / 2);
+    file.close();
+    QVERIFY(!cached.loadCache(cache, source));
+    QVERIFY(!cached.isUrlMatched(banner));
+
+    // a damaged file, a number of the first record of one of its tables out of the bounds of the
+    // table it indexes: the body and the options of a rule, the domains of options, the name and
+    // the id of a domain, a state of the automaton, a rule found in a state
+    const QList<QPair<int, int>> fields = {{1, 0}, {1, 12}, {3, 16}, {5, 0}, {5, 8}, {15, 0}, {16, 0}, {18, 0}, {19, 0}};
+    for (const auto &field : fields) {
+        QVERIFY(set.saveCache(cache, source));
+        QFile damaged(cache);
+        QVERIFY(damaged.open(QIODevice::ReadWrite));
+        // after the header, the offsets and sizes of the tables
+        quint32 offset;
+        QVERIFY(damaged.seek(24 + field.first * 8));
+        QCOMPARE(damaged.read(reinterpret_cast<char *>(&offset), sizeof(offset)), qint64(sizeof(offset)));
+        QVERIFY(damaged.seek(offset + field.second));
+        const qint32 outOfBounds = 1 << 30;
+        damaged.write(reinterpret_cast<const char *>(&outOfBounds), sizeof(outOfBounds));
+        damaged.close();
+        QVERIFY2(!cached.loadCache(cache, source), qPrintable(QStringLiteral("table %1, at %2").arg(field.first).arg(field.second)));
+    }
+}
+
+void WebEngineFilterTest::shouldHideElements()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString cache = dir.filePath(QStringLiteral("filters.cache"));
+
+    FilterSet set;
+    set.addFilter(QStringLiteral("##.ad"));
+    set.addFilter(QStringLiteral("example.org,other.org##.banner"));
+    set.addFilter(QStringLiteral("example.org#@#.ad"));
+    set.addFilter(QStringLiteral("~www.example.org##.promo"));
+    set.addFilter(QStringLiteral("##.removed"));
+    set.addFilter(QStringLiteral("other.org##.removed"));
+    set.addFilter(QStringLiteral("#@#.removed"));
+    set.addFilter(QStringLiteral("##div:-abp-contains(ad)"));
+    // would end the rule, or hide the next ones in a comment or an escaped character
+    set.addFilter(QStringLiteral("##.x{display:block}"));
+    set.addFilter(QStringLiteral("##.x/*"));
+    set.addFilter(QStringLiteral("##.x\\"));
+    set.addFilter(QStringLiteral("# a comment"));
+    QVERIFY(!set.isUrlMatched(QStringLiteral("http://example.org/ad")));
+    QVERIFY(set.saveCache(cache, QByteArray("lists")));
+
+    FilterSet cached;
+    QVERIFY(cached.loadCache(cache, QByteArray("lists")));
+    for (FilterSet *s : {&set, &cached}) {
+        QCOMPARE(s->elementHidingStyleSheet(), QStringLiteral(".ad,.promo{display:none!important}"));
+
+        bool generic = false;
+        QCOMPARE(s->elementHidingStyleSheet(QStringLiteral("other.org"), &generic), QStringLiteral(".banner{display:none!important}"));
+        QVERIFY(generic);
+        // the exception for ".ad" shows it, so the rules for all pages are in the sheet
+        QCOMPARE(s->elementHidingStyleSheet(QStringLiteral("news.example.org"), &generic), QStringLiteral(".banner,.promo{display:none!important}"));
+        QVERIFY(!generic);
+        QCOMPARE(s->elementHidingStyleSheet(QStringLiteral("WWW.example.org"), &generic), QStringLiteral(".banner{display:none!important}"));
+        QVERIFY(!generic);
+        QVERIFY(s->elementHidingStyleSheet(QStringLiteral("example.com"), &generic).isEmpty());
+        QVERIFY(generic);
+    }
+
+    // the sheet for all pages is made again for new filters only
+    const QString sheet = cached.elementHidingStyleSheet();
+    QCOMPARE(cached.elementHidingStyleSheet().constData(), sheet.constData());
+    cached.addFilter(QStringLiteral("##.late"));
+    QCOMPARE(cached.elementHidingStyleSheet(), QStringLiteral(".ad,.promo,.late{display:none!important}"));
+}
+
+QTEST_GUILESS_MAIN(WebEngineFilterTest)
+
+#include "webengine_filter_test.moc"
@@ -0,0 +1,7 @@
+//Hides the elements of the ad block element hiding filters. This runs when the document is
+//created, before it has any element, so the sheet is adopted rather than put in a <style> element
+(function() {
+  var sheet = new CSSStyleSheet();
+  sheet.replaceSync('%1');
+  document.adoptedStyleSheets = document.adoptedStyleSheets.concat(sheet);
+})();
@@ -9,186 +9,1360 @@
 
 #include "webengine_filter.h"
 
+#include <QFile>
 #include <QHash>
-#include <QBitArray>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QVarLengthArray>
 #include <QStringView>
 
-// rolling hash parameters
-#define HASH_P (1997)
-#define HASH_Q (17509)
-// HASH_MOD = (HASH_P^7) % HASH_Q
-#define HASH_MOD (523)
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+// Longest part of a filter looked for in addresses, see StringsMatcher::addFilter()
+#define KEY_MAX_LENGTH (16)
+
+// Selectors in a rule of the element hiding style sheets: the browser drops
+// a rule with a selector it doesn't know, but rules of one selector are long
+#define HIDING_SELECTORS_PER_RULE (32)
 
 
 using namespace KDEPrivate;
 
-// Updateable Multi-String Matcher based on Rabin-Karp's algorithm
-class StringsMatcher {
+// Characters matched by "^": anything but letters, digits, and _ - . %
+static bool isSeparator(QChar c)
+{
+    return !c.isLetterOrNumber() && c != QLatin1Char('_') && c != QLatin1Char('-') &&
+           c != QLatin1Char('.') && c != QLatin1Char('%');
+}
+
+// Position in url after seg matched at pos, or -1
+static int matchSegment(QStringView seg, QStringView url, int pos)
+{
+    for (int i = 0; i < seg.size(); ++i) {
+        const QChar c = seg[i];
+        if (pos == url.size()) {
+            // a separator at the end also matches the end of the address
+            return (c == QLatin1Char('^') && i == seg.size() - 1) ? pos : -1;
+        }
+        if (c == QLatin1Char('^') ? !isSeparator(url[pos]) : url[pos] != c)
+            return -1;
+        ++pos;
+    }
+    return pos;
+}
+
+// Leftmost position from where seg matches in url, setting end; or -1
+static int findSegment(QStringView seg, QStringView url, int from, int *end)
+{
+    for (int pos = from; pos <= url.size(); ++pos) {
+        if (seg[0] != QLatin1Char('^')) {
+            pos = url.indexOf(seg[0], pos);
+            if (pos < 0)
+                return -1;
+        }
+        const int e = matchSegment(seg, url, pos);
+        if (e >= 0) {
+            *end = e;
+            return pos;
+        }
+    }
+    return -1;
+}
+
+// Lower case of s, of the same length so positions in it stay the same
+static QString toLowerChars(QStringView s)
+{
+    QString lower(s.size(), Qt::Uninitialized);
+    QChar *out = lower.data();
+    for (const QChar c : s)
+        *out++ = c.toLower();
+    return lower;
+}
+
+// Whether a filter is a regular expression, "/.../"
+static bool isRegExpFilter(QStringView filter)
+{
+    return filter.size() > 2 && filter.startsWith(QLatin1Char('/')) && filter.endsWith(QLatin1Char('/'));
+}
+
+/*
+ * The domain of a site a host belongs to, to tell third-party requests:
+ * the last two labels of the host, or three under second level domains
+ * like "co.uk".
+ *
+ * This is only a guess of the public suffix list, which is not used: the
+ * suffixes registered by hosting services, like "github.io", "blogspot.com"
+ * or "appspot.com", are not known, so all the sites under one of them are
+ * taken as the same site, and their requests to each other as first-party.
+ * Nor are second level domains other than the ones below, like "ltd.uk"
+ * or "nom.fr"; while under a country domain without second level domains,
+ * "a.org.de" and "b.org.de" are taken as different sites.
+ */
+static QStringView siteDomain(QStringView host)
+{
+    static const char *const secondLevel[] = {"ac", "co", "com", "edu", "go", "gov", "ne", "net", "or", "org"};
+
+    if (host.isEmpty() || host.endsWith(QLatin1Char(']')) || host.back().isDigit())
+        return host; // an IP address
+    const int last = host.lastIndexOf(QLatin1Char('.'));
+    if (last <= 0)
+        return host;
+    const int second = host.lastIndexOf(QLatin1Char('.'), last - 1);
+    if (second < 0)
+        return host;
+    if (host.size() - last - 1 == 2) {
+        const QStringView label = host.mid(second + 1, last - second - 1);
+        for (const char *name : secondLevel) {
+            if (label == QLatin1String(name)) {
+                const int third = second > 0 ? host.lastIndexOf(QLatin1Char('.'), second - 1) : -1;
+                return third < 0 ? host : host.mid(third + 1);
+            }
+        }
+    }
+    return host.mid(second + 1);
+}
+
+// Where the host name is in an address, for "||"
+struct FilterUrl {
+    explicit FilterUrl(QStringView url)
+    {
+        hostStart = url.indexOf(QLatin1String("://"));
+        hostStart = (hostStart < 0) ? 0 : hostStart + 3;
+        hostEnd = hostStart;
+        while (hostEnd < url.size() && url[hostEnd] != QLatin1Char('/') &&
+               url[hostEnd] != QLatin1Char('?') && url[hostEnd] != QLatin1Char('#')) {
+            if (url[hostEnd] == QLatin1Char('@'))
+                hostStart = hostEnd + 1;
+            ++hostEnd;
+        }
+    }
+
+    // The host name without port
+    QStringView host(QStringView url) const
+    {
+        QStringView h = url.mid(hostStart, hostEnd - hostStart);
+        const int colon = h.lastIndexOf(QLatin1Char(':'));
+        if (colon >= 0 && !h.endsWith(QLatin1Char(']')))
+            h.truncate(colon);
+        return h;
+    }
+
+    int hostStart, hostEnd;
+};
+
+/*
+ * The options of a filter, after "$": the types of requests it matches,
+ * from which pages, and whether its case matters.
+ *
+ * Like the other records of StringsMatcher, only numbers, so they can be
+ * used from a cache file mapped in memory: strings are in the string pool
+ * of the matcher, "domain=" in its list of option domains.
+ */
+struct FilterOptions {
+    enum Party { AnyParty, FirstParty, ThirdParty };
+    // What filters without type options match
+    static constexpr int DefaultTypes = 0xfff & ~FilterRequest::DocumentType;
+
+    qint32 types;
+    qint32 party;
+    qint32 matchCase;
+    qint32 hasIncludedDomains;
+    // ids of the domains shifted left, the lowest bit set for "~domain", sorted
+    qint32 domains;
+    qint32 domainCount;
+    qint32 text;
+    qint32 textLength;
+};
+
+// A wildcard filter, see FilterRule
+struct RuleRecord {
+    qint32 body;
+    qint32 length;
+    qint32 flags;
+    // index in the options, -1 for none
+    qint32 options;
+};
+
+struct RegExpRecord {
+    qint32 pattern;
+    qint32 length;
+    qint32 options;
+    qint32 matchCase;
+};
+
+struct DomainRecord {
+    qint32 name;
+    qint32 length;
+    qint32 id;
+};
+
+// A selector of element hiding filters, the same for all its filters
+struct HidingRecord {
+    enum Flag { Generic = 1, Disabled = 2 };
+
+    qint32 selector;
+    qint32 length;
+    // Generic for "##selector" hiding on all pages, Disabled for "#@#selector"
+    qint32 flags;
+};
+
+// Extended selectors of other ad blockers, which would not be understood
+static const char *const unsupportedSelectors[] = {
+    ":-abp-", ":has-text(", ":matches-", ":min-text-length(", ":others(", ":remove(",
+    ":style(", ":upward(", ":watch-attr(", ":xpath(",
+};
+
+// Adds rules hiding the elements of selectors to sheet
+static void appendHidingRules(QString *sheet, const QVector<QStringView> &selectors)
+{
+    for (int i = 0; i < selectors.count(); ++i) {
+        *sheet += selectors.at(i);
+        if (i % HIDING_SELECTORS_PER_RULE == HIDING_SELECTORS_PER_RULE - 1 || i == selectors.count() - 1)
+            *sheet += QLatin1String("{display:none!important}");
+        else
+            *sheet += QLatin1Char(',');
+    }
+}
+
+static const struct {
+    const char *name;
+    int type;
+} resourceTypeOptions[] = {
+    {"other", FilterRequest::OtherType},
+    {"script", FilterRequest::ScriptType},
+    {"image", FilterRequest::ImageType},
+    {"stylesheet", FilterRequest::StylesheetType},
+    {"css", FilterRequest::StylesheetType},
+    {"object", FilterRequest::ObjectType},
+    {"object-subrequest", FilterRequest::ObjectType},
+    {"xmlhttprequest", FilterRequest::XmlHttpRequestType},
+    {"xhr", FilterRequest::XmlHttpRequestType},
+    {"subdocument", FilterRequest::SubdocumentType},
+    {"frame", FilterRequest::SubdocumentType},
+    {"ping", FilterRequest::PingType},
+    {"beacon", FilterRequest::PingType},
+    {"media", FilterRequest::MediaType},
+    {"font", FilterRequest::FontType},
+    {"websocket", FilterRequest::WebSocketType},
+    {"document", FilterRequest::DocumentType},
+};
+
+/*
+ * A filter with wildcards and anchors, compiled into the parts between
+ * the wildcards, so matching needs no regular expression.
+ *
+ * "||" anchors the filter at the start of the host name or of one of its
+ * domains, "|" at the start or the end of the address. "^" matches a
+ * separator, or the end of the address.
+ *
+ * The rule is a view of its body, which stays in the matcher.
+ */
+class FilterRule {
 public:
-    // add filter to matching set
-    void addString(const QString& pattern)
+    enum Flag { StartAnchor = 1, DomainAnchor = 2, EndAnchor = 4, MatchCase = 8 };
+
+    FilterRule(QStringView body, int flags)
+        : body(body), flags(flags)
     {
-        if (pattern.length() < 8) {
-            // handle short string differently
-            shortStringFilters.append(pattern);
-        } else {
-            // use modified Rabin-Karp's algorithm with 8-length string hash
-            // i.e. store hash of first 8 chars in the HashMap for fast look-up
-            stringFilters.append(pattern);
-            int ind = stringFilters.size() - 1;
-            int current = 0;
-
-            // compute hash using rolling hash
-            // hash for string: x0,x1,x2...xn-1 will be:
-            // (p^(n-1)*x0 + p^(n-2)*x1 + ... + p * xn-2 + xn-1) % q
-            // where p and q some wisely-chosen integers
-            /*for (int k = 0; k < 8; ++k)*/
-            int len = pattern.length();
-            for (int k = len - 8; k < len; ++k)
-                current = (current * HASH_P + pattern[k].unicode()) % HASH_Q;
-
-            // insert computed hash value into HashMap
-            QHash<int, QVector<int> >::iterator it = stringFiltersHash.find(current + 1);
-            if (it == stringFiltersHash.end()) {
-                QVector<int> list;
-                list.append(ind);
-                stringFiltersHash.insert(current + 1, list);
-                fastLookUp.setBit(current);
-            } else {
-                it->append(ind);
-            }
+    }
+
+    // The body of filter f, setting its flags. Unless matchCase, the body is
+    // in lower case, to be matched against lower case addresses
+    static QString parse(QStringView f, bool matchCase, int *flags)
+    {
+        *flags = matchCase ? MatchCase : 0;
+        if (f.startsWith(QLatin1String("||"))) {
+            *flags |= DomainAnchor;
+            f = f.mid(2);
+        } else if (f.startsWith(QLatin1Char('|'))) {
+            *flags |= StartAnchor;
+            f = f.mid(1);
+        }
+        if (f.endsWith(QLatin1Char('|'))) {
+            *flags |= EndAnchor;
+            f.chop(1);
+        }
+        // wildcards at the ends undo the anchors
+        if (f.startsWith(QLatin1Char('*')))
+            *flags &= ~(StartAnchor | DomainAnchor);
+        if (f.endsWith(QLatin1Char('*')))
+            *flags &= ~EndAnchor;
+
+        // the parts, separated by a single '*'
+        QString body;
+        for (QStringView part : f.tokenize(QLatin1Char('*'), Qt::SkipEmptyParts)) {
+            if (!body.isEmpty())
+                body += QLatin1Char('*');
+            body += part;
         }
+        return matchCase ? body : toLowerChars(body);
     }
 
+    bool isMatchCase() const
+    {
+        return flags & MatchCase;
+    }
 
-    // check if string match at least one string from matching set
-    bool isMatched(const QString& str, QString *by = nullptr) const
+    // The filter, without wildcards at the ends
+    QString text() const
     {
-        // check short strings first
-        for (int i = 0; i < shortStringFilters.size(); ++i) {
-            if (str.contains(shortStringFilters[i]))
-            {
-                if (by != nullptr) *by = shortStringFilters[i];
-                return true;
+        QString t = (flags & DomainAnchor) ? QStringLiteral("||") : (flags & StartAnchor) ? QStringLiteral("|") : QString();
+        t += body;
+        if (flags & EndAnchor)
+            t += QLatin1Char('|');
+        return t;
+    }
+
+    // The longest part without wildcard or separator, looked for before matching
+    QStringView key() const
+    {
+        QStringView best;
+        for (QStringView run : body.tokenize(QLatin1Char('*'), Qt::SkipEmptyParts)) {
+            for (QStringView part : run.tokenize(QLatin1Char('^'), Qt::SkipEmptyParts)) {
+                if (part.size() > best.size())
+                    best = part;
             }
         }
+        return best.left(KEY_MAX_LENGTH);
+    }
 
-        int len = str.length();
-        int k;
-
-        int current = 0;
-        int next = 0;
-        // compute hash for first 8 characters
-        for (k = 0; k < 8 && k < len; ++k)
-            current = (current * HASH_P + str[k].unicode()) % HASH_Q;
+    bool matches(QStringView url, const FilterUrl &u) const
+    {
+        QStringView rest(body);
+        if (rest.isEmpty())
+            return true;
 
-        QHash<int, QVector<int> >::const_iterator hashEnd = stringFiltersHash.end();
-        // main Rabin-Karp's algorithm loop
-        for (k = 7; k < len; ++k, current = next) {
-            // roll the hash if not at the end
-            // (calculate hash for the next iteration)
-            if (k + 1 < len)
-                next = (HASH_P * ((current + HASH_Q - ((HASH_MOD * str[k - 7].unicode()) % HASH_Q)) % HASH_Q) + str[k + 1].unicode()) % HASH_Q;
+        int end = 0;
+        bool first = true;
+        while (!rest.isEmpty()) {
+            const int star = rest.indexOf(QLatin1Char('*'));
+            const QStringView seg = rest.left(star < 0 ? rest.size() : star);
+            rest = (star < 0) ? QStringView() : rest.mid(star + 1);
 
-            if (!fastLookUp.testBit(current))
-                continue;
+            if (rest.isEmpty() && (flags & EndAnchor)) {
+                // ending the address, a separator at the end maybe matching its end
+                for (int pos = url.size() - seg.size(); pos <= url.size() - seg.size() + 1; ++pos) {
+                    if (pos >= end && isStart(first, pos, url, u) && matchSegment(seg, url, pos) == url.size())
+                        return true;
+                }
+                return false;
+            }
 
-            // look-up the hash in the HashMap and check all strings
-            QHash<int, QVector<int> >::const_iterator it = stringFiltersHash.find(current + 1);
-
-            // check possible strings
-            if (it != hashEnd) {
-                for (int j = 0; j < it->size(); ++j) {
-                    int index = it->value(j);
-                    // check if we got simple string or REs prefix
-                    if (index >= 0) {
-                        int flen = stringFilters[index].length();
-                        if (k - flen + 1 >= 0 && stringFilters[index] == QStringView{str}.mid(k - flen + 1 , flen))
-                        {
-                            if (by != nullptr) *by = stringFilters[index];
-                            return true;
-                        }
-                    } else {
-                        index = -index - 1;
-                        int flen = rePrefixes[index].length();
-                        if (k - 8 + flen < len && rePrefixes[index] == QStringView{str}.mid(k - 7, flen))
-                        {
-                            int remStart = k - 7 + flen;
-                            QString remainder = QString::fromRawData(str.unicode() + remStart,
-                                                                    str.length() - remStart);
-                            QRegularExpression exactMatchRegexp = QRegularExpression(QRegularExpression::anchoredPattern(reFilters[index].pattern()));
-                            if (exactMatchRegexp.match(remainder).hasMatch()) {
-                                if (by != nullptr) *by = rePrefixes[index]+reFilters[index].pattern();
-                                return true;
-                            }
-                        }
-                    }
+            if (first && (flags & (StartAnchor | DomainAnchor))) {
+                end = -1;
+                const int last = (flags & StartAnchor) ? 0 : u.hostEnd - 1;
+                for (int pos = (flags & StartAnchor) ? 0 : u.hostStart; pos <= last && end < 0; ++pos) {
+                    if (isStart(true, pos, url, u))
+                        end = matchSegment(seg, url, pos);
                 }
+                if (end < 0)
+                    return false;
+            } else if (findSegment(seg, url, end, &end) < 0) {
+                return false;
             }
+            first = false;
         }
+        return true;
+    }
 
-        return false;
+private:
+    // Whether the first part may start at pos
+    bool isStart(bool first, int pos, QStringView url, const FilterUrl &u) const
+    {
+        if (!first)
+            return true;
+        if (flags & StartAnchor)
+            return pos == 0;
+        if (flags & DomainAnchor)
+            return pos == u.hostStart || (pos > u.hostStart && pos < u.hostEnd && url[pos - 1] == QLatin1Char('.'));
+        return true;
     }
 
-    // add filter to matching set with wildcards (*,?) in it
-    void addWildedString(const QString& prefix, const QRegularExpression& rx)
+    QStringView body;
+    int flags;
+};
+
+// A read only array of a StringsMatcher
+template<typename T>
+class FilterTable {
+public:
+    typedef T value_type;
+
+    FilterTable()
+        : d(nullptr), n(0)
+    {
+    }
+    FilterTable(const T *data, int size)
+        : d(data), n(size)
+    {
+    }
+    explicit FilterTable(const QVector<T> &v)
+        : d(v.constData()), n(v.size())
     {
-        rePrefixes.append(prefix);
-        reFilters.append(rx);
-        int index = -rePrefixes.size();
+    }
 
-        int current = 0;
-        for (int k = 0; k < 8; ++k)
-            current = (current * HASH_P + prefix[k].unicode()) % HASH_Q;
+    const T &at(int i) const
+    {
+        return d[i];
+    }
+    int size() const
+    {
+        return n;
+    }
+    const T *begin() const
+    {
+        return d;
+    }
+    const T *end() const
+    {
+        return d + n;
+    }
 
-        // insert computed hash value into HashMap
-        QHash<int, QVector<int> >::iterator it = stringFiltersHash.find(current + 1);
-        if (it == stringFiltersHash.end()) {
-            QVector<int> list;
-            list.append(index);
-            stringFiltersHash.insert(current + 1, list);
-            fastLookUp.setBit(current);
+private:
+    const T *d;
+    int n;
+};
+
+/*
+ * A cache file: the header, then the offset and size of each table, the
+ * source the filters were added from, and the tables at aligned offsets.
+ * Numbers are written as they are in memory, a cache is not portable.
+ */
+static const char cacheMagic[8] = {'K', 'W', 'E', 'F', 'I', 'L', 'T', 'R'};
+// Change when the format, or the records, change
+static const quint32 cacheVersion = 2;
+static const quint32 cacheByteOrder = 0x01020304;
+
+struct CacheHeader {
+    char magic[8];
+    quint32 version;
+    quint32 byteOrder;
+    quint32 tableCount;
+    quint32 sourceLength;
+};
+
+struct CacheTableEntry {
+    quint32 offset;
+    quint32 count;
+};
+
+static qint64 alignCacheOffset(qint64 offset)
+{
+    return (offset + 7) & ~qint64(7);
+}
+
+/*
+ * Matcher of many filters at once: an Aho-Corasick automaton finds the
+ * keys of all filters in an address in one pass, and only the filters
+ * whose key is found are matched in full.
+ *
+ * Filters without key, usually restricted to some sites by their options,
+ * are indexed by these domains, so only the ones for the page are tried.
+ * So are element hiding filters, which are not matched against addresses:
+ * the matcher makes the style sheets hiding their elements in a page.
+ *
+ * The automaton is built on first use after filters were added. Matching
+ * only uses the tables of numbers and strings in Tables, which view the
+ * vectors of the matcher, or a cache file mapped in memory.
+ */
+class StringsMatcher {
+public:
+    StringsMatcher()
+    {
+        clear();
+    }
+
+    // add filter to matching set, unless some of its options are not supported
+    void addFilter(const QString &filter)
+    {
+        if (cacheFile)
+            detach();
+
+        QStringView f(filter);
+        int o = -1;
+        bool matchCase = false;
+        const int dollar = f.lastIndexOf(QLatin1Char('$'));
+        // a regular expression may end with "$"
+        if (dollar >= 0 && (!isRegExpFilter(f) || isRegExpFilter(f.left(dollar)))) {
+            FilterOptions opt;
+            if (!parseOptions(f.mid(dollar + 1), &opt))
+                return;
+            matchCase = opt.matchCase;
+            o = options.count();
+            options.append(opt);
+            f = f.left(dollar);
+        }
+
+        if (isRegExpFilter(f)) {
+            const QStringView pattern = f.mid(1, f.size() - 2);
+            const QRegularExpression rx = regExp(pattern, matchCase);
+            if (!rx.isValid())
+                return;
+            regExps.append({addString(pattern), qint32(pattern.size()), o, matchCase});
+            regExpMatchers.append(rx);
         } else {
-            it->append(index);
+            int flags;
+            const QString body = FilterRule::parse(f, matchCase, &flags);
+            rules.append({addString(body), qint32(body.size()), flags, o});
+        }
+        compiled = false;
+    }
+
+    // add element hiding filter "domains##selector", or exception "domains#@#selector"
+    void addHidingFilter(QStringView filter)
+    {
+        int separator = filter.indexOf(QLatin1String("##"));
+        const bool exception = separator < 0;
+        if (exception)
+            separator = filter.indexOf(QLatin1String("#@#"));
+        if (separator < 0)
+            return; // like "#?#" or "#$#" of other ad blockers
+        const QStringView domains = filter.left(separator);
+        const QStringView selector = filter.mid(separator + (exception ? 3 : 2)).trimmed();
+        // a selector may not end its rule, nor hide the ones after it in a comment or an escaped character
+        if (selector.isEmpty() || selector.startsWith(QLatin1Char('+')) || selector.startsWith(QLatin1Char('^')) ||
+            selector.contains(QLatin1Char('{')) || selector.contains(QLatin1Char('}')) ||
+            selector.contains(QLatin1String("/*")) || selector.endsWith(QLatin1Char('\\')))
+            return;
+        for (const char *unsupported : unsupportedSelectors) {
+            if (selector.contains(QLatin1String(unsupported)))
+                return;
+        }
+
+        if (cacheFile)
+            detach();
+        const QString key = selector.toString();
+        auto it = hidingIds.constFind(key);
+        if (it == hidingIds.constEnd()) {
+            it = hidingIds.insert(key, hidings.count());
+            hidings.append({addString(selector), qint32(selector.size()), 0});
+        }
+        const int id = it.value();
+
+        bool included = false;
+        for (QStringView domain : domains.tokenize(QLatin1Char(','), Qt::SkipEmptyParts)) {
+            domain = domain.trimmed();
+            const bool exclude = domain.startsWith(QLatin1Char('~'));
+            if (exclude)
+                domain = domain.mid(1);
+            if (domain.isEmpty() || (exception && exclude))
+                continue;
+            // shown on the domains of exceptions and the excluded ones
+            hidingEntries.append({domainId(domain), (id << 1) | ((exception || exclude) ? 1 : 0)});
+            included |= !exclude;
+        }
+        // an exception only for excluded domains means nothing
+        if (!included && !(exception && !domains.isEmpty()))
+            hidings[id].flags |= exception ? HidingRecord::Disabled : HidingRecord::Generic;
+        compiled = false;
+    }
+
+    // The style sheet hiding the elements of the filters for all pages
+    QString hidingStyleSheet()
+    {
+        if (!compiled)
+            compile();
+        // the sheet of a cache file is copied once
+        if (genericSheet.size() != t.genericSheet.size())
+            genericSheet = QString(reinterpret_cast<const QChar *>(t.genericSheet.begin()), t.genericSheet.size());
+        return genericSheet;
+    }
+
+    // The style sheet hiding the elements of the filters for the pages of host, with the ones
+    // for all pages unless generic is set: then they don't change for host
+    QString hidingStyleSheet(QStringView host, bool *generic)
+    {
+        if (!compiled)
+            compile();
+
+        QVarLengthArray<int, 8> ids;
+        pageDomains(host, &ids);
+        QVarLengthArray<int, 64> hidden;
+        QVarLengthArray<int, 64> shown;
+        for (const int id : ids) {
+            for (int k = t.hidingStart.at(id); k < t.hidingStart.at(id + 1); ++k)
+                (t.hidingRules.at(k) & 1 ? shown : hidden).append(t.hidingRules.at(k) >> 1);
+        }
+        std::sort(shown.begin(), shown.end());
+        auto isShown = [&shown](int h) {
+            return std::binary_search(shown.cbegin(), shown.cend(), h);
+        };
+
+        *generic = true;
+        for (const int h : shown) {
+            if (t.hidings.at(h).flags & HidingRecord::Generic)
+                *generic = false;
+        }
+
+        QVector<QStringView> selectors;
+        std::sort(hidden.begin(), hidden.end());
+        for (int i = 0; i < hidden.size(); ++i) {
+            const int h = hidden.at(i);
+            if ((i > 0 && hidden.at(i - 1) == h) || isShown(h) || (t.hidings.at(h).flags & HidingRecord::Disabled) ||
+                (*generic && (t.hidings.at(h).flags & HidingRecord::Generic)))
+                continue;
+            selectors.append(string(t.hidings.at(h).selector, t.hidings.at(h).length));
+        }
+        if (!*generic) {
+            for (int h = 0; h < t.hidings.size(); ++h) {
+                if ((t.hidings.at(h).flags & (HidingRecord::Generic | HidingRecord::Disabled)) == HidingRecord::Generic && !isShown(h) &&
+                    !std::binary_search(hidden.cbegin(), hidden.cend(), h))
+                    selectors.append(string(t.hidings.at(h).selector, t.hidings.at(h).length));
+            }
+        }
+
+        QString sheet;
+        appendHidingRules(&sheet, selectors);
+        return sheet;
+    }
+
+    // check if the request matches at least one filter from matching set
+    bool isMatched(const FilterRequest &request, QString *by = nullptr)
+    {
+        if (!compiled)
+            compile();
+
+        const Context c = context(request);
+        // filters whose key occurs several times are matched once: a filter was tried
+        // for this request when its stamp is the generation of the request
+        if (tried.size() != t.rules.size())
+            tried.fill(0, t.rules.size());
+        if (++generation == 0) {
+            tried.fill(0);
+            generation = 1;
+        }
+        auto tryRule = [&](int r) {
+            if (tried.at(r) == generation)
+                return false;
+            tried[r] = generation;
+            const RuleRecord &record = t.rules.at(r);
+            const FilterRule rule = this->rule(record);
+            if (!allows(record.options, c) || !rule.matches(rule.isMatchCase() ? c.url : QStringView(c.lowerUrl), c.u))
+                return false;
+            if (by != nullptr)
+                *by = rule.text() + optionsText(record.options);
+            return true;
+        };
+
+        int state = 0;
+        for (const QChar ch : QStringView(c.lowerUrl)) {
+            for (;;) {
+                const int next = transition(state, ch.unicode());
+                if (next >= 0) {
+                    state = next;
+                    break;
+                }
+                if (state == 0)
+                    break;
+                state = t.fail.at(state);
+            }
+            // the keys ending here: of this state, and of the states of its suffixes
+            for (int s = t.outputStart.at(state) < t.outputStart.at(state + 1) ? state : t.outputLink.at(state);
+                 s > 0; s = t.outputLink.at(s)) {
+                for (int o = t.outputStart.at(s); o < t.outputStart.at(s + 1); ++o) {
+                    if (tryRule(t.outputRules.at(o)))
+                        return true;
+                }
+            }
+        }
+
+        for (const int r : t.keylessRules) {
+            if (tryRule(r))
+                return true;
+        }
+        for (const int id : c.domains) {
+            for (int k = t.domainRuleStart.at(id); k < t.domainRuleStart.at(id + 1); ++k) {
+                if (tryRule(t.domainRules.at(k)))
+                    return true;
+            }
+        }
+
+        for (int r = 0; r < t.regExps.size(); ++r) {
+            const RegExpRecord &record = t.regExps.at(r);
+            if (allows(record.options, c) && c.url.contains(regExpMatchers.at(r))) {
+                if (by != nullptr)
+                    *by = string(record.pattern, record.length).toString() + optionsText(record.options);
+                return true;
+            }
         }
+        return false;
     }
 
     void clear()
     {
-        stringFilters.clear();
-        shortStringFilters.clear();
-        reFilters.clear();
-        rePrefixes.clear();
-        stringFiltersHash.clear();
-        fastLookUp.resize(HASH_Q);
-        fastLookUp.fill(0, 0, HASH_Q);
+        cacheFile.reset();
+        strings.clear();
+        rules.clear();
+        regExps.clear();
+        regExpMatchers.clear();
+        options.clear();
+        optionDomains.clear();
+        domainList.clear();
+        domainIds.clear();
+        hidings.clear();
+        hidingIds.clear();
+        hidingEntries.clear();
+        keylessRules.clear();
+        sortedDomains.clear();
+        domainRuleStart.fill(0, 1);
+        domainRules.clear();
+        hidingStart.fill(0, 1);
+        hidingRules.clear();
+        genericSheet.clear();
+        edgeStart.fill(0, 2);
+        edgeChars.clear();
+        edgeTargets.clear();
+        fail.fill(0, 1);
+        outputStart.fill(0, 2);
+        outputRules.clear();
+        outputLink.fill(0, 1);
+        tried.clear();
+        generation = 0;
+        viewOwnTables();
+        compiled = true;
+    }
+
+    // Writes the compiled filters and source to a cache file
+    bool saveCache(const QString &fileName, const QByteArray &source)
+    {
+        if (!compiled)
+            compile();
+
+        CacheHeader header;
+        memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+        header.version = cacheVersion;
+        header.byteOrder = cacheByteOrder;
+        header.tableCount = tableCount();
+        header.sourceLength = source.size();
+
+        QVector<CacheTableEntry> entries;
+        qint64 pos = alignCacheOffset(sizeof(CacheHeader) + header.tableCount * sizeof(CacheTableEntry) + source.size());
+        visitTables(t, [&](const auto &table) {
+            typedef typename std::decay_t<decltype(table)>::value_type T;
+            entries.append({quint32(pos), quint32(table.size())});
+            pos = alignCacheOffset(pos + table.size() * sizeof(T));
+        });
+        if (pos > std::numeric_limits<quint32>::max())
+            return false;
+
+        QSaveFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly))
+            return false;
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(entries.constData()), entries.size() * sizeof(CacheTableEntry));
+        file.write(source);
+        int i = 0;
+        visitTables(t, [&](const auto &table) {
+            typedef typename std::decay_t<decltype(table)>::value_type T;
+            file.write(QByteArray(entries.at(i++).offset - file.pos(), '\0'));
+            file.write(reinterpret_cast<const char *>(table.begin()), table.size() * sizeof(T));
+        });
+        return file.commit();
+    }
+
+    // Uses the filters of a cache file written for source, mapped in memory
+    bool loadCache(const QString &fileName, const QByteArray &source)
+    {
+        clear();
+        auto file = std::make_unique<QFile>(fileName);
+        if (!file->open(QIODevice::ReadOnly))
+            return false;
+        const qint64 size = file->size();
+        if (size < qint64(sizeof(CacheHeader)))
+            return false;
+        const uchar *data = file->map(0, size);
+        if (data == nullptr)
+            return false;
+
+        const CacheHeader *header = reinterpret_cast<const CacheHeader *>(data);
+        if (memcmp(header->magic, cacheMagic, sizeof(cacheMagic)) != 0 || header->version != cacheVersion ||
+            header->byteOrder != cacheByteOrder || header->tableCount != tableCount())
+            return false;
+        const CacheTableEntry *entries = reinterpret_cast<const CacheTableEntry *>(data + sizeof(CacheHeader));
+        const qint64 sourceStart = sizeof(CacheHeader) + header->tableCount * sizeof(CacheTableEntry);
+        if (sourceStart + header->sourceLength > size ||
+            QByteArray::fromRawData(reinterpret_cast<const char *>(data) + sourceStart, header->sourceLength) != source)
+            return false;
+
+        bool valid = true;
+        int i = 0;
+        visitTables(t, [&](auto &table) {
+            typedef typename std::decay_t<decltype(table)>::value_type T;
+            const CacheTableEntry &entry = entries[i++];
+            if (entry.offset % alignof(T) != 0 || entry.offset + qint64(entry.count) * sizeof(T) > size)
+                valid = false;
+            else
+                table = FilterTable<T>(reinterpret_cast<const T *>(data + entry.offset), entry.count);
+        });
+        if (!valid || !isConsistent()) {
+            viewOwnTables();
+            return false;
+        }
+
+        for (const RegExpRecord &record : t.regExps)
+            regExpMatchers.append(regExp(string(record.pattern, record.length), record.matchCase));
+        cacheFile = std::move(file);
+        return true;
     }
 
 private:
-    QVector<QString> stringFilters;
-    QVector<QString> shortStringFilters;
-    QVector<QRegularExpression> reFilters;
-    QVector<QString> rePrefixes;
-    QBitArray fastLookUp;
+    // The tables used for matching
+    struct Tables {
+        FilterTable<char16_t> strings;
+        FilterTable<RuleRecord> rules;
+        FilterTable<RegExpRecord> regExps;
+        FilterTable<FilterOptions> options;
+        FilterTable<qint32> optionDomains;
+        // sorted by name, for looking the domains of a page up
+        FilterTable<DomainRecord> domains;
+        FilterTable<qint32> keylessRules;
+        // keyless filters for domain id from domainRuleStart[id] up to domainRuleStart[id + 1]
+        FilterTable<qint32> domainRuleStart;
+        FilterTable<qint32> domainRules;
+        // element hiding selectors for domain id from hidingStart[id] up to hidingStart[id + 1],
+        // shifted left, the lowest bit set for the ones shown
+        FilterTable<HidingRecord> hidings;
+        FilterTable<qint32> hidingStart;
+        FilterTable<qint32> hidingRules;
+        FilterTable<char16_t> genericSheet;
+        // the automaton: edges of state s from edgeStart[s] up to edgeStart[s + 1]
+        FilterTable<qint32> edgeStart;
+        FilterTable<char16_t> edgeChars;
+        FilterTable<qint32> edgeTargets;
+        FilterTable<qint32> fail;
+        // filters whose key ends in state s, from outputStart[s] up to outputStart[s + 1]
+        FilterTable<qint32> outputStart;
+        FilterTable<qint32> outputRules;
+        // nearest state with output on the failure chain, 0 for none
+        FilterTable<qint32> outputLink;
+    };
 
-    QHash<int, QVector<int> > stringFiltersHash;
-};
+    // Calls f for each table, in the order of the cache files
+    template<typename T, typename F>
+    static void visitTables(T &t, F f)
+    {
+        f(t.strings);
+        f(t.rules);
+        f(t.regExps);
+        f(t.options);
+        f(t.optionDomains);
+        f(t.domains);
+        f(t.keylessRules);
+        f(t.domainRuleStart);
+        f(t.domainRules);
+        f(t.hidings);
+        f(t.hidingStart);
+        f(t.hidingRules);
+        f(t.genericSheet);
+        f(t.edgeStart);
+        f(t.edgeChars);
+        f(t.edgeTargets);
+        f(t.fail);
+        f(t.outputStart);
+        f(t.outputRules);
+        f(t.outputLink);
+    }
 
+    static quint32 tableCount()
+    {
+        Tables tables;
+        quint32 count = 0;
+        visitTables(tables, [&count](auto &) {
+            ++count;
+        });
+        return count;
+    }
 
-// We only want a subset of features of wildcards -- just the 
-// star, so we can't use QRegularExpression::wildcardToRegularExpression
-static QRegularExpression fromAdBlockWildcard(const QString& wcStr) {
-    QString pattern;
-    for (const QChar &c : wcStr) {
-        if (c == QLatin1Char('*')) {
-            pattern.append(QLatin1String(".*"));
-        } else if (c == QLatin1Char('?') || c == QLatin1Char('[') || c == QLatin1Char(']')) {
-            pattern.append(QLatin1String("\\") + c);
-        } else {
-            pattern.append(c);
+    void viewOwnTables()
+    {
+        t.strings = FilterTable<char16_t>(reinterpret_cast<const char16_t *>(strings.utf16()), strings.size());
+        t.rules = FilterTable<RuleRecord>(rules);
+        t.regExps = FilterTable<RegExpRecord>(regExps);
+        t.options = FilterTable<FilterOptions>(options);
+        t.optionDomains = FilterTable<qint32>(optionDomains);
+        t.domains = FilterTable<DomainRecord>(sortedDomains);
+        t.keylessRules = FilterTable<qint32>(keylessRules);
+        t.domainRuleStart = FilterTable<qint32>(domainRuleStart);
+        t.domainRules = FilterTable<qint32>(domainRules);
+        t.hidings = FilterTable<HidingRecord>(hidings);
+        t.hidingStart = FilterTable<qint32>(hidingStart);
+        t.hidingRules = FilterTable<qint32>(hidingRules);
+        t.genericSheet = FilterTable<char16_t>(reinterpret_cast<const char16_t *>(genericSheet.utf16()), genericSheet.size());
+        t.edgeStart = FilterTable<qint32>(edgeStart);
+        t.edgeChars = FilterTable<char16_t>(edgeChars);
+        t.edgeTargets = FilterTable<qint32>(edgeTargets);
+        t.fail = FilterTable<qint32>(fail);
+        t.outputStart = FilterTable<qint32>(outputStart);
+        t.outputRules = FilterTable<qint32>(outputRules);
+        t.outputLink = FilterTable<qint32>(outputLink);
+    }
+
+    // Whether the tables of a cache file fit together, and each number indexing a table is in
+    // its bounds, so that a damaged file can't make matching read out of them, or loop
+    bool isConsistent() const
+    {
+        const int states = t.fail.size();
+        if (!(states > 0 && t.edgeStart.size() == states + 1 && t.outputStart.size() == states + 1 &&
+              t.outputLink.size() == states && t.edgeChars.size() == t.edgeTargets.size() &&
+              t.edgeStart.at(states) == t.edgeChars.size() && t.outputStart.at(states) == t.outputRules.size() &&
+              t.domainRuleStart.size() == t.domains.size() + 1 && t.domainRuleStart.at(t.domains.size()) == t.domainRules.size() &&
+              t.hidingStart.size() == t.domains.size() + 1 && t.hidingStart.at(t.domains.size()) == t.hidingRules.size()))
+            return false;
+
+        const auto isString = [this](qint32 offset, qint32 length) {
+            return offset >= 0 && length >= 0 && qint64(offset) + length <= t.strings.size();
+        };
+        const auto isOptions = [this](qint32 o) {
+            return o >= -1 && o < t.options.size();
+        };
+        // the numbers of table, shifted right by shift, index a table of size
+        const auto isIndexes = [](const FilterTable<qint32> &table, int size, int shift) {
+            return std::all_of(table.begin(), table.end(), [size, shift](qint32 i) {
+                return i >= 0 && (i >> shift) < size;
+            });
+        };
+        // the starts of the ranges of a table, which end where the next ones start
+        const auto isStarts = [](const FilterTable<qint32> &starts) {
+            return starts.at(0) == 0 && std::is_sorted(starts.begin(), starts.end());
+        };
+
+        for (const RuleRecord &record : t.rules) {
+            if (!isString(record.body, record.length) || !isOptions(record.options))
+                return false;
+        }
+        for (const RegExpRecord &record : t.regExps) {
+            if (!isString(record.pattern, record.length) || !isOptions(record.options))
+                return false;
+        }
+        for (const FilterOptions &opt : t.options) {
+            if (!isString(opt.text, opt.textLength) || opt.domains < 0 || opt.domainCount < 0 ||
+                qint64(opt.domains) + opt.domainCount > t.optionDomains.size())
+                return false;
+        }
+        for (const DomainRecord &domain : t.domains) {
+            if (!isString(domain.name, domain.length) || domain.id < 0 || domain.id >= t.domains.size())
+                return false;
+        }
+        for (const HidingRecord &hiding : t.hidings) {
+            if (!isString(hiding.selector, hiding.length))
+                return false;
+        }
+        if (!isIndexes(t.optionDomains, t.domains.size(), 1) || !isIndexes(t.keylessRules, t.rules.size(), 0) ||
+            !isIndexes(t.domainRules, t.rules.size(), 0) || !isIndexes(t.hidingRules, t.hidings.size(), 1) ||
+            !isIndexes(t.outputRules, t.rules.size(), 0) || !isIndexes(t.edgeTargets, states, 0) ||
+            !isIndexes(t.fail, states, 0) || !isIndexes(t.outputLink, states, 0) ||
+            !isStarts(t.domainRuleStart) || !isStarts(t.hidingStart) || !isStarts(t.edgeStart) || !isStarts(t.outputStart))
+            return false;
+
+        // the edges make a tree, whose failure and output links lead to states nearer to
+        // its root, so following them ends there
+        QVector<int> depth(states, -1);
+        depth[0] = 0;
+        QVector<int> queue;
+        queue.reserve(states);
+        queue.append(0);
+        for (int q = 0; q < queue.count(); ++q) {
+            const int state = queue.at(q);
+            for (int e = t.edgeStart.at(state); e < t.edgeStart.at(state + 1); ++e) {
+                const int target = t.edgeTargets.at(e);
+                if (depth.at(target) >= 0)
+                    return false;
+                depth[target] = depth.at(state) + 1;
+                queue.append(target);
+            }
+        }
+        if (queue.count() != states || t.fail.at(0) != 0 || t.outputLink.at(0) != 0)
+            return false;
+        for (int s = 1; s < states; ++s) {
+            if (depth.at(t.fail.at(s)) >= depth.at(s) || depth.at(t.outputLink.at(s)) >= depth.at(s))
+                return false;
+        }
+        return true;
+    }
+
+    // Copies the filters of a cache file, to add more
+    void detach()
+    {
+        strings = QString(reinterpret_cast<const QChar *>(t.strings.begin()), t.strings.size());
+        rules = QVector<RuleRecord>(t.rules.begin(), t.rules.end());
+        regExps = QVector<RegExpRecord>(t.regExps.begin(), t.regExps.end());
+        options = QVector<FilterOptions>(t.options.begin(), t.options.end());
+        optionDomains = QVector<qint32>(t.optionDomains.begin(), t.optionDomains.end());
+        domainList.resize(t.domains.size());
+        for (const DomainRecord &domain : t.domains) {
+            domainList[domain.id] = domain;
+            domainIds.insert(string(domain.name, domain.length).toString(), domain.id);
+        }
+        hidings = QVector<HidingRecord>(t.hidings.begin(), t.hidings.end());
+        for (int h = 0; h < t.hidings.size(); ++h)
+            hidingIds.insert(string(t.hidings.at(h).selector, t.hidings.at(h).length).toString(), h);
+        for (int id = 0; id + 1 < t.hidingStart.size(); ++id) {
+            for (int k = t.hidingStart.at(id); k < t.hidingStart.at(id + 1); ++k)
+                hidingEntries.append({id, t.hidingRules.at(k)});
+        }
+        genericSheet.clear();
+        cacheFile.reset();
+        compiled = false;
+    }
+
+    // A request prepared for matching
+    struct Context {
+        QStringView url;
+        QString lowerUrl;
+        FilterUrl u;
+        int type;
+        // AnyParty when the page is not known
+        FilterOptions::Party party;
+        // ids of the domains of the page which are in filters, the most specific first
+        QVarLengthArray<int, 8> domains;
+    };
+
+    Context context(const FilterRequest &request) const
+    {
+        const QString lowerUrl = toLowerChars(request.url);
+        Context c{request.url, lowerUrl, FilterUrl(lowerUrl), request.type, FilterOptions::AnyParty, {}};
+        if (request.firstPartyUrl.isEmpty())
+            return c;
+
+        const QString page = toLowerChars(request.firstPartyUrl);
+        const QStringView pageHost = FilterUrl(page).host(page);
+        c.party = siteDomain(c.u.host(c.lowerUrl)) == siteDomain(pageHost) ? FilterOptions::FirstParty : FilterOptions::ThirdParty;
+        pageDomains(pageHost, &c.domains);
+        return c;
+    }
+
+    // Sets ids to the ids of host and its domains which are in filters, the most specific first
+    void pageDomains(QStringView host, QVarLengthArray<int, 8> *ids) const
+    {
+        if (t.domains.size() == 0)
+            return;
+        for (QStringView d = host; !d.isEmpty();) {
+            const DomainRecord *it = std::lower_bound(t.domains.begin(), t.domains.end(), d, [this](const DomainRecord &r, QStringView name) {
+                return string(r.name, r.length) < name;
+            });
+            if (it != t.domains.end() && string(it->name, it->length) == d)
+                ids->append(it->id);
+            const int dot = d.indexOf(QLatin1Char('.'));
+            d = (dot < 0) ? QStringView() : d.mid(dot + 1);
+        }
+    }
+
+    // Whether the options with index o let a filter match the request
+    bool allows(int o, const Context &c) const
+    {
+        const int types = (o < 0) ? FilterOptions::DefaultTypes : t.options.at(o).types;
+        if (c.type == FilterRequest::UnknownType ? types != FilterOptions::DefaultTypes : !(types & c.type))
+            return false;
+        if (o < 0)
+            return true;
+
+        const FilterOptions &opt = t.options.at(o);
+        if (opt.party != FilterOptions::AnyParty && opt.party != c.party)
+            return false;
+        if (opt.domainCount == 0)
+            return true;
+        // the most specific domain of the page in the list decides
+        const qint32 *first = t.optionDomains.begin() + opt.domains;
+        const qint32 *last = first + opt.domainCount;
+        for (const int id : c.domains) {
+            const qint32 *it = std::lower_bound(first, last, id << 1);
+            if (it != last && (*it >> 1) == id)
+                return !(*it & 1);
+        }
+        return !opt.hasIncludedDomains;
+    }
+
+    QStringView string(int offset, int length) const
+    {
+        return QStringView(t.strings.begin() + offset, length);
+    }
+
+    FilterRule rule(const RuleRecord &record) const
+    {
+        return FilterRule(string(record.body, record.length), record.flags);
+    }
+
+    QString optionsText(int o) const
+    {
+        if (o < 0)
+            return QString();
+        return QLatin1Char('$') + string(t.options.at(o).text, t.options.at(o).textLength);
+    }
+
+    static QRegularExpression regExp(QStringView pattern, bool matchCase)
+    {
+        return QRegularExpression(pattern.toString(), matchCase ? QRegularExpression::NoPatternOption : QRegularExpression::CaseInsensitiveOption);
+    }
+
+    // Offset of s in the strings
+    qint32 addString(QStringView s)
+    {
+        const qint32 offset = strings.size();
+        strings += s;
+        return offset;
+    }
+
+    int domainId(QStringView domain)
+    {
+        const QString d = toLowerChars(domain);
+        auto it = domainIds.constFind(d);
+        if (it == domainIds.constEnd()) {
+            it = domainIds.insert(d, domainList.count());
+            domainList.append({addString(d), qint32(d.size()), it.value()});
+        }
+        return it.value();
+    }
+
+    // Parses the options of a filter, false if some of them are not supported
+    bool parseOptions(QStringView text, FilterOptions *opt)
+    {
+        int included = 0;
+        int excluded = 0;
+        opt->party = FilterOptions::AnyParty;
+        opt->matchCase = false;
+        opt->hasIncludedDomains = false;
+        QVarLengthArray<qint32, 8> domains;
+        for (QStringView option : text.tokenize(QLatin1Char(','), Qt::SkipEmptyParts)) {
+            option = option.trimmed();
+            const bool inverse = option.startsWith(QLatin1Char('~'));
+            const QStringView name = inverse ? option.mid(1) : option;
+
+            if (name.startsWith(QLatin1String("domain="))) {
+                if (inverse)
+                    return false;
+                for (QStringView domain : name.mid(7).tokenize(QLatin1Char('|'), Qt::SkipEmptyParts)) {
+                    const bool exclude = domain.startsWith(QLatin1Char('~'));
+                    if (exclude)
+                        domain = domain.mid(1);
+                    if (domain.isEmpty())
+                        continue;
+                    domains.append((domainId(domain) << 1) | (exclude ? 1 : 0));
+                    opt->hasIncludedDomains |= !exclude;
+                }
+                continue;
+            }
+
+            bool known = false;
+            for (const auto &type : resourceTypeOptions) {
+                if (name == QLatin1String(type.name)) {
+                    (inverse ? excluded : included) |= type.type;
+                    known = true;
+                    break;
+                }
+            }
+            if (known)
+                continue;
+
+            if (name == QLatin1String("third-party") || name == QLatin1String("3p"))
+                opt->party = inverse ? FilterOptions::FirstParty : FilterOptions::ThirdParty;
+            else if (name == QLatin1String("first-party") || name == QLatin1String("1p"))
+                opt->party = inverse ? FilterOptions::ThirdParty : FilterOptions::FirstParty;
+            else if (name == QLatin1String("match-case"))
+                opt->matchCase = !inverse;
+            else if (name != QLatin1String("collapse") && name != QLatin1String("important"))
+                return false; // would not do what the filter means, like "$popup" or "$csp="
         }
+
+        opt->types = (included ? included : FilterOptions::DefaultTypes) & ~excluded;
+        if (opt->types == 0)
+            return false;
+        // an included and excluded domain is included
+        std::sort(domains.begin(), domains.end());
+        const auto end = std::unique(domains.begin(), domains.end(), [](qint32 a, qint32 b) {
+            return (a >> 1) == (b >> 1);
+        });
+        opt->domains = optionDomains.count();
+        opt->domainCount = end - domains.begin();
+        for (auto it = domains.begin(); it != end; ++it)
+            optionDomains.append(*it);
+        opt->text = addString(text);
+        opt->textLength = text.size();
+        return true;
     }
-    return QRegularExpression(pattern);
+
+    // Target of the edge of state for c, or -1
+    int transition(int state, char16_t c) const
+    {
+        const char16_t *first = t.edgeChars.begin() + t.edgeStart.at(state);
+        const char16_t *last = t.edgeChars.begin() + t.edgeStart.at(state + 1);
+        const char16_t *it = std::lower_bound(first, last, c);
+        if (it == last || *it != c)
+            return -1;
+        return t.edgeTargets.at(it - t.edgeChars.begin());
+    }
+
+    void compile()
+    {
+        compiled = true;
+
+        // the trie of the keys
+        QHash<quint64, int> trie;
+        QVector<QVector<int>> outputs(1);
+        QVector<QVector<int>> byDomain(domainList.count());
+        keylessRules.clear();
+        for (int r = 0; r < rules.count(); ++r) {
+            const QStringView key = FilterRule(QStringView(strings).mid(rules.at(r).body, rules.at(r).length), rules.at(r).flags).key();
+            if (key.isEmpty()) {
+                // tried for the domains it is restricted to, or for all requests
+                const int o = rules.at(r).options;
+                if (o < 0 || !options.at(o).hasIncludedDomains) {
+                    keylessRules.append(r);
+                    continue;
+                }
+                for (int i = options.at(o).domains; i < options.at(o).domains + options.at(o).domainCount; ++i) {
+                    if (!(optionDomains.at(i) & 1))
+                        byDomain[optionDomains.at(i) >> 1].append(r);
+                }
+                continue;
+            }
+            int state = 0;
+            for (const QChar c : key) {
+                // addresses are looked through in lower case
+                const quint64 edge = (quint64(state) << 16) | c.toLower().unicode();
+                auto it = trie.constFind(edge);
+                if (it == trie.constEnd()) {
+                    it = trie.insert(edge, outputs.count());
+                    outputs.append(QVector<int>());
+                }
+                state = it.value();
+            }
+            outputs[state].append(r);
+        }
+        const int states = outputs.count();
+
+        domainRuleStart.fill(0, byDomain.count() + 1);
+        domainRules.clear();
+        for (int id = 0; id < byDomain.count(); ++id) {
+            domainRules += byDomain.at(id);
+            domainRuleStart[id + 1] = domainRules.count();
+        }
+        QVector<QVector<int>> hidingByDomain(domainList.count());
+        for (const HidingEntry &entry : std::as_const(hidingEntries))
+            hidingByDomain[entry.domain].append(entry.rule);
+        hidingStart.fill(0, hidingByDomain.count() + 1);
+        hidingRules.clear();
+        for (int id = 0; id < hidingByDomain.count(); ++id) {
+            hidingRules += hidingByDomain.at(id);
+            hidingStart[id + 1] = hidingRules.count();
+        }
+        QVector<QStringView> genericSelectors;
+        for (const HidingRecord &hiding : std::as_const(hidings)) {
+            if ((hiding.flags & (HidingRecord::Generic | HidingRecord::Disabled)) == HidingRecord::Generic)
+                genericSelectors.append(QStringView(strings).mid(hiding.selector, hiding.length));
+        }
+        genericSheet.clear();
+        appendHidingRules(&genericSheet, genericSelectors);
+
+        sortedDomains = domainList;
+        std::sort(sortedDomains.begin(), sortedDomains.end(), [this](const DomainRecord &a, const DomainRecord &b) {
+            return QStringView(strings).mid(a.name, a.length) < QStringView(strings).mid(b.name, b.length);
+        });
+
+        // edges sorted by state and character, for binary search
+        QVector<quint64> edges;
+        edges.reserve(trie.count());
+        for (auto it = trie.constBegin(); it != trie.constEnd(); ++it)
+            edges.append(it.key());
+        std::sort(edges.begin(), edges.end());
+        edgeStart.fill(0, states + 1);
+        edgeChars.resize(edges.count());
+        edgeTargets.resize(edges.count());
+        for (int e = 0; e < edges.count(); ++e) {
+            edgeStart[int(edges.at(e) >> 16) + 1]++;
+            edgeChars[e] = char16_t(edges.at(e) & 0xffff);
+            edgeTargets[e] = trie.value(edges.at(e));
+        }
+        for (int s = 0; s < states; ++s)
+            edgeStart[s + 1] += edgeStart[s];
+
+        outputStart.fill(0, states + 1);
+        outputRules.clear();
+        for (int s = 0; s < states; ++s) {
+            outputRules += outputs.at(s);
+            outputStart[s + 1] = outputRules.count();
+        }
+
+        // failure links breadth-first, so the ones of shorter keys are known
+        fail.fill(0, states);
+        outputLink.fill(0, states);
+        // for transition()
+        viewOwnTables();
+        QVector<int> queue;
+        queue.reserve(states);
+        queue.append(0);
+        for (int q = 0; q < queue.count(); ++q) {
+            const int state = queue.at(q);
+            for (int e = edgeStart.at(state); e < edgeStart.at(state + 1); ++e) {
+                const int target = edgeTargets.at(e);
+                int f = 0;
+                if (state != 0) {
+                    f = fail.at(state);
+                    int next;
+                    while ((next = transition(f, edgeChars.at(e))) < 0 && f != 0)
+                        f = fail.at(f);
+                    f = (next >= 0) ? next : 0;
+                }
+                fail[target] = f;
+                outputLink[target] = outputs.at(f).isEmpty() ? outputLink.at(f) : f;
+                queue.append(target);
+            }
+        }
+        // the vectors were written to, and may have been reallocated
+        viewOwnTables();
+    }
+
+    // the filters as added: strings of the rules, options and domains
+    QString strings;
+    QVector<RuleRecord> rules;
+    QVector<RegExpRecord> regExps;
+    QVector<FilterOptions> options;
+    QVector<qint32> optionDomains;
+    // by id
+    QVector<DomainRecord> domainList;
+    QHash<QString, int> domainIds;
+    QVector<HidingRecord> hidings;
+    QHash<QString, int> hidingIds;
+    struct HidingEntry {
+        qint32 domain;
+        // as in Tables::hidingRules
+        qint32 rule;
+    };
+    QVector<HidingEntry> hidingEntries;
+    // compiled from them
+    QVector<qint32> keylessRules;
+    QVector<DomainRecord> sortedDomains;
+    QVector<qint32> domainRuleStart;
+    QVector<qint32> domainRules;
+    QVector<qint32> hidingStart;
+    QVector<qint32> hidingRules;
+    QString genericSheet;
+    QVector<qint32> edgeStart;
+    QVector<char16_t> edgeChars;
+    QVector<qint32> edgeTargets;
+    QVector<qint32> fail;
+    QVector<qint32> outputStart;
+    QVector<qint32> outputRules;
+    QVector<qint32> outputLink;
+    bool compiled;
+
+    Tables t;
+    // of t.regExps
+    QVector<QRegularExpression> regExpMatchers;
+    // by rule, the generation of the last request the rule was tried for, see isMatched()
+    QVector<quint32> tried;
+    quint32 generation;
+    // mapped, when t views a cache file
+    std::unique_ptr<QFile> cacheFile;
+};
+
+
+bool FilterRequest::isFilteredNavigation(const QUrl& url, const QUrl& initiator)
+{
+    return initiator.isEmpty() || url.host() != initiator.host() || url.scheme() != initiator.scheme() ||
+           url.port() != initiator.port();
 }
 
 FilterSet::FilterSet()
@@ -205,119 +1379,76 @@ void FilterSet::addFilter(const QString& filterStr)
 {
     QString filter = filterStr;
 
-    /** ignore special lines starting with "[", "!", "&", or "#" or contain "#" (comments or features are not supported by KHTML's AdBlock */
+    /** ignore special lines starting with "[", "!", or "&" (comments or features are not supported by KHTML's AdBlock */
     QChar firstChar = filter.at(0);
-    if (firstChar == QLatin1Char('[') || firstChar == QLatin1Char('!') || firstChar == QLatin1Char('&') || firstChar == QLatin1Char('#') || filter.contains(QLatin1Char('#')))
+    if (firstChar == QLatin1Char('[') || firstChar == QLatin1Char('!') || firstChar == QLatin1Char('&'))
         return;
 
+    /** element hiding filters contain "##" or "#@#", other lines with "#" are comments or not supported */
+    if (filter.contains(QLatin1Char('#'))) {
+        stringFiltersMatcher->addHidingFilter(filter);
+        return;
+    }
+
     // Strip leading @@
     int first = 0;
     int last  = filter.length() - 1;
     if (filter.startsWith(QLatin1String("@@")))
         first = 2;
 
-    // Strip options, we ignore them for now.
-    // TODO: Add support for filters with options. See #310230.
-    int dollar = filter.lastIndexOf(QLatin1Char('$'));
-    if (dollar != -1) {
-        return;
-    }
-
     // Perhaps nothing left?
     if (first > last)
         return;
 
-    filter = filter.mid(first, last - first + 1);
-
-    // Is it a regexp filter?
-    if (filter.length()>2 && filter.startsWith(QLatin1Char('/')) && filter.endsWith(QLatin1Char('/')))
-    {
-        QString inside = filter.mid(1, filter.length()-2);
-        QRegularExpression rx(inside);
-        reFilters.append(rx);
-//         qCDebug(WEBENGINEPART_LOG) << "R:" << inside;
-    }
-    else
-    {
-        // Nope, a wildcard one.
-        // Note: For these, we also need to handle |.
-
-        // Strip wildcards at the ends
-        first = 0;
-        last  = filter.length() - 1;
-
-        while (first < filter.length() && filter[first] == QLatin1Char('*'))
-            ++first;
-
-        while (last >= 0 && filter[last] == QLatin1Char('*'))
-            --last;
-
-        if (first > last)
-            filter = QStringLiteral("*"); // erm... Well, they asked for it.
-        else
-            filter = filter.mid(first, last - first + 1);
-
-        // Now, do we still have any wildcard stuff left?
-        if (filter.contains(QLatin1String("*")))
-        {
-            // check if we can use RK first (and then check full RE for the rest) for better performance
-            int aPos = filter.indexOf('*');
-            if (aPos < 0)
-                aPos = filter.length();
-            if (aPos > 7) {
-                QRegularExpression rx = fromAdBlockWildcard(filter.mid(aPos) + QLatin1Char('*'));
-                // We pad the final r.e. with * so we can check for an exact match
-                stringFiltersMatcher->addWildedString(filter.mid(0, aPos), rx);
-            } else {
-                QRegularExpression rx = fromAdBlockWildcard(filter);
-                reFilters.append(rx);
-            }
-        }
-        else
-        {
-            // Fast path
-            stringFiltersMatcher->addString(filter);
-        }
-    }
+    // A regular expression, or a wildcard filter maybe anchored, with its options
+    stringFiltersMatcher->addFilter(filter.mid(first, last - first + 1));
 }
 
 bool FilterSet::isUrlMatched(const QString& url)
 {
-    if (stringFiltersMatcher->isMatched(url))
-        return true;
-
-    for (int c = 0; c < reFilters.size(); ++c)
-    {
-        if (url.contains(reFilters[c]))
-            return true;
-    }
-
-    return false;
+    return isUrlMatched(FilterRequest(url));
 }
 
 QString FilterSet::urlMatchedBy(const QString& url)
 {
-    QString by;
-
-    if (stringFiltersMatcher->isMatched(url, &by))
-        return by;
+    return urlMatchedBy(FilterRequest(url));
+}
 
-    for (int c = 0; c < reFilters.size(); ++c)
-    {
-        if (url.contains(reFilters[c]))
-        {
-            by = reFilters[c].pattern();
-            break;
-        }
-    }
+bool FilterSet::isUrlMatched(const FilterRequest& request)
+{
+    return stringFiltersMatcher->isMatched(request);
+}
 
+QString FilterSet::urlMatchedBy(const FilterRequest& request)
+{
+    QString by;
+    stringFiltersMatcher->isMatched(request, &by);
     return by;
 }
 
 void FilterSet::clear()
 {
-    reFilters.clear();
     stringFiltersMatcher->clear();
 }
 
+QString FilterSet::elementHidingStyleSheet()
+{
+    return stringFiltersMatcher->hidingStyleSheet();
+}
+
+QString FilterSet::elementHidingStyleSheet(const QString& host, bool* generic)
+{
+    return stringFiltersMatcher->hidingStyleSheet(toLowerChars(host), generic);
+}
+
+bool FilterSet::saveCache(const QString& fileName, const QByteArray& source)
+{
+    return stringFiltersMatcher->saveCache(fileName, source);
+}
+
+bool FilterSet::loadCache(const QString& fileName, const QByteArray& source)
+{
+    return stringFiltersMatcher->loadCache(fileName, source);
+}
+
 // kate: indent-width 4; replace-tabs on; tab-width 4; space-indent on;
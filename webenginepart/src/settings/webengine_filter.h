@@ -11,7 +11,7 @@
 #define WEBENGNINE_FILTER_H
 
 #include <QString>
-#include <QRegularExpression>
+#include <QUrl>
 #include <QVector>
 #include <webenginepart.h>
 
@@ -19,6 +19,44 @@ class StringsMatcher;
 
 namespace KDEPrivate
 {
+// A request matched against filters with options, like "$script,third-party":
+// what it loads, and the address of the page loading it.
+// Filters restricted by their options only match requests telling enough:
+// with an unknown type, only filters for any type; without the page, no
+// filter for some domains, or only for third-party or first-party requests.
+struct FilterRequest {
+    // The types of the options; DocumentType is only matched by "$document"
+    enum ResourceType {
+        UnknownType = 0,
+        OtherType = 0x1,
+        ScriptType = 0x2,
+        ImageType = 0x4,
+        StylesheetType = 0x8,
+        ObjectType = 0x10,
+        XmlHttpRequestType = 0x20,
+        SubdocumentType = 0x40,
+        PingType = 0x80,
+        MediaType = 0x100,
+        FontType = 0x200,
+        WebSocketType = 0x400,
+        DocumentType = 0x800
+    };
+
+    explicit FilterRequest(const QString& url, const QString& firstPartyUrl = QString(), ResourceType type = UnknownType)
+        : url(url), firstPartyUrl(firstPartyUrl), type(type)
+    {
+    }
+
+    // Whether a load of the main frame of url is filtered, started from a page of the origin
+    // initiator, or typed when it is empty: not when following a link within a site.
+    // The first party of such a load is url itself, the page loading it is initiator.
+    static bool isFilteredNavigation(const QUrl& url, const QUrl& initiator);
+
+    QString url;
+    QString firstPartyUrl;
+    ResourceType type;
+};
+
 // This represents a set of filters that may match URLs.
 // Currently it supports a subset of AddBlock Plus functionality.
 class FilterSet {
@@ -33,10 +71,26 @@ public:
     bool isUrlMatched(const QString& url);
     QString urlMatchedBy(const QString& url);
 
+    // The same, checking the options of the filters against what is known of the request
+    bool isUrlMatched(const FilterRequest& request);
+    QString urlMatchedBy(const FilterRequest& request);
+
     void clear();
 
+    // The style sheets hiding the elements of the element hiding filters, "##selector" and
+    // "example.org##selector": the one for all pages, made once, and the one for the pages
+    // of host. That one has the rules for all pages too, unless generic is set, when they
+    // are the same for host as for the others.
+    QString elementHidingStyleSheet();
+    QString elementHidingStyleSheet(const QString& host, bool* generic);
+
+    // The filters can be written compiled to a cache file, and used from it mapped in memory
+    // instead of being added again. source tells what they were added from, loading fails
+    // for another one, or for a file of another version of the format.
+    bool saveCache(const QString& fileName, const QByteArray& source);
+    bool loadCache(const QString& fileName, const QByteArray& source);
+
 private:
-    QVector<QRegularExpression> reFilters;
     StringsMatcher* stringFiltersMatcher;
 };
 
@@ -25,8 +25,13 @@
 #include <QDir>
 #include <QStringView>
 #include <QRegularExpression>
+#include <QCryptographicHash>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QUrl>
 
 using namespace KonqWebEnginePart;
+using KDEPrivate::FilterRequest;
 
 QDataStream & operator<<(QDataStream& ds, const WebEngineSettings::WebFormInfo& info)
 {
@@ -72,6 +77,25 @@ struct KPerDomainSettings {
 
 typedef QMap<QString,KPerDomainSettings> PolicyMap;
 
+/**
+ * @internal
+ * The switches of the filter settings for the types of requests, see KCMFilter
+ */
+static const struct {
+    const char *key;
+    int types;
+} adFilterTypeSwitches[] = {
+    {"FilterImages", FilterRequest::ImageType},
+    {"FilterScripts", FilterRequest::ScriptType},
+    {"FilterStylesheets", FilterRequest::StylesheetType},
+    {"FilterFrames", FilterRequest::SubdocumentType},
+    {"FilterConnections", FilterRequest::XmlHttpRequestType | FilterRequest::WebSocketType | FilterRequest::PingType},
+    {"FilterMedia", FilterRequest::MediaType | FilterRequest::ObjectType},
+    {"FilterFonts", FilterRequest::FontType},
+    {"FilterPages", FilterRequest::DocumentType},
+    {"FilterOther", FilterRequest::OtherType},
+};
+
 class WebEngineSettingsData
 {
 public:  
@@ -114,6 +138,7 @@ public:
 
     int m_fontSize;
     int m_minFontSize;
+    int m_adFilterTypes;
     int m_maxFormCompletionItems;
     WebEngineSettings::KAnimationAdvice m_showAnimations;
     WebEngineSettings::KSmoothScrollingMode m_smoothScrolling;
@@ -134,6 +159,10 @@ public:
 
     KDEPrivate::FilterSet adBlackList;
     KDEPrivate::FilterSet adWhiteList;
+    // what the filter sets are made of: filters of the settings, and files of the filter lists
+    QStringList adFilters;
+    QStringList adFilterFiles;
+    int adFilterDownloads = 0;
     QList< QPair< QString, QChar > > m_fallbackAccessKeysAssignments;
 
     KSharedConfig::Ptr nonPasswordStorableSites;
@@ -165,6 +194,99 @@ public:
         }
     }
 
+    static QString adFilterCachePath(const QString &name)
+    {
+        return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QLatin1String("/adblock-") + name;
+    }
+
+    /**
+     * What the filter sets are made of, to check their cache: a checksum of the
+     * filters of the settings, and of each list. The checksum of a list is only
+     * computed again when its size or modification time changed.
+     */
+    QByteArray adFilterSource() const
+    {
+        const QString checksumsPath = adFilterCachePath(QStringLiteral("checksums"));
+        QHash<QString, QPair<qint64, qint64>> stamps, oldStamps;
+        QHash<QString, QByteArray> checksums, oldChecksums;
+        QFile checksumsFile(checksumsPath);
+        if (checksumsFile.open(QIODevice::ReadOnly)) {
+            QDataStream ds(&checksumsFile);
+            ds >> oldStamps >> oldChecksums;
+            if (ds.status() != QDataStream::Ok) {
+                oldStamps.clear();
+                oldChecksums.clear();
+            }
+            checksumsFile.close();
+        }
+
+        QCryptographicHash source(QCryptographicHash::Sha1);
+        for (const QString &filter : adFilters) {
+            source.addData(filter.toUtf8());
+            source.addData(QByteArrayView("\n"));
+        }
+        for (const QString &path : adFilterFiles) {
+            source.addData(path.toUtf8());
+            source.addData(QByteArrayView("\0", 1));
+            const QFileInfo info(path);
+            if (!info.exists())
+                continue;
+            const QPair<qint64, qint64> stamp(info.size(), info.lastModified().toMSecsSinceEpoch());
+            QByteArray checksum = oldChecksums.value(path);
+            if (checksum.isEmpty() || oldStamps.value(path) != stamp) {
+                QFile file(path);
+                QCryptographicHash hash(QCryptographicHash::Sha1);
+                if (file.open(QIODevice::ReadOnly) && hash.addData(&file))
+                    checksum = hash.result();
+                else
+                    checksum.clear();
+            }
+            if (checksum.isEmpty())
+                continue;
+            stamps.insert(path, stamp);
+            checksums.insert(path, checksum);
+            source.addData(checksum);
+        }
+
+        if (stamps != oldStamps || checksums != oldChecksums) {
+            QSaveFile file(checksumsPath);
+            if (file.open(QIODevice::WriteOnly)) {
+                QDataStream ds(&file);
+                ds << stamps << checksums;
+                file.commit();
+            }
+        }
+        return source.result();
+    }
+
+    /**
+     * Makes the filter sets from the filters of the settings and the lists,
+     * using their cache if they did not change since it was written.
+     */
+    void loadAdFilters()
+    {
+        QDir().mkpath(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+        const QByteArray source = adFilterSource();
+        const QString blackCache = adFilterCachePath(QStringLiteral("black.cache"));
+        const QString whiteCache = adFilterCachePath(QStringLiteral("white.cache"));
+        if (adBlackList.loadCache(blackCache, source) && adWhiteList.loadCache(whiteCache, source))
+            return;
+
+        adBlackList.clear();
+        adWhiteList.clear();
+        for (const QString &filter : std::as_const(adFilters)) {
+            if (filter.startsWith(QLatin1String("@@")))
+                adWhiteList.addFilter(filter);
+            else
+                adBlackList.addFilter(filter);
+        }
+        for (const QString &file : std::as_const(adFilterFiles))
+            adblockFilterLoadList(file);
+
+        if (!adBlackList.saveCache(blackCache, source) || !adWhiteList.saveCache(whiteCache, source))
+            qCDebug(WEBENGINEPART_LOG) << "Cannot write the cache of the filters to" << blackCache;
+    }
+
 public Q_SLOTS:
     void adblockFilterResult(KJob *job)
     {
@@ -180,9 +302,7 @@ public Q_SLOTS:
             if ( file.open(QFile::WriteOnly) )
             {
                 const bool success = (file.write(byteArray) == byteArray.size());
-                if ( success )
-                    adblockFilterLoadList(localFileName);
-                else
+                if ( !success )
                     qCWarning(WEBENGINEPART_LOG) << "Could not write" << byteArray.size() << "to file" << localFileName;
                 file.close();
             }
@@ -191,6 +311,12 @@ public Q_SLOTS:
         }
         else
             qCDebug(WEBENGINEPART_LOG) << "Downloading" << tJob->url() << "failed with message:" << job->errorText();
+
+        /** once all lists are downloaded, make the filter sets again, from the cache if no list changed */
+        if (--adFilterDownloads <= 0) {
+            adFilterDownloads = 0;
+            loadAdFilters();
+        }
     }
 };
 
@@ -346,8 +472,14 @@ void WebEngineSettings::init( KConfig * config, bool reset )
   {
       d->m_hideAdsEnabled = cgFilter.readEntry("Shrink", false);
 
-      d->adBlackList.clear();
-      d->adWhiteList.clear();
+      d->m_adFilterTypes = 0;
+      for (const auto &s : adFilterTypeSwitches) {
+          if (cgFilter.readEntry(s.key, true))
+              d->m_adFilterTypes |= s.types;
+      }
+
+      d->adFilters.clear();
+      d->adFilterFiles.clear();
 
       /** read maximum age for filter list files, minimum is one day */
       int htmlFilterListMaxAgeDays = cgFilter.readEntry(QStringLiteral("HTMLFilterListMaxAgeDays")).toInt();
@@ -362,12 +494,9 @@ void WebEngineSettings::init( KConfig * config, bool reset )
           const QString name = it.key();
           const QString url = it.value();
 
-          if (name.startsWith(QLatin1String("Filter")))
+          if (name.startsWith(QLatin1String("Filter-")))
           {
-              if (url.startsWith(QLatin1String("@@")))
-                  d->adWhiteList.addFilter(url);
-              else
-                  d->adBlackList.addFilter(url);
+              d->adFilters.append(url);
           }
           else if (name.startsWith(QLatin1String("HTMLFilterListName-")) && (id = QStringView{name}.mid(19).toInt()) > 0)
           {
@@ -387,9 +516,8 @@ void WebEngineSettings::init( KConfig * config, bool reset )
                   /** determine existence and age of cache file */
                   QFileInfo fileInfo(localFile);
 
-                  /** load cached file if it exists, irrespective of age */
-                  if (fileInfo.exists())
-                      d->adblockFilterLoadList( localFile );
+                  /** use cached file if it exists, irrespective of age */
+                  d->adFilterFiles.append(localFile);
 
                   /** if no cache list file exists or if it is too old ... */
                   if (!fileInfo.exists() || fileInfo.lastModified().daysTo(QDateTime::currentDateTime()) > htmlFilterListMaxAgeDays)
@@ -400,10 +528,13 @@ void WebEngineSettings::init( KConfig * config, bool reset )
                       QObject::connect( job, &KJob::result, d, &WebEngineSettingsPrivate::adblockFilterResult);
                       /** for later reference, store name of cache file */
                       job->setProperty("webenginesettings_adBlock_filename", localFile);
+                      d->adFilterDownloads++;
                   }
               }
           }
       }
+
+      d->loadAdFilters();
   }
 
   KConfigGroup cgHtml( config, "HTML Settings" );
@@ -873,6 +1004,48 @@ bool WebEngineSettings::isAdFiltered( const QString &url ) const
     return d->adBlackList.isUrlMatched(url) && !d->adWhiteList.isUrlMatched(url);
 }
 
+bool WebEngineSettings::isAdFiltered( const QString &url, const QString &firstPartyUrl, int type ) const
+{
+    if (!d->m_adFilterEnabled)
+        return false;
+
+    if (type != FilterRequest::UnknownType && !(d->m_adFilterTypes & type))
+        return false;
+
+    if (url.startsWith(QLatin1String("data:")))
+        return false;
+
+    const FilterRequest request(url, firstPartyUrl, FilterRequest::ResourceType(type));
+    if (!d->adBlackList.isUrlMatched(request) || d->adWhiteList.isUrlMatched(request))
+        return false;
+
+    // "@@||example.org^$document" allows everything on the pages of example.org
+    return firstPartyUrl.isEmpty() || !d->adWhiteList.isUrlMatched(FilterRequest(firstPartyUrl, firstPartyUrl, FilterRequest::DocumentType));
+}
+
+QString WebEngineSettings::adElementHidingStyleSheet() const
+{
+    if (!d->m_adFilterEnabled)
+        return QString();
+
+    return d->adBlackList.elementHidingStyleSheet();
+}
+
+QString WebEngineSettings::adElementHidingStyleSheet( const QString &url, bool *generic ) const
+{
+    *generic = d->m_adFilterEnabled;
+    if (!d->m_adFilterEnabled)
+        return QString();
+
+    // nothing is hidden on the pages allowed by "@@||example.org^$document"
+    if (d->adWhiteList.isUrlMatched(FilterRequest(url, url, FilterRequest::DocumentType))) {
+        *generic = false;
+        return QString();
+    }
+
+    return d->adBlackList.elementHidingStyleSheet(QUrl(url).host(), generic);
+}
+
 QString WebEngineSettings::adFilteredBy( const QString &url, bool *isWhiteListed ) const
 {
     QString m = d->adWhiteList.urlMatchedBy(url);
@@ -918,6 +1091,7 @@ void WebEngineSettings::addAdFilter( const QString &url )
         config.writeEntry("Count",last+1);
         config.sync();
 
+        d->adFilters.append(url);
         if (url.startsWith(QLatin1String("@@")))
             d->adWhiteList.addFilter(url);
         else
@@ -82,10 +82,16 @@ public:
 
     // AdBlocK Filtering
     bool isAdFiltered( const QString &url ) const;
+    // type is a KDEPrivate::FilterRequest::ResourceType, firstPartyUrl the page loading url
+    bool isAdFiltered( const QString &url, const QString &firstPartyUrl, int type ) const;
     bool isAdFilterEnabled() const;
     bool isHideAdsEnabled() const;
     void addAdFilter( const QString &url );
     QString adFilteredBy( const QString &url, bool *isWhiteListed = nullptr ) const;
+    // The style sheets hiding the elements of the element hiding filters, for all pages and
+    // for the page at url, see KDEPrivate::FilterSet::elementHidingStyleSheet()
+    QString adElementHidingStyleSheet() const;
+    QString adElementHidingStyleSheet( const QString &url, bool *generic ) const;
 
     // Access Keys
     bool accessKeysEnabled() const;
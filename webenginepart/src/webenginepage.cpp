@@ -419,6 +419,7 @@ bool WebEnginePage::acceptNavigationRequest(const QUrl& url, NavigationType type
     settings()->setAttribute(QWebEngineSettings::PluginsEnabled, WebEngineSettings::self()->isPluginsEnabled(reqUrl.host()));
 
     if (isMainFrame) {
+        WebEnginePartControls::self()->updateElementHidingScripts(this, url);
         emit mainFrameNavigationRequested(this, url);
     }
     return QWebEnginePage::acceptNavigationRequest(url, type, isMainFrame);
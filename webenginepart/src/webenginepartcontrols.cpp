@@ -318,6 +318,59 @@ void WebEnginePartControls::updateUserStyleSheetScript()
     m_profile->scripts()->insert(applyUserCss);
 }
 
+/**
+ * @brief The script inserting a style sheet hiding elements
+ * @param name the name of the script
+ * @param css the style sheet
+ * @param subFrames whether the script should also run in the frames of the page
+ */
+static QWebEngineScript elementHidingScript(const char *name, QString css, bool subFrames)
+{
+    QFile file(":/elementhiding.js");
+    file.open(QFile::ReadOnly);
+    Q_ASSERT(file.isOpen());
+    css.replace(QLatin1Char('\\'), QLatin1String("\\\\")).replace(QLatin1Char('\''), QLatin1String("\\'"));
+    QWebEngineScript script;
+    script.setName(name);
+    script.setInjectionPoint(QWebEngineScript::DocumentCreation);
+    script.setWorldId(QWebEngineScript::ApplicationWorld);
+    script.setRunsOnSubFrames(subFrames);
+    script.setSourceCode(QString(file.readAll()).arg(css));
+    return script;
+}
+
+void WebEnginePartControls::updateElementHidingScripts(WebEnginePage *page, const QUrl &url)
+{
+    QWebEngineScriptCollection &scripts = page->scripts();
+    const QList<QWebEngineScript> oldScripts = scripts.find(s_elementHidingScriptName);
+    for (const QWebEngineScript &s : oldScripts) {
+        scripts.remove(s);
+    }
+    if (!WebEngineSettings::self()->isAdFilterEnabled() || (url.scheme() != QLatin1String("http") && url.scheme() != QLatin1String("https"))) {
+        return;
+    }
+
+    bool generic = true;
+    const QString css = WebEngineSettings::self()->adElementHidingStyleSheet(url.url(), &generic);
+    if (!css.isEmpty()) {
+        scripts.insert(elementHidingScript(s_elementHidingScriptName, css, false));
+    }
+    if (!generic) {
+        return;
+    }
+
+    //The style sheet for all pages is the same string while the filters don't change, so the script is only
+    //made again when they do
+    const QString genericCss = WebEngineSettings::self()->adElementHidingStyleSheet();
+    if (genericCss.isEmpty()) {
+        return;
+    }
+    if (genericCss.constData() != m_elementHidingStyleSheet.constData() || genericCss.size() != m_elementHidingStyleSheet.size()) {
+        m_elementHidingStyleSheet = genericCss;
+        m_elementHidingScript = elementHidingScript(s_elementHidingScriptName, genericCss, true);
+    }
+    scripts.insert(m_elementHidingScript);
+}
 
 QString WebEnginePartControls::httpUserAgent() const
 {
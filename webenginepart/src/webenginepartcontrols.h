@@ -11,13 +11,13 @@
 
 #include <QObject>
 #include <QWebEngineCertificateError>
+#include <QWebEngineScript>
 
 #include <kwebenginepartlib_export.h>
 
 #include "cookies/webenginepartcookiejar.h"
 
 class QWebEngineProfile;
-class QWebEngineScript;
 
 class SpellCheckerManager;
 class WebEnginePartDownloadManager;
@@ -56,6 +56,17 @@ public:
 
     QString defaultHttpUserAgent() const;
 
+    /**
+     * @brief Replaces the scripts of @p page hiding the elements of the ad block element hiding filters
+     *
+     * The scripts insert style sheets hiding the elements when the document is created, before it's displayed.
+     * The one for all pages, also inserted in their frames, is made once while the filters don't change; the
+     * one for the host of @p url only has the filters for it.
+     * @param page the page which is going to load @p url in its main frame
+     * @param url the url
+     */
+    void updateElementHidingScripts(WebEnginePage *page, const QUrl &url);
+
 private slots:
     void reparseConfiguration();
     void setHttpUserAgent(const QString &uaString);
@@ -153,6 +164,9 @@ private:
     NavigationRecorder *m_navigationRecorder;
     QString m_defaultUserAgent;
     static constexpr const char* s_userStyleSheetScriptName{"apply konqueror user stylesheet"};
+    QString m_elementHidingStyleSheet;
+    QWebEngineScript m_elementHidingScript;
+    static constexpr const char* s_elementHidingScriptName{"konqueror element hiding"};
 };
 
 #endif // WEBENGINEPARTCONTROLS_H
@@ -7,25 +7,90 @@
 */
 
 #include "settings/webenginesettings.h"
+#include "settings/webengine_filter.h"
 #include "webengineurlrequestinterceptor.h"
 #include "webenginepartcontrols.h"
 #include "navigationrecorder.h"
 
+using KDEPrivate::FilterRequest;
+
 WebEngineUrlRequestInterceptor::WebEngineUrlRequestInterceptor(QObject* parent) :
     QWebEngineUrlRequestInterceptor(parent)
 {
 }
 
+// The type of the filter options for a request
+static FilterRequest::ResourceType filterType(QWebEngineUrlRequestInfo::ResourceType type)
+{
+    switch (type) {
+    case QWebEngineUrlRequestInfo::ResourceTypeMainFrame:
+    case QWebEngineUrlRequestInfo::ResourceTypeNavigationPreloadMainFrame:
+        return FilterRequest::DocumentType;
+    case QWebEngineUrlRequestInfo::ResourceTypeSubFrame:
+    case QWebEngineUrlRequestInfo::ResourceTypeNavigationPreloadSubFrame:
+        return FilterRequest::SubdocumentType;
+    case QWebEngineUrlRequestInfo::ResourceTypeStylesheet:
+        return FilterRequest::StylesheetType;
+    case QWebEngineUrlRequestInfo::ResourceTypeScript:
+    case QWebEngineUrlRequestInfo::ResourceTypeWorker:
+    case QWebEngineUrlRequestInfo::ResourceTypeSharedWorker:
+    case QWebEngineUrlRequestInfo::ResourceTypeServiceWorker:
+        return FilterRequest::ScriptType;
+    case QWebEngineUrlRequestInfo::ResourceTypeImage:
+    case QWebEngineUrlRequestInfo::ResourceTypeFavicon:
+        return FilterRequest::ImageType;
+    case QWebEngineUrlRequestInfo::ResourceTypeFontResource:
+        return FilterRequest::FontType;
+    case QWebEngineUrlRequestInfo::ResourceTypeObject:
+    case QWebEngineUrlRequestInfo::ResourceTypePluginResource:
+        return FilterRequest::ObjectType;
+    case QWebEngineUrlRequestInfo::ResourceTypeMedia:
+        return FilterRequest::MediaType;
+    case QWebEngineUrlRequestInfo::ResourceTypeXhr:
+        return FilterRequest::XmlHttpRequestType;
+    case QWebEngineUrlRequestInfo::ResourceTypePing:
+    case QWebEngineUrlRequestInfo::ResourceTypeCspReport:
+        return FilterRequest::PingType;
+    default:
+        return FilterRequest::OtherType;
+    }
+}
+
 void WebEngineUrlRequestInterceptor::interceptRequest(QWebEngineUrlRequestInfo &info)
 {
-    if (info.resourceType() == QWebEngineUrlRequestInfo::ResourceTypeImage) {
-        if (info.requestUrl().scheme() == QLatin1String("http") && info.firstPartyUrl().scheme() == QLatin1String("https")) {
+    const QWebEngineUrlRequestInfo::ResourceType type = info.resourceType();
+    if (type == QWebEngineUrlRequestInfo::ResourceTypeMainFrame) {
+        WebEnginePartControls::self()->navigationRecorder()->recordRequestDetails(info);
+    }
+
+    const QUrl url = info.requestUrl();
+    const QUrl firstPartyUrl = info.firstPartyUrl();
+    if (type == QWebEngineUrlRequestInfo::ResourceTypeImage) {
+        if (url.scheme() == QLatin1String("http") && firstPartyUrl.scheme() == QLatin1String("https")) {
             info.block(true);
             return;
         }
-        info.block(WebEngineSettings::self()->isAdFiltered(info.requestUrl().url()));
     }
-    if (info.resourceType() == QWebEngineUrlRequestInfo::ResourceTypeMainFrame) {
-        WebEnginePartControls::self()->navigationRecorder()->recordRequestDetails(info);
+
+    WebEngineSettings *settings = WebEngineSettings::self();
+    if (!settings->isAdFilterEnabled()) {
+        return;
     }
+    // Only requests to the network are filtered, not data: or local ones
+    const QString scheme = url.scheme();
+    if (scheme != QLatin1String("https") && scheme != QLatin1String("http") && scheme != QLatin1String("wss") && scheme != QLatin1String("ws")) {
+        return;
+    }
+    // Nor pages loaded from the site shown. The first party of a page is the page itself,
+    // the one it is loaded from is the initiator
+    const FilterRequest::ResourceType filter = filterType(type);
+    if (filter == FilterRequest::DocumentType) {
+        if (!FilterRequest::isFilteredNavigation(url, info.initiator())) {
+            return;
+        }
+        info.block(settings->isAdFiltered(url.url(), info.initiator().url(), filter));
+        return;
+    }
+
+    info.block(settings->isAdFiltered(url.url(), firstPartyUrl.url(), filter));
 }